@@ -166,6 +166,7 @@ sub build_pgprobackup
 		'parsexlog.c',
 		'pg_probackup.c',
 		'restore.c',
+		'schedule.c',
 		'show.c',
 		'util.c',
 		'validate.c',
@@ -175,6 +176,7 @@ sub build_pgprobackup
 	$probackup->AddFiles(
 		"$currpath/src/utils",
 		'configuration.c',
+		'crc32c.c',
 		'file.c',
 		'remote.c',
 		'json.c',
@@ -11,15 +11,122 @@
 #include "pg_probackup.h"
 
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+/* Size of the buffer used to copy and compare WAL files */
+#define WAL_BUFFER_SIZE		(1024 * 1024)
+
+/* WAL segment to push in batch mode */
+typedef struct
+{
+	char		name[MAXFNAMELEN];
+	/* segment was found in archive_status, mark it as done after push */
+	bool		from_batch;
+	bool		pushed;
+	volatile pg_atomic_flag lock;
+} WalPushFile;
+
+typedef struct
+{
+	InstanceConfig *instance;
+	const char *pg_xlog_dir;
+	parray	   *files;
+	bool		overwrite;
+	bool		wal_summary;
+	/* threads to compress each file with */
+	int			compress_threads;
+
+	/*
+	 * Return value from the thread.
+	 * 0 means there is no error, 1 - there is an error.
+	 */
+	int			ret;
+} archive_push_arg;
+
+/* WAL segment to prefetch from archive */
+typedef struct
+{
+	char		name[MAXFNAMELEN];
+	bool		prefetched;
+	volatile pg_atomic_flag lock;
+} WalPrefetchFile;
 
+typedef struct
+{
+	InstanceConfig *instance;
+	const char *prefetch_dir;
+	parray	   *files;
+
+	/*
+	 * Return value from the thread.
+	 * 0 means there is no error, 1 - there is an error.
+	 */
+	int			ret;
+} archive_get_arg;
+
+#ifdef HAVE_LIBZ
+/* Chunk of WAL file compressed independently, see compress_wal_chunks() */
+typedef struct
+{
+	const char *in;
+	size_t		in_size;
+	char	   *out;
+	size_t		out_size;
+	/* CRC32 of uncompressed data, as used by gzip */
+	uLong		crc;
+	bool		last;
+	bool		done;
+	volatile pg_atomic_flag lock;
+} WalGzChunk;
+
+typedef struct
+{
+	WalGzChunk *chunks;
+	int			nchunks;
+	bool		compress;
+	int			level;
+
+	/*
+	 * Return value from the thread.
+	 * 0 means there is no error, 1 - there is an error.
+	 */
+	int			ret;
+} wal_gz_arg;
+#endif
+
+static void *push_wal_segments(void *arg);
+static void add_ready_segments(parray *files, const char *pg_xlog_dir,
+							   const char *wal_file_name, int batch_size);
+static int	compare_wal_push_file(const void *f1, const void *f2);
+static void prefetch_wal_files(InstanceConfig *instance,
+							   const char *prefetch_dir,
+							   const char *wal_file_name, int batch_size);
+static void *prefetch_wal_segments(void *arg);
+static void clean_prefetch_dir(const char *prefetch_dir);
 static void push_wal_file(const char *from_path, const char *to_path,
-						  bool is_compress, bool overwrite, int compress_level);
-static void get_wal_file(const char *from_path, const char *to_path);
+						  bool is_compress, bool overwrite, int compress_level,
+						  int compress_threads);
+static void write_wal_summary(InstanceConfig *instance, const char *from_path,
+							  const char *wal_file_name);
+static void get_wal_file(const char *from_path, const char *to_path,
+						 int decompress_threads);
 #ifdef HAVE_LIBZ
 static const char *get_gz_error(gzFile gzf, int errnum);
+static char *compress_wal_chunks(const char *data, size_t size, int level,
+								 int nthreads, size_t *gz_size);
+static char *decompress_wal_chunks(const char *path, const char *gz_data,
+								   size_t gz_size, int nthreads, size_t *size);
+static char *read_wal_file(const char *path, size_t *size);
 #endif
 static bool fileEqualCRC(const char *path1, const char *path2,
 						 bool path2_is_compressed);
+static int	copy_file_kernel(int in_fd, int out_fd);
+static void advise_wal_file(FILE *in, int advice);
+static void start_writeback(int fd, fio_location location, off_t offset,
+							off_t nbytes);
 static void copy_file_attributes(const char *from_path,
 								 fio_location from_location,
 								 const char *to_path, fio_location to_location,
@@ -31,16 +138,28 @@ static void copy_file_attributes(const char *from_path,
  * --wal-file-path %p --wal-file-name %f', to move backups into arclog_path.
  * Where archlog_path is $BACKUP_PATH/wal/system_id.
  * Currently it just copies wal files to the new location.
+ *
+ * If batch_size is greater than 1, other segments which are ready for
+ * archiving are pushed along with the requested one in num_threads threads.
+ * Their .ready files in archive_status are renamed to .done, so the server
+ * does not call archive_command for them.
  */
 int
 do_archive_push(InstanceConfig *instance,
-				char *wal_file_path, char *wal_file_name, bool overwrite)
+				char *wal_file_path, char *wal_file_name, bool overwrite,
+				bool wal_summary, int batch_size)
 {
-	char		backup_wal_file_path[MAXPGPATH];
 	char		absolute_wal_file_path[MAXPGPATH];
+	char		pg_xlog_dir[MAXPGPATH];
 	char		current_dir[MAXPGPATH];
 	uint64		system_id;
-	bool		is_compress = false;
+	parray	   *files;
+	WalPushFile *file;
+	pthread_t  *threads;
+	archive_push_arg *threads_args;
+	int			n_threads;
+	int			n_pushed = 0;
+	int			i;
 
 	if (wal_file_name == NULL && wal_file_path == NULL)
 		elog(ERROR, "required parameters are not specified: --wal-file-name %%f --wal-file-path %%p");
@@ -72,36 +191,285 @@ do_archive_push(InstanceConfig *instance,
 	fio_mkdir(instance->arclog_path, DIR_PERMISSION, FIO_BACKUP_HOST);
 
 	join_path_components(absolute_wal_file_path, current_dir, wal_file_path);
-	join_path_components(backup_wal_file_path, instance->arclog_path, wal_file_name);
-
-	elog(INFO, "pg_probackup archive-push from %s to %s", absolute_wal_file_path, backup_wal_file_path);
+	strncpy(pg_xlog_dir, absolute_wal_file_path, MAXPGPATH);
+	get_parent_directory(pg_xlog_dir);
 
 	if (instance->compress_alg == PGLZ_COMPRESS)
 		elog(ERROR, "pglz compression is not supported");
 
-#ifdef HAVE_LIBZ
-	if (instance->compress_alg == ZLIB_COMPRESS)
-		is_compress = IsXLogFileName(wal_file_name);
-#endif
+	/*
+	 * Archived WAL files are gzip files, archive-get and WAL readers expect
+	 * the .gz suffix. The instance config is shared with backup, so zstd or
+	 * lz4 chosen for backups must not make archive_command fail, compress
+	 * WAL with zlib instead.
+	 */
+	if (instance->compress_alg == ZSTD_COMPRESS ||
+		instance->compress_alg == LZ4_COMPRESS)
+	{
+		elog(WARNING, "%s compression is not supported for WAL files, use zlib",
+			 deparse_compress_alg(instance->compress_alg));
+		instance->compress_alg = ZLIB_COMPRESS;
+		instance->compress_level = Min(instance->compress_level, 9);
+	}
+
+	files = parray_new();
+
+	/* The requested file goes first */
+	file = pgut_new(WalPushFile);
+	strncpy(file->name, wal_file_name, MAXFNAMELEN);
+	file->name[MAXFNAMELEN - 1] = '\0';
+	file->from_batch = false;
+	file->pushed = false;
+	pg_atomic_clear_flag(&file->lock);
+	parray_append(files, file);
+
+	/* History and backup history files are never pushed in batch */
+	if (batch_size > 1 && IsXLogFileName(wal_file_name))
+		add_ready_segments(files, pg_xlog_dir, wal_file_name, batch_size);
+
+	n_threads = Min(num_threads, (int) parray_num(files));
+
+	threads = (pthread_t *) palloc(sizeof(pthread_t) * n_threads);
+	threads_args = (archive_push_arg *) palloc(sizeof(archive_push_arg) * n_threads);
+
+	for (i = 0; i < n_threads; i++)
+	{
+		archive_push_arg *arg = &(threads_args[i]);
+
+		arg->instance = instance;
+		arg->pg_xlog_dir = pg_xlog_dir;
+		arg->files = files;
+		arg->overwrite = overwrite;
+		arg->wal_summary = wal_summary;
+		/* Threads left from pushing files in parallel compress each file */
+		arg->compress_threads = Max(num_threads / n_threads, 1);
+		/* By default there is some error */
+		arg->ret = 1;
+	}
+
+	/* Run threads */
+	for (i = 0; i < n_threads; i++)
+	{
+		elog(VERBOSE, "Start thread num: %i", i);
+		pthread_create(&threads[i], NULL, push_wal_segments, &(threads_args[i]));
+	}
+
+	/* Wait threads */
+	for (i = 0; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		char		ready_path[MAXPGPATH];
+		char		done_path[MAXPGPATH];
+
+		file = (WalPushFile *) parray_get(files, i);
+
+		if (!file->pushed)
+		{
+			/* Error message is already reported by the thread */
+			if (!file->from_batch)
+				elog(ERROR, "Failed to push WAL file \"%s\"", file->name);
+			elog(WARNING, "WAL file \"%s\" of the batch is not pushed, "
+				 "it is left for archive_command", file->name);
+			continue;
+		}
+
+		n_pushed++;
+
+		/* The server marks the requested file as done itself */
+		if (!file->from_batch)
+			continue;
+
+		snprintf(ready_path, MAXPGPATH, "%s/archive_status/%s.ready",
+				 pg_xlog_dir, file->name);
+		snprintf(done_path, MAXPGPATH, "%s/archive_status/%s.done",
+				 pg_xlog_dir, file->name);
+
+		if (fio_rename(ready_path, done_path, FIO_DB_HOST) < 0)
+			elog(WARNING, "Cannot rename file \"%s\" to \"%s\": %s",
+				 ready_path, done_path, strerror(errno));
+	}
+
+	if (parray_num(files) > 1)
+		elog(INFO, "Pushed %i of %i WAL files in batch",
+			 n_pushed, (int) parray_num(files));
+
+	parray_walk(files, pfree);
+	parray_free(files);
+	pfree(threads);
+	pfree(threads_args);
 
-	push_wal_file(absolute_wal_file_path, backup_wal_file_path, is_compress,
-				  overwrite, instance->compress_level);
 	elog(INFO, "pg_probackup archive-push completed successfully");
 
 	return 0;
 }
 
+/*
+ * Push WAL files from the list. Errors in one thread do not stop
+ * other threads, so failure to push a segment of the batch does not
+ * prevent the requested segment from being archived.
+ * Segment of the batch which is already archived with different content
+ * is skipped with a warning. Other errors are reported by the thread as
+ * usual, the segment is left for archive_command then.
+ */
+static void *
+push_wal_segments(void *arg)
+{
+	archive_push_arg *arguments = (archive_push_arg *) arg;
+	InstanceConfig *instance = arguments->instance;
+	int			i;
+
+	for (i = 0; i < parray_num(arguments->files); i++)
+	{
+		WalPushFile *file = (WalPushFile *) parray_get(arguments->files, i);
+		char		from_path[MAXPGPATH];
+		char		to_path[MAXPGPATH];
+		bool		is_compress = false;
+
+		if (!pg_atomic_test_set_flag(&file->lock))
+			continue;
+
+		if (interrupted)
+			elog(ERROR, "interrupted during archive-push");
+
+		join_path_components(from_path, arguments->pg_xlog_dir, file->name);
+		join_path_components(to_path, instance->arclog_path, file->name);
+
+		elog(INFO, "pg_probackup archive-push from %s to %s", from_path, to_path);
+
+#ifdef HAVE_LIBZ
+		if (instance->compress_alg == ZLIB_COMPRESS)
+			is_compress = IsXLogFileName(file->name);
+#endif
+
+		/*
+		 * push_wal_file() fails if the segment is archived already with
+		 * different content. It's up to archive_command to decide what
+		 * to do with such segment of the batch.
+		 */
+		if (file->from_batch && !arguments->overwrite)
+		{
+			char		to_path_p[MAXPGPATH];
+
+			snprintf(to_path_p, sizeof(to_path_p), "%s%s", to_path,
+					 is_compress ? ".gz" : "");
+			if (fileExists(to_path_p, FIO_BACKUP_HOST) &&
+				!fileEqualCRC(from_path, to_path_p, is_compress))
+			{
+				elog(WARNING, "WAL segment \"%s\" already exists, skip it in batch",
+					 to_path_p);
+				continue;
+			}
+		}
+
+		push_wal_file(from_path, to_path, is_compress,
+					  arguments->overwrite, instance->compress_level,
+					  arguments->compress_threads);
+
+		if (arguments->wal_summary && IsXLogFileName(file->name))
+			write_wal_summary(instance, from_path, file->name);
+
+		file->pushed = true;
+	}
+
+	/* All taken files are pushed */
+	arguments->ret = 0;
+
+	return NULL;
+}
+
+/*
+ * Look for WAL segments following wal_file_name which are ready for
+ * archiving and append up to batch_size - 1 of them to the list.
+ */
+static void
+add_ready_segments(parray *files, const char *pg_xlog_dir,
+				   const char *wal_file_name, int batch_size)
+{
+	char		archive_status_dir[MAXPGPATH];
+	DIR		   *dir;
+	struct dirent *dent;
+	parray	   *ready = parray_new();
+	int			i;
+
+	join_path_components(archive_status_dir, pg_xlog_dir, "archive_status");
+
+	dir = fio_opendir(archive_status_dir, FIO_DB_HOST);
+	if (dir == NULL)
+	{
+		elog(WARNING, "Cannot open directory \"%s\": %s",
+			 archive_status_dir, strerror(errno));
+		parray_free(ready);
+		return;
+	}
+
+	while ((dent = fio_readdir(dir)) != NULL)
+	{
+		WalPushFile *file;
+		char		name[MAXFNAMELEN];
+
+		if (strlen(dent->d_name) != XLOG_FNAME_LEN + strlen(".ready") ||
+			strcmp(dent->d_name + XLOG_FNAME_LEN, ".ready") != 0)
+			continue;
+
+		strncpy(name, dent->d_name, XLOG_FNAME_LEN);
+		name[XLOG_FNAME_LEN] = '\0';
+
+		/* Older segments are ready only if they failed to be archived */
+		if (!IsXLogFileName(name) || strcmp(name, wal_file_name) <= 0)
+			continue;
+
+		file = pgut_new(WalPushFile);
+		strcpy(file->name, name);
+		file->from_batch = true;
+		file->pushed = false;
+		pg_atomic_clear_flag(&file->lock);
+		parray_append(ready, file);
+	}
+	fio_closedir(dir);
+
+	/* The server archives segments in this order as well */
+	parray_qsort(ready, compare_wal_push_file);
+
+	for (i = 0; i < parray_num(ready); i++)
+	{
+		if (i < batch_size - 1)
+			parray_append(files, parray_get(ready, i));
+		else
+			pfree(parray_get(ready, i));
+	}
+
+	parray_free(ready);
+}
+
+static int
+compare_wal_push_file(const void *f1, const void *f2)
+{
+	WalPushFile *file1 = *(WalPushFile **) f1;
+	WalPushFile *file2 = *(WalPushFile **) f2;
+
+	return strcmp(file1->name, file2->name);
+}
+
 /*
  * pg_probackup specific restore command.
  * Move files from arclog_path to pgdata/wal_file_path.
+ *
+ * If batch_size is greater than 1, segments following the requested one
+ * are fetched in num_threads threads into PREFETCH_DIR subdirectory of
+ * pg_wal, so the following calls only have to rename them.
  */
 int
 do_archive_get(InstanceConfig *instance,
-			   char *wal_file_path, char *wal_file_name)
+			   char *wal_file_path, char *wal_file_name, int batch_size)
 {
 	char		backup_wal_file_path[MAXPGPATH];
 	char		absolute_wal_file_path[MAXPGPATH];
 	char		current_dir[MAXPGPATH];
+	char		prefetch_dir[MAXPGPATH];
+	char		prefetched_path[MAXPGPATH];
+	bool		prefetch = false;
 
 	if (wal_file_name == NULL && wal_file_path == NULL)
 		elog(ERROR, "required parameters are not specified: --wal-file-name %%f --wal-file-path %%p");
@@ -120,28 +488,237 @@ do_archive_get(InstanceConfig *instance,
 	join_path_components(absolute_wal_file_path, current_dir, wal_file_path);
 	join_path_components(backup_wal_file_path, instance->arclog_path, wal_file_name);
 
+	if (batch_size > 1)
+	{
+		char		pg_xlog_dir[MAXPGPATH];
+
+		strncpy(pg_xlog_dir, absolute_wal_file_path, MAXPGPATH);
+		get_parent_directory(pg_xlog_dir);
+		join_path_components(prefetch_dir, pg_xlog_dir, PREFETCH_DIR);
+		join_path_components(prefetched_path, prefetch_dir, wal_file_name);
+
+		/* History and backup history files are never prefetched */
+		prefetch = IsXLogFileName(wal_file_name);
+	}
+
+	if (prefetch)
+	{
+		if (fio_access(prefetched_path, F_OK, FIO_DB_HOST) == 0)
+		{
+			if (fio_rename(prefetched_path, absolute_wal_file_path,
+						   FIO_DB_HOST) == 0)
+			{
+				elog(INFO, "pg_probackup archive-get from %s to %s",
+					 prefetched_path, absolute_wal_file_path);
+				elog(INFO, "pg_probackup archive-get completed successfully");
+				return 0;
+			}
+
+			elog(WARNING, "Cannot rename file \"%s\" to \"%s\": %s",
+				 prefetched_path, absolute_wal_file_path, strerror(errno));
+		}
+	}
+
+	/*
+	 * The server asked for a file which is not prefetched, so segments left
+	 * in prefetch_dir are not going to be requested. Remove them before the
+	 * file is fetched: if it is not in the archive, recovery may be over and
+	 * nobody would remove them afterwards.
+	 */
+	if (batch_size > 1)
+		clean_prefetch_dir(prefetch_dir);
+
 	elog(INFO, "pg_probackup archive-get from %s to %s",
 		 backup_wal_file_path, absolute_wal_file_path);
-	get_wal_file(backup_wal_file_path, absolute_wal_file_path);
+	get_wal_file(backup_wal_file_path, absolute_wal_file_path, num_threads);
+
+	if (prefetch)
+		prefetch_wal_files(instance, prefetch_dir, wal_file_name, batch_size);
+
 	elog(INFO, "pg_probackup archive-get completed successfully");
 
 	return 0;
 }
 
 /* ------------- INTERNAL FUNCTIONS ---------- */
+/*
+ * Remove files left in prefetch_dir. The directory itself is kept.
+ */
+static void
+clean_prefetch_dir(const char *prefetch_dir)
+{
+	DIR		   *dir;
+	struct dirent *dent;
+
+	dir = fio_opendir(prefetch_dir, FIO_DB_HOST);
+	if (dir == NULL)
+	{
+		if (errno != ENOENT)
+			elog(WARNING, "Cannot open directory \"%s\": %s",
+				 prefetch_dir, strerror(errno));
+		return;
+	}
+
+	while ((dent = fio_readdir(dir)) != NULL)
+	{
+		char		path[MAXPGPATH];
+
+		if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+			continue;
+
+		join_path_components(path, prefetch_dir, dent->d_name);
+		if (fio_unlink(path, FIO_DB_HOST) < 0 && errno != ENOENT)
+			elog(WARNING, "Cannot remove file \"%s\": %s",
+				 path, strerror(errno));
+	}
+	fio_closedir(dir);
+}
+
+/*
+ * Fetch batch_size - 1 segments following wal_file_name into prefetch_dir,
+ * which is already cleaned by the caller.
+ */
+static void
+prefetch_wal_files(InstanceConfig *instance, const char *prefetch_dir,
+				   const char *wal_file_name, int batch_size)
+{
+	TimeLineID	tli;
+	uint32		log,
+				seg;
+	XLogSegNo	segno;
+	parray	   *files;
+	pthread_t  *threads;
+	archive_get_arg *threads_args;
+	int			n_threads;
+	int			n_prefetched = 0;
+	int			i;
+
+	fio_mkdir(prefetch_dir, DIR_PERMISSION, FIO_DB_HOST);
+
+	sscanf(wal_file_name, "%08X%08X%08X", &tli, &log, &seg);
+	GetXLogSegNoFromScrath(segno, log, seg, instance->xlog_seg_size);
+
+	files = parray_new();
+	for (i = 1; i < batch_size; i++)
+	{
+		WalPrefetchFile *file = pgut_new(WalPrefetchFile);
+
+		GetXLogFileName(file->name, tli, segno + i, instance->xlog_seg_size);
+		file->prefetched = false;
+		pg_atomic_clear_flag(&file->lock);
+		parray_append(files, file);
+	}
+
+	n_threads = Min(num_threads, (int) parray_num(files));
+
+	threads = (pthread_t *) palloc(sizeof(pthread_t) * n_threads);
+	threads_args = (archive_get_arg *) palloc(sizeof(archive_get_arg) * n_threads);
+
+	for (i = 0; i < n_threads; i++)
+	{
+		archive_get_arg *arg = &(threads_args[i]);
+
+		arg->instance = instance;
+		arg->prefetch_dir = prefetch_dir;
+		arg->files = files;
+		/* By default there is some error */
+		arg->ret = 1;
+	}
+
+	/* Run threads */
+	for (i = 0; i < n_threads; i++)
+	{
+		elog(VERBOSE, "Start thread num: %i", i);
+		pthread_create(&threads[i], NULL, prefetch_wal_segments, &(threads_args[i]));
+	}
+
+	/* Wait threads */
+	for (i = 0; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		if (((WalPrefetchFile *) parray_get(files, i))->prefetched)
+			n_prefetched++;
+	}
+
+	elog(INFO, "Prefetched %i of %i WAL files", n_prefetched, batch_size - 1);
+
+	parray_walk(files, pfree);
+	parray_free(files);
+	pfree(threads);
+	pfree(threads_args);
+}
+
+/*
+ * Fetch WAL files from the list into prefetch directory. Segments which
+ * are not archived yet are skipped.
+ */
+static void *
+prefetch_wal_segments(void *arg)
+{
+	archive_get_arg *arguments = (archive_get_arg *) arg;
+	InstanceConfig *instance = arguments->instance;
+	int			i;
+
+	for (i = 0; i < parray_num(arguments->files); i++)
+	{
+		WalPrefetchFile *file = (WalPrefetchFile *) parray_get(arguments->files, i);
+		char		from_path[MAXPGPATH];
+		char		to_path[MAXPGPATH];
+
+		if (!pg_atomic_test_set_flag(&file->lock))
+			continue;
+
+		if (interrupted)
+			elog(ERROR, "interrupted during archive-get");
+
+		join_path_components(from_path, instance->arclog_path, file->name);
+		join_path_components(to_path, arguments->prefetch_dir, file->name);
+
+		if (fio_access(from_path, F_OK, FIO_BACKUP_HOST) != 0)
+		{
+#ifdef HAVE_LIBZ
+			char		gz_from_path[MAXPGPATH];
+
+			snprintf(gz_from_path, sizeof(gz_from_path), "%s.gz", from_path);
+			if (fio_access(gz_from_path, F_OK, FIO_BACKUP_HOST) != 0)
+#endif
+			{
+				elog(VERBOSE, "WAL file \"%s\" is not archived yet",
+					 file->name);
+				continue;
+			}
+		}
+
+		get_wal_file(from_path, to_path, 1);
+		file->prefetched = true;
+	}
+
+	/* All taken files are fetched */
+	arguments->ret = 0;
+
+	return NULL;
+}
+
 /*
  * Copy WAL segment from pgdata to archive catalog with possible compression.
+ * Compressed segment is split into chunks compressed in compress_threads
+ * threads, see compress_wal_chunks().
  */
 void
 push_wal_file(const char *from_path, const char *to_path, bool is_compress,
-			  bool overwrite, int compress_level)
+			  bool overwrite, int compress_level, int compress_threads)
 {
 	FILE	   *in = NULL;
 	int			out = -1;
-	char		buf[XLOG_BLCKSZ];
+	char	   *buf;
 	const char *to_path_p;
 	char		to_path_temp[MAXPGPATH];
+	char		summary_path[MAXPGPATH];
 	int			errno_temp;
+	int			copied = 0;
+	off_t		write_pos = 0;
 	/* partial handling */
 	struct stat		st;
 	int			partial_try_count = 0;
@@ -150,7 +727,6 @@ push_wal_file(const char *from_path, const char *to_path, bool is_compress,
 
 #ifdef HAVE_LIBZ
 	char		gz_to_path[MAXPGPATH];
-	gzFile		gz_out = NULL;
 
 	if (is_compress)
 	{
@@ -167,6 +743,10 @@ push_wal_file(const char *from_path, const char *to_path, bool is_compress,
 		elog(ERROR, "Cannot open source WAL file \"%s\": %s", from_path,
 			 strerror(errno));
 
+#ifdef POSIX_FADV_SEQUENTIAL
+	advise_wal_file(in, POSIX_FADV_SEQUENTIAL);
+#endif
+
 	/* Check if possible to skip copying */
 	if (fileExists(to_path_p, FIO_BACKUP_HOST))
 	{
@@ -177,32 +757,26 @@ push_wal_file(const char *from_path, const char *to_path, bool is_compress,
 			elog(ERROR, "WAL segment \"%s\" already exists.", to_path_p);
 	}
 
+	/*
+	 * Summary left from the segment which is overwritten or was removed
+	 * doesn't describe the new one. Remove it before the segment is written,
+	 * archive-push --wal-summary writes a new one afterwards.
+	 */
+	snprintf(summary_path, sizeof(summary_path), "%s.%s", to_path,
+			 WAL_SUMMARY_SUFFIX);
+	if (fio_unlink(summary_path, FIO_BACKUP_HOST) < 0 && errno != ENOENT)
+		elog(ERROR, "Cannot remove WAL summary file \"%s\": %s",
+			 summary_path, strerror(errno));
+
 	/* open backup file for write  */
-#ifdef HAVE_LIBZ
-	if (is_compress)
-	{
-		snprintf(to_path_temp, sizeof(to_path_temp), "%s.part", gz_to_path);
+	snprintf(to_path_temp, sizeof(to_path_temp), "%s.part", to_path_p);
 
-		gz_out = fio_gzopen(to_path_temp, PG_BINARY_W, compress_level, FIO_BACKUP_HOST);
-		if (gz_out == NULL)
-		{
-			partial_file_exists = true;
-			elog(WARNING, "Cannot open destination temporary WAL file \"%s\": %s",
-				 to_path_temp, strerror(errno));
-		}
-	}
-	else
-#endif
+	out = fio_open(to_path_temp, O_RDWR | O_CREAT | O_EXCL | PG_BINARY, FIO_BACKUP_HOST);
+	if (out < 0)
 	{
-		snprintf(to_path_temp, sizeof(to_path_temp), "%s.part", to_path);
-
-		out = fio_open(to_path_temp, O_RDWR | O_CREAT | O_EXCL | PG_BINARY, FIO_BACKUP_HOST);
-		if (out < 0)
-		{
-			partial_file_exists = true;
-			elog(WARNING, "Cannot open destination temporary WAL file \"%s\": %s",
-				 to_path_temp, strerror(errno));
-		}
+		partial_file_exists = true;
+		elog(WARNING, "Cannot open destination temporary WAL file \"%s\": %s",
+			 to_path_temp, strerror(errno));
 	}
 
 	/* Partial file is already exists, it could have happened due to failed archive-push,
@@ -243,30 +817,100 @@ push_wal_file(const char *from_path, const char *to_path, bool is_compress,
 		elog(WARNING, "Reusing stale destination temporary WAL file \"%s\"", to_path_temp);
 		fio_unlink(to_path_temp, FIO_BACKUP_HOST);
 
+		out = fio_open(to_path_temp, O_RDWR | O_CREAT | O_EXCL | PG_BINARY, FIO_BACKUP_HOST);
+		if (out < 0)
+			elog(ERROR, "Cannot open destination temporary WAL file \"%s\": %s",
+				to_path_temp, strerror(errno));
+	}
+
 #ifdef HAVE_LIBZ
-		if (is_compress)
+	if (is_compress)
+	{
+		char	   *data;
+		size_t		size = 0;
+		size_t		data_size;
+		char	   *gz_data;
+		size_t		gz_size;
+
+		/* Segment is compressed in memory as a whole */
+		if (fio_ffstat(in, &st) < 0)
 		{
-			gz_out = fio_gzopen(to_path_temp, PG_BINARY_W, compress_level, FIO_BACKUP_HOST);
-			if (gz_out == NULL)
-				elog(ERROR, "Cannot open destination temporary WAL file \"%s\": %s",
-					to_path_temp, strerror(errno));
+			errno_temp = errno;
+			fio_unlink(to_path_temp, FIO_BACKUP_HOST);
+			elog(ERROR, "Cannot stat source WAL file \"%s\": %s",
+				 from_path, strerror(errno_temp));
 		}
-		else
+
+		data_size = Max(st.st_size, WAL_BUFFER_SIZE);
+		data = pgut_malloc(data_size);
+		for (;;)
+		{
+			ssize_t		read_len;
+
+			if (size == data_size)
+			{
+				data_size *= 2;
+				data = pgut_realloc(data, data_size);
+			}
+
+			read_len = fio_fread(in, data + size, data_size - size);
+			if (read_len < 0)
+			{
+				errno_temp = errno;
+				fio_unlink(to_path_temp, FIO_BACKUP_HOST);
+				elog(ERROR, "Cannot read source WAL file \"%s\": %s",
+					 from_path, strerror(errno_temp));
+			}
+			if (read_len == 0)
+				break;
+			size += read_len;
+		}
+
+		gz_data = compress_wal_chunks(data, size, compress_level,
+									  compress_threads, &gz_size);
+		pg_free(data);
+
+		while ((size_t) write_pos < gz_size)
+		{
+			size_t		write_len = Min(gz_size - write_pos, WAL_BUFFER_SIZE);
+
+			if (fio_write(out, gz_data + write_pos, write_len) != write_len)
+			{
+				errno_temp = errno;
+				fio_unlink(to_path_temp, FIO_BACKUP_HOST);
+				elog(ERROR, "Cannot write to compressed WAL file \"%s\": %s",
+					 to_path_temp, strerror(errno_temp));
+			}
+			start_writeback(out, FIO_BACKUP_HOST, write_pos, write_len);
+			write_pos += write_len;
+		}
+		pg_free(gz_data);
+
+		copied = 1;
+	}
 #endif
+
+	/* Both files are local, let the kernel copy the content */
+	if (!copied && !fio_is_remote_file(in) &&
+		!fio_is_remote(FIO_BACKUP_HOST))
+	{
+		copied = copy_file_kernel(fileno(in), out);
+		if (copied < 0)
 		{
-			out = fio_open(to_path_temp, O_RDWR | O_CREAT | O_EXCL | PG_BINARY, FIO_BACKUP_HOST);
-			if (out < 0)
-				elog(ERROR, "Cannot open destination temporary WAL file \"%s\": %s",
-					to_path_temp, strerror(errno));
+			errno_temp = errno;
+			fio_unlink(to_path_temp, FIO_BACKUP_HOST);
+			elog(ERROR, "Cannot copy WAL file \"%s\" to \"%s\": %s",
+				 from_path, to_path_temp, strerror(errno_temp));
 		}
 	}
 
 	/* copy content */
-	for (;;)
+	buf = pgut_malloc(WAL_BUFFER_SIZE);
+	while (!copied)
 	{
 		ssize_t		read_len = 0;
 
-		read_len = fio_fread(in, buf, sizeof(buf));
+		read_len = fio_fread(in, buf, WAL_BUFFER_SIZE);
 
 		if (read_len < 0)
 		{
@@ -279,55 +923,28 @@ push_wal_file(const char *from_path, const char *to_path, bool is_compress,
 
 		if (read_len > 0)
 		{
-#ifdef HAVE_LIBZ
-			if (is_compress)
-			{
-				if (fio_gzwrite(gz_out, buf, read_len) != read_len)
-				{
-					errno_temp = errno;
-					fio_unlink(to_path_temp, FIO_BACKUP_HOST);
-					elog(ERROR, "Cannot write to compressed WAL file \"%s\": %s",
-						 to_path_temp, get_gz_error(gz_out, errno_temp));
-				}
-			}
-			else
-#endif
+			if (fio_write(out, buf, read_len) != read_len)
 			{
-				if (fio_write(out, buf, read_len) != read_len)
-				{
-					errno_temp = errno;
-					fio_unlink(to_path_temp, FIO_BACKUP_HOST);
-					elog(ERROR, "Cannot write to WAL file \"%s\": %s",
-						 to_path_temp, strerror(errno_temp));
-				}
+				errno_temp = errno;
+				fio_unlink(to_path_temp, FIO_BACKUP_HOST);
+				elog(ERROR, "Cannot write to WAL file \"%s\": %s",
+					 to_path_temp, strerror(errno_temp));
 			}
+			start_writeback(out, FIO_BACKUP_HOST, write_pos, read_len);
+			write_pos += read_len;
 		}
 
 		if (read_len == 0)
 			break;
 	}
+	pg_free(buf);
 
-#ifdef HAVE_LIBZ
-	if (is_compress)
-	{
-		if (fio_gzclose(gz_out) != 0)
-		{
-			errno_temp = errno;
-			fio_unlink(to_path_temp, FIO_BACKUP_HOST);
-			elog(ERROR, "Cannot close compressed WAL file \"%s\": %s",
-				 to_path_temp, get_gz_error(gz_out, errno_temp));
-		}
-	}
-	else
-#endif
+	if (fio_flush(out) != 0 || fio_close(out) != 0)
 	{
-		if (fio_flush(out) != 0 || fio_close(out) != 0)
-		{
-			errno_temp = errno;
-			fio_unlink(to_path_temp, FIO_BACKUP_HOST);
-			elog(ERROR, "Cannot write WAL file \"%s\": %s",
-				 to_path_temp, strerror(errno_temp));
-		}
+		errno_temp = errno;
+		fio_unlink(to_path_temp, FIO_BACKUP_HOST);
+		elog(ERROR, "Cannot write WAL file \"%s\": %s",
+			 to_path_temp, strerror(errno_temp));
 	}
 
 	if (fio_fclose(in))
@@ -355,19 +972,132 @@ push_wal_file(const char *from_path, const char *to_path, bool is_compress,
 #endif
 }
 
+/*
+ * Write summary of blocks changed by the WAL segment next to the archived
+ * segment, see summarize_wal_segment(). Failure is not critical, PAGE
+ * backup reads the segment itself if there is no summary.
+ */
+static void
+write_wal_summary(InstanceConfig *instance, const char *from_path,
+				  const char *wal_file_name)
+{
+	FILE	   *in;
+	char	   *buf;
+	size_t		size = 0;
+	ssize_t		read_len = 0;
+	TimeLineID	tli;
+	uint32		log,
+				seg;
+	XLogSegNo	segno;
+	WalSummaryHeader header;
+	WalSummaryBlock *blocks;
+	char		to_path[MAXPGPATH];
+	char		to_path_temp[MAXPGPATH];
+	int			out;
+	int			errno_temp;
+
+	snprintf(to_path, sizeof(to_path), "%s/%s.%s", instance->arclog_path,
+			 wal_file_name, WAL_SUMMARY_SUFFIX);
+	snprintf(to_path_temp, sizeof(to_path_temp), "%s.part", to_path);
+
+	/* The segment is just copied, so it is read from the OS cache */
+	in = fio_fopen(from_path, PG_BINARY_R, FIO_DB_HOST);
+	if (in == NULL)
+	{
+		elog(WARNING, "Cannot open source WAL file \"%s\": %s", from_path,
+			 strerror(errno));
+		return;
+	}
+
+	buf = pgut_malloc(instance->xlog_seg_size);
+	while (size < instance->xlog_seg_size)
+	{
+		read_len = fio_fread(in, buf + size, instance->xlog_seg_size - size);
+		if (read_len <= 0)
+			break;
+		size += read_len;
+	}
+	fio_fclose(in);
+
+	if (read_len < 0)
+	{
+		elog(WARNING, "Cannot read source WAL file \"%s\": %s", from_path,
+			 strerror(errno));
+		pg_free(buf);
+		return;
+	}
+
+	sscanf(wal_file_name, "%08X%08X%08X", &tli, &log, &seg);
+	GetXLogSegNoFromScrath(segno, log, seg, instance->xlog_seg_size);
+
+	/* Header is written as is, don't leave garbage in its padding */
+	MemSet(&header, 0, sizeof(header));
+	blocks = summarize_wal_segment(buf, size, tli, segno,
+								   instance->xlog_seg_size,
+								   &header.nblocks, &header.end_lsn);
+	pg_free(buf);
+
+	if (blocks == NULL)
+	{
+		elog(LOG, "WAL segment \"%s\" cannot be summarized", wal_file_name);
+		/* Summary of overwritten segment is not valid anymore */
+		fio_unlink(to_path, FIO_BACKUP_HOST);
+		return;
+	}
+
+	header.magic = WAL_SUMMARY_MAGIC;
+	INIT_FILE_CRC32(true, header.crc);
+	COMP_FILE_CRC32(true, header.crc, blocks,
+					sizeof(WalSummaryBlock) * header.nblocks);
+	FIN_FILE_CRC32(true, header.crc);
+
+	out = fio_open(to_path_temp, O_RDWR | O_CREAT | O_TRUNC | PG_BINARY,
+				   FIO_BACKUP_HOST);
+	if (out < 0)
+	{
+		elog(WARNING, "Cannot open WAL summary file \"%s\": %s",
+			 to_path_temp, strerror(errno));
+		pg_free(blocks);
+		return;
+	}
+
+	if (fio_write(out, &header, sizeof(header)) != sizeof(header) ||
+		fio_write(out, blocks, sizeof(WalSummaryBlock) * header.nblocks) !=
+			sizeof(WalSummaryBlock) * header.nblocks ||
+		fio_flush(out) != 0 || fio_close(out) != 0 ||
+		fio_rename(to_path_temp, to_path, FIO_BACKUP_HOST) < 0)
+	{
+		errno_temp = errno;
+		fio_unlink(to_path_temp, FIO_BACKUP_HOST);
+		elog(WARNING, "Cannot write WAL summary file \"%s\": %s",
+			 to_path, strerror(errno_temp));
+	}
+	else
+		elog(INFO, "WAL summary with %u blocks is written to \"%s\"",
+			 header.nblocks, to_path);
+
+	pg_free(blocks);
+}
+
 /*
  * Copy WAL segment from archive catalog to pgdata with possible decompression.
+ * Segment compressed by push_wal_file() is decompressed in decompress_threads
+ * threads.
  */
 void
-get_wal_file(const char *from_path, const char *to_path)
+get_wal_file(const char *from_path, const char *to_path, int decompress_threads)
 {
 	FILE	   *in = NULL;
 	int			out;
-	char		buf[XLOG_BLCKSZ];
+	char	   *buf;
 	const char *from_path_p = from_path;
 	char		to_path_temp[MAXPGPATH];
 	int			errno_temp;
 	bool		is_decompress = false;
+	int			copied = 0;
+	off_t		write_pos = 0;
+	char	   *data = NULL;
+	size_t		data_size = 0;
 
 #ifdef HAVE_LIBZ
 	char		gz_from_path[MAXPGPATH];
@@ -403,15 +1133,30 @@ get_wal_file(const char *from_path, const char *to_path)
 		if (in == NULL)
 			elog(ERROR, "Cannot open source WAL file \"%s\": %s",
 					from_path, strerror(errno));
+#ifdef POSIX_FADV_SEQUENTIAL
+		advise_wal_file(in, POSIX_FADV_SEQUENTIAL);
+#endif
 	}
 #ifdef HAVE_LIBZ
 	else
 	{
-		gz_in = fio_gzopen(gz_from_path, PG_BINARY_R, Z_DEFAULT_COMPRESSION,
-						   FIO_BACKUP_HOST);
-		if (gz_in == NULL)
-			elog(ERROR, "Cannot open compressed WAL file \"%s\": %s",
-					 gz_from_path, strerror(errno));
+		char	   *gz_data;
+		size_t		gz_size;
+
+		/* Segments compressed in chunks are decompressed in memory */
+		gz_data = read_wal_file(gz_from_path, &gz_size);
+		data = decompress_wal_chunks(gz_from_path, gz_data, gz_size,
+									 decompress_threads, &data_size);
+		pg_free(gz_data);
+
+		if (data == NULL)
+		{
+			gz_in = fio_gzopen(gz_from_path, PG_BINARY_R, Z_DEFAULT_COMPRESSION,
+							   FIO_BACKUP_HOST);
+			if (gz_in == NULL)
+				elog(ERROR, "Cannot open compressed WAL file \"%s\": %s",
+						 gz_from_path, strerror(errno));
+		}
 	}
 #endif
 
@@ -423,15 +1168,50 @@ get_wal_file(const char *from_path, const char *to_path)
 		elog(ERROR, "Cannot open destination temporary WAL file \"%s\": %s",
 				to_path_temp, strerror(errno));
 
+	if (data != NULL)
+	{
+		while ((size_t) write_pos < data_size)
+		{
+			size_t		write_len = Min(data_size - write_pos, WAL_BUFFER_SIZE);
+
+			if (fio_write(out, data + write_pos, write_len) != write_len)
+			{
+				errno_temp = errno;
+				fio_unlink(to_path_temp, FIO_DB_HOST);
+				elog(ERROR, "Cannot write to WAL file \"%s\": %s", to_path_temp,
+					 strerror(errno_temp));
+			}
+			start_writeback(out, FIO_DB_HOST, write_pos, write_len);
+			write_pos += write_len;
+		}
+		pg_free(data);
+
+		copied = 1;
+	}
+	/* Both files are local, let the kernel copy the content */
+	else if (!is_decompress && !fio_is_remote_file(in) &&
+			 !fio_is_remote(FIO_DB_HOST))
+	{
+		copied = copy_file_kernel(fileno(in), out);
+		if (copied < 0)
+		{
+			errno_temp = errno;
+			fio_unlink(to_path_temp, FIO_DB_HOST);
+			elog(ERROR, "Cannot copy WAL file \"%s\" to \"%s\": %s",
+				 from_path, to_path_temp, strerror(errno_temp));
+		}
+	}
+
 	/* copy content */
-	for (;;)
+	buf = pgut_malloc(WAL_BUFFER_SIZE);
+	while (!copied)
 	{
 		int read_len = 0;
 
 #ifdef HAVE_LIBZ
 		if (is_decompress)
 		{
-			read_len = fio_gzread(gz_in, buf, sizeof(buf));
+			read_len = fio_gzread(gz_in, buf, WAL_BUFFER_SIZE);
 			if (read_len <= 0 && !fio_gzeof(gz_in))
 			{
 				errno_temp = errno;
@@ -443,7 +1223,7 @@ get_wal_file(const char *from_path, const char *to_path)
 		else
 #endif
 		{
-			read_len = fio_fread(in, buf, sizeof(buf));
+			read_len = fio_fread(in, buf, WAL_BUFFER_SIZE);
 			if (read_len < 0)
 			{
 				errno_temp = errno;
@@ -462,6 +1242,8 @@ get_wal_file(const char *from_path, const char *to_path)
 				elog(ERROR, "Cannot write to WAL file \"%s\": %s", to_path_temp,
 					 strerror(errno_temp));
 			}
+			start_writeback(out, FIO_DB_HOST, write_pos, read_len);
+			write_pos += read_len;
 		}
 
 		/* Check for EOF */
@@ -478,6 +1260,7 @@ get_wal_file(const char *from_path, const char *to_path)
 				break;
 		}
 	}
+	pg_free(buf);
 
 	if (fio_flush(out) != 0 || fio_close(out) != 0)
 	{
@@ -490,7 +1273,7 @@ get_wal_file(const char *from_path, const char *to_path)
 #ifdef HAVE_LIBZ
 	if (is_decompress)
 	{
-		if (fio_gzclose(gz_in) != 0)
+		if (gz_in != NULL && fio_gzclose(gz_in) != 0)
 		{
 			errno_temp = errno;
 			fio_unlink(to_path_temp, FIO_DB_HOST);
@@ -501,6 +1284,10 @@ get_wal_file(const char *from_path, const char *to_path)
 	else
 #endif
 	{
+		/* The archived file is not going to be read again soon */
+#ifdef POSIX_FADV_DONTNEED
+		advise_wal_file(in, POSIX_FADV_DONTNEED);
+#endif
 		if (fio_fclose(in))
 		{
 			errno_temp = errno;
@@ -543,6 +1330,400 @@ get_gz_error(gzFile gzf, int errnum)
 	else
 		return errmsg;
 }
+
+/*
+ * Compressed WAL segment is a single member gzip file, which can be read by
+ * any gzip reader. Data is split into chunks of WAL_GZ_CHUNK_SIZE bytes,
+ * which are deflated independently: every chunk except the last one ends
+ * with a full flush. Compressed sizes of the chunks are stored in the extra
+ * field of gzip header, so the chunks can be inflated in parallel as well.
+ *
+ * Extra subfield 'PB' contains chunk size, number of chunks and compressed
+ * size of each chunk, all as little-endian uint32.
+ */
+#define WAL_GZ_CHUNK_SIZE		(1024 * 1024)
+#define WAL_GZ_HEADER_SIZE		10
+#define WAL_GZ_TRAILER_SIZE		8
+#define WAL_GZ_MAX_CHUNKS		((0xFFFF - 4 - 8) / 4)
+
+static uint32
+get_le32(const unsigned char *p)
+{
+	return (uint32) p[0] | ((uint32) p[1] << 8) |
+		((uint32) p[2] << 16) | ((uint32) p[3] << 24);
+}
+
+static void
+put_le32(unsigned char *p, uint32 value)
+{
+	p[0] = value & 0xFF;
+	p[1] = (value >> 8) & 0xFF;
+	p[2] = (value >> 16) & 0xFF;
+	p[3] = (value >> 24) & 0xFF;
+}
+
+static bool
+deflate_wal_chunk(WalGzChunk *chunk, int level)
+{
+	z_stream	strm;
+	int			rc;
+	bool		ok;
+
+	memset(&strm, 0, sizeof(strm));
+	if (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+					 Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+
+	/* Leave room for the full flush marker */
+	chunk->out_size = deflateBound(&strm, chunk->in_size) + 16;
+	chunk->out = pgut_malloc(chunk->out_size);
+
+	strm.next_in = (Bytef *) chunk->in;
+	strm.avail_in = chunk->in_size;
+	strm.next_out = (Bytef *) chunk->out;
+	strm.avail_out = chunk->out_size;
+
+	rc = deflate(&strm, chunk->last ? Z_FINISH : Z_FULL_FLUSH);
+	if (chunk->last)
+		ok = rc == Z_STREAM_END;
+	else
+		ok = rc == Z_OK && strm.avail_in == 0 && strm.avail_out > 0;
+
+	chunk->out_size = strm.total_out;
+	chunk->crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef *) chunk->in,
+					   chunk->in_size);
+
+	deflateEnd(&strm);
+	return ok;
+}
+
+static bool
+inflate_wal_chunk(WalGzChunk *chunk)
+{
+	z_stream	strm;
+	int			rc;
+	bool		ok;
+
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+		return false;
+
+	strm.next_in = (Bytef *) chunk->in;
+	strm.avail_in = chunk->in_size;
+	strm.next_out = (Bytef *) chunk->out;
+	strm.avail_out = chunk->out_size;
+
+	/* Chunk must fill its part of the output exactly */
+	rc = inflate(&strm, Z_SYNC_FLUSH);
+	ok = strm.total_out == chunk->out_size &&
+		(chunk->last ? rc == Z_STREAM_END :
+		 ((rc == Z_OK || rc == Z_BUF_ERROR) && strm.avail_in == 0));
+
+	chunk->crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef *) chunk->out,
+					   chunk->out_size);
+
+	inflateEnd(&strm);
+	return ok;
+}
+
+static void *
+wal_gz_worker(void *arg)
+{
+	wal_gz_arg *arguments = (wal_gz_arg *) arg;
+	int			i;
+
+	for (i = 0; i < arguments->nchunks; i++)
+	{
+		WalGzChunk *chunk = &arguments->chunks[i];
+
+		if (!pg_atomic_test_set_flag(&chunk->lock))
+			continue;
+
+		if (interrupted)
+			elog(ERROR, "interrupted during WAL file compression");
+
+		if (arguments->compress)
+			chunk->done = deflate_wal_chunk(chunk, arguments->level);
+		else
+			chunk->done = inflate_wal_chunk(chunk);
+	}
+
+	arguments->ret = 0;
+
+	return NULL;
+}
+
+/*
+ * Process chunks in nthreads threads. Returns false if some chunk
+ * cannot be processed.
+ */
+static bool
+run_wal_gz_workers(WalGzChunk *chunks, int nchunks, bool compress,
+				   int level, int nthreads)
+{
+	pthread_t  *threads;
+	wal_gz_arg *threads_args;
+	int			i;
+
+	nthreads = Max(Min(nthreads, nchunks), 1);
+
+	threads = (pthread_t *) palloc(sizeof(pthread_t) * nthreads);
+	threads_args = (wal_gz_arg *) palloc(sizeof(wal_gz_arg) * nthreads);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		wal_gz_arg *arg = &(threads_args[i]);
+
+		arg->chunks = chunks;
+		arg->nchunks = nchunks;
+		arg->compress = compress;
+		arg->level = level;
+		/* By default there is some error */
+		arg->ret = 1;
+	}
+
+	/* A single chunk is not worth a thread */
+	if (nthreads == 1)
+		wal_gz_worker(&threads_args[0]);
+	else
+	{
+		for (i = 0; i < nthreads; i++)
+			pthread_create(&threads[i], NULL, wal_gz_worker, &(threads_args[i]));
+
+		for (i = 0; i < nthreads; i++)
+			pthread_join(threads[i], NULL);
+	}
+
+	pfree(threads);
+	pfree(threads_args);
+
+	for (i = 0; i < nchunks; i++)
+	{
+		if (!chunks[i].done)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Compress WAL segment data in nthreads threads.
+ * Returns palloc'd gzip file content and its size in *gz_size.
+ */
+static char *
+compress_wal_chunks(const char *data, size_t size, int level, int nthreads,
+					size_t *gz_size)
+{
+	WalGzChunk *chunks;
+	size_t		chunk_size = WAL_GZ_CHUNK_SIZE;
+	int			nchunks;
+	unsigned char *gz_data;
+	unsigned char *p;
+	size_t		extra_len;
+	uLong		crc = crc32(0L, Z_NULL, 0);
+	int			i;
+
+	if (size > (size_t) chunk_size * WAL_GZ_MAX_CHUNKS)
+		chunk_size = (size + WAL_GZ_MAX_CHUNKS - 1) / WAL_GZ_MAX_CHUNKS;
+	nchunks = Max((size + chunk_size - 1) / chunk_size, 1);
+
+	chunks = pgut_newarray(WalGzChunk, nchunks);
+	for (i = 0; i < nchunks; i++)
+	{
+		chunks[i].in = data + (size_t) i * chunk_size;
+		chunks[i].in_size = Min(size - (size_t) i * chunk_size, chunk_size);
+		chunks[i].out = NULL;
+		chunks[i].last = (i == nchunks - 1);
+		chunks[i].done = false;
+		pg_atomic_clear_flag(&chunks[i].lock);
+	}
+
+	if (!run_wal_gz_workers(chunks, nchunks, true, level, nthreads))
+		elog(ERROR, "Cannot compress WAL file");
+
+	extra_len = 4 + 8 + 4 * nchunks;
+	*gz_size = WAL_GZ_HEADER_SIZE + 2 + extra_len + WAL_GZ_TRAILER_SIZE;
+	for (i = 0; i < nchunks; i++)
+		*gz_size += chunks[i].out_size;
+
+	gz_data = pgut_malloc(*gz_size);
+	p = gz_data;
+
+	/* gzip header with FEXTRA flag, no modification time, Unix OS */
+	*p++ = 0x1F;
+	*p++ = 0x8B;
+	*p++ = Z_DEFLATED;
+	*p++ = 0x04;
+	put_le32(p, 0);
+	p += 4;
+	*p++ = 0;
+	*p++ = 3;
+	*p++ = extra_len & 0xFF;
+	*p++ = (extra_len >> 8) & 0xFF;
+
+	*p++ = 'P';
+	*p++ = 'B';
+	*p++ = (extra_len - 4) & 0xFF;
+	*p++ = ((extra_len - 4) >> 8) & 0xFF;
+	put_le32(p, chunk_size);
+	p += 4;
+	put_le32(p, nchunks);
+	p += 4;
+	for (i = 0; i < nchunks; i++)
+	{
+		put_le32(p, chunks[i].out_size);
+		p += 4;
+	}
+
+	for (i = 0; i < nchunks; i++)
+	{
+		memcpy(p, chunks[i].out, chunks[i].out_size);
+		p += chunks[i].out_size;
+		crc = crc32_combine(crc, chunks[i].crc, chunks[i].in_size);
+		pg_free(chunks[i].out);
+	}
+
+	put_le32(p, crc);
+	put_le32(p + 4, (uint32) size);
+
+	pg_free(chunks);
+
+	return (char *) gz_data;
+}
+
+/*
+ * Decompress WAL file compressed by compress_wal_chunks() in nthreads
+ * threads. Returns palloc'd data and its size in *size, or NULL if the file
+ * is compressed in another way and should be read as a gzip stream.
+ */
+static char *
+decompress_wal_chunks(const char *path, const char *gz_data, size_t gz_size,
+					  int nthreads, size_t *size)
+{
+	const unsigned char *p = (const unsigned char *) gz_data;
+	const unsigned char *extra;
+	const unsigned char *sizes = NULL;
+	const unsigned char *chunk_data;
+	size_t		xlen;
+	size_t		pos;
+	size_t		chunk_size = 0;
+	size_t		nchunks = 0;
+	size_t		compressed_size = 0;
+	WalGzChunk *chunks;
+	char	   *data;
+	uLong		crc = crc32(0L, Z_NULL, 0);
+	int			i;
+
+	if (gz_size < WAL_GZ_HEADER_SIZE + 2 + WAL_GZ_TRAILER_SIZE ||
+		p[0] != 0x1F || p[1] != 0x8B || p[2] != Z_DEFLATED || p[3] != 0x04)
+		return NULL;
+
+	xlen = p[10] | (p[11] << 8);
+	if (WAL_GZ_HEADER_SIZE + 2 + xlen + WAL_GZ_TRAILER_SIZE > gz_size)
+		return NULL;
+
+	/* Look for our subfield */
+	extra = p + WAL_GZ_HEADER_SIZE + 2;
+	for (pos = 0; pos + 4 <= xlen;)
+	{
+		size_t		len = extra[pos + 2] | (extra[pos + 3] << 8);
+
+		if (pos + 4 + len > xlen)
+			return NULL;
+
+		if (extra[pos] == 'P' && extra[pos + 1] == 'B' && len >= 8)
+		{
+			chunk_size = get_le32(extra + pos + 4);
+			nchunks = get_le32(extra + pos + 8);
+			sizes = extra + pos + 12;
+			if (len != 8 + 4 * nchunks)
+				return NULL;
+			break;
+		}
+		pos += 4 + len;
+	}
+
+	if (sizes == NULL || chunk_size == 0 || nchunks == 0)
+		return NULL;
+
+	for (i = 0; i < nchunks; i++)
+		compressed_size += get_le32(sizes + 4 * i);
+
+	if (WAL_GZ_HEADER_SIZE + 2 + xlen + compressed_size +
+		WAL_GZ_TRAILER_SIZE != gz_size)
+		return NULL;
+
+	*size = get_le32(p + gz_size - 4);
+	if (*size > nchunks * chunk_size ||
+		*size < (nchunks - 1) * chunk_size)
+		return NULL;
+
+	data = pgut_malloc(Max(*size, 1));
+	chunks = pgut_newarray(WalGzChunk, nchunks);
+
+	chunk_data = extra + xlen;
+	for (i = 0; i < nchunks; i++)
+	{
+		chunks[i].in = (const char *) chunk_data;
+		chunks[i].in_size = get_le32(sizes + 4 * i);
+		chunks[i].out = data + (size_t) i * chunk_size;
+		chunks[i].out_size = Min(*size - (size_t) i * chunk_size, chunk_size);
+		chunks[i].last = (i == nchunks - 1);
+		chunks[i].done = false;
+		pg_atomic_clear_flag(&chunks[i].lock);
+		chunk_data += chunks[i].in_size;
+	}
+
+	if (!run_wal_gz_workers(chunks, nchunks, false, 0, nthreads))
+		elog(ERROR, "Cannot decompress WAL file \"%s\": data is corrupted",
+			 path);
+
+	for (i = 0; i < nchunks; i++)
+		crc = crc32_combine(crc, chunks[i].crc, chunks[i].out_size);
+
+	if (crc != get_le32(p + gz_size - WAL_GZ_TRAILER_SIZE))
+		elog(ERROR, "Cannot decompress WAL file \"%s\": checksum mismatch",
+			 path);
+
+	pg_free(chunks);
+
+	return data;
+}
+
+/*
+ * Read the whole file from backup catalog into memory.
+ */
+static char *
+read_wal_file(const char *path, size_t *size)
+{
+	int			fd;
+	struct stat	st;
+	char	   *buf;
+	size_t		len = 0;
+
+	fd = fio_open(path, O_RDONLY | PG_BINARY, FIO_BACKUP_HOST);
+	if (fd < 0)
+		elog(ERROR, "Cannot open WAL file \"%s\": %s", path, strerror(errno));
+
+	if (fio_fstat(fd, &st) < 0)
+		elog(ERROR, "Cannot stat WAL file \"%s\": %s", path, strerror(errno));
+
+	buf = pgut_malloc(Max(st.st_size, 1));
+	while (len < (size_t) st.st_size)
+	{
+		ssize_t		rc = fio_read(fd, buf + len, st.st_size - len);
+
+		if (rc < 0)
+			elog(ERROR, "Cannot read WAL file \"%s\": %s", path, strerror(errno));
+		if (rc == 0)
+			break;
+		len += rc;
+	}
+	fio_close(fd);
+
+	*size = len;
+	return buf;
+}
 #endif
 
 /*
@@ -559,7 +1740,7 @@ fileEqualCRC(const char *path1, const char *path2, bool path2_is_compressed)
 #ifdef HAVE_LIBZ
 	if (path2_is_compressed)
 	{
-		char 		buf [1024];
+		char	   *buf;
 		gzFile		gz_in = NULL;
 
 		INIT_FILE_CRC32(true, crc2);
@@ -570,15 +1751,17 @@ fileEqualCRC(const char *path1, const char *path2, bool path2_is_compressed)
 					 "Cannot compare WAL file \"%s\" with compressed \"%s\"",
 					 path1, path2);
 
+		buf = pgut_malloc(WAL_BUFFER_SIZE);
 		for (;;)
 		{
-			int read_len = fio_gzread(gz_in, buf, sizeof(buf));
+			int read_len = fio_gzread(gz_in, buf, WAL_BUFFER_SIZE);
 			if (read_len <= 0 && !fio_gzeof(gz_in))
 			{
 				/* An error occurred while reading the file */
 				elog(WARNING,
 					 "Cannot compare WAL file \"%s\" with compressed \"%s\": %d",
 					 path1, path2, read_len);
+				pg_free(buf);
 				return false;
 			}
 			COMP_FILE_CRC32(true, crc2, buf, read_len);
@@ -586,6 +1769,7 @@ fileEqualCRC(const char *path1, const char *path2, bool path2_is_compressed)
 				break;
 		}
 		FIN_FILE_CRC32(true, crc2);
+		pg_free(buf);
 
 		if (fio_gzclose(gz_in) != 0)
 			elog(ERROR, "Cannot close compressed WAL file \"%s\": %s",
@@ -594,15 +1778,133 @@ fileEqualCRC(const char *path1, const char *path2, bool path2_is_compressed)
 	else
 #endif
 	{
+		struct stat	st1;
+		struct stat	st2;
+
+		/* Files of different size cannot be equal, do not read them */
+		if (fio_stat(path1, &st1, true, FIO_DB_HOST) == 0 &&
+			fio_stat(path2, &st2, true, FIO_BACKUP_HOST) == 0 &&
+			st1.st_size != st2.st_size)
+			return false;
+
 		crc2 = pgFileGetCRC(path2, true, true, NULL, FIO_BACKUP_HOST);
 	}
 
-	/* Get checksum of original file */
+	/*
+	 * Get checksum of original file. Single pass is used, because it is
+	 * called from threads pushing the batch too.
+	 */
 	crc1 = pgFileGetCRC(path1, true, true, NULL, FIO_DB_HOST);
 
 	return EQ_CRC32C(crc1, crc2);
 }
 
+/*
+ * Copy the rest of local file in_fd into local file out_fd without moving
+ * the data through user space. Returns 1 if the file is copied, 0 if the
+ * kernel cannot copy these files and nothing is copied, so the caller
+ * has to copy the file itself, -1 on error with errno set.
+ *
+ * Some file systems (procfs-like, some overlay, FUSE and cross-fs setups)
+ * report EOF from the very first call without copying anything, so zero
+ * on the first call is not trusted and the caller copies the file itself.
+ */
+static int
+copy_file_kernel(int in_fd, int out_fd)
+{
+#ifdef __linux__
+	off_t		copied = 0;
+	off_t		expected;
+	off_t		start_pos;
+	struct stat	st;
+#ifdef SYS_copy_file_range
+	bool		use_copy_file_range = true;
+#endif
+
+	/* Remember how much we are going to copy to check the result */
+	start_pos = lseek(in_fd, 0, SEEK_CUR);
+	if (start_pos < 0 || fstat(in_fd, &st) < 0)
+		return 0;
+	expected = st.st_size - start_pos;
+
+	for (;;)
+	{
+		ssize_t		rc;
+
+#ifdef SYS_copy_file_range
+		if (use_copy_file_range)
+		{
+			rc = syscall(SYS_copy_file_range, in_fd, NULL, out_fd, NULL,
+						 (size_t) WAL_BUFFER_SIZE, 0);
+
+			/* Old kernel or different file systems, fall back to sendfile() */
+			if (rc < 0 && copied == 0 &&
+				(errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+				 errno == EOPNOTSUPP))
+			{
+				use_copy_file_range = false;
+				continue;
+			}
+		}
+		else
+#endif
+			rc = sendfile(out_fd, in_fd, NULL, WAL_BUFFER_SIZE);
+
+		if (rc < 0)
+		{
+			if (copied == 0 && (errno == ENOSYS || errno == EINVAL))
+				return 0;
+			return -1;
+		}
+
+		if (rc == 0)
+		{
+			/* Nothing is copied yet, let the caller copy the file */
+			if (copied == 0 && expected > 0)
+				return 0;
+
+			/* The kernel stopped early, do not leave a short file */
+			if (copied != expected)
+			{
+				errno = EIO;
+				return -1;
+			}
+
+			return 1;
+		}
+
+		start_writeback(out_fd, FIO_LOCAL_HOST, copied, rc);
+		copied += rc;
+	}
+#else
+	return 0;
+#endif
+}
+
+/* Give the kernel a hint about access pattern of local WAL file */
+static void
+advise_wal_file(FILE *in, int advice)
+{
+#ifdef HAVE_POSIX_FADVISE
+	if (!fio_is_remote_file(in))
+		(void) posix_fadvise(fileno(in), 0, 0, advice);
+#endif
+}
+
+/*
+ * Start writeback of just written range of the file, so that data is
+ * written out while the file is being copied and fsync() at the end has
+ * little to do.
+ */
+static void
+start_writeback(int fd, fio_location location, off_t offset, off_t nbytes)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+	if (!fio_is_remote(location))
+		(void) sync_file_range(fd, offset, nbytes, SYNC_FILE_RANGE_WRITE);
+#endif
+}
+
 /* Copy file attributes */
 static void
 copy_file_attributes(const char *from_path, fio_location from_location,
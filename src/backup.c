@@ -42,6 +42,37 @@ const char *progname = "pg_probackup";
 /* list of files contained in backup */
 static parray *backup_files_list = NULL;
 
+/*
+ * Number of files whose stat requests are sent to the remote agent ahead
+ * of copying, so that round trips to the database host overlap. Only files
+ * of the chunk already claimed from the scheduler are requested ahead.
+ */
+#define BACKUP_STAT_PIPELINE_DEPTH	64
+
+/*
+ * Index of main fork data files by relfilenode and segment number, used by
+ * process_block_change() to find the file of a block referenced in WAL
+ * without building and comparing paths. Changed blocks are marked in
+ * preallocated bitmaps with atomic operations, so WAL reader threads don't
+ * have to lock each other.
+ */
+typedef struct
+{
+	Oid			tblspcOid;
+	Oid			dbOid;
+	Oid			relOid;
+	int			segno;
+	pgFile	   *file;
+	uint32		nwords;			/* size of bitmap in 32-bit words */
+	pg_atomic_uint32 *bitmap;	/* changed blocks within the file size */
+	datapagemap_t overflow;		/* changed blocks beyond the file size */
+} PagemapIndexEntry;
+
+static PagemapIndexEntry *pagemap_entries = NULL;
+static int	pagemap_nentries = 0;
+static int *pagemap_buckets = NULL;	/* entry numbers, -1 for empty bucket */
+static uint32 pagemap_mask = 0;
+
 /* We need critical section for datapagemap_add() in case of using threads */
 static pthread_mutex_t backup_pagemap_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -110,6 +141,9 @@ static void check_server_version(PGconn *conn, PGNodeInfo *nodeInfo);
 static void confirm_block_size(PGconn *conn, const char *name, int blcksz);
 static void set_cfs_datafiles(parray *files, const char *root, char *relative, size_t i);
 
+static void build_pagemap_index(parray *files);
+static void finish_pagemap_index(void);
+
 static void
 backup_stopbackup_callback(bool fatal, void *userdata)
 {
@@ -142,6 +176,7 @@ do_backup_instance(PGconn *backup_conn, PGNodeInfo *nodeInfo)
 	pthread_t	*threads;
 	backup_files_arg *threads_args;
 	bool		backup_isok = true;
+	FileScheduler *sched;
 
 	pgBackup   *prev_backup = NULL;
 	parray	   *prev_backup_filelist = NULL;
@@ -354,7 +389,7 @@ do_backup_instance(PGconn *backup_conn, PGNodeInfo *nodeInfo)
 	 * 2 - create 'base/1'
 	 *
 	 * Sorted array is used at least in parse_filelist_filenames(),
-	 * extractPageMap(), make_pagemap_from_ptrack().
+	 * make_pagemap_from_ptrack().
 	 */
 	parray_qsort(backup_files_list, pgFileComparePath);
 
@@ -387,8 +422,10 @@ do_backup_instance(PGconn *backup_conn, PGNodeInfo *nodeInfo)
 			 * reading WAL segments present in archives up to the point
 			 * where this backup has started.
 			 */
+			build_pagemap_index(backup_files_list);
 			extractPageMap(arclog_path, current.tli, instance_config.xlog_seg_size,
 						   prev_backup->start_lsn, current.start_lsn);
+			finish_pagemap_index();
 		}
 		else if (current.backup_mode == BACKUP_MODE_DIFF_PTRACK)
 		{
@@ -443,13 +480,8 @@ do_backup_instance(PGconn *backup_conn, PGNodeInfo *nodeInfo)
 				join_path_components(dirpath, database_path, dir_name);
 			fio_mkdir(dirpath, DIR_PERMISSION, FIO_BACKUP_HOST);
 		}
-
-		/* setup threads */
-		pg_atomic_clear_flag(&file->lock);
 	}
 
-	/* Sort by size for load balancing */
-	parray_qsort(backup_files_list, pgFileCompareSize);
 	/* Sort the array for binary search */
 	if (prev_backup_filelist)
 		parray_qsort(prev_backup_filelist, pgFileComparePathWithExternal);
@@ -459,6 +491,16 @@ do_backup_instance(PGconn *backup_conn, PGNodeInfo *nodeInfo)
 						  instance_config.pgdata, external_dirs);
 	write_backup(&current);
 
+	/* Sample pages to be backed up to train compression dictionary */
+	if (compress_dictionary)
+		train_page_dictionary(backup_files_list, &current);
+
+	/*
+	 * Datafiles are written to the backup as a stream of pages, so every
+	 * file is copied by one thread.
+	 */
+	sched = file_scheduler_new(backup_files_list, false);
+
 	/* init thread args with own file lists */
 	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
 	threads_args = (backup_files_arg *) palloc(sizeof(backup_files_arg)*num_threads);
@@ -473,6 +515,7 @@ do_backup_instance(PGconn *backup_conn, PGNodeInfo *nodeInfo)
 		arg->external_prefix = external_prefix;
 		arg->external_dirs = external_dirs;
 		arg->files_list = backup_files_list;
+		arg->sched = sched;
 		arg->prev_filelist = prev_backup_filelist;
 		arg->prev_start_lsn = prev_backup_start_lsn;
 		arg->conn_arg.conn = NULL;
@@ -504,6 +547,7 @@ do_backup_instance(PGconn *backup_conn, PGNodeInfo *nodeInfo)
 		elog(INFO, "Data files are transferred");
 	else
 		elog(ERROR, "Data files transferring failed");
+	file_scheduler_free(sched);
 
 	/* Remove disappeared during backup files from backup_list */
 	for (i = 0; i < parray_num(backup_files_list); i++)
@@ -580,18 +624,13 @@ do_backup_instance(PGconn *backup_conn, PGNodeInfo *nodeInfo)
 			pgFile	   *file = (pgFile *) parray_get(xlog_files_list, i);
 			if (S_ISREG(file->mode))
 			{
-				file->crc = pgFileGetCRC(file->path, true, false,
-										 &file->read_size, FIO_BACKUP_HOST);
+				file->crc = pgFileGetCRCParallel(file->path, false,
+												 &file->read_size, FIO_BACKUP_HOST);
 				file->write_size = file->read_size;
 			}
 			/* Remove file path root prefix*/
 			if (strstr(file->path, database_path) == file->path)
-			{
-				char	   *ptr = file->path;
-
-				file->path = pstrdup(GetRelativePath(ptr, database_path));
-				free(ptr);
-			}
+				pgFileSetPath(file, GetRelativePath(file->path, database_path));
 		}
 		/* Add xlog files into the list of backed up files */
 		parray_concat(backup_files_list, xlog_files_list);
@@ -1758,8 +1797,7 @@ pg_stop_backup(pgBackup *backup, PGconn *pg_startbackup_conn,
 										 &file->read_size, FIO_BACKUP_HOST);
 				file->write_size = file->read_size;
 				file->uncompressed_size = file->read_size;
-				free(file->path);
-				file->path = strdup(PG_BACKUP_LABEL_FILE);
+				pgFileSetPath(file, PG_BACKUP_LABEL_FILE);
 				parray_append(backup_files_list, file);
 			}
 		}
@@ -1807,8 +1845,7 @@ pg_stop_backup(pgBackup *backup, PGconn *pg_startbackup_conn,
 											 &file->read_size, FIO_BACKUP_HOST);
 					file->write_size = file->read_size;
 				}
-				free(file->path);
-				file->path = strdup(PG_TABLESPACE_MAP_FILE);
+				pgFileSetPath(file, PG_TABLESPACE_MAP_FILE);
 				parray_append(backup_files_list, file);
 			}
 		}
@@ -1927,19 +1964,57 @@ backup_cleanup(bool fatal, void *userdata)
 static void *
 backup_files(void *arg)
 {
-	int			i;
 	backup_files_arg *arguments = (backup_files_arg *) arg;
-	int			n_backup_files_list = parray_num(arguments->files_list);
 	static time_t prev_time;
+	FileTaskCursor cursor = FILE_TASK_CURSOR_INIT;
+	/* claimed tasks and their stat requests in flight */
+	FileTask   *pending[BACKUP_STAT_PIPELINE_DEPTH];
+	int			stat_requests[BACKUP_STAT_PIPELINE_DEPTH];
+	int			first_pending = 0;
+	int			n_pending = 0;
+	int			slot = 0;
+	bool		pipeline = fio_is_remote(FIO_DB_HOST);
 
 	prev_time = current.start_time;
 
 	/* backup a file */
-	for (i = 0; i < n_backup_files_list; i++)
+	for (;;)
 	{
 		int			ret;
 		struct stat	buf;
-		pgFile	   *file = (pgFile *) parray_get(arguments->files_list, i);
+		FileTask   *task;
+		pgFile	   *file;
+
+		if (pipeline)
+		{
+			/*
+			 * Claim following files of the chunk and ask agent about them
+			 * in advance. Next chunk is claimed only when nothing is pending,
+			 * so that large files are not held back from other threads.
+			 */
+			while (n_pending < BACKUP_STAT_PIPELINE_DEPTH &&
+				   (n_pending == 0 || cursor.pos < cursor.end) &&
+				   (task = file_scheduler_next(arguments->sched, &cursor)) != NULL)
+			{
+				int			next = (first_pending + n_pending) % BACKUP_STAT_PIPELINE_DEPTH;
+
+				pending[next] = task;
+				stat_requests[next] = fio_stat_async(task->file->path, true,
+													 FIO_DB_HOST);
+				n_pending++;
+			}
+			if (n_pending == 0)
+				break;
+
+			slot = first_pending;
+			task = pending[slot];
+			first_pending = (first_pending + 1) % BACKUP_STAT_PIPELINE_DEPTH;
+			n_pending--;
+		}
+		else if ((task = file_scheduler_next(arguments->sched, &cursor)) == NULL)
+			break;
+
+		file = task->file;
 
 		if (arguments->thread_num == 1)
 		{
@@ -1955,8 +2030,6 @@ backup_files(void *arg)
 			}
 		}
 
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
 		elog(VERBOSE, "Copying file: \"%s\"", file->path);
 
 		/* check for interrupt */
@@ -1965,10 +2038,14 @@ backup_files(void *arg)
 
 		if (progress)
 			elog(INFO, "Progress: (%d/%d). Process file \"%s\"",
-				 i + 1, n_backup_files_list, file->path);
+				 (int) (task - arguments->sched->tasks) + 1,
+				 arguments->sched->ntasks, file->path);
 
 		/* stat file to check its current state */
-		ret = fio_stat(file->path, &buf, true, FIO_DB_HOST);
+		if (pipeline)
+			ret = fio_stat_wait(stat_requests[slot], &buf);
+		else
+			ret = fio_stat(file->path, &buf, true, FIO_DB_HOST);
 		if (ret == -1)
 		{
 			if (errno == ENOENT)
@@ -2246,35 +2323,170 @@ set_cfs_datafiles(parray *files, const char *root, char *relative, size_t i)
 	free(cfs_tblspc_path);
 }
 
+static uint32
+pagemap_hash(Oid tblspcOid, Oid dbOid, Oid relOid, int segno)
+{
+	uint32		h = relOid;
+
+	h = h * 0x9E3779B1 ^ dbOid;
+	h = h * 0x9E3779B1 ^ tblspcOid;
+	h = h * 0x9E3779B1 ^ (uint32) segno;
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+
+	return h;
+}
+
+static PagemapIndexEntry *
+pagemap_index_find(Oid tblspcOid, Oid dbOid, Oid relOid, int segno)
+{
+	uint32		pos = pagemap_hash(tblspcOid, dbOid, relOid, segno) & pagemap_mask;
+
+	while (pagemap_buckets[pos] >= 0)
+	{
+		PagemapIndexEntry *entry = &pagemap_entries[pagemap_buckets[pos]];
+
+		if (entry->relOid == relOid && entry->segno == segno &&
+			entry->dbOid == dbOid && entry->tblspcOid == tblspcOid)
+			return entry;
+
+		pos = (pos + 1) & pagemap_mask;
+	}
+
+	return NULL;
+}
+
+/*
+ * Build index of data files for process_block_change(). Must be called
+ * before WAL parsing.
+ */
+static void
+build_pagemap_index(parray *files)
+{
+	size_t		nfiles = parray_num(files);
+	uint32		nbuckets = 1;
+	size_t		i;
+
+	/* Keep hash table at most half full */
+	while (nbuckets < 2 * nfiles)
+		nbuckets <<= 1;
+
+	pagemap_entries = pgut_newarray(PagemapIndexEntry, Max(nfiles, 1));
+	pagemap_nentries = 0;
+	pagemap_buckets = pgut_newarray(int, nbuckets);
+	memset(pagemap_buckets, -1, sizeof(int) * nbuckets);
+	pagemap_mask = nbuckets - 1;
+
+	for (i = 0; i < nfiles; i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+		PagemapIndexEntry *entry;
+		BlockNumber nblocks;
+		uint32		pos;
+		uint32		j;
+
+		if (!S_ISREG(file->mode) || !file->is_datafile ||
+			file->external_dir_num != 0)
+			continue;
+
+		if (pagemap_index_find(file->tblspcOid, file->dbOid, file->relOid,
+							   file->segno) != NULL)
+			continue;
+
+		entry = &pagemap_entries[pagemap_nentries];
+		entry->tblspcOid = file->tblspcOid;
+		entry->dbOid = file->dbOid;
+		entry->relOid = file->relOid;
+		entry->segno = file->segno;
+		entry->file = file;
+
+		/* Reserve a block for partially written tail of the file */
+		nblocks = Min(file->size / BLCKSZ + 1, RELSEG_SIZE);
+		entry->nwords = (nblocks + 31) / 32;
+		entry->bitmap = pgut_newarray(pg_atomic_uint32, entry->nwords);
+		for (j = 0; j < entry->nwords; j++)
+			pg_atomic_init_u32(&entry->bitmap[j], 0);
+		entry->overflow.bitmap = NULL;
+		entry->overflow.bitmapsize = 0;
+
+		pos = pagemap_hash(file->tblspcOid, file->dbOid, file->relOid,
+						   file->segno) & pagemap_mask;
+		while (pagemap_buckets[pos] >= 0)
+			pos = (pos + 1) & pagemap_mask;
+		pagemap_buckets[pos] = pagemap_nentries++;
+	}
+}
+
+/*
+ * Move changed blocks collected during WAL parsing into pagemaps of the
+ * files and free the index.
+ */
+static void
+finish_pagemap_index(void)
+{
+	int			i;
+
+	for (i = 0; i < pagemap_nentries; i++)
+	{
+		PagemapIndexEntry *entry = &pagemap_entries[i];
+		pgFile	   *file = entry->file;
+		int			j;
+
+		/*
+		 * Blocks beyond the file size are already in pagemap format. Add
+		 * the rest starting from the highest block, so that the pagemap
+		 * is allocated only once.
+		 */
+		file->pagemap = entry->overflow;
+		for (j = entry->nwords - 1; j >= 0; j--)
+		{
+			uint32		word = pg_atomic_read_u32(&entry->bitmap[j]);
+			int			bit;
+
+			if (word == 0)
+				continue;
+
+			for (bit = 31; bit >= 0; bit--)
+			{
+				if (word & ((uint32) 1 << bit))
+					datapagemap_add(&file->pagemap, j * 32 + bit);
+			}
+		}
+
+		pg_free(entry->bitmap);
+	}
+
+	pg_free(pagemap_entries);
+	pg_free(pagemap_buckets);
+	pagemap_entries = NULL;
+	pagemap_buckets = NULL;
+	pagemap_nentries = 0;
+}
+
 /*
- * Find pgfile by given rnode in the backup_files_list
+ * Find pgfile by given rnode in the index built by build_pagemap_index()
  * and add given blkno to its pagemap.
  */
 void
 process_block_change(ForkNumber forknum, RelFileNode rnode, BlockNumber blkno)
 {
-	char	   *path;
-	char	   *rel_path;
 	BlockNumber blkno_inseg;
 	int			segno;
-	pgFile	  **file_item;
-	pgFile		f;
+	PagemapIndexEntry *entry;
+
+	/*
+	 * Only files of the main fork are data files, the index has no other
+	 * forks. Other forks are copied as a whole anyway.
+	 */
+	if (forknum != MAIN_FORKNUM)
+		return;
 
 	segno = blkno / RELSEG_SIZE;
 	blkno_inseg = blkno % RELSEG_SIZE;
 
-	rel_path = relpathperm(rnode, forknum);
-	if (segno > 0)
-		path = psprintf("%s/%s.%u", instance_config.pgdata, rel_path, segno);
-	else
-		path = psprintf("%s/%s", instance_config.pgdata, rel_path);
-
-	pg_free(rel_path);
-
-	f.path = path;
-	/* backup_files_list should be sorted before */
-	file_item = (pgFile **) parray_bsearch(backup_files_list, &f,
-										   pgFileComparePath);
+	entry = pagemap_index_find(rnode.spcNode, rnode.dbNode, rnode.relNode,
+							   segno);
 
 	/*
 	 * If we don't have any record of this file in the file map, it means
@@ -2282,19 +2494,29 @@ process_block_change(ForkNumber forknum, RelFileNode rnode, BlockNumber blkno)
 	 * backup. We can safely ignore it. If it is a new relation file, the
 	 * backup would simply copy it as-is.
 	 */
-	if (file_item)
+	if (entry == NULL)
+		return;
+
+	if (blkno_inseg < entry->nwords * 32)
+	{
+		pg_atomic_uint32 *word = &entry->bitmap[blkno_inseg / 32];
+		uint32		mask = (uint32) 1 << (blkno_inseg % 32);
+
+		/* Hot blocks are already marked, don't bounce the cache line */
+		if ((pg_atomic_read_u32(word) & mask) == 0)
+			pg_atomic_fetch_or_u32(word, mask);
+	}
+	else
 	{
-		/* We need critical section only we use more than one threads */
+		/* The file was truncated after the change, rare case */
 		if (num_threads > 1)
 			pthread_lock(&backup_pagemap_mutex);
 
-		datapagemap_add(&(*file_item)->pagemap, blkno_inseg);
+		datapagemap_add(&entry->overflow, blkno_inseg);
 
 		if (num_threads > 1)
 			pthread_mutex_unlock(&backup_pagemap_mutex);
 	}
-
-	pg_free(path);
 }
 
 /*
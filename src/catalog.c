@@ -24,6 +24,115 @@ static pgBackup* get_oldest_backup(timelineInfo *tlinfo);
 static const char *backupModes[] = {"", "PAGE", "PTRACK", "DELTA", "FULL"};
 static pgBackup *readBackupControlFile(const char *path);
 
+/* Entry of the file list to be written in binary format */
+typedef struct FileListEntry
+{
+	pgFile	   *file;
+	const char *path;	/* path as it is written to the list */
+} FileListEntry;
+
+static void write_binary_filelist(FILE *out, const char *path_temp,
+								  FileListEntry *entries, size_t nentries);
+
+/*
+ * Index of the backups of the instance. It keeps contents of backup.control
+ * of every backup, so catalog_get_backup_list() has to stat backup.control
+ * only instead of reading and parsing it. The index is kept out of the
+ * instance directory, in BACKUPS_DIR/.<instance_name>.BACKUP_CATALOG_INDEX.
+ * BackupIndexHeader is followed by nbackups of BackupIndexEntry, each one
+ * followed by primary_conninfo and external_dir_str strings.
+ */
+#define BACKUP_INDEX_MAGIC		0x49435042	/* "BPCI" */
+#define BACKUP_INDEX_VERSION	1
+
+typedef struct BackupIndexHeader
+{
+	uint32		magic;
+	uint32		version;
+	uint32		backup_size;	/* sizeof(pgBackup) */
+	uint32		nbackups;
+	int64		index_time;		/* when backup.control files were read */
+	uint64		data_size;		/* size of the entries */
+	pg_crc32	crc;			/* CRC of the entries */
+} BackupIndexHeader;
+
+typedef struct BackupIndexEntry
+{
+	int64		control_mtime;	/* mtime and size of backup.control */
+	int64		control_size;	/* the entry was made from */
+	uint32		conninfo_len;	/* length of strings following the entry, */
+	uint32		external_dirs_len;	/* 0 means NULL */
+	pgBackup	backup;
+} BackupIndexEntry;
+
+/* Loaded index entry */
+typedef struct BackupIndexItem
+{
+	time_t		backup_id;
+	const char *entry;			/* BackupIndexEntry, may be unaligned */
+} BackupIndexItem;
+
+typedef struct BackupIndex
+{
+	char	   *data;
+	time_t		index_time;
+	uint32		nbackups;
+	BackupIndexItem *items;		/* sorted by backup_id */
+} BackupIndex;
+
+static BackupIndex *read_backup_index(const char *instance_name);
+static void free_backup_index(BackupIndex *index);
+static pgBackup *backup_index_get(BackupIndex *index, time_t backup_id,
+								  struct stat *st);
+static void backup_index_append(PQExpBuffer buf, pgBackup *backup,
+								struct stat *st);
+static void write_backup_index(const char *instance_name, PQExpBuffer buf,
+							   uint32 nbackups, time_t index_time);
+
+/*
+ * Listing of the WAL archive of the instance cached between runs of
+ * catalog_get_timelines(), kept in WAL_DIR/.<instance_name>.BACKUP_CATALOG_INDEX.
+ * If the archive directory wasn't modified since the listing was made, it
+ * is used as is, otherwise the directory is read again, but only new files
+ * have to be stat'ed. Under continuous archiving the directory changes all
+ * the time, so it is read and timelines are rebuilt on every call anyway,
+ * only stat() of old files is saved. WalIndexHeader is followed by nfiles
+ * of WalIndexRecord sorted by name and by the string table with names.
+ */
+#define WAL_INDEX_MAGIC			0x49575042	/* "BPWI" */
+#define WAL_INDEX_VERSION		1
+
+typedef struct WalIndexHeader
+{
+	uint32		magic;
+	uint32		version;
+	uint32		nfiles;
+	uint32		names_size;		/* size of the string table */
+	int64		dir_mtime;		/* mtime of the archive directory */
+	int64		index_time;		/* when the directory was read */
+	pg_crc32	crc;			/* CRC of the records and names */
+	uint32		padding;
+} WalIndexHeader;
+
+typedef struct WalIndexRecord
+{
+	uint64		ino;			/* inode number, 0 if unknown */
+	int64		size;
+	uint32		mode;
+	uint32		name;			/* offset in the string table */
+} WalIndexRecord;
+
+typedef struct WalIndex
+{
+	char	   *data;
+	WalIndexHeader header;
+	WalIndexRecord *records;
+	const char *names;
+} WalIndex;
+
+static void catalog_list_wal_files(parray *files, const char *arclog_path,
+								   const char *instance_name);
+
 static bool exit_hook_registered = false;
 static parray *lock_files = NULL;
 
@@ -399,6 +508,11 @@ catalog_get_backup_list(const char *instance_name, time_t requested_backup_id)
 	parray	   *backups = NULL;
 	int			i;
 	char backup_instance_path[MAXPGPATH];
+	BackupIndex *index;
+	PQExpBufferData index_buf;
+	uint32		index_nbackups = 0;
+	uint32		index_hits = 0;
+	time_t		index_time;
 
 	sprintf(backup_instance_path, "%s/%s/%s",
 			backup_path, BACKUPS_DIR, instance_name);
@@ -412,6 +526,15 @@ catalog_get_backup_list(const char *instance_name, time_t requested_backup_id)
 		goto err_proc;
 	}
 
+	/*
+	 * Control files modified since this moment are not trusted when the
+	 * index is read next time, because their modification in the same
+	 * second could go unnoticed.
+	 */
+	index_time = time(NULL);
+	index = read_backup_index(instance_name);
+	initPQExpBuffer(&index_buf);
+
 	/* scan the directory and list backups */
 	backups = parray_new();
 	for (; (data_ent = fio_readdir(data_dir)) != NULL; errno = 0)
@@ -419,18 +542,34 @@ catalog_get_backup_list(const char *instance_name, time_t requested_backup_id)
 		char		backup_conf_path[MAXPGPATH];
 		char		data_path[MAXPGPATH];
 		pgBackup   *backup = NULL;
+		struct stat	st;
+		bool		has_control;
 
-		/* skip not-directory entries and hidden entries */
-		if (!IsDir(backup_instance_path, data_ent->d_name, FIO_BACKUP_HOST)
-			|| data_ent->d_name[0] == '.')
+		/* skip hidden entries */
+		if (data_ent->d_name[0] == '.')
 			continue;
 
 		/* open subdirectory of specific backup */
 		join_path_components(data_path, backup_instance_path, data_ent->d_name);
-
-		/* read backup information from BACKUP_CONTROL_FILE */
 		snprintf(backup_conf_path, MAXPGPATH, "%s/%s", data_path, BACKUP_CONTROL_FILE);
-		backup = readBackupControlFile(backup_conf_path);
+
+		/* skip not-directory entries */
+		has_control = fio_stat(backup_conf_path, &st, true, FIO_BACKUP_HOST) == 0;
+		if (!has_control &&
+			!IsDir(backup_instance_path, data_ent->d_name, FIO_BACKUP_HOST))
+			continue;
+
+		/* take backup information from the index if it is still valid */
+		if (has_control && index)
+			backup = backup_index_get(index, base36dec(data_ent->d_name), &st);
+
+		if (backup)
+			index_hits++;
+		else if (has_control)
+		{
+			/* read backup information from BACKUP_CONTROL_FILE */
+			backup = readBackupControlFile(backup_conf_path);
+		}
 
 		if (!backup)
 		{
@@ -438,10 +577,14 @@ catalog_get_backup_list(const char *instance_name, time_t requested_backup_id)
 			pgBackupInit(backup);
 			backup->start_time = base36dec(data_ent->d_name);
 		}
-		else if (strcmp(base36enc(backup->start_time), data_ent->d_name) != 0)
+		else
 		{
-			elog(WARNING, "backup ID in control file \"%s\" doesn't match name of the backup folder \"%s\"",
-				 base36enc(backup->start_time), backup_conf_path);
+			if (strcmp(base36enc(backup->start_time), data_ent->d_name) != 0)
+				elog(WARNING, "backup ID in control file \"%s\" doesn't match name of the backup folder \"%s\"",
+					 base36enc(backup->start_time), backup_conf_path);
+
+			backup_index_append(&index_buf, backup, &st);
+			index_nbackups++;
 		}
 
 		backup->backup_id = backup->start_time;
@@ -457,6 +600,8 @@ catalog_get_backup_list(const char *instance_name, time_t requested_backup_id)
 		{
 			elog(WARNING, "cannot read data directory \"%s\": %s",
 				 data_ent->d_name, strerror(errno));
+			free_backup_index(index);
+			termPQExpBuffer(&index_buf);
 			goto err_proc;
 		}
 	}
@@ -464,9 +609,20 @@ catalog_get_backup_list(const char *instance_name, time_t requested_backup_id)
 	{
 		elog(WARNING, "cannot read backup root directory \"%s\": %s",
 			backup_instance_path, strerror(errno));
+		free_backup_index(index);
+		termPQExpBuffer(&index_buf);
 		goto err_proc;
 	}
 
+	/* Rewrite the index if some backups were read from control files */
+	if (index == NULL || index_hits != index_nbackups ||
+		index_hits != index->nbackups)
+		write_backup_index(instance_name, &index_buf, index_nbackups,
+						   index_time);
+
+	free_backup_index(index);
+	termPQExpBuffer(&index_buf);
+
 	fio_closedir(data_dir);
 	data_dir = NULL;
 
@@ -503,6 +659,251 @@ err_proc:
 	return NULL;
 }
 
+static int
+BackupIndexItemCompare(const void *a, const void *b)
+{
+	const BackupIndexItem *i1 = (const BackupIndexItem *) a;
+	const BackupIndexItem *i2 = (const BackupIndexItem *) b;
+
+	if (i1->backup_id > i2->backup_id)
+		return 1;
+	else if (i1->backup_id < i2->backup_id)
+		return -1;
+	return 0;
+}
+
+/*
+ * Read BACKUP_CATALOG_INDEX of the instance. Return NULL if there is no
+ * index or it cannot be used, the index is rebuilt by the caller then.
+ */
+static BackupIndex *
+read_backup_index(const char *instance_name)
+{
+	char		path[MAXPGPATH];
+	BackupIndexHeader header;
+	BackupIndex *index;
+	FILE	   *fp;
+	char	   *ptr;
+	char	   *end;
+	pg_crc32	crc;
+	uint32		i;
+
+	snprintf(path, MAXPGPATH, "%s/%s/.%s.%s", backup_path, BACKUPS_DIR,
+			 instance_name, BACKUP_CATALOG_INDEX);
+
+	fp = fio_fopen(path, PG_BINARY_R, FIO_BACKUP_HOST);
+	if (fp == NULL)
+		return NULL;
+
+	if (fio_fread(fp, &header, sizeof(header)) != sizeof(header) ||
+		header.magic != BACKUP_INDEX_MAGIC ||
+		header.version != BACKUP_INDEX_VERSION ||
+		header.backup_size != sizeof(pgBackup))
+	{
+		elog(LOG, "Backup catalog index \"%s\" is ignored", path);
+		fio_fclose(fp);
+		return NULL;
+	}
+
+	index = pgut_new(BackupIndex);
+	index->data = pgut_malloc(Max(header.data_size, 1));
+	index->index_time = (time_t) header.index_time;
+	index->nbackups = header.nbackups;
+	index->items = pgut_newarray(BackupIndexItem, Max(header.nbackups, 1));
+
+	if (fio_fread(fp, index->data, header.data_size) != (ssize_t) header.data_size)
+		goto bad_index;
+
+	INIT_FILE_CRC32(true, crc);
+	COMP_FILE_CRC32(true, crc, index->data, header.data_size);
+	FIN_FILE_CRC32(true, crc);
+	if (crc != header.crc)
+		goto bad_index;
+
+	ptr = index->data;
+	end = index->data + header.data_size;
+	for (i = 0; i < header.nbackups; i++)
+	{
+		BackupIndexEntry entry;
+
+		if ((size_t) (end - ptr) < sizeof(entry))
+			goto bad_index;
+		memcpy(&entry, ptr, sizeof(entry));
+
+		index->items[i].backup_id = entry.backup.start_time;
+		index->items[i].entry = ptr;
+
+		ptr += sizeof(entry);
+		if ((size_t) (end - ptr) < (size_t) entry.conninfo_len + entry.external_dirs_len)
+			goto bad_index;
+		ptr += entry.conninfo_len + entry.external_dirs_len;
+	}
+
+	fio_fclose(fp);
+
+	qsort(index->items, index->nbackups, sizeof(BackupIndexItem),
+		  BackupIndexItemCompare);
+
+	return index;
+
+bad_index:
+	elog(WARNING, "Backup catalog index \"%s\" is corrupted, rebuilding it", path);
+	fio_fclose(fp);
+	free_backup_index(index);
+	return NULL;
+}
+
+static void
+free_backup_index(BackupIndex *index)
+{
+	if (index == NULL)
+		return;
+
+	pfree(index->data);
+	pfree(index->items);
+	pfree(index);
+}
+
+/*
+ * Get the backup from the index if its control file wasn't modified since
+ * the index entry was made, otherwise return NULL.
+ */
+static pgBackup *
+backup_index_get(BackupIndex *index, time_t backup_id, struct stat *st)
+{
+	BackupIndexItem key;
+	BackupIndexItem *item;
+	BackupIndexEntry entry;
+	const char *ptr;
+	pgBackup   *backup;
+
+	key.backup_id = backup_id;
+	item = bsearch(&key, index->items, index->nbackups,
+				   sizeof(BackupIndexItem), BackupIndexItemCompare);
+	if (item == NULL)
+		return NULL;
+
+	memcpy(&entry, item->entry, sizeof(entry));
+	if (entry.control_mtime != (int64) st->st_mtime ||
+		entry.control_size != (int64) st->st_size ||
+		/* the file could be modified later in the same second */
+		entry.control_mtime >= (int64) index->index_time)
+		return NULL;
+
+	backup = pgut_new(pgBackup);
+	memcpy(backup, &entry.backup, sizeof(pgBackup));
+	backup->parent_backup_link = NULL;
+	backup->primary_conninfo = NULL;
+	backup->external_dir_str = NULL;
+
+	ptr = item->entry + sizeof(entry);
+	if (entry.conninfo_len > 0)
+	{
+		backup->primary_conninfo = pgut_malloc(entry.conninfo_len + 1);
+		memcpy(backup->primary_conninfo, ptr, entry.conninfo_len);
+		backup->primary_conninfo[entry.conninfo_len] = '\0';
+		ptr += entry.conninfo_len;
+	}
+	if (entry.external_dirs_len > 0)
+	{
+		backup->external_dir_str = pgut_malloc(entry.external_dirs_len + 1);
+		memcpy(backup->external_dir_str, ptr, entry.external_dirs_len);
+		backup->external_dir_str[entry.external_dirs_len] = '\0';
+	}
+
+	return backup;
+}
+
+/*
+ * Add the backup read from the control file with stat st to the index
+ * being built.
+ */
+static void
+backup_index_append(PQExpBuffer buf, pgBackup *backup, struct stat *st)
+{
+	BackupIndexEntry entry;
+
+	MemSet(&entry, 0, sizeof(entry));
+	entry.control_mtime = (int64) st->st_mtime;
+	entry.control_size = (int64) st->st_size;
+	if (backup->primary_conninfo)
+		entry.conninfo_len = strlen(backup->primary_conninfo);
+	if (backup->external_dir_str)
+		entry.external_dirs_len = strlen(backup->external_dir_str);
+	memcpy(&entry.backup, backup, sizeof(pgBackup));
+	entry.backup.parent_backup_link = NULL;
+	entry.backup.primary_conninfo = NULL;
+	entry.backup.external_dir_str = NULL;
+
+	appendBinaryPQExpBuffer(buf, (char *) &entry, sizeof(entry));
+	if (entry.conninfo_len > 0)
+		appendBinaryPQExpBuffer(buf, backup->primary_conninfo,
+								entry.conninfo_len);
+	if (entry.external_dirs_len > 0)
+		appendBinaryPQExpBuffer(buf, backup->external_dir_str,
+								entry.external_dirs_len);
+}
+
+/*
+ * Write BACKUP_CATALOG_INDEX atomically. The index is only a cache, so
+ * failure to write it is not an error, e.g. the catalog may be read-only.
+ */
+static void
+write_backup_index(const char *instance_name, PQExpBuffer buf,
+				   uint32 nbackups, time_t index_time)
+{
+	char		path[MAXPGPATH];
+	char		path_temp[MAXPGPATH];
+	BackupIndexHeader header;
+	FILE	   *out;
+
+	if (PQExpBufferBroken(buf))
+		return;
+
+	snprintf(path, MAXPGPATH, "%s/%s/.%s.%s", backup_path, BACKUPS_DIR,
+			 instance_name, BACKUP_CATALOG_INDEX);
+	snprintf(path_temp, sizeof(path_temp), "%s.tmp.%d", path, (int) getpid());
+
+	MemSet(&header, 0, sizeof(header));
+	header.magic = BACKUP_INDEX_MAGIC;
+	header.version = BACKUP_INDEX_VERSION;
+	header.backup_size = sizeof(pgBackup);
+	header.nbackups = nbackups;
+	header.index_time = (int64) index_time;
+	header.data_size = buf->len;
+
+	INIT_FILE_CRC32(true, header.crc);
+	COMP_FILE_CRC32(true, header.crc, buf->data, buf->len);
+	FIN_FILE_CRC32(true, header.crc);
+
+	out = fio_fopen(path_temp, PG_BINARY_W, FIO_BACKUP_HOST);
+	if (out == NULL)
+	{
+		elog(LOG, "Cannot open backup catalog index \"%s\": %s",
+			 path_temp, strerror(errno));
+		return;
+	}
+
+	if (fio_fwrite(out, &header, sizeof(header)) != sizeof(header) ||
+		fio_fwrite(out, buf->data, buf->len) != buf->len ||
+		fio_fflush(out) != 0)
+	{
+		elog(LOG, "Cannot write backup catalog index \"%s\": %s",
+			 path_temp, strerror(errno));
+		fio_fclose(out);
+		fio_unlink(path_temp, FIO_BACKUP_HOST);
+		return;
+	}
+
+	if (fio_fclose(out) != 0 ||
+		fio_rename(path_temp, path, FIO_BACKUP_HOST) < 0)
+	{
+		elog(LOG, "Cannot write backup catalog index \"%s\": %s",
+			 path, strerror(errno));
+		fio_unlink(path_temp, FIO_BACKUP_HOST);
+	}
+}
+
 /*
  * Create list of backup datafiles.
  * If 'requested_backup_id' is INVALID_BACKUP_ID, exit with error.
@@ -683,6 +1084,413 @@ pgBackupCreateDir(pgBackup *backup)
 	return 0;
 }
 
+static void
+wal_index_path(char *path, const char *instance_name)
+{
+	snprintf(path, MAXPGPATH, "%s/%s/.%s.%s", backup_path, "wal",
+			 instance_name, BACKUP_CATALOG_INDEX);
+}
+
+/*
+ * Read cached listing of the WAL archive. Return NULL if there is none
+ * or it cannot be used.
+ */
+static WalIndex *
+read_wal_index(const char *instance_name)
+{
+	char		path[MAXPGPATH];
+	WalIndex   *index;
+	FILE	   *fp;
+	size_t		data_size;
+	pg_crc32	crc;
+	uint32		i;
+
+	wal_index_path(path, instance_name);
+
+	fp = fio_fopen(path, PG_BINARY_R, FIO_BACKUP_HOST);
+	if (fp == NULL)
+		return NULL;
+
+	index = pgut_new(WalIndex);
+	index->data = NULL;
+
+	if (fio_fread(fp, &index->header, sizeof(WalIndexHeader)) != sizeof(WalIndexHeader) ||
+		index->header.magic != WAL_INDEX_MAGIC ||
+		index->header.version != WAL_INDEX_VERSION ||
+		index->header.names_size == 0)
+		goto bad_index;
+
+	data_size = (size_t) index->header.nfiles * sizeof(WalIndexRecord) +
+		index->header.names_size;
+	index->data = pgut_malloc(data_size);
+
+	if (fio_fread(fp, index->data, data_size) != (ssize_t) data_size)
+		goto bad_index;
+
+	INIT_FILE_CRC32(true, crc);
+	COMP_FILE_CRC32(true, crc, index->data, data_size);
+	FIN_FILE_CRC32(true, crc);
+	if (crc != index->header.crc)
+		goto bad_index;
+
+	index->records = (WalIndexRecord *) index->data;
+	index->names = index->data + (size_t) index->header.nfiles * sizeof(WalIndexRecord);
+
+	if (index->names[index->header.names_size - 1] != '\0')
+		goto bad_index;
+	for (i = 0; i < index->header.nfiles; i++)
+	{
+		if (index->records[i].name >= index->header.names_size)
+			goto bad_index;
+	}
+
+	fio_fclose(fp);
+	return index;
+
+bad_index:
+	elog(LOG, "WAL archive index \"%s\" is ignored", path);
+	fio_fclose(fp);
+	pfree(index->data);
+	pfree(index);
+	return NULL;
+}
+
+static void
+free_wal_index(WalIndex *index)
+{
+	if (index == NULL)
+		return;
+
+	pfree(index->data);
+	pfree(index);
+}
+
+static WalIndexRecord *
+wal_index_find(WalIndex *index, const char *name)
+{
+	uint32		low = 0;
+	uint32		high = index->header.nfiles;
+
+	while (low < high)
+	{
+		uint32		middle = low + (high - low) / 2;
+		int			res;
+
+		res = strcmp(index->names + index->records[middle].name, name);
+		if (res == 0)
+			return &index->records[middle];
+		else if (res < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return NULL;
+}
+
+/* Entry of the listing to be saved */
+typedef struct WalIndexEntry
+{
+	pgFile	   *file;
+	uint64		ino;
+} WalIndexEntry;
+
+static int
+WalIndexEntryCompare(const void *a, const void *b)
+{
+	const WalIndexEntry *e1 = (const WalIndexEntry *) a;
+	const WalIndexEntry *e2 = (const WalIndexEntry *) b;
+
+	return strcmp(e1->file->name, e2->file->name);
+}
+
+/*
+ * Save listing of the WAL archive. As well as the backup catalog index,
+ * it is only a cache, so errors are not reported.
+ */
+static void
+write_wal_index(const char *instance_name, WalIndexEntry *entries,
+				size_t nfiles, time_t dir_mtime, time_t index_time)
+{
+	char		path[MAXPGPATH];
+	char		path_temp[MAXPGPATH];
+	WalIndexHeader header;
+	WalIndexRecord *records;
+	char	   *names;
+	size_t		names_size = 1;		/* empty string at offset 0 */
+	size_t		offset = 1;
+	size_t		i;
+	FILE	   *out;
+
+	qsort(entries, nfiles, sizeof(WalIndexEntry), WalIndexEntryCompare);
+
+	for (i = 0; i < nfiles; i++)
+		names_size += strlen(entries[i].file->name) + 1;
+
+	records = pgut_newarray(WalIndexRecord, Max(nfiles, 1));
+	names = pgut_malloc(names_size);
+	names[0] = '\0';
+
+	for (i = 0; i < nfiles; i++)
+	{
+		pgFile	   *file = entries[i].file;
+		size_t		len = strlen(file->name) + 1;
+
+		records[i].ino = entries[i].ino;
+		records[i].size = (int64) file->size;
+		records[i].mode = (uint32) file->mode;
+		records[i].name = (uint32) offset;
+		memcpy(names + offset, file->name, len);
+		offset += len;
+	}
+
+	MemSet(&header, 0, sizeof(header));
+	header.magic = WAL_INDEX_MAGIC;
+	header.version = WAL_INDEX_VERSION;
+	header.nfiles = (uint32) nfiles;
+	header.names_size = (uint32) names_size;
+	header.dir_mtime = (int64) dir_mtime;
+	header.index_time = (int64) index_time;
+
+	INIT_FILE_CRC32(true, header.crc);
+	COMP_FILE_CRC32(true, header.crc, records, nfiles * sizeof(WalIndexRecord));
+	COMP_FILE_CRC32(true, header.crc, names, names_size);
+	FIN_FILE_CRC32(true, header.crc);
+
+	wal_index_path(path, instance_name);
+	snprintf(path_temp, sizeof(path_temp), "%s.tmp.%d", path, (int) getpid());
+
+	out = fio_fopen(path_temp, PG_BINARY_W, FIO_BACKUP_HOST);
+	if (out == NULL)
+	{
+		elog(LOG, "Cannot open WAL archive index \"%s\": %s",
+			 path_temp, strerror(errno));
+		goto cleanup;
+	}
+
+	if (fio_fwrite(out, &header, sizeof(header)) != sizeof(header) ||
+		fio_fwrite(out, records, nfiles * sizeof(WalIndexRecord)) !=
+			nfiles * sizeof(WalIndexRecord) ||
+		fio_fwrite(out, names, names_size) != names_size ||
+		fio_fflush(out) != 0)
+	{
+		elog(LOG, "Cannot write WAL archive index \"%s\": %s",
+			 path_temp, strerror(errno));
+		fio_fclose(out);
+		fio_unlink(path_temp, FIO_BACKUP_HOST);
+		goto cleanup;
+	}
+
+	if (fio_fclose(out) != 0 ||
+		fio_rename(path_temp, path, FIO_BACKUP_HOST) < 0)
+	{
+		elog(LOG, "Cannot write WAL archive index \"%s\": %s",
+			 path, strerror(errno));
+		fio_unlink(path_temp, FIO_BACKUP_HOST);
+	}
+
+cleanup:
+	pfree(records);
+	pfree(names);
+}
+
+static pgFile *
+wal_index_file(const char *arclog_path, const char *name, WalIndexRecord *rec)
+{
+	char		path[MAXPGPATH];
+	pgFile	   *file;
+
+	join_path_components(path, arclog_path, name);
+	file = pgFileInit(path, name);
+	file->size = (size_t) rec->size;
+	file->mode = (mode_t) rec->mode;
+
+	return file;
+}
+
+/*
+ * Files with these names are renamed into the archive when they are
+ * complete and never modified in place, so their cached size can be
+ * trusted. Other files, like ".part" files being written by archive-push,
+ * may grow without changing the directory and are always stat'ed.
+ */
+static bool
+wal_index_name_is_final(const char *name)
+{
+	char		base[MAXFNAMELEN];
+	size_t		len = strlen(name);
+
+	if (len >= MAXFNAMELEN)
+		return false;
+
+	strcpy(base, name);
+	if (len > 3 && strcmp(base + len - 3, ".gz") == 0)
+		base[len - 3] = '\0';
+
+	return IsXLogFileName(base) || IsPartialXLogFileName(base) ||
+		IsBackupHistoryFileName(base) || IsTLHistoryFileName(base) ||
+		(strspn(base, "0123456789ABCDEF") == XLOG_FNAME_LEN &&
+		 strcmp(base + XLOG_FNAME_LEN, "." WAL_SUMMARY_SUFFIX) == 0);
+}
+
+/*
+ * List files of the WAL archive, the same way dir_list_file() does, using
+ * the listing cached by the previous call if possible. Cached sizes are used
+ * only for files with final names, see wal_index_name_is_final().
+ */
+static void
+catalog_list_wal_files(parray *files, const char *arclog_path,
+					   const char *instance_name)
+{
+	WalIndex   *index;
+	struct stat	dir_st;
+	time_t		index_time;
+	DIR		   *dir;
+	struct dirent *dent;
+	bool		has_subdirs = false;
+	WalIndexEntry *entries;
+	size_t		nentries = 0;
+	size_t		entries_size;
+	size_t		i;
+
+	/*
+	 * Directory modified in the same second the listing was made could
+	 * be modified once more after that, so such listing is not trusted.
+	 */
+	index_time = time(NULL);
+	if (fio_stat(arclog_path, &dir_st, true, FIO_BACKUP_HOST) < 0 ||
+		!S_ISDIR(dir_st.st_mode))
+	{
+		/* let dir_list_file() complain */
+		dir_list_file(files, arclog_path, false, false, false, 0, FIO_BACKUP_HOST);
+		return;
+	}
+
+	index = read_wal_index(instance_name);
+
+	/* Nothing changed since the last time */
+	if (index &&
+		index->header.dir_mtime == (int64) dir_st.st_mtime &&
+		index->header.dir_mtime < index->header.index_time)
+	{
+		elog(VERBOSE, "Use cached listing of WAL archive \"%s\"", arclog_path);
+
+		for (i = 0; i < index->header.nfiles; i++)
+		{
+			WalIndexRecord *rec = &index->records[i];
+			const char *name = index->names + rec->name;
+			pgFile	   *file;
+
+			if (wal_index_name_is_final(name))
+				file = wal_index_file(arclog_path, name, rec);
+			else
+			{
+				char		child[MAXPGPATH];
+
+				/* the file may be changed or already gone */
+				join_path_components(child, arclog_path, name);
+				file = pgFileNew(child, name, false, 0, FIO_BACKUP_HOST);
+				if (file == NULL)
+					continue;
+			}
+			parray_append(files, file);
+		}
+		free_wal_index(index);
+		return;
+	}
+
+	dir = fio_opendir(arclog_path, FIO_BACKUP_HOST);
+	if (dir == NULL)
+		elog(ERROR, "Cannot open directory \"%s\": %s",
+			 arclog_path, strerror(errno));
+
+	entries_size = index ? index->header.nfiles + 64 : 1024;
+	entries = pgut_newarray(WalIndexEntry, entries_size);
+
+	for (errno = 0; (dent = fio_readdir(dir)) != NULL; errno = 0)
+	{
+		WalIndexRecord *rec = NULL;
+		pgFile	   *file = NULL;
+		char		child[MAXPGPATH];
+		uint64		ino = 0;
+
+		if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+			continue;
+
+		/*
+		 * Files are renamed into the archive, so the file with the same
+		 * name and inode is the same file we have seen before.
+		 */
+#ifndef WIN32
+		if (index && dent->d_ino != 0 && wal_index_name_is_final(dent->d_name))
+		{
+			rec = wal_index_find(index, dent->d_name);
+			if (rec && rec->ino != (uint64) dent->d_ino)
+				rec = NULL;
+		}
+#endif
+
+#ifndef WIN32
+		ino = (uint64) dent->d_ino;
+#endif
+
+		if (rec)
+			file = wal_index_file(arclog_path, dent->d_name, rec);
+		else
+		{
+			join_path_components(child, arclog_path, dent->d_name);
+			file = pgFileNew(child, dent->d_name, false, 0, FIO_BACKUP_HOST);
+			if (file == NULL)
+				continue;
+
+			if (S_ISDIR(file->mode))
+				has_subdirs = true;
+			else if (!S_ISREG(file->mode))
+			{
+				elog(WARNING, "Skip \"%s\": unexpected file format", file->path);
+				pgFileFree(file);
+				continue;
+			}
+		}
+
+		if (nentries == entries_size)
+		{
+			entries_size *= 2;
+			entries = pgut_realloc(entries, sizeof(WalIndexEntry) * entries_size);
+		}
+		entries[nentries].file = file;
+		entries[nentries].ino = ino;
+		nentries++;
+	}
+
+	if (errno)
+		elog(ERROR, "Cannot read directory \"%s\": %s",
+			 arclog_path, strerror(errno));
+
+	fio_closedir(dir);
+	free_wal_index(index);
+
+	/*
+	 * There are no subdirectories in the archive normally, list them
+	 * recursively as dir_list_file() does and don't cache such listing.
+	 */
+	if (has_subdirs)
+	{
+		for (i = 0; i < nentries; i++)
+			pgFileFree(entries[i].file);
+		pfree(entries);
+		dir_list_file(files, arclog_path, false, false, false, 0, FIO_BACKUP_HOST);
+		return;
+	}
+
+	for (i = 0; i < nentries; i++)
+		parray_append(files, entries[i].file);
+
+	write_wal_index(instance_name, entries, nentries, dir_st.st_mtime,
+					index_time);
+	pfree(entries);
+}
+
 /*
  * Create list of timelines
  */
@@ -702,7 +1510,7 @@ catalog_get_timelines(InstanceConfig *instance)
 
 	/* read all xlog files that belong to this archive */
 	sprintf(arclog_path, "%s/%s/%s", backup_path, "wal", instance->name);
-	dir_list_file(xlog_files_list, arclog_path, false, false, false, 0, FIO_BACKUP_HOST);
+	catalog_list_wal_files(xlog_files_list, arclog_path, instance->name);
 	parray_qsort(xlog_files_list, pgFileComparePath);
 
 	timelineinfos = parray_new();
@@ -783,6 +1591,26 @@ catalog_get_timelines(InstanceConfig *instance)
 					parray_append(tlinfo->xlog_filelist, wal_file);
 					continue;
 				}
+				/* summary of changed blocks, written by archive-push */
+				else if (strcmp(suffix, WAL_SUMMARY_SUFFIX) == 0)
+				{
+					elog(VERBOSE, "WAL summary file \"%s\"", file->name);
+
+					if (!tlinfo || tlinfo->tli != tli)
+					{
+						tlinfo = timelineInfoNew(tli);
+						parray_append(timelineinfos, tlinfo);
+					}
+
+					/* append file to xlog file list */
+					wal_file = palloc(sizeof(xlogFile));
+					wal_file->file = *file;
+					wal_file->segno = segno;
+					wal_file->type = WAL_SUMMARY_FILE;
+					wal_file->keep = false;
+					parray_append(tlinfo->xlog_filelist, wal_file);
+					continue;
+				}
 				/* we only expect compressed wal files with .gz suffix */
 				else if (strcmp(suffix, "gz") != 0)
 				{
@@ -1471,6 +2299,9 @@ pgBackupWriteControl(FILE *out, pgBackup *backup)
 		time2iso(timestamp, lengthof(timestamp), backup->merge_time);
 		fio_fprintf(out, "merge-time = '%s'\n", timestamp);
 	}
+	/* 'merge_dest_backup' is set only while FULL backup is being merged */
+	if (backup->merge_dest_backup != 0)
+		fio_fprintf(out, "merge-dest-id = '%s'\n", base36enc(backup->merge_dest_backup));
 	if (backup->end_time > 0)
 	{
 		time2iso(timestamp, lengthof(timestamp), backup->end_time);
@@ -1557,6 +2388,77 @@ write_backup(pgBackup *backup)
 	}
 }
 
+/*
+ * Print the line describing the file in text format of the file list into
+ * line, which must be at least BLCKSZ long. Returns length of the line.
+ */
+static int
+print_file_list_line(char *line, pgFile *file, const char *path)
+{
+	int			len;
+
+	len = sprintf(line, "{\"path\":\"%s\", \"size\":\"" INT64_FORMAT "\", "
+				 "\"mode\":\"%u\", \"is_datafile\":\"%u\", "
+				 "\"is_cfs\":\"%u\", \"crc\":\"%u\", "
+				 "\"compress_alg\":\"%s\", \"external_dir_num\":\"%d\", "
+				 "\"dbOid\":\"%u\"",
+				path, file->write_size, file->mode,
+				file->is_datafile ? 1 : 0,
+				file->is_cfs ? 1 : 0,
+				file->crc,
+				deparse_compress_alg(file->compress_alg),
+				file->external_dir_num,
+				file->dbOid);
+
+	if (file->is_datafile)
+		len += sprintf(line+len, ",\"segno\":\"%d\"", file->segno);
+
+	if (file->linked)
+		len += sprintf(line+len, ",\"linked\":\"%s\"", file->linked);
+
+	if (file->n_blocks != BLOCKNUM_INVALID)
+		len += sprintf(line+len, ",\"n_blocks\":\"%i\"", file->n_blocks);
+
+	if (file->frame_size > 0)
+		len += sprintf(line+len, ",\"frame_size\":\"%i\"", file->frame_size);
+
+	if (file->dict_crc != 0)
+		len += sprintf(line+len, ",\"dict_crc\":\"%u\"", file->dict_crc);
+
+	len += sprintf(line+len, "}\n");
+
+	return len;
+}
+
+/*
+ * Print the file list of the backup in text format, whatever format it is
+ * stored in. Paths are printed as they are stored in the list.
+ */
+void
+print_backup_filelist(FILE *out, pgBackup *backup)
+{
+	char		path[MAXPGPATH];
+	parray	   *files;
+	size_t		i;
+
+	pgBackupGetPath(backup, path, lengthof(path), DATABASE_FILE_LIST);
+	files = dir_read_file_list(NULL, NULL, path, FIO_BACKUP_HOST);
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+		char		line[BLCKSZ];
+		int			len;
+
+		len = print_file_list_line(line, file, file->rel_path);
+		if (fwrite(line, 1, len, out) != (size_t) len)
+			elog(ERROR, "Cannot print file list: %s", strerror(errno));
+	}
+
+	parray_walk(files, pgFileFree);
+	parray_free(files);
+}
+
 /*
  * Output the list of files to backup catalog DATABASE_FILE_LIST
  */
@@ -1570,11 +2472,13 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 	int			errno_temp;
 	size_t		i = 0;
 	#define BUFFERSZ 1024*1024
-	char		*buf;
+	char		*buf = NULL;
 	size_t		write_len = 0;
 	int64 		backup_size_on_disk = 0;
 	int64 		uncompressed_size_on_disk = 0;
 	int64 		wal_size_on_disk = 0;
+	FileListEntry *entries = NULL;
+	size_t		nentries = 0;
 
 	pgBackupGetPath(backup, path, lengthof(path), DATABASE_FILE_LIST);
 	snprintf(path_temp, sizeof(path_temp), "%s.tmp", path);
@@ -1584,7 +2488,10 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 		elog(ERROR, "Cannot open file list \"%s\": %s", path_temp,
 			 strerror(errno));
 
-	buf = pgut_malloc(BUFFERSZ);
+	if (binary_file_list)
+		entries = pgut_newarray(FileListEntry, Max(parray_num(files), 1));
+	else
+		buf = pgut_malloc(BUFFERSZ);
 
 	/* print each file in the list */
 	while(i < parray_num(files))
@@ -1626,29 +2533,16 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 			(file->external_dir_num && external_list))
 				path = file->rel_path;
 
-		len = sprintf(line, "{\"path\":\"%s\", \"size\":\"" INT64_FORMAT "\", "
-					 "\"mode\":\"%u\", \"is_datafile\":\"%u\", "
-					 "\"is_cfs\":\"%u\", \"crc\":\"%u\", "
-					 "\"compress_alg\":\"%s\", \"external_dir_num\":\"%d\", "
-					 "\"dbOid\":\"%u\"",
-					path, file->write_size, file->mode,
-					file->is_datafile ? 1 : 0,
-					file->is_cfs ? 1 : 0,
-					file->crc,
-					deparse_compress_alg(file->compress_alg),
-					file->external_dir_num,
-					file->dbOid);
-
-		if (file->is_datafile)
-			len += sprintf(line+len, ",\"segno\":\"%d\"", file->segno);
-
-		if (file->linked)
-			len += sprintf(line+len, ",\"linked\":\"%s\"", file->linked);
-
-		if (file->n_blocks != BLOCKNUM_INVALID)
-			len += sprintf(line+len, ",\"n_blocks\":\"%i\"", file->n_blocks);
+		/* binary list is written at once after sorting */
+		if (binary_file_list)
+		{
+			entries[nentries].file = file;
+			entries[nentries].path = path;
+			nentries++;
+			continue;
+		}
 
-		len += sprintf(line+len, "}\n");
+		len = print_file_list_line(line, file, path);
 
 		if (write_len + len >= BUFFERSZ)
 		{
@@ -1668,8 +2562,13 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 		write_len += len;
 	}
 
+	if (binary_file_list)
+	{
+		write_binary_filelist(out, path_temp, entries, nentries);
+		pfree(entries);
+	}
 	/* write what is left in the buffer to file */
-	if (write_len > 0)
+	else if (write_len > 0)
 		if (fio_fwrite(out, buf, write_len) != write_len)
 		{
 			errno_temp = errno;
@@ -1699,7 +2598,117 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 	backup->wal_bytes = wal_size_on_disk;
 	backup->uncompressed_bytes = uncompressed_size_on_disk;
 
-	free(buf);
+	if (buf)
+		free(buf);
+}
+
+static int
+FileListEntryCompare(const void *a, const void *b)
+{
+	const FileListEntry *e1 = (const FileListEntry *) a;
+	const FileListEntry *e2 = (const FileListEntry *) b;
+	int			res;
+
+	res = strcmp(e1->path, e2->path);
+	if (res == 0)
+	{
+		if (e1->file->external_dir_num > e2->file->external_dir_num)
+			return 1;
+		else if (e1->file->external_dir_num < e2->file->external_dir_num)
+			return -1;
+	}
+	return res;
+}
+
+/*
+ * Write file list in binary format described near FileListHeader.
+ * Records are sorted the same way as pgFileCompareRelPathWithExternal()
+ * sorts files, so the reader may use binary search over them.
+ */
+static void
+write_binary_filelist(FILE *out, const char *path_temp,
+					  FileListEntry *entries, size_t nentries)
+{
+	FileListHeader header;
+	FileListRecord *records;
+	char	   *strings;
+	size_t		strings_size = 1;	/* empty string at offset 0 */
+	size_t		offset = 1;
+	size_t		i;
+
+	qsort(entries, nentries, sizeof(FileListEntry), FileListEntryCompare);
+
+	for (i = 0; i < nentries; i++)
+	{
+		strings_size += strlen(entries[i].path) + 1;
+		if (entries[i].file->linked)
+			strings_size += strlen(entries[i].file->linked) + 1;
+	}
+
+	records = pgut_newarray(FileListRecord, Max(nentries, 1));
+	strings = pgut_malloc(strings_size);
+	strings[0] = '\0';
+
+	for (i = 0; i < nentries; i++)
+	{
+		pgFile	   *file = entries[i].file;
+		FileListRecord *rec = &records[i];
+		size_t		len;
+
+		MemSet(rec, 0, sizeof(FileListRecord));
+		rec->write_size = file->write_size;
+		rec->mode = (uint32) file->mode;
+		rec->crc = file->crc;
+		rec->dict_crc = file->dict_crc;
+		rec->dbOid = file->dbOid;
+		rec->segno = file->segno;
+		rec->n_blocks = file->n_blocks;
+		rec->frame_size = file->frame_size;
+		rec->external_dir_num = file->external_dir_num;
+		rec->is_datafile = file->is_datafile ? 1 : 0;
+		rec->is_cfs = file->is_cfs ? 1 : 0;
+		rec->compress_alg = (uint8) file->compress_alg;
+
+		len = strlen(entries[i].path) + 1;
+		memcpy(strings + offset, entries[i].path, len);
+		rec->path = (uint32) offset;
+		offset += len;
+
+		if (file->linked)
+		{
+			len = strlen(file->linked) + 1;
+			memcpy(strings + offset, file->linked, len);
+			rec->linked = (uint32) offset;
+			offset += len;
+		}
+	}
+
+	MemSet(&header, 0, sizeof(header));
+	header.magic = FILE_LIST_MAGIC;
+	header.version = FILE_LIST_VERSION;
+	header.nfiles = (uint32) nentries;
+	header.record_size = sizeof(FileListRecord);
+	header.strings_size = (uint32) strings_size;
+
+	INIT_FILE_CRC32(true, header.crc);
+	COMP_FILE_CRC32(true, header.crc, records, sizeof(FileListRecord) * nentries);
+	COMP_FILE_CRC32(true, header.crc, strings, strings_size);
+	FIN_FILE_CRC32(true, header.crc);
+
+	if (fio_fwrite(out, &header, sizeof(header)) != sizeof(header) ||
+		fio_fwrite(out, records, sizeof(FileListRecord) * nentries) !=
+			sizeof(FileListRecord) * nentries ||
+		fio_fwrite(out, strings, strings_size) != strings_size)
+	{
+		int			errno_temp = errno;
+
+		fio_unlink(path_temp, FIO_BACKUP_HOST);
+		elog(ERROR, "Cannot write file list \"%s\": %s",
+			 path_temp, strerror(errno_temp));
+	}
+
+	pfree(records);
+	pfree(strings);
 }
 
 /*
@@ -1716,6 +2725,7 @@ readBackupControlFile(const char *path)
 	char	   *stop_lsn = NULL;
 	char	   *status = NULL;
 	char	   *parent_backup = NULL;
+	char	   *merge_dest_backup = NULL;
 	char	   *program_version = NULL;
 	char	   *server_version = NULL;
 	char	   *compress_alg = NULL;
@@ -1745,6 +2755,7 @@ readBackupControlFile(const char *path)
 		{'b', 0, "stream",				&backup->stream, SOURCE_FILE_STRICT},
 		{'s', 0, "status",				&status, SOURCE_FILE_STRICT},
 		{'s', 0, "parent-backup-id",	&parent_backup, SOURCE_FILE_STRICT},
+		{'s', 0, "merge-dest-id",		&merge_dest_backup, SOURCE_FILE_STRICT},
 		{'s', 0, "compress-alg",		&compress_alg, SOURCE_FILE_STRICT},
 		{'u', 0, "compress-level",		&backup->compress_level, SOURCE_FILE_STRICT},
 		{'b', 0, "from-replica",		&backup->from_replica, SOURCE_FILE_STRICT},
@@ -1838,6 +2849,12 @@ readBackupControlFile(const char *path)
 		free(parent_backup);
 	}
 
+	if (merge_dest_backup)
+	{
+		backup->merge_dest_backup = base36dec(merge_dest_backup);
+		free(merge_dest_backup);
+	}
+
 	if (program_version)
 	{
 		StrNCpy(backup->program_version, program_version,
@@ -1920,6 +2937,10 @@ parse_compress_alg(const char *arg)
 		return ZLIB_COMPRESS;
 	else if (pg_strncasecmp("pglz", arg, len) == 0)
 		return PGLZ_COMPRESS;
+	else if (pg_strncasecmp("zstd", arg, len) == 0)
+		return ZSTD_COMPRESS;
+	else if (pg_strncasecmp("lz4", arg, len) == 0)
+		return LZ4_COMPRESS;
 	else if (pg_strncasecmp("none", arg, len) == 0)
 		return NONE_COMPRESS;
 	else
@@ -1940,6 +2961,10 @@ deparse_compress_alg(int alg)
 			return "zlib";
 		case PGLZ_COMPRESS:
 			return "pglz";
+		case ZSTD_COMPRESS:
+			return "zstd";
+		case LZ4_COMPRESS:
+			return "lz4";
 	}
 
 	return NULL;
@@ -1980,6 +3005,7 @@ pgBackupInit(pgBackup *backup)
 	backup->stop_lsn = 0;
 	backup->start_time = (time_t) 0;
 	backup->merge_time = (time_t) 0;
+	backup->merge_dest_backup = INVALID_BACKUP_ID;
 	backup->end_time = (time_t) 0;
 	backup->recovery_xid = 0;
 	backup->recovery_time = (time_t) 0;
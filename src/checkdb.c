@@ -26,8 +26,8 @@
 
 typedef struct
 {
-	/* list of files to validate */
-	parray	   *files_list;
+	/* queue of files to validate */
+	FileScheduler *sched;
 	/* if page checksums are enabled in this postgres instance? */
 	uint32 checksum_version;
 	/*
@@ -127,22 +127,16 @@ static void do_amcheck(ConnectionOptions conn_opt, PGconn *conn);
 static void *
 check_files(void *arg)
 {
-	int			i;
 	check_files_arg *arguments = (check_files_arg *) arg;
-	int			n_files_list = 0;
-
-	if (arguments->files_list)
-		n_files_list = parray_num(arguments->files_list);
+	FileTaskCursor cursor = FILE_TASK_CURSOR_INIT;
+	FileTask   *task;
 
-	/* check a file */
-	for (i = 0; i < n_files_list; i++)
+	/* check a file or a range of its blocks */
+	while ((task = file_scheduler_next(arguments->sched, &cursor)) != NULL)
 	{
 		int			ret;
 		struct stat	buf;
-		pgFile	   *file = (pgFile *) parray_get(arguments->files_list, i);
-
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
+		pgFile	   *file = task->file;
 
 		elog(VERBOSE, "Checking file:  \"%s\" ", file->path);
 
@@ -152,7 +146,8 @@ check_files(void *arg)
 
 		if (progress)
 			elog(INFO, "Progress: (%d/%d). Process file \"%s\"",
-				 i + 1, n_files_list, file->path);
+				 (int) (task - arguments->sched->tasks) + 1,
+				 arguments->sched->ntasks, file->path);
 
 		/* stat file to check its current state */
 		ret = stat(file->path, &buf);
@@ -190,7 +185,8 @@ check_files(void *arg)
 				 * Need refactoring.
 				 */
 				if (!check_data_file(&(arguments->conn_arg), file,
-									 arguments->checksum_version))
+									 arguments->checksum_version,
+									 task->start_block, task->end_block))
 					arguments->ret = 2; /* corruption found */
 			}
 		}
@@ -219,6 +215,7 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 	check_files_arg *threads_args;
 	bool		check_isok = true;
 	parray *files_list = NULL;
+	FileScheduler *sched;
 
 	/* initialize file list */
 	files_list = parray_new();
@@ -238,15 +235,8 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 	/* Extract information about files in pgdata parsing their names:*/
 	parse_filelist_filenames(files_list, pgdata);
 
-	/* setup threads */
-	for (i = 0; i < parray_num(files_list); i++)
-	{
-		pgFile	   *file = (pgFile *) parray_get(files_list, i);
-		pg_atomic_init_flag(&file->lock);
-	}
-
-	/* Sort by size for load balancing */
-	parray_qsort(files_list, pgFileCompareSize);
+	/* Large datafiles are checked by several threads */
+	sched = file_scheduler_new(files_list, true);
 
 	/* init thread args with own file lists */
 	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
@@ -256,7 +246,7 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 	{
 		check_files_arg *arg = &(threads_args[i]);
 
-		arg->files_list = files_list;
+		arg->sched = sched;
 		arg->checksum_version = checksum_version;
 
 		arg->conn_arg.conn = NULL;
@@ -288,6 +278,7 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 	}
 
 	/* cleanup */
+	file_scheduler_free(sched);
 	if (files_list)
 	{
 		parray_walk(files_list, pgFileFree);
@@ -241,6 +241,11 @@ ConfigOption instance_options[] =
 		&instance_config.remote.ssh_config, SOURCE_CMD, 0,
 		OPTION_REMOTE_GROUP, 0, option_get_value
 	},
+	{
+		'u', 231, "remote-connections",
+		&instance_config.remote.connections, SOURCE_CMD, 0,
+		OPTION_REMOTE_GROUP, 0, option_get_value
+	},
 	{ 0 }
 };
 
@@ -588,6 +593,11 @@ readInstanceConfigFile(const char *instance_name)
 			&instance->remote.ssh_config, SOURCE_CMD, 0,
 			OPTION_REMOTE_GROUP, 0, option_get_value
 		},
+		{
+			'u', 231, "remote-connections",
+			&instance->remote.connections, SOURCE_CMD, 0,
+			OPTION_REMOTE_GROUP, 0, option_get_value
+		},
 		{ 0 }
 	};
 
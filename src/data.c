@@ -15,6 +15,7 @@
 #include <common/pg_lzcompress.h>
 #include "utils/file.h"
 
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -22,6 +23,27 @@
 #include <zlib.h>
 #endif
 
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#include <zdict.h>
+
+/* Number of pages sampled to train compression dictionary */
+#define PAGE_DICT_SAMPLE_PAGES	2048
+/* Maximum size of compression dictionary */
+#define PAGE_DICT_MAX_SIZE		(112 * 1024)
+#endif
+
+#ifdef HAVE_LIBLZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define USE_SSE2_PAGE_SCAN
+#define USE_AVX2_PAGE_SCAN
+#endif
+
 #include "utils/thread.h"
 
 /* Union to ease operations on relation pages */
@@ -31,6 +53,20 @@ typedef union DataPage
 	char		data[BLCKSZ];
 } DataPage;
 
+/*
+ * Buffer for reading data file by large chunks instead of
+ * a single pread() per block.
+ */
+typedef struct PageReadBuffer
+{
+	char	   *data;
+	BlockNumber	size;		/* capacity of the buffer in blocks */
+	BlockNumber	first;		/* number of the first block in the buffer */
+	BlockNumber	nblocks;	/* number of blocks read into the buffer */
+	PageClass  *classes;	/* classes of pages in the buffer */
+	XLogRecPtr	horizon_lsn;	/* pages with lower LSN are unchanged */
+} PageReadBuffer;
+
 #ifdef HAVE_LIBZ
 /* Implementation of zlib compression method */
 static int32
@@ -55,6 +91,162 @@ zlib_decompress(void *dst, size_t dst_size, void const *src, size_t src_size)
 }
 #endif
 
+#ifdef HAVE_LIBZSTD
+/*
+ * Compression contexts are expensive to create, so each thread keeps
+ * its own ones for all pages it processes.
+ */
+static pg_thread_local ZSTD_CCtx *zstd_cctx = NULL;
+static pg_thread_local ZSTD_DCtx *zstd_dctx = NULL;
+
+/* Dictionary used to compress pages of the current backup, if any */
+static ZSTD_CDict *page_cdict = NULL;
+static pg_crc32 page_cdict_crc = 0;
+
+/*
+ * Dictionaries of backups being read. Each compressed page refers to its
+ * dictionary by ID, so pages of different backups in the chain can be
+ * decompressed without knowing which backup they came from. IDs of trained
+ * dictionaries are random, so files also record CRC of their dictionary,
+ * see check_page_dictionary().
+ */
+typedef struct PageDictionary
+{
+	unsigned	id;
+	pg_crc32	crc;
+	ZSTD_DDict *ddict;
+} PageDictionary;
+
+static parray *page_ddicts = NULL;
+
+static ZSTD_DDict *
+find_page_ddict(unsigned id)
+{
+	int			i;
+
+	for (i = 0; page_ddicts && i < parray_num(page_ddicts); i++)
+	{
+		PageDictionary *dict = (PageDictionary *) parray_get(page_ddicts, i);
+
+		if (dict->id == id)
+			return dict->ddict;
+	}
+	return NULL;
+}
+
+/* Implementation of zstd compression method */
+static int32
+zstd_compress(void *dst, size_t dst_size, void const *src, size_t src_size,
+			  int level, const char **errormsg)
+{
+	size_t		rc;
+
+	if (zstd_cctx == NULL && (zstd_cctx = ZSTD_createCCtx()) == NULL)
+	{
+		if (errormsg)
+			*errormsg = "Cannot create zstd compression context";
+		return -1;
+	}
+
+	if (page_cdict)
+		rc = ZSTD_compress_usingCDict(zstd_cctx, dst, dst_size, src, src_size,
+									  page_cdict);
+	else
+		rc = ZSTD_compressCCtx(zstd_cctx, dst, dst_size, src, src_size, level);
+
+	if (ZSTD_isError(rc))
+	{
+		if (errormsg)
+			*errormsg = ZSTD_getErrorName(rc);
+		return -1;
+	}
+	return rc;
+}
+
+/* Implementation of zstd decompression method */
+static int32
+zstd_decompress(void *dst, size_t dst_size, void const *src, size_t src_size,
+				const char **errormsg)
+{
+	size_t		rc;
+	unsigned	dict_id;
+
+	if (zstd_dctx == NULL && (zstd_dctx = ZSTD_createDCtx()) == NULL)
+	{
+		if (errormsg)
+			*errormsg = "Cannot create zstd decompression context";
+		return -1;
+	}
+
+	dict_id = ZSTD_getDictID_fromFrame(src, src_size);
+	if (dict_id != 0)
+	{
+		ZSTD_DDict *ddict = find_page_ddict(dict_id);
+
+		if (ddict == NULL)
+		{
+			if (errormsg)
+				*errormsg = "Compression dictionary of the page is not found";
+			return -1;
+		}
+		rc = ZSTD_decompress_usingDDict(zstd_dctx, dst, dst_size, src, src_size,
+										ddict);
+	}
+	else
+		rc = ZSTD_decompressDCtx(zstd_dctx, dst, dst_size, src, src_size);
+
+	if (ZSTD_isError(rc))
+	{
+		if (errormsg)
+			*errormsg = ZSTD_getErrorName(rc);
+		return -1;
+	}
+	return rc;
+}
+#endif
+
+#ifdef HAVE_LIBLZ4
+/*
+ * Implementation of lz4 compression method.
+ * Level 1 and less means fast lz4, higher levels use lz4hc.
+ */
+static int32
+lz4_compress(void *dst, size_t dst_size, void const *src, size_t src_size,
+			 int level, const char **errormsg)
+{
+	int			rc;
+
+	if (level <= 1)
+		rc = LZ4_compress_default(src, dst, src_size, dst_size);
+	else
+		rc = LZ4_compress_HC(src, dst, src_size, dst_size, level);
+
+	if (rc <= 0)
+	{
+		if (errormsg)
+			*errormsg = "lz4 compression failed";
+		return -1;
+	}
+	return rc;
+}
+
+/* Implementation of lz4 decompression method */
+static int32
+lz4_decompress(void *dst, size_t dst_size, void const *src, size_t src_size,
+			   const char **errormsg)
+{
+	int			rc = LZ4_decompress_safe(src, dst, src_size, dst_size);
+
+	if (rc < 0)
+	{
+		if (errormsg)
+			*errormsg = "lz4 decompression failed, data is corrupted";
+		return -1;
+	}
+	return rc;
+}
+#endif
+
 /*
  * Compresses source into dest using algorithm. Returns the number of bytes
  * written in the destination buffer, or -1 if compression fails.
@@ -77,9 +269,21 @@ do_compress(void* dst, size_t dst_size, void const* src, size_t src_size,
 					*errormsg = zError(ret);
 				return ret;
 			}
+#endif
+#ifdef HAVE_LIBZSTD
+		case ZSTD_COMPRESS:
+			return zstd_compress(dst, dst_size, src, src_size, level, errormsg);
+#endif
+#ifdef HAVE_LIBLZ4
+		case LZ4_COMPRESS:
+			return lz4_compress(dst, dst_size, src, src_size, level, errormsg);
 #endif
 		case PGLZ_COMPRESS:
 			return pglz_compress(src, src_size, dst, PGLZ_strategy_always);
+		default:
+			if (errormsg)
+				*errormsg = "This build does not support the compression algorithm";
+			return -1;
 	}
 
 	return -1;
@@ -109,6 +313,14 @@ do_decompress(void* dst, size_t dst_size, void const* src, size_t src_size,
 					*errormsg = zError(ret);
 				return ret;
 			}
+#endif
+#ifdef HAVE_LIBZSTD
+		case ZSTD_COMPRESS:
+			return zstd_decompress(dst, dst_size, src, src_size, errormsg);
+#endif
+#ifdef HAVE_LIBLZ4
+		case LZ4_COMPRESS:
+			return lz4_decompress(dst, dst_size, src, src_size, errormsg);
 #endif
 		case PGLZ_COMPRESS:
 
@@ -117,11 +329,432 @@ do_decompress(void* dst, size_t dst_size, void const* src, size_t src_size,
 #else
 			return pglz_decompress(src, src_size, dst, dst_size);
 #endif
+		default:
+			if (errormsg)
+				*errormsg = "This build does not support the compression algorithm";
+			return -1;
 	}
 
 	return -1;
 }
 
+/*
+ * Check whether compressed page or frame refers to the compression dictionary
+ * of its backup, see train_page_dictionary().
+ */
+static bool
+compressed_with_dictionary(const char *data, size_t size, CompressAlg alg)
+{
+#ifdef HAVE_LIBZSTD
+	if (alg == ZSTD_COMPRESS)
+		return ZSTD_getDictID_fromFrame(data, size) != 0;
+#endif
+	return false;
+}
+
+
+/*
+ * Compress nblocks consecutive pages starting from the block into one frame.
+ * BackupPageHeader, BackupFrameHeader and the frame are written into dst,
+ * which must have room for BACKUP_FRAME_BUFFER_SIZE(nblocks) bytes.
+ * Returns number of bytes written. If pages cannot be compressed, they are
+ * stored as is.
+ */
+size_t
+compress_frame(char *dst, const char *pages, BlockNumber block,
+			   uint32 nblocks, CompressAlg calg, int clevel)
+{
+	BackupPageHeader *header = (BackupPageHeader *) dst;
+	BackupFrameHeader *frame_header;
+	char	   *data;
+	size_t		size = (size_t) nblocks * BLCKSZ;
+	const char *errormsg = NULL;
+	int32		compressed_size;
+
+	frame_header = (BackupFrameHeader *) (dst + sizeof(BackupPageHeader));
+	data = dst + sizeof(BackupPageHeader) + sizeof(BackupFrameHeader);
+
+	header->block = block;
+	header->compressed_size = PageIsFrame;
+	frame_header->nblocks = nblocks;
+
+	compressed_size = do_compress(data, 2 * size, pages, size, calg, clevel,
+								  &errormsg);
+	if (compressed_size < 0 && errormsg != NULL)
+		elog(WARNING, "An error occured during compressing blocks %u-%u: %s",
+			 block, block + nblocks - 1, errormsg);
+
+	/* Non-positive value means that compression failed. Store pages as is. */
+	if (compressed_size <= 0 || compressed_size >= size)
+	{
+		memcpy(data, pages, size);
+		compressed_size = size;
+	}
+	frame_header->compressed_size = compressed_size;
+
+	return sizeof(BackupPageHeader) + sizeof(BackupFrameHeader) +
+		MAXALIGN(compressed_size);
+}
+
+void
+frame_index_init(BackupFrameIndex *index)
+{
+	index->frames = NULL;
+	index->nframes = 0;
+	index->max_frames = 0;
+	index->truncated_block = InvalidBlockNumber;
+}
+
+void
+frame_index_add(BackupFrameIndex *index, BlockNumber block, uint32 nblocks,
+				int64 offset)
+{
+	BackupFrameIndexEntry *entry;
+
+	if (index->nframes == index->max_frames)
+	{
+		index->max_frames = Max(index->max_frames * 2, 64);
+		index->frames = pgut_realloc(index->frames,
+									 index->max_frames * sizeof(BackupFrameIndexEntry));
+	}
+
+	entry = &index->frames[index->nframes++];
+	entry->block = block;
+	entry->nblocks = nblocks;
+	entry->offset = offset;
+}
+
+void
+frame_index_free(BackupFrameIndex *index)
+{
+	pg_free(index->frames);
+	frame_index_init(index);
+}
+
+/*
+ * Read the frame which follows BackupPageHeader of the block as is.
+ * buffer must have room for BACKUP_FRAME_MAX_BLOCKS pages.
+ */
+static void
+read_frame_data(FILE *in, pgFile *file, BlockNumber block,
+				BackupFrameHeader *frame_header, char *buffer)
+{
+	size_t		size;
+	size_t		read_len;
+
+	if (fread(frame_header, 1, sizeof(*frame_header), in) != sizeof(*frame_header))
+		elog(ERROR, "Cannot read header of frame at block %u of \"%s\": %s",
+			 block, file->path, strerror(errno));
+
+	size = (size_t) frame_header->nblocks * BLCKSZ;
+	if (frame_header->nblocks == 0 ||
+		frame_header->nblocks > BACKUP_FRAME_MAX_BLOCKS ||
+		frame_header->compressed_size <= 0 ||
+		frame_header->compressed_size > size)
+		elog(ERROR, "Invalid header of frame at block %u of \"%s\"",
+			 block, file->path);
+
+	read_len = fread(buffer, 1, MAXALIGN(frame_header->compressed_size), in);
+	if (read_len != MAXALIGN(frame_header->compressed_size))
+		elog(ERROR, "Cannot read frame at block %u of \"%s\" read %zu of %d",
+			 block, file->path, read_len, frame_header->compressed_size);
+}
+
+/*
+ * Decompress pages of the frame read by read_frame_data().
+ */
+static void
+decompress_frame(pgFile *file, BlockNumber block, CompressAlg alg,
+				 BackupFrameHeader *frame_header, const char *buffer,
+				 char *pages)
+{
+	size_t		size = (size_t) frame_header->nblocks * BLCKSZ;
+
+	/* Frame which cannot be compressed is stored as is */
+	if (frame_header->compressed_size == size)
+		memcpy(pages, buffer, size);
+	else
+	{
+		const char *errormsg = NULL;
+		int32		uncompressed_size;
+
+		uncompressed_size = do_decompress(pages, size, buffer,
+										  frame_header->compressed_size,
+										  alg, &errormsg);
+		if (uncompressed_size < 0 && errormsg != NULL)
+			elog(WARNING, "An error occured during decompressing frame at block %u of file \"%s\": %s",
+				 block, file->path, errormsg);
+
+		if (uncompressed_size != size)
+			elog(ERROR, "Frame at block %u of file \"%s\" uncompressed to %d bytes. != %zu",
+				 block, file->path, uncompressed_size, size);
+	}
+}
+
+/*
+ * Read the frame which follows BackupPageHeader of the block and decompress
+ * its pages. pages and buffer must have room for BACKUP_FRAME_MAX_BLOCKS
+ * pages. Returns number of pages in the frame.
+ */
+static uint32
+read_backup_frame(FILE *in, pgFile *file, BlockNumber block,
+				  char *pages, char *buffer)
+{
+	BackupFrameHeader frame_header;
+
+	read_frame_data(in, file, block, &frame_header, buffer);
+	decompress_frame(file, block, file->compress_alg, &frame_header, buffer,
+					 pages);
+
+	return frame_header.nblocks;
+}
+
+/*
+ * Use the dictionary to compress pages with zstd from now on.
+ * Should be called before worker threads start.
+ */
+void
+set_page_dictionary(const void *dict, size_t size, int level)
+{
+#ifdef HAVE_LIBZSTD
+	if (page_cdict)
+		ZSTD_freeCDict(page_cdict);
+
+	page_cdict = ZSTD_createCDict(dict, size, level);
+	if (page_cdict == NULL)
+		elog(ERROR, "Cannot create zstd compression dictionary");
+#endif
+}
+
+#ifdef HAVE_LIBZSTD
+static pg_crc32
+page_dictionary_crc(const char *dict, size_t size)
+{
+	pg_crc32	crc;
+
+	INIT_FILE_CRC32(true, crc);
+	COMP_FILE_CRC32(true, crc, dict, size);
+	FIN_FILE_CRC32(true, crc);
+
+	return crc;
+}
+#endif
+
+/*
+ * Load compression dictionary of the backup, if it has one, to be able to
+ * decompress its pages. Should be called before worker threads start.
+ */
+void
+load_page_dictionary(pgBackup *backup)
+{
+#ifdef HAVE_LIBZSTD
+	char		path[MAXPGPATH];
+	char	   *dict;
+	size_t		size;
+	ZSTD_DDict *ddict;
+	PageDictionary *page_dict;
+
+	pg_crc32	crc;
+	int			i;
+
+	pgBackupGetPath(backup, path, lengthof(path), NULL);
+
+	dict = slurpFile(path, DATABASE_PAGE_DICTIONARY, &size, true,
+					 FIO_BACKUP_HOST);
+	if (dict == NULL)
+		return;
+
+	crc = page_dictionary_crc(dict, size);
+
+	/* Merged backups share the dictionary of the FULL backup */
+	for (i = 0; page_ddicts && i < parray_num(page_ddicts); i++)
+	{
+		if (((PageDictionary *) parray_get(page_ddicts, i))->crc == crc)
+		{
+			pg_free(dict);
+			return;
+		}
+	}
+
+	ddict = ZSTD_createDDict(dict, size);
+	if (ddict == NULL)
+		elog(ERROR, "Cannot load compression dictionary of backup %s",
+			 base36enc(backup->start_time));
+	pg_free(dict);
+
+	if (page_ddicts == NULL)
+		page_ddicts = parray_new();
+
+	page_dict = pgut_new(PageDictionary);
+	page_dict->id = ZSTD_getDictID_fromDDict(ddict);
+	page_dict->crc = crc;
+	page_dict->ddict = ddict;
+	parray_append(page_ddicts, page_dict);
+
+	elog(LOG, "Loaded compression dictionary of backup %s",
+		 base36enc(backup->start_time));
+#endif
+}
+
+/*
+ * Check that pages of the file, which refer to their dictionary by ID, get
+ * the dictionary they were compressed with. Two trained dictionaries may
+ * have the same ID, then pages cannot be decompressed safely. Files of
+ * older backups don't record their dictionary and are not checked.
+ * Returns false after reporting the problem with elevel.
+ */
+bool
+check_page_dictionary(pgFile *file, int elevel)
+{
+#ifdef HAVE_LIBZSTD
+	PageDictionary *page_dict = NULL;
+	int			i;
+
+	if (file->dict_crc == 0 || file->compress_alg != ZSTD_COMPRESS)
+		return true;
+
+	for (i = 0; page_ddicts && i < parray_num(page_ddicts); i++)
+	{
+		page_dict = (PageDictionary *) parray_get(page_ddicts, i);
+		if (page_dict->crc == file->dict_crc)
+			break;
+		page_dict = NULL;
+	}
+
+	if (page_dict == NULL)
+	{
+		elog(elevel, "Compression dictionary of file \"%s\" is not found",
+			 file->path);
+		return false;
+	}
+
+	if (find_page_ddict(page_dict->id) != page_dict->ddict)
+	{
+		elog(elevel, "Compression dictionaries of backups have the same ID %u, "
+			 "cannot decompress file \"%s\"", page_dict->id, file->path);
+		return false;
+	}
+#endif
+	return true;
+}
+
+/*
+ * Train zstd dictionary on pages sampled evenly from the data files of the
+ * backup, save it in the backup directory and use it to compress pages.
+ * If there are too few pages to train on, the backup is taken without
+ * a dictionary.
+ */
+void
+train_page_dictionary(parray *files, pgBackup *backup)
+{
+#ifdef HAVE_LIBZSTD
+	char	   *samples;
+	size_t	   *sample_sizes;
+	int			nsamples = 0;
+	uint64		total_blocks = 0;
+	uint64		step;
+	uint64		next = 0;
+	uint64		pos = 0;
+	char	   *dict;
+	size_t		dict_size;
+	char		path[MAXPGPATH];
+	FILE	   *out;
+	int			i;
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+
+		if (S_ISREG(file->mode) && file->is_datafile && !file->is_cfs &&
+			file->external_dir_num == 0)
+			total_blocks += file->size / BLCKSZ;
+	}
+
+	if (total_blocks == 0)
+		return;
+
+	elog(INFO, "Training compression dictionary");
+
+	step = Max(total_blocks / PAGE_DICT_SAMPLE_PAGES, 1);
+	samples = pgut_malloc((size_t) PAGE_DICT_SAMPLE_PAGES * BLCKSZ);
+	sample_sizes = pgut_malloc(PAGE_DICT_SAMPLE_PAGES * sizeof(size_t));
+
+	for (i = 0; i < parray_num(files) && nsamples < PAGE_DICT_SAMPLE_PAGES; i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+		BlockNumber	nblocks;
+		FILE	   *in = NULL;
+
+		if (!S_ISREG(file->mode) || !file->is_datafile || file->is_cfs ||
+			file->external_dir_num != 0)
+			continue;
+
+		if (interrupted)
+			elog(ERROR, "Interrupted during training of compression dictionary");
+
+		nblocks = file->size / BLCKSZ;
+
+		while (next < pos + nblocks && nsamples < PAGE_DICT_SAMPLE_PAGES)
+		{
+			char	   *page = samples + (size_t) nsamples * BLCKSZ;
+
+			/* File may be removed meanwhile, just skip it */
+			if (in == NULL &&
+				(in = fio_fopen(file->path, PG_BINARY_R, FIO_DB_HOST)) == NULL)
+				break;
+
+			if (fio_pread(in, page, (next - pos) * BLCKSZ) == BLCKSZ &&
+				!page_is_zero(page))
+				sample_sizes[nsamples++] = BLCKSZ;
+
+			next += step;
+		}
+
+		if (in)
+			fio_fclose(in);
+
+		pos += nblocks;
+		while (next < pos)
+			next += step;
+	}
+
+	dict = pgut_malloc(PAGE_DICT_MAX_SIZE);
+	dict_size = ZDICT_trainFromBuffer(dict, PAGE_DICT_MAX_SIZE,
+									  samples, sample_sizes, nsamples);
+	pg_free(samples);
+	pg_free(sample_sizes);
+
+	if (ZDICT_isError(dict_size))
+	{
+		elog(WARNING, "Cannot train compression dictionary on %d pages: %s, "
+			 "pages will be compressed without dictionary",
+			 nsamples, ZDICT_getErrorName(dict_size));
+		pg_free(dict);
+		return;
+	}
+
+	pgBackupGetPath(backup, path, lengthof(path), DATABASE_PAGE_DICTIONARY);
+	out = fio_fopen(path, PG_BINARY_W, FIO_BACKUP_HOST);
+	if (out == NULL)
+		elog(ERROR, "Cannot open file \"%s\": %s", path, strerror(errno));
+	if (fio_fwrite(out, dict, dict_size) != dict_size ||
+		fio_fflush(out) != 0 ||
+		fio_fclose(out))
+		elog(ERROR, "Cannot write file \"%s\": %s", path, strerror(errno));
+
+	/* Pages are compressed by the agent in remote mode */
+	fio_set_page_dictionary(dict, dict_size, backup->compress_level,
+							FIO_DB_HOST);
+	page_cdict_crc = page_dictionary_crc(dict, dict_size);
+
+	elog(INFO, "Compression dictionary of %lu bytes is trained on %d pages",
+		 (unsigned long) dict_size, nsamples);
+	pg_free(dict);
+#else
+	elog(ERROR, "This build does not support zstd compression");
+#endif
+}
+
 
 #define ZLIB_MAGIC 0x78
 
@@ -192,22 +825,248 @@ parse_page(Page page, XLogRecPtr *lsn)
 	return false;
 }
 
-/* Read one page from file directly accessing disk
- * return value:
- * 0  - if the page is not found
+/*
+ * Check whether the page is filled with zeroes.
+ *
+ * The page is scanned by 128-byte strides, so that pages with non-zero
+ * content (which is almost always found at the very beginning) are rejected
+ * quickly. On x86-64 the AVX2 version is used if the CPU supports it,
+ * SSE2 is always available there. Other platforms compare machine words.
+ */
+static bool
+page_is_zero_generic(const char *page)
+{
+	const uint64 *words = (const uint64 *) page;
+	int			i;
+
+	for (i = 0; i < BLCKSZ / sizeof(uint64); i += 16)
+	{
+		uint64		acc = 0;
+		int			j;
+
+		for (j = 0; j < 16; j++)
+			acc |= words[i + j];
+
+		if (acc != 0)
+			return false;
+	}
+
+	return true;
+}
+
+#ifdef USE_SSE2_PAGE_SCAN
+static bool
+page_is_zero_sse2(const char *page)
+{
+	const __m128i *vec = (const __m128i *) page;
+	int			i;
+
+	for (i = 0; i < BLCKSZ / sizeof(__m128i); i += 8)
+	{
+		__m128i		acc;
+
+		acc = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(vec + i),
+										_mm_loadu_si128(vec + i + 1)),
+						   _mm_or_si128(_mm_loadu_si128(vec + i + 2),
+										_mm_loadu_si128(vec + i + 3)));
+		acc = _mm_or_si128(acc,
+						   _mm_or_si128(_mm_or_si128(_mm_loadu_si128(vec + i + 4),
+													 _mm_loadu_si128(vec + i + 5)),
+										_mm_or_si128(_mm_loadu_si128(vec + i + 6),
+													 _mm_loadu_si128(vec + i + 7))));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF)
+			return false;
+	}
+
+	return true;
+}
+#endif
+
+#ifdef USE_AVX2_PAGE_SCAN
+__attribute__((target("avx2")))
+static bool
+page_is_zero_avx2(const char *page)
+{
+	const __m256i *vec = (const __m256i *) page;
+	int			i;
+
+	for (i = 0; i < BLCKSZ / sizeof(__m256i); i += 4)
+	{
+		__m256i		acc;
+
+		acc = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(vec + i),
+											  _mm256_loadu_si256(vec + i + 1)),
+							  _mm256_or_si256(_mm256_loadu_si256(vec + i + 2),
+											  _mm256_loadu_si256(vec + i + 3)));
+
+		if (!_mm256_testz_si256(acc, acc))
+			return false;
+	}
+
+	return true;
+}
+#endif
+
+static bool page_is_zero_choose(const char *page);
+
+static bool (*page_is_zero_impl) (const char *page) = page_is_zero_choose;
+
+/*
+ * Choose the best implementation on the first call. It is harmless if
+ * several threads do it simultaneously.
+ */
+static bool
+page_is_zero_choose(const char *page)
+{
+#if defined(USE_AVX2_PAGE_SCAN)
+	if (__builtin_cpu_supports("avx2"))
+		page_is_zero_impl = page_is_zero_avx2;
+	else
+		page_is_zero_impl = page_is_zero_sse2;
+#elif defined(USE_SSE2_PAGE_SCAN)
+	page_is_zero_impl = page_is_zero_sse2;
+#else
+	page_is_zero_impl = page_is_zero_generic;
+#endif
+
+	return page_is_zero_impl(page);
+}
+
+bool
+page_is_zero(const char *page)
+{
+	return page_is_zero_impl(page);
+}
+
+/*
+ * Classify npages pages located one after another in buf.
+ * Pages with valid header are told apart by their LSN: pages with
+ * LSN below horizon_lsn haven't changed since the previous backup.
+ * Pass InvalidXLogRecPtr as horizon_lsn to get PAGE_CLASS_CHANGED
+ * for every valid page with LSN set.
+ * Checksums are not verified here.
+ */
+void
+classify_pages(const char *buf, int npages, XLogRecPtr horizon_lsn,
+			   PageClass *classes)
+{
+	int			i;
+
+	for (i = 0; i < npages; i++)
+	{
+		const char *page = buf + (size_t) i * BLCKSZ;
+		XLogRecPtr	lsn;
+
+		if (!parse_page((Page) page, &lsn))
+			classes[i] = page_is_zero(page) ? PAGE_CLASS_ZERO : PAGE_CLASS_INVALID;
+		else if (lsn == InvalidXLogRecPtr)
+			classes[i] = PAGE_CLASS_NEW;
+		else if (lsn < horizon_lsn)
+			classes[i] = PAGE_CLASS_UNCHANGED;
+		else
+			classes[i] = PAGE_CLASS_CHANGED;
+	}
+}
+
+/*
+ * Allocate buffer for reading up to nblocks blocks of the file by chunks
+ * of read_chunk_size. Pages with LSN below horizon_lsn are classified as
+ * unchanged.
+ */
+static PageReadBuffer *
+page_read_buffer_new(BlockNumber nblocks, XLogRecPtr horizon_lsn)
+{
+	PageReadBuffer *rbuf = pgut_new(PageReadBuffer);
+
+	rbuf->size = Max(Min(read_chunk_size * 1024 / BLCKSZ, nblocks), 1);
+	rbuf->data = pgut_malloc((size_t) rbuf->size * BLCKSZ);
+	rbuf->classes = pgut_malloc(rbuf->size * sizeof(PageClass));
+	rbuf->first = 0;
+	rbuf->nblocks = 0;
+	rbuf->horizon_lsn = horizon_lsn;
+
+	return rbuf;
+}
+
+static void
+page_read_buffer_free(PageReadBuffer *rbuf)
+{
+	if (rbuf == NULL)
+		return;
+
+	pg_free(rbuf->data);
+	pg_free(rbuf->classes);
+	pg_free(rbuf);
+}
+
+/*
+ * Copy block blknum into "page" from the read buffer, reading the next chunk
+ * of the file into the buffer if necessary. Pages of the chunk are classified
+ * all at once right after reading.
+ * Returns false if the block cannot be taken from the buffer, so it must
+ * be read individually.
+ */
+static bool
+read_page_from_buffer(PageReadBuffer *rbuf, FILE *in, BlockNumber blknum,
+					  BlockNumber nblocks, Page page, PageClass *page_class)
+{
+	if (blknum < rbuf->first || blknum >= rbuf->first + rbuf->nblocks)
+	{
+		BlockNumber	count;
+		ssize_t		read_len;
+
+		if (blknum >= nblocks)
+			return false;
+
+		count = Min(rbuf->size, nblocks - blknum);
+		read_len = pread(fileno(in), rbuf->data, (size_t) count * BLCKSZ,
+						 (off_t) blknum * BLCKSZ);
+
+		rbuf->first = blknum;
+		rbuf->nblocks = (read_len > 0) ? read_len / BLCKSZ : 0;
+
+		if (rbuf->nblocks == 0)
+			return false;
+
+		classify_pages(rbuf->data, rbuf->nblocks, rbuf->horizon_lsn,
+					   rbuf->classes);
+	}
+
+	memcpy(page, rbuf->data + (size_t) (blknum - rbuf->first) * BLCKSZ, BLCKSZ);
+	*page_class = rbuf->classes[blknum - rbuf->first];
+	return true;
+}
+
+/* Read one page from file directly accessing disk
+ * If rbuf is not NULL, the page is taken from the read buffer, which
+ * is filled by large chunks, otherwise it is read individually.
+ * Class of the page is returned in page_class, pages with LSN below
+ * horizon_lsn are PAGE_CLASS_UNCHANGED.
+ * return value:
+ * 0  - if the page is not found
  * 1  - if the page is found and valid
  * -1 - if the page is found but invalid
  */
 static int
-read_page_from_file(pgFile *file, BlockNumber blknum,
-					FILE *in, Page page, XLogRecPtr *page_lsn,
-					uint32 checksum_version)
+read_page_from_file(pgFile *file, BlockNumber blknum, BlockNumber nblocks,
+					FILE *in, PageReadBuffer *rbuf, Page page,
+					XLogRecPtr horizon_lsn, XLogRecPtr *page_lsn,
+					PageClass *page_class, uint32 checksum_version)
 {
 	off_t		offset = blknum * BLCKSZ;
 	ssize_t		read_len = 0;
 
 	/* read the block */
-	read_len = fio_pread(in, page, offset);
+	if (rbuf && read_page_from_buffer(rbuf, in, blknum, nblocks, page,
+									  page_class))
+		read_len = BLCKSZ;
+	else
+	{
+		read_len = fio_pread(in, page, offset);
+		if (read_len == BLCKSZ)
+			classify_pages(page, 1, horizon_lsn, page_class);
+	}
 
 	if (read_len != BLCKSZ)
 	{
@@ -234,14 +1093,12 @@ read_page_from_file(pgFile *file, BlockNumber blknum,
 	 * If after several attempts page header is still invalid, throw an error.
 	 * The same idea is applied to checksum verification.
 	 */
-	if (!parse_page(page, page_lsn))
-	{
-		int i;
-		/* Check if the page is zeroed. */
-		for(i = 0; i < BLCKSZ && page[i] == 0; i++);
+	*page_lsn = PageXLogRecPtrGet(((PageHeader) page)->pd_lsn);
 
+	if (*page_class == PAGE_CLASS_ZERO || *page_class == PAGE_CLASS_INVALID)
+	{
 		/* Page is zeroed. No need to check header and checksum. */
-		if (i == BLCKSZ)
+		if (*page_class == PAGE_CLASS_ZERO)
 		{
 			elog(VERBOSE, "File: \"%s\" blknum %u, empty page", file->path, blknum);
 			return 1;
@@ -298,7 +1155,7 @@ static int32
 prepare_page(ConnectionArgs *arguments,
 			 pgFile *file, XLogRecPtr prev_backup_start_lsn,
 			 BlockNumber blknum, BlockNumber nblocks,
-			 FILE *in, BlockNumber *n_skipped,
+			 FILE *in, PageReadBuffer *rbuf, BlockNumber *n_skipped,
 			 BackupMode backup_mode,
 			 Page page, bool strict,
 			 uint32 checksum_version,
@@ -306,10 +1163,15 @@ prepare_page(ConnectionArgs *arguments,
 			 const char *ptrack_schema)
 {
 	XLogRecPtr	page_lsn = 0;
+	PageClass	page_class = PAGE_CLASS_CHANGED;
 	int			try_again = 100;
 	bool		page_is_valid = false;
 	bool		page_is_truncated = false;
 	BlockNumber absolute_blknum = file->segno * RELSEG_SIZE + blknum;
+	/* DELTA backup skips pages which haven't changed since the previous one */
+	XLogRecPtr	horizon_lsn = (backup_mode == BACKUP_MODE_DIFF_DELTA &&
+							   file->exists_in_prev) ?
+		prev_backup_start_lsn : InvalidXLogRecPtr;
 
 	/* check for interrupt */
 	if (interrupted || thread_interrupted)
@@ -324,8 +1186,14 @@ prepare_page(ConnectionArgs *arguments,
 	{
 		while(!page_is_valid && try_again)
 		{
-			int result = read_page_from_file(file, blknum, in, page,
-											 &page_lsn, checksum_version);
+			/*
+			 * At first take the page from the read buffer. If it is not
+			 * valid, reread it individually.
+			 */
+			int result = read_page_from_file(file, blknum, nblocks, in,
+											 (try_again == 100) ? rbuf : NULL,
+											 page, horizon_lsn, &page_lsn,
+											 &page_class, checksum_version);
 
 			try_again--;
 			if (result == 0)
@@ -415,21 +1283,22 @@ prepare_page(ConnectionArgs *arguments,
 				((PageHeader) page)->pd_checksum = pg_checksum_page(page, absolute_blknum);
 		}
 		/* get lsn from page, provided by pg_ptrack_get_block() */
-		if (backup_mode == BACKUP_MODE_DIFF_DELTA &&
-			file->exists_in_prev &&
-			!page_is_truncated &&
-			!parse_page(page, &page_lsn))
+		if (horizon_lsn != InvalidXLogRecPtr && !page_is_truncated)
+		{
+			if (!parse_page(page, &page_lsn))
 				elog(ERROR, "Cannot parse page after pg_ptrack_get_block. "
-								"Possible risk of a memory corruption");
-
+					 "Possible risk of a memory corruption");
+			classify_pages(page, 1, horizon_lsn, &page_class);
+		}
+		else
+			page_class = PAGE_CLASS_CHANGED;
 	}
 
-	/* Nullified pages must be copied by DELTA backup, just to be safe */
-	if (backup_mode == BACKUP_MODE_DIFF_DELTA &&
-		file->exists_in_prev &&
-		!page_is_truncated &&
-		page_lsn &&
-		page_lsn < prev_backup_start_lsn)
+	/*
+	 * Pages classified as unchanged are skipped by DELTA backup. Nullified
+	 * pages are never classified so and are copied, just to be safe.
+	 */
+	if (!page_is_truncated && page_class == PAGE_CLASS_UNCHANGED)
 	{
 		elog(VERBOSE, "Skipping blknum %u in file: \"%s\"", blknum, file->path);
 		(*n_skipped)++;
@@ -442,20 +1311,209 @@ prepare_page(ConnectionArgs *arguments,
 	return 0;
 }
 
+/*
+ * Pages are not written to the backup file one by one, but are accumulated
+ * in the write buffer and written out in large chunks.
+ */
+#define BACKUP_WRITE_BUFFER_SIZE	(128 * (BLCKSZ + sizeof(BackupPageHeader)))
+
+/*
+ * Number of blocks the kernel is asked to read ahead while we checksum
+ * and compress the current ones.
+ */
+#define BACKUP_PREFETCH_BLOCKS		128
+
+typedef struct
+{
+	FILE	   *out;
+	char	   *data;
+	size_t		len;
+
+	/*
+	 * Consecutive pages collected to be compressed together in one frame,
+	 * see compress_frame(). frame_size is 0 if pages are compressed one
+	 * by one.
+	 */
+	uint32		frame_size;
+	char	   *frame_pages;
+	char	   *frame_buffer;
+	BlockNumber	frame_first;
+	uint32		frame_nblocks;
+	BackupFrameIndex index;
+} BackupWriteBuffer;
+
+/*
+ * Write out content of the write buffer.
+ */
+static void
+flush_backup_buffer(pgFile *file, FILE *in, BackupWriteBuffer *wbuf)
+{
+	if (wbuf->len == 0)
+		return;
+
+	if (fio_fwrite(wbuf->out, wbuf->data, wbuf->len) != wbuf->len)
+	{
+		int			errno_tmp = errno;
+
+		if (in)
+			fio_fclose(in);
+		if (wbuf->out)
+			fio_fclose(wbuf->out);
+		elog(ERROR, "File: \"%s\", cannot write backup: %s",
+			 file->path, strerror(errno_tmp));
+	}
+
+	wbuf->len = 0;
+}
+
+/*
+ * Append data to the write buffer, flushing it when it is full.
+ */
+static void
+append_backup_buffer(pgFile *file, FILE *in, BackupWriteBuffer *wbuf,
+					 pg_crc32 *crc, const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		size_t		n;
+
+		if (wbuf->len == BACKUP_WRITE_BUFFER_SIZE)
+			flush_backup_buffer(file, in, wbuf);
+
+		n = Min(len, BACKUP_WRITE_BUFFER_SIZE - wbuf->len);
+		memcpy(wbuf->data + wbuf->len, data, n);
+		COMP_FILE_CRC32(true, *crc, data, n);
+
+		wbuf->len += n;
+		file->write_size += n;
+		data += n;
+		len -= n;
+	}
+}
+
+/*
+ * Compress collected pages as one frame and append it to the write buffer.
+ */
+static void
+flush_backup_frame(pgFile *file, FILE *in, BackupWriteBuffer *wbuf,
+				   pg_crc32 *crc, CompressAlg calg, int clevel)
+{
+	size_t		size;
+
+	if (wbuf->frame_nblocks == 0)
+		return;
+
+	size = compress_frame(wbuf->frame_buffer, wbuf->frame_pages,
+						  wbuf->frame_first, wbuf->frame_nblocks,
+						  calg, clevel);
+
+	frame_index_add(&wbuf->index, wbuf->frame_first, wbuf->frame_nblocks,
+					file->write_size);
+	append_backup_buffer(file, in, wbuf, crc, wbuf->frame_buffer, size);
+
+	wbuf->frame_nblocks = 0;
+}
+
+/*
+ * Write out the last frame and the index of frames at the end of file.
+ */
+static void
+finish_backup_frames(pgFile *file, FILE *in, BackupWriteBuffer *wbuf,
+					 pg_crc32 *crc, CompressAlg calg, int clevel)
+{
+	BackupPageHeader header;
+	BackupFrameIndexHeader index_header;
+	int64		index_offset;
+
+	if (wbuf->frame_size == 0)
+		return;
+
+	flush_backup_frame(file, in, wbuf, crc, calg, clevel);
+
+	index_offset = file->write_size;
+	header.block = 0;
+	header.compressed_size = PageIsFrameIndex;
+	index_header.nframes = wbuf->index.nframes;
+	index_header.truncated_block = wbuf->index.truncated_block;
+
+	append_backup_buffer(file, in, wbuf, crc, (char *) &header, sizeof(header));
+	append_backup_buffer(file, in, wbuf, crc, (char *) &index_header,
+						 sizeof(index_header));
+	append_backup_buffer(file, in, wbuf, crc, (char *) wbuf->index.frames,
+						 wbuf->index.nframes * sizeof(BackupFrameIndexEntry));
+	append_backup_buffer(file, in, wbuf, crc, (char *) &index_offset,
+						 sizeof(index_offset));
+
+	file->frame_size = wbuf->frame_size;
+}
+
+/*
+ * Ask the kernel to start reading the following blocks of the file, so
+ * that disk reads overlap with checksumming and compression of the
+ * current ones.
+ *
+ * This stands in for separate reader and compressor threads per worker.
+ * The kernel read-ahead runs concurrently with the worker just like a
+ * reader thread would, while the worker needs no queue and no extra
+ * synchronization, and backup still runs num_threads threads. Remote
+ * files are streamed by the agent, which reads them by large chunks while
+ * we write received pages, see fio_send_pages().
+ */
+static void
+prefetch_blocks(FILE *in, BlockNumber blknum, BlockNumber count)
+{
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	if (!fio_is_remote_file(in))
+		(void) posix_fadvise(fileno(in), (off_t) blknum * BLCKSZ,
+							 (off_t) count * BLCKSZ, POSIX_FADV_WILLNEED);
+#endif
+}
+
 static void
 compress_and_backup_page(pgFile *file, BlockNumber blknum,
-						FILE *in, FILE *out, pg_crc32 *crc,
+						FILE *in, BackupWriteBuffer *wbuf, pg_crc32 *crc,
 						int page_state, Page page,
 						CompressAlg calg, int clevel)
 {
 	BackupPageHeader header;
 	size_t		write_buffer_size = sizeof(header);
-	char		write_buffer[BLCKSZ+sizeof(header)];
+	char	   *write_buffer;
 	char		compressed_page[BLCKSZ*2]; /* compressed page may require more space than uncompressed */
 
 	if (page_state == SkipCurrentPage)
 		return;
 
+	if (wbuf->frame_size > 0)
+	{
+		/* Frame can hold only consecutive pages */
+		if (wbuf->frame_nblocks > 0 &&
+			(page_state == PageIsTruncated ||
+			 blknum != wbuf->frame_first + wbuf->frame_nblocks ||
+			 wbuf->frame_nblocks == wbuf->frame_size))
+			flush_backup_frame(file, in, wbuf, crc, calg, clevel);
+
+		if (page_state == PageIsTruncated)
+			wbuf->index.truncated_block = blknum;
+		else
+		{
+			if (wbuf->frame_nblocks == 0)
+				wbuf->frame_first = blknum;
+			memcpy(wbuf->frame_pages + (size_t) wbuf->frame_nblocks * BLCKSZ,
+				   page, BLCKSZ);
+			wbuf->frame_nblocks++;
+
+			file->compress_alg = calg;
+			file->read_size += BLCKSZ;
+			file->uncompressed_size += BLCKSZ;
+			return;
+		}
+	}
+
+	/* Make room for the page in the write buffer */
+	if (wbuf->len + sizeof(header) + BLCKSZ > BACKUP_WRITE_BUFFER_SIZE)
+		flush_backup_buffer(file, in, wbuf);
+	write_buffer = wbuf->data + wbuf->len;
+
 	header.block = blknum;
 	header.compressed_size = page_state;
 
@@ -507,16 +1565,7 @@ compress_and_backup_page(pgFile *file, BlockNumber blknum,
 	/* Update CRC */
 	COMP_FILE_CRC32(true, *crc, write_buffer, write_buffer_size);
 
-	/* write data page */
-	if (fio_fwrite(out, write_buffer, write_buffer_size) != write_buffer_size)
-	{
-		int			errno_tmp = errno;
-
-		fclose(in);
-		fio_fclose(out);
-		elog(ERROR, "File: \"%s\", cannot write backup at block %u: %s",
-			 file->path, blknum, strerror(errno_tmp));
-	}
+	wbuf->len += write_buffer_size;
 
 	file->write_size += write_buffer_size;
 	file->uncompressed_size += BLCKSZ;
@@ -545,6 +1594,8 @@ backup_data_file(backup_files_arg* arguments,
 	BlockNumber	n_blocks_read = 0;
 	int			page_state;
 	char		curr_page[BLCKSZ];
+	BackupWriteBuffer wbuf;
+	PageReadBuffer *rbuf = NULL;
 
 	/*
 	 * Skip unchanged file only if it exists in previous backup.
@@ -616,6 +1667,28 @@ backup_data_file(backup_files_arg* arguments,
 			 to_path, strerror(errno_tmp));
 	}
 
+	wbuf.out = out;
+	wbuf.data = pgut_malloc(BACKUP_WRITE_BUFFER_SIZE);
+	wbuf.len = 0;
+
+	/* Compress consecutive pages together, if requested */
+	wbuf.frame_size = 0;
+	wbuf.frame_pages = NULL;
+	wbuf.frame_buffer = NULL;
+	wbuf.frame_nblocks = 0;
+	frame_index_init(&wbuf.index);
+	file->frame_size = 0;
+#ifdef HAVE_LIBZSTD
+	file->dict_crc = (calg == ZSTD_COMPRESS && page_cdict) ? page_cdict_crc : 0;
+#endif
+	if (compress_frame_size > 1 &&
+		calg != NONE_COMPRESS && calg != NOT_DEFINED_COMPRESS)
+	{
+		wbuf.frame_size = compress_frame_size;
+		wbuf.frame_pages = pgut_malloc((size_t) wbuf.frame_size * BLCKSZ);
+		wbuf.frame_buffer = pgut_malloc(BACKUP_FRAME_BUFFER_SIZE(wbuf.frame_size));
+	}
+
 	/*
 	 * Read each page, verify checksum and write it to backup.
 	 * If page map is empty or file is not present in previous backup
@@ -631,7 +1704,8 @@ backup_data_file(backup_files_arg* arguments,
 		{
 			int rc = fio_send_pages(in, out, file,
 									backup_mode == BACKUP_MODE_DIFF_DELTA && file->exists_in_prev ? prev_backup_start_lsn : InvalidXLogRecPtr,
-									&n_blocks_skipped, calg, clevel);
+									&n_blocks_skipped, calg, clevel,
+									wbuf.frame_size, &wbuf.index);
 
 			if (rc == PAGE_CHECKSUM_MISMATCH && ptrack_version_num >= 15)
 				 /* only ptrack versions 1.5, 1.6, 1.7 and 2.x support this functionality */
@@ -647,14 +1721,26 @@ backup_data_file(backup_files_arg* arguments,
 		else
 		{
 		  RetryUsingPtrack:
+			/* Local file is read by large chunks */
+			if (!fio_is_remote_file(in))
+				rbuf = page_read_buffer_new(nblocks,
+											backup_mode == BACKUP_MODE_DIFF_DELTA && file->exists_in_prev ?
+											prev_backup_start_lsn : InvalidXLogRecPtr);
+
 			for (blknum = 0; blknum < nblocks; blknum++)
 			{
+				/* Keep the kernel reading ahead of us */
+				if (blknum % BACKUP_PREFETCH_BLOCKS == 0 &&
+					blknum + BACKUP_PREFETCH_BLOCKS < nblocks)
+					prefetch_blocks(in, blknum + BACKUP_PREFETCH_BLOCKS,
+									BACKUP_PREFETCH_BLOCKS);
+
 				page_state = prepare_page(&(arguments->conn_arg), file, prev_backup_start_lsn,
-										  blknum, nblocks, in, &n_blocks_skipped,
+										  blknum, nblocks, in, rbuf, &n_blocks_skipped,
 										  backup_mode, curr_page, true,
 										  checksum_version, ptrack_version_num,
 										  ptrack_schema);
-				compress_and_backup_page(file, blknum, in, out, &(file->crc),
+				compress_and_backup_page(file, blknum, in, &wbuf, &(file->crc),
 										  page_state, curr_page, calg, clevel);
 				n_blocks_read++;
 				if (page_state == PageIsTruncated)
@@ -678,11 +1764,11 @@ backup_data_file(backup_files_arg* arguments,
 		while (datapagemap_next(iter, &blknum))
 		{
 			page_state = prepare_page(&(arguments->conn_arg), file, prev_backup_start_lsn,
-									  blknum, nblocks, in, &n_blocks_skipped,
+									  blknum, nblocks, in, NULL, &n_blocks_skipped,
 									  backup_mode, curr_page, true,
 									  checksum_version, ptrack_version_num,
 									  ptrack_schema);
-			compress_and_backup_page(file, blknum, in, out, &(file->crc),
+			compress_and_backup_page(file, blknum, in, &wbuf, &(file->crc),
 									  page_state, curr_page, calg, clevel);
 			n_blocks_read++;
 			if (page_state == PageIsTruncated)
@@ -693,6 +1779,14 @@ backup_data_file(backup_files_arg* arguments,
 		pg_free(iter);
 	}
 
+	finish_backup_frames(file, in, &wbuf, &(file->crc), calg, clevel);
+	flush_backup_buffer(file, in, &wbuf);
+	pg_free(wbuf.data);
+	pg_free(wbuf.frame_pages);
+	pg_free(wbuf.frame_buffer);
+	frame_index_free(&wbuf.index);
+	page_read_buffer_free(rbuf);
+
 	/* update file permission */
 	if (fio_chmod(to_path, FILE_PERMISSION, FIO_BACKUP_HOST) == -1)
 	{
@@ -703,164 +1797,1061 @@ backup_data_file(backup_files_arg* arguments,
 			 strerror(errno_tmp));
 	}
 
-	if (fio_fflush(out) != 0 ||
-		fio_fclose(out))
-		elog(ERROR, "cannot write backup file \"%s\": %s",
-			 to_path, strerror(errno));
-	fio_fclose(in);
+	if (fio_fflush(out) != 0 ||
+		fio_fclose(out))
+		elog(ERROR, "cannot write backup file \"%s\": %s",
+			 to_path, strerror(errno));
+	fio_fclose(in);
+
+	FIN_FILE_CRC32(true, file->crc);
+
+	/*
+	 * If we have pagemap then file in the backup can't be a zero size.
+	 * Otherwise, we will clear the last file.
+	 */
+	if (n_blocks_read != 0 && n_blocks_read == n_blocks_skipped)
+	{
+		if (fio_unlink(to_path, FIO_BACKUP_HOST) == -1)
+			elog(ERROR, "cannot remove file \"%s\": %s", to_path,
+				 strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Write the restored page to its position in the file. If write_header is
+ * true, the page is preceded by BackupPageHeader.
+ */
+static void
+write_restored_page(FILE *out, pgFile *file, const char *to_path,
+					BlockNumber blknum, const char *page, bool write_header)
+{
+	BackupPageHeader header;
+	off_t		write_pos;
+
+	write_pos = (write_header) ? blknum * (BLCKSZ + sizeof(header)) :
+								 blknum * BLCKSZ;
+
+	/*
+	 * Seek and write the restored page.
+	 */
+	if (fio_fseek(out, write_pos) < 0)
+		elog(ERROR, "Cannot seek block %u of \"%s\": %s",
+			 blknum, to_path, strerror(errno));
+
+	if (write_header)
+	{
+		/* We uncompressed the page, so its size is BLCKSZ */
+		header.block = blknum;
+		header.compressed_size = BLCKSZ;
+		if (fio_fwrite(out, &header, sizeof(header)) != sizeof(header))
+			elog(ERROR, "Cannot write header of block %u of \"%s\": %s",
+				 blknum, file->path, strerror(errno));
+	}
+
+	if (fio_fwrite(out, page, BLCKSZ) != BLCKSZ)
+		elog(ERROR, "Cannot write block %u of \"%s\": %s",
+			 blknum, file->path, strerror(errno));
+}
+
+/*
+ * Restore files in the from_root directory to the to_root directory with
+ * same relative path.
+ *
+ * If write_header is true then we add header to each restored block, currently
+ * it is used for MERGE command.
+ */
+void
+restore_data_file(const char *to_path, pgFile *file, bool allow_truncate,
+				  bool write_header, uint32 backup_version)
+{
+	FILE	   *in = NULL;
+	FILE	   *out = NULL;
+	BackupPageHeader header;
+	BlockNumber	blknum = 0,
+				truncate_from = 0;
+	bool		need_truncate = false;
+	char	   *frame_pages = NULL;
+	char	   *frame_buffer = NULL;
+
+	/* BYTES_INVALID allowed only in case of restoring file from DELTA backup */
+	if (file->write_size != BYTES_INVALID)
+	{
+		/* open backup mode file for read */
+		in = fopen(file->path, PG_BINARY_R);
+		if (in == NULL)
+		{
+			elog(ERROR, "Cannot open backup file \"%s\": %s", file->path,
+				 strerror(errno));
+		}
+		check_page_dictionary(file, ERROR);
+	}
+
+	/*
+	 * Open backup file for write. 	We use "r+" at first to overwrite only
+	 * modified pages for differential restore. If the file does not exist,
+	 * re-open it with "w" to create an empty file.
+	 */
+	out = fio_fopen(to_path, PG_BINARY_R "+", FIO_DB_HOST);
+	if (out == NULL)
+	{
+		int errno_tmp = errno;
+		if (in)
+			fclose(in);
+		elog(ERROR, "Cannot open restore target file \"%s\": %s",
+			 to_path, strerror(errno_tmp));
+	}
+
+	while (true)
+	{
+		size_t		read_len;
+		DataPage	compressed_page; /* used as read buffer */
+		DataPage	page;
+		int32		uncompressed_size = 0;
+
+		/* File didn`t changed. Nothing to copy */
+		if (file->write_size == BYTES_INVALID)
+			break;
+
+		/*
+		 * We need to truncate result file if data file in an incremental backup
+		 * less than data file in a full backup. We know it thanks to n_blocks.
+		 *
+		 * It may be equal to -1, then we don't want to truncate the result
+		 * file.
+		 */
+		if (file->n_blocks != BLOCKNUM_INVALID &&
+			(blknum + 1) > file->n_blocks)
+		{
+			truncate_from = blknum;
+			need_truncate = true;
+			break;
+		}
+
+		/* read BackupPageHeader */
+		read_len = fread(&header, 1, sizeof(header), in);
+		if (read_len != sizeof(header))
+		{
+			int errno_tmp = errno;
+			if (read_len == 0 && feof(in))
+				break;		/* EOF found */
+			else if (read_len != 0 && feof(in))
+				elog(ERROR,
+					 "Odd size page found at block %u of \"%s\"",
+					 blknum, file->path);
+			else
+				elog(ERROR, "Cannot read header of block %u of \"%s\": %s",
+					 blknum, file->path, strerror(errno_tmp));
+		}
+
+		if (header.block == 0 && header.compressed_size == 0)
+		{
+			elog(VERBOSE, "Skip empty block of \"%s\"", file->path);
+			continue;
+		}
+
+		/*
+		 * Index of frames is at the end of file, all pages are restored.
+		 * Its header has block 0, so check it before the order of blocks.
+		 */
+		if (header.compressed_size == PageIsFrameIndex)
+			break;
+
+		if (header.block < blknum)
+			elog(ERROR, "Backup is broken at block %u of \"%s\"",
+				 blknum, file->path);
+
+		blknum = header.block;
+
+		if (header.compressed_size == PageIsTruncated)
+		{
+			/*
+			 * Backup contains information that this block was truncated.
+			 * We need to truncate file to this length.
+			 */
+			truncate_from = blknum;
+			need_truncate = true;
+			break;
+		}
+
+		if (header.compressed_size == PageIsFrame)
+		{
+			uint32		nblocks;
+			uint32		i;
+
+			if (frame_pages == NULL)
+			{
+				frame_pages = pgut_malloc(BACKUP_FRAME_MAX_BLOCKS * BLCKSZ);
+				frame_buffer = pgut_malloc(BACKUP_FRAME_MAX_BLOCKS * BLCKSZ);
+			}
+
+			nblocks = read_backup_frame(in, file, blknum, frame_pages,
+										frame_buffer);
+			for (i = 0; i < nblocks; i++)
+			{
+				if (file->n_blocks != BLOCKNUM_INVALID &&
+					blknum + i >= file->n_blocks)
+				{
+					truncate_from = blknum + i;
+					need_truncate = true;
+					break;
+				}
+				write_restored_page(out, file, to_path, blknum + i,
+									frame_pages + (size_t) i * BLCKSZ,
+									write_header);
+			}
+			if (need_truncate)
+				break;
+
+			blknum += nblocks - 1;
+			continue;
+		}
+
+		Assert(header.compressed_size <= BLCKSZ);
+
+		/* read a page from file */
+		read_len = fread(compressed_page.data, 1,
+			MAXALIGN(header.compressed_size), in);
+		if (read_len != MAXALIGN(header.compressed_size))
+			elog(ERROR, "Cannot read block %u of \"%s\" read %zu of %d",
+				blknum, file->path, read_len, header.compressed_size);
+
+		/*
+		 * if page size is smaller than BLCKSZ, decompress the page.
+		 * BUGFIX for versions < 2.0.23: if page size is equal to BLCKSZ.
+		 * we have to check, whether it is compressed or not using
+		 * page_may_be_compressed() function.
+		 */
+		if (header.compressed_size != BLCKSZ
+			|| page_may_be_compressed(compressed_page.data, file->compress_alg,
+									  backup_version))
+		{
+			const char *errormsg = NULL;
+
+			uncompressed_size = do_decompress(page.data, BLCKSZ,
+											  compressed_page.data,
+											  header.compressed_size,
+											  file->compress_alg, &errormsg);
+			if (uncompressed_size < 0 && errormsg != NULL)
+				elog(WARNING, "An error occured during decompressing block %u of file \"%s\": %s",
+					 blknum, file->path, errormsg);
+
+			if (uncompressed_size != BLCKSZ)
+				elog(ERROR, "Page of file \"%s\" uncompressed to %d bytes. != BLCKSZ",
+					 file->path, uncompressed_size);
+		}
+
+		/* if we uncompressed the page - write page.data,
+		 * if page wasn't compressed -
+		 * write what we've read - compressed_page.data
+		 */
+		write_restored_page(out, file, to_path, blknum,
+							uncompressed_size == BLCKSZ ? page.data : compressed_page.data,
+							write_header);
+	}
+	pg_free(frame_pages);
+	pg_free(frame_buffer);
+
+	/*
+	 * DELTA backup have no knowledge about truncated blocks as PAGE or PTRACK do
+	 * But during DELTA backup we read every file in PGDATA and thus DELTA backup
+	 * knows exact size of every file at the time of backup.
+	 * So when restoring file from DELTA backup we, knowing it`s size at
+	 * a time of a backup, can truncate file to this size.
+	 */
+	if (allow_truncate && file->n_blocks != BLOCKNUM_INVALID && !need_truncate)
+	{
+		struct stat st;
+		if (fio_ffstat(out, &st) == 0 && st.st_size > file->n_blocks * BLCKSZ)
+		{
+			truncate_from = file->n_blocks;
+			need_truncate = true;
+		}
+	}
+
+	if (need_truncate)
+	{
+		off_t		write_pos;
+
+		write_pos = (write_header) ? truncate_from * (BLCKSZ + sizeof(header)) :
+									 truncate_from * BLCKSZ;
+
+		/*
+		 * Truncate file to this length.
+		 */
+		if (fio_ftruncate(out, write_pos) != 0)
+			elog(ERROR, "Cannot truncate \"%s\": %s",
+				 file->path, strerror(errno));
+		elog(VERBOSE, "Delta truncate file %s to block %u",
+			 file->path, truncate_from);
+	}
+
+	/* update file permission */
+	if (fio_chmod(to_path, file->mode, FIO_DB_HOST) == -1)
+	{
+		int errno_tmp = errno;
+
+		if (in)
+			fclose(in);
+		fio_fclose(out);
+		elog(ERROR, "Cannot change mode of \"%s\": %s", to_path,
+			 strerror(errno_tmp));
+	}
+
+	if (fio_fflush(out) != 0 ||
+		fio_fclose(out))
+		elog(ERROR, "Cannot write \"%s\": %s", to_path, strerror(errno));
+
+	if (in)
+		fclose(in);
+}
+
+/*
+ * Location of the latest version of a block across the backup chain.
+ */
+typedef struct
+{
+	int			version;	/* index in files[], -1 if block is not mapped */
+	off_t		offset;		/* offset of BackupPageHeader in that file */
+	BlockNumber	frame_first; /* first block of the frame containing the block,
+							  * InvalidBlockNumber if the page is stored alone */
+} BlockSource;
+
+/*
+ * Block map of a file built by build_block_map(). Ranges of a split file
+ * share one map, see restore_data_file_chain().
+ */
+typedef struct BlockMap
+{
+	BlockSource *map;
+	BlockNumber	map_size;
+	BlockNumber	nblocks;		/* size of the resulting file in blocks */
+	bool		need_truncate;
+	bool		found;			/* the file exists in the chain */
+	mode_t		mode;			/* mode of the newest version of the file */
+} BlockMap;
+
+/*
+ * Remember the location of the block in the block map, extending the map
+ * if necessary.
+ */
+static void
+block_map_set(BlockSource **map, BlockNumber *map_size, BlockNumber blknum,
+			  int version, off_t offset, BlockNumber frame_first)
+{
+	if (blknum >= *map_size)
+	{
+		BlockNumber	new_size = Max(blknum + 1, *map_size * 2);
+		BlockNumber	j;
+
+		*map = (*map == NULL) ? pgut_malloc(new_size * sizeof(BlockSource)) :
+								pgut_realloc(*map, new_size * sizeof(BlockSource));
+		for (j = *map_size; j < new_size; j++)
+			(*map)[j].version = -1;
+		*map_size = new_size;
+	}
+	(*map)[blknum].version = version;
+	(*map)[blknum].offset = offset;
+	(*map)[blknum].frame_first = frame_first;
+}
+
+/*
+ * Read the index of frames from the end of the file written with
+ * compression frames. Returns array of index->nframes entries.
+ */
+static BackupFrameIndexEntry *
+read_frame_index(FILE *in, pgFile *file, BackupFrameIndexHeader *index)
+{
+	BackupPageHeader header;
+	BackupFrameIndexEntry *frames;
+	int64		index_offset;
+
+	if (fseeko(in, -(off_t) sizeof(index_offset), SEEK_END) != 0 ||
+		fread(&index_offset, 1, sizeof(index_offset), in) != sizeof(index_offset) ||
+		fseeko(in, index_offset, SEEK_SET) != 0 ||
+		fread(&header, 1, sizeof(header), in) != sizeof(header) ||
+		fread(index, 1, sizeof(*index), in) != sizeof(*index))
+		elog(ERROR, "Cannot read index of frames of \"%s\": %s",
+			 file->path, strerror(errno));
+
+	if (header.compressed_size != PageIsFrameIndex)
+		elog(ERROR, "Index of frames of \"%s\" is broken", file->path);
+
+	frames = pgut_malloc(Max(index->nframes, 1) * sizeof(BackupFrameIndexEntry));
+	if (fread(frames, sizeof(BackupFrameIndexEntry), index->nframes, in) != index->nframes)
+		elog(ERROR, "Cannot read index of frames of \"%s\": %s",
+			 file->path, strerror(errno));
+
+	return frames;
+}
+
+/*
+ * Build the map of the latest version of each block of the file.
+ *
+ * files[] and backups[] are ordered from the oldest backup to the newest one,
+ * files[i] is NULL if the file is absent in backups[i]. We scan
+ * BackupPageHeaders of every version of the file, honouring truncation
+ * the same way restore_data_file() does when the chain is replayed backup
+ * by backup. *nblocks is set to the resulting size of the file in blocks,
+ * *last_file to the newest version of the file, NULL if there is none.
+ */
+static BlockSource *
+build_block_map(pgFile **files, pgBackup **backups, int nbackups,
+				BlockNumber *map_size, BlockNumber *nblocks,
+				bool *need_truncate, pgFile **last_file)
+{
+	FILE	   *in = NULL;
+	BlockSource *map = NULL;
+	int			i;
+
+	*map_size = 0;
+	*nblocks = 0;
+	*need_truncate = false;
+	*last_file = NULL;
+
+	/* Start from the oldest backup */
+	for (i = 0; i < nbackups; i++)
+	{
+		pgFile	   *file = files[i];
+		BackupPageHeader header;
+		BlockNumber	blknum = 0,
+					truncate_from = 0;
+		bool		truncated = false;
+
+		if (file == NULL)
+			continue;
+
+		if (file->write_size == BYTES_INVALID)
+		{
+			/* File didn`t change since previous backup */
+			if (backups[i]->backup_mode == BACKUP_MODE_DIFF_PAGE ||
+				backups[i]->backup_mode == BACKUP_MODE_DIFF_PTRACK)
+				continue;
+		}
+		else
+		{
+			in = fopen(file->path, PG_BINARY_R);
+			if (in == NULL)
+				elog(ERROR, "Cannot open backup file \"%s\": %s", file->path,
+					 strerror(errno));
+
+			/*
+			 * File with compression frames has the index of frames at
+			 * the end, so we don't have to scan the whole file.
+			 */
+			if (file->frame_size > 0)
+			{
+				BackupFrameIndexHeader index;
+				BackupFrameIndexEntry *frames;
+				uint32		k;
+
+				frames = read_frame_index(in, file, &index);
+				for (k = 0; k < index.nframes && !truncated; k++)
+				{
+					uint32		j;
+
+					for (j = 0; j < frames[k].nblocks; j++)
+					{
+						if (file->n_blocks != BLOCKNUM_INVALID &&
+							(blknum + 1) > file->n_blocks)
+						{
+							truncate_from = blknum;
+							truncated = true;
+							break;
+						}
+
+						blknum = frames[k].block + j;
+						block_map_set(&map, map_size, blknum, i,
+									  frames[k].offset, frames[k].block);
+						*nblocks = Max(*nblocks, blknum + 1);
+					}
+				}
+				pg_free(frames);
+
+				if (!truncated && file->n_blocks != BLOCKNUM_INVALID &&
+					(blknum + 1) > file->n_blocks)
+				{
+					truncate_from = blknum;
+					truncated = true;
+				}
+				if (!truncated && index.truncated_block != InvalidBlockNumber)
+				{
+					truncate_from = index.truncated_block;
+					truncated = true;
+				}
+			}
+
+			while (file->frame_size == 0)
+			{
+				size_t		read_len;
+				off_t		header_pos;
+
+				if (file->n_blocks != BLOCKNUM_INVALID &&
+					(blknum + 1) > file->n_blocks)
+				{
+					truncate_from = blknum;
+					truncated = true;
+					break;
+				}
+
+				header_pos = ftello(in);
+				read_len = fread(&header, 1, sizeof(header), in);
+				if (read_len != sizeof(header))
+				{
+					int errno_tmp = errno;
+					if (read_len == 0 && feof(in))
+						break;		/* EOF found */
+					else if (read_len != 0 && feof(in))
+						elog(ERROR,
+							 "Odd size page found at block %u of \"%s\"",
+							 blknum, file->path);
+					else
+						elog(ERROR, "Cannot read header of block %u of \"%s\": %s",
+							 blknum, file->path, strerror(errno_tmp));
+				}
+
+				if (header.block == 0 && header.compressed_size == 0)
+				{
+					elog(VERBOSE, "Skip empty block of \"%s\"", file->path);
+					continue;
+				}
+
+				if (header.block < blknum)
+					elog(ERROR, "Backup is broken at block %u of \"%s\"",
+						 blknum, file->path);
+
+				blknum = header.block;
+
+				if (header.compressed_size == PageIsTruncated)
+				{
+					truncate_from = blknum;
+					truncated = true;
+					break;
+				}
+
+				Assert(header.compressed_size <= BLCKSZ);
+
+				/* Remember the location of the block and skip its content */
+				block_map_set(&map, map_size, blknum, i, header_pos,
+							  InvalidBlockNumber);
+				*nblocks = Max(*nblocks, blknum + 1);
+
+				if (fseeko(in, MAXALIGN(header.compressed_size), SEEK_CUR) != 0)
+					elog(ERROR, "Cannot seek block %u of \"%s\": %s",
+						 blknum, file->path, strerror(errno));
+			}
+
+			fclose(in);
+			in = NULL;
+		}
+
+		*last_file = file;
+
+		/*
+		 * DELTA backup knows exact size of the file at the time of backup,
+		 * see restore_data_file().
+		 */
+		if (!truncated &&
+			backups[i]->backup_mode == BACKUP_MODE_DIFF_DELTA &&
+			file->n_blocks != BLOCKNUM_INVALID && *nblocks > file->n_blocks)
+		{
+			truncate_from = file->n_blocks;
+			truncated = true;
+		}
+
+		if (truncated)
+		{
+			BlockNumber	j;
+
+			/* Forget about blocks beyond the new end of file */
+			for (j = truncate_from; j < Min(*nblocks, *map_size); j++)
+				map[j].version = -1;
+			*nblocks = truncate_from;
+			*need_truncate = true;
+		}
+	}
+
+	return map;
+}
+
+static void
+free_block_map(BlockMap *bmap)
+{
+	if (bmap->map)
+		free(bmap->map);
+	pg_free(bmap);
+}
+
+/*
+ * Restore data file from the whole backup chain in one pass.
+ *
+ * files[] and backups[] are ordered from the FULL backup to the destination
+ * backup, files[i] is NULL if the file is absent in backups[i].
+ * At first we build a map of the latest version of each block, see
+ * build_block_map(). Then every block is read from its latest version
+ * and written exactly once.
+ *
+ * Only blocks of the task's range are restored. The map covers the whole
+ * file, so it is built by the range of a split file which comes first and
+ * shared with the other ranges instead of scanning all versions of the file
+ * for every range. The thread which finishes the last range of the file sets
+ * its length and permissions and frees the map.
+ */
+void
+restore_data_file_chain(const char *to_path, pgFile **files,
+						pgBackup **backups, int nbackups, FileTask *task)
+{
+	FILE	   *in = NULL;
+	FILE	   *out = NULL;
+	BlockMap   *bmap;
+	BlockSource *map;
+	BlockNumber	map_size;
+	pgFile	   *last_file = NULL;
+	bool		last_range;
+	struct stat	st;
+	char	   *frame_pages = NULL;
+	char	   *frame_buffer = NULL;
+	BlockNumber	end_block;
+	int			i;
+
+	if (file_task_get_shared(task, (void **) &bmap))
+	{
+		bmap = pgut_new(BlockMap);
+		bmap->map = build_block_map(files, backups, nbackups, &bmap->map_size,
+									&bmap->nblocks, &bmap->need_truncate,
+									&last_file);
+		bmap->found = (last_file != NULL);
+		bmap->mode = last_file ? last_file->mode : 0;
+		file_task_set_shared(task, bmap);
+	}
+
+	/* Nothing to restore */
+	if (!bmap->found)
+	{
+		if (file_task_finish(task))
+			free_block_map(bmap);
+		return;
+	}
+
+	map = bmap->map;
+	map_size = bmap->map_size;
+	end_block = Min(bmap->nblocks, task->end_block);
+
+	out = fio_fopen(to_path, PG_BINARY_R "+", FIO_DB_HOST);
+	if (out == NULL)
+		elog(ERROR, "Cannot open restore target file \"%s\": %s",
+			 to_path, strerror(errno));
+
+	/*
+	 * Copy blocks from every version of the file. Blocks of the same version
+	 * are read in ascending order, so reads are sequential within each file.
+	 */
+	for (i = 0; i < nbackups && map != NULL; i++)
+	{
+		pgFile	   *file = files[i];
+		uint32		backup_version;
+		BlockNumber	blknum;
+		off_t		frame_offset = -1;	/* offset of the frame in frame_pages */
+
+		for (blknum = task->start_block; blknum < end_block; blknum++)
+		{
+			BackupPageHeader header;
+			DataPage	compressed_page; /* used as read buffer */
+			DataPage	page;
+			int32		uncompressed_size = 0;
+			size_t		read_len;
+
+			if (blknum >= map_size || map[blknum].version != i)
+				continue;
+
+			if (in == NULL)
+			{
+				in = fopen(file->path, PG_BINARY_R);
+				if (in == NULL)
+					elog(ERROR, "Cannot open backup file \"%s\": %s", file->path,
+						 strerror(errno));
+				check_page_dictionary(file, ERROR);
+			}
+
+			/* check for interrupt */
+			if (interrupted || thread_interrupted)
+				elog(ERROR, "Interrupted during restore of \"%s\"", to_path);
+
+			/* Pages of one frame are decompressed together */
+			if (map[blknum].frame_first != InvalidBlockNumber)
+			{
+				if (frame_pages == NULL)
+				{
+					frame_pages = pgut_malloc(BACKUP_FRAME_MAX_BLOCKS * BLCKSZ);
+					frame_buffer = pgut_malloc(BACKUP_FRAME_MAX_BLOCKS * BLCKSZ);
+				}
+
+				if (frame_offset != map[blknum].offset)
+				{
+					if (fseeko(in, map[blknum].offset, SEEK_SET) != 0 ||
+						fread(&header, 1, sizeof(header), in) != sizeof(header))
+						elog(ERROR, "Cannot read header of frame at block %u of \"%s\": %s",
+							 blknum, file->path, strerror(errno));
+					if (header.compressed_size != PageIsFrame)
+						elog(ERROR, "Backup is broken at block %u of \"%s\"",
+							 blknum, file->path);
+
+					read_backup_frame(in, file, header.block, frame_pages,
+									  frame_buffer);
+					frame_offset = map[blknum].offset;
+				}
+
+				if (fio_fseek(out, (off_t) blknum * BLCKSZ) < 0)
+					elog(ERROR, "Cannot seek block %u of \"%s\": %s",
+						 blknum, to_path, strerror(errno));
+
+				if (fio_fwrite(out, frame_pages +
+							   (size_t) (blknum - map[blknum].frame_first) * BLCKSZ,
+							   BLCKSZ) != BLCKSZ)
+					elog(ERROR, "Cannot write block %u of \"%s\": %s",
+						 blknum, to_path, strerror(errno));
+				continue;
+			}
+
+			if (fseeko(in, map[blknum].offset, SEEK_SET) != 0 ||
+				fread(&header, 1, sizeof(header), in) != sizeof(header))
+				elog(ERROR, "Cannot read header of block %u of \"%s\": %s",
+					 blknum, file->path, strerror(errno));
+
+			read_len = fread(compressed_page.data, 1,
+							 MAXALIGN(header.compressed_size), in);
+			if (read_len != MAXALIGN(header.compressed_size))
+				elog(ERROR, "Cannot read block %u of \"%s\" read %zu of %d",
+					 blknum, file->path, read_len, header.compressed_size);
+
+			backup_version = parse_program_version(backups[i]->program_version);
+			if (header.compressed_size != BLCKSZ
+				|| page_may_be_compressed(compressed_page.data, file->compress_alg,
+										  backup_version))
+			{
+				const char *errormsg = NULL;
+
+				uncompressed_size = do_decompress(page.data, BLCKSZ,
+												  compressed_page.data,
+												  header.compressed_size,
+												  file->compress_alg, &errormsg);
+				if (uncompressed_size < 0 && errormsg != NULL)
+					elog(WARNING, "An error occured during decompressing block %u of file \"%s\": %s",
+						 blknum, file->path, errormsg);
+
+				if (uncompressed_size != BLCKSZ)
+					elog(ERROR, "Page of file \"%s\" uncompressed to %d bytes. != BLCKSZ",
+						 file->path, uncompressed_size);
+			}
+
+			if (fio_fseek(out, (off_t) blknum * BLCKSZ) < 0)
+				elog(ERROR, "Cannot seek block %u of \"%s\": %s",
+					 blknum, to_path, strerror(errno));
+
+			if (fio_fwrite(out, (uncompressed_size == BLCKSZ) ?
+						   page.data : compressed_page.data,
+						   BLCKSZ) != BLCKSZ)
+				elog(ERROR, "Cannot write block %u of \"%s\": %s",
+					 blknum, to_path, strerror(errno));
+		}
 
-	FIN_FILE_CRC32(true, file->crc);
+		if (in)
+		{
+			fclose(in);
+			in = NULL;
+		}
+	}
 
-	/*
-	 * If we have pagemap then file in the backup can't be a zero size.
-	 * Otherwise, we will clear the last file.
-	 */
-	if (n_blocks_read != 0 && n_blocks_read == n_blocks_skipped)
+	if (fio_fflush(out) != 0)
+		elog(ERROR, "Cannot write \"%s\": %s", to_path, strerror(errno));
+
+	/* Other ranges may free the shared map as soon as we are done */
+	last_range = file_task_finish(task);
+	if (last_range)
 	{
-		if (fio_unlink(to_path, FIO_BACKUP_HOST) == -1)
-			elog(ERROR, "cannot remove file \"%s\": %s", to_path,
-				 strerror(errno));
-		return false;
+		/*
+		 * Truncated blocks at the end of file are never written, so set
+		 * the file length explicitly.
+		 */
+		if (bmap->need_truncate &&
+			(fio_ffstat(out, &st) != 0 ||
+			 st.st_size != (off_t) bmap->nblocks * BLCKSZ))
+		{
+			if (fio_ftruncate(out, (off_t) bmap->nblocks * BLCKSZ) != 0)
+				elog(ERROR, "Cannot truncate \"%s\": %s",
+					 to_path, strerror(errno));
+			elog(VERBOSE, "Truncate file %s to block %u", to_path,
+				 bmap->nblocks);
+		}
+
+		/* update file permission */
+		if (fio_chmod(to_path, bmap->mode, FIO_DB_HOST) == -1)
+		{
+			int errno_tmp = errno;
+
+			fio_fclose(out);
+			elog(ERROR, "Cannot change mode of \"%s\": %s", to_path,
+				 strerror(errno_tmp));
+		}
 	}
 
-	return true;
+	if (fio_fclose(out))
+		elog(ERROR, "Cannot write \"%s\": %s", to_path, strerror(errno));
+
+	pg_free(frame_pages);
+	pg_free(frame_buffer);
+	if (last_range)
+		free_block_map(bmap);
 }
 
 /*
- * Restore files in the from_root directory to the to_root directory with
- * same relative path.
+ * Merge versions of the data file from the chain of backups without
+ * restoring them.
  *
- * If write_header is true then we add header to each restored block, currently
- * it is used for MERGE command.
+ * files[] and backups[] are ordered from the FULL backup to the destination
+ * backup, files[i] is NULL if the file is absent in backups[i]. Paths of
+ * the files must be absolute. The latest version of each block is found by
+ * build_block_map() and blocks are written to to_path in ascending order.
+ * Compressed pages and frames are copied as is if they are compressed with
+ * calg and can be read within the merged backup. Other pages are
+ * decompressed and compressed again. Pages are compressed in frames of
+ * frame_size blocks, if it is greater than 1.
+ * On return files[nbackups - 1] describes the merged file.
  */
 void
-restore_data_file(const char *to_path, pgFile *file, bool allow_truncate,
-				  bool write_header, uint32 backup_version)
+merge_data_file(const char *to_path, pgFile **files, pgBackup **backups,
+				int nbackups, CompressAlg calg, int clevel, uint32 frame_size)
 {
-	FILE	   *in = NULL;
-	FILE	   *out = NULL;
-	BackupPageHeader header;
-	BlockNumber	blknum = 0,
-				truncate_from = 0;
+	pgFile	   *result = files[nbackups - 1];
+	FILE	  **in;
+	CompressAlg *algs;
+	uint32	   *versions;
+	FILE	   *out;
+	BlockSource *map = NULL;
+	BlockNumber	map_size = 0;
+	BlockNumber	nblocks = 0;
+	BlockNumber	blknum;
+	pgFile	   *last_file = NULL;
 	bool		need_truncate = false;
-
-	/* BYTES_INVALID allowed only in case of restoring file from DELTA backup */
-	if (file->write_size != BYTES_INVALID)
+	BackupWriteBuffer wbuf;
+	char	   *frame_pages;
+	char	   *frame_buffer;
+	int			frame_version = -1;	/* frame decompressed into frame_pages */
+	off_t		frame_offset = -1;
+	int			i;
+
+	map = build_block_map(files, backups, nbackups, &map_size, &nblocks,
+						  &need_truncate, &last_file);
+
+	in = pgut_malloc(nbackups * sizeof(FILE *));
+	algs = pgut_malloc(nbackups * sizeof(CompressAlg));
+	versions = pgut_malloc(nbackups * sizeof(uint32));
+	for (i = 0; i < nbackups; i++)
 	{
-		/* open backup mode file for read */
-		in = fopen(file->path, PG_BINARY_R);
-		if (in == NULL)
-		{
-			elog(ERROR, "Cannot open backup file \"%s\": %s", file->path,
-				 strerror(errno));
-		}
+		in[i] = NULL;
+		algs[i] = files[i] ? files[i]->compress_alg : NOT_DEFINED_COMPRESS;
+		versions[i] = parse_program_version(backups[i]->program_version);
 	}
 
-	/*
-	 * Open backup file for write. 	We use "r+" at first to overwrite only
-	 * modified pages for differential restore. If the file does not exist,
-	 * re-open it with "w" to create an empty file.
-	 */
-	out = fio_fopen(to_path, PG_BINARY_R "+", FIO_DB_HOST);
+	out = fio_fopen(to_path, PG_BINARY_W, FIO_BACKUP_HOST);
 	if (out == NULL)
+		elog(ERROR, "Cannot open merge target file \"%s\": %s",
+			 to_path, strerror(errno));
+
+	/* The newest version describes the merged file from now on */
+	result->read_size = 0;
+	result->write_size = 0;
+	result->uncompressed_size = 0;
+	result->frame_size = 0;
+	result->dict_crc = 0;
+	INIT_FILE_CRC32(true, result->crc);
+
+	wbuf.out = out;
+	wbuf.data = pgut_malloc(BACKUP_WRITE_BUFFER_SIZE);
+	wbuf.len = 0;
+	wbuf.frame_size = 0;
+	wbuf.frame_pages = NULL;
+	wbuf.frame_buffer = NULL;
+	wbuf.frame_nblocks = 0;
+	frame_index_init(&wbuf.index);
+	if (frame_size > 1 &&
+		calg != NONE_COMPRESS && calg != NOT_DEFINED_COMPRESS)
 	{
-		int errno_tmp = errno;
-		fclose(in);
-		elog(ERROR, "Cannot open restore target file \"%s\": %s",
-			 to_path, strerror(errno_tmp));
+		wbuf.frame_size = frame_size;
+		wbuf.frame_pages = pgut_malloc((size_t) wbuf.frame_size * BLCKSZ);
+		wbuf.frame_buffer = pgut_malloc(BACKUP_FRAME_BUFFER_SIZE(wbuf.frame_size));
 	}
 
-	while (true)
+	frame_pages = pgut_malloc(BACKUP_FRAME_MAX_BLOCKS * BLCKSZ);
+	frame_buffer = pgut_malloc(BACKUP_FRAME_MAX_BLOCKS * BLCKSZ);
+
+	for (blknum = 0; blknum < nblocks; blknum++)
 	{
-		off_t		write_pos;
-		size_t		read_len;
+		BackupPageHeader header;
 		DataPage	compressed_page; /* used as read buffer */
 		DataPage	page;
-		int32		uncompressed_size = 0;
+		pgFile	   *file;
+		int			v;
+		size_t		read_len;
 
-		/* File didn`t changed. Nothing to copy */
-		if (file->write_size == BYTES_INVALID)
-			break;
+		/* check for interrupt */
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during merge of \"%s\"", result->path);
 
 		/*
-		 * We need to truncate result file if data file in an incremental backup
-		 * less than data file in a full backup. We know it thanks to n_blocks.
-		 *
-		 * It may be equal to -1, then we don't want to truncate the result
-		 * file.
+		 * The block is absent in both versions, it would be restored as
+		 * zeroes, so store zero page.
 		 */
-		if (file->n_blocks != BLOCKNUM_INVALID &&
-			(blknum + 1) > file->n_blocks)
+		if (blknum >= map_size || map[blknum].version < 0)
 		{
-			truncate_from = blknum;
-			need_truncate = true;
-			break;
+			MemSet(page.data, 0, BLCKSZ);
+			compress_and_backup_page(result, blknum, NULL, &wbuf,
+									 &result->crc, 0, page.data,
+									 calg, clevel);
+			continue;
 		}
 
-		/* read BackupPageHeader */
-		read_len = fread(&header, 1, sizeof(header), in);
-		if (read_len != sizeof(header))
+		v = map[blknum].version;
+		file = files[v];
+
+		if (in[v] == NULL)
 		{
-			int errno_tmp = errno;
-			if (read_len == 0 && feof(in))
-				break;		/* EOF found */
-			else if (read_len != 0 && feof(in))
-				elog(ERROR,
-					 "Odd size page found at block %u of \"%s\"",
-					 blknum, file->path);
-			else
-				elog(ERROR, "Cannot read header of block %u of \"%s\": %s",
-					 blknum, file->path, strerror(errno_tmp));
+			in[v] = fopen(file->path, PG_BINARY_R);
+			if (in[v] == NULL)
+				elog(ERROR, "Cannot open backup file \"%s\": %s", file->path,
+					 strerror(errno));
+			check_page_dictionary(file, ERROR);
 		}
 
-		if (header.block == 0 && header.compressed_size == 0)
+		if (map[blknum].frame_first != InvalidBlockNumber)
 		{
-			elog(VERBOSE, "Skip empty block of \"%s\"", file->path);
-			continue;
-		}
+			BackupFrameHeader frame_header;
+			BlockNumber	n = 0;
 
-		if (header.block < blknum)
-			elog(ERROR, "Backup is broken at block %u of \"%s\"",
-				 blknum, file->path);
+			if (frame_version != v || frame_offset != map[blknum].offset)
+			{
+				if (fseeko(in[v], map[blknum].offset, SEEK_SET) != 0 ||
+					fread(&header, 1, sizeof(header), in[v]) != sizeof(header))
+					elog(ERROR, "Cannot read header of frame at block %u of \"%s\": %s",
+						 blknum, file->path, strerror(errno));
+				if (header.compressed_size != PageIsFrame)
+					elog(ERROR, "Backup is broken at block %u of \"%s\"",
+						 blknum, file->path);
+
+				read_frame_data(in[v], file, header.block, &frame_header,
+								frame_buffer);
+
+				/* Count blocks of the frame which are still the latest ones */
+				while (blknum + n < nblocks && blknum + n < map_size &&
+					   map[blknum + n].version == v &&
+					   map[blknum + n].offset == map[blknum].offset)
+					n++;
+
+				/*
+				 * Copy the whole frame as is, if none of its blocks is
+				 * overwritten or truncated, and pages are compressed the same
+				 * way. Pages of the FULL backup may refer to its compression
+				 * dictionary, which stays with the merged backup.
+				 */
+				if (wbuf.frame_size > 0 &&
+					header.block == blknum && frame_header.nblocks == n &&
+					(frame_header.compressed_size == (int32) (n * BLCKSZ) ||
+					 (algs[v] == calg &&
+					  (v == 0 ||
+					   !compressed_with_dictionary(frame_buffer,
+												   frame_header.compressed_size,
+												   algs[v])))))
+				{
+					flush_backup_frame(result, NULL, &wbuf, &result->crc,
+									   calg, clevel);
+					frame_index_add(&wbuf.index, blknum, n,
+									result->write_size);
+					if (v == 0)
+						result->dict_crc = file->dict_crc;
+					append_backup_buffer(result, NULL, &wbuf, &result->crc,
+										 (char *) &header, sizeof(header));
+					append_backup_buffer(result, NULL, &wbuf, &result->crc,
+										 (char *) &frame_header,
+										 sizeof(frame_header));
+					append_backup_buffer(result, NULL, &wbuf, &result->crc,
+										 frame_buffer,
+										 MAXALIGN(frame_header.compressed_size));
+
+					result->compress_alg = calg;
+					result->read_size += (int64) n * BLCKSZ;
+					result->uncompressed_size += (int64) n * BLCKSZ;
+
+					blknum += n - 1;
+					continue;
+				}
 
-		blknum = header.block;
+				decompress_frame(file, header.block, algs[v], &frame_header,
+								 frame_buffer, frame_pages);
 
-		if (header.compressed_size == PageIsTruncated)
-		{
-			/*
-			 * Backup contains information that this block was truncated.
-			 * We need to truncate file to this length.
-			 */
-			truncate_from = blknum;
-			need_truncate = true;
-			break;
+				frame_version = v;
+				frame_offset = map[blknum].offset;
+			}
+
+			compress_and_backup_page(result, blknum, NULL, &wbuf,
+									 &result->crc, 0,
+									 frame_pages +
+									 (size_t) (blknum - map[blknum].frame_first) * BLCKSZ,
+									 calg, clevel);
+			continue;
 		}
 
-		Assert(header.compressed_size <= BLCKSZ);
+		if (fseeko(in[v], map[blknum].offset, SEEK_SET) != 0 ||
+			fread(&header, 1, sizeof(header), in[v]) != sizeof(header))
+			elog(ERROR, "Cannot read header of block %u of \"%s\": %s",
+				 blknum, file->path, strerror(errno));
 
-		/* read a page from file */
 		read_len = fread(compressed_page.data, 1,
-			MAXALIGN(header.compressed_size), in);
+						 MAXALIGN(header.compressed_size), in[v]);
 		if (read_len != MAXALIGN(header.compressed_size))
 			elog(ERROR, "Cannot read block %u of \"%s\" read %zu of %d",
-				blknum, file->path, read_len, header.compressed_size);
+				 blknum, file->path, read_len, header.compressed_size);
 
 		/*
-		 * if page size is smaller than BLCKSZ, decompress the page.
-		 * BUGFIX for versions < 2.0.23: if page size is equal to BLCKSZ.
-		 * we have to check, whether it is compressed or not using
-		 * page_may_be_compressed() function.
+		 * Copy the page as is, if it is compressed the same way or isn't
+		 * compressed at all. Pages stored as is by versions prior to 2.0.23
+		 * may be compressed in fact, see page_may_be_compressed().
 		 */
+		if (wbuf.frame_size == 0 &&
+			(header.compressed_size == BLCKSZ ?
+			 versions[v] >= 20023 :
+			 (algs[v] == calg &&
+			  (v == 0 ||
+			   !compressed_with_dictionary(compressed_page.data,
+										   header.compressed_size,
+										   algs[v])))))
+		{
+			append_backup_buffer(result, NULL, &wbuf, &result->crc,
+								 (char *) &header, sizeof(header));
+			append_backup_buffer(result, NULL, &wbuf, &result->crc,
+								 compressed_page.data,
+								 MAXALIGN(header.compressed_size));
+			if (v == 0)
+				result->dict_crc = file->dict_crc;
+
+			result->compress_alg = calg;
+			result->read_size += BLCKSZ;
+			result->uncompressed_size += BLCKSZ;
+			continue;
+		}
+
 		if (header.compressed_size != BLCKSZ
-			|| page_may_be_compressed(compressed_page.data, file->compress_alg,
-									  backup_version))
+			|| page_may_be_compressed(compressed_page.data, algs[v],
+									  versions[v]))
 		{
 			const char *errormsg = NULL;
+			int32		uncompressed_size;
 
 			uncompressed_size = do_decompress(page.data, BLCKSZ,
 											  compressed_page.data,
 											  header.compressed_size,
-											  file->compress_alg, &errormsg);
+											  algs[v], &errormsg);
 			if (uncompressed_size < 0 && errormsg != NULL)
 				elog(WARNING, "An error occured during decompressing block %u of file \"%s\": %s",
 					 blknum, file->path, errormsg);
@@ -869,85 +2860,39 @@ restore_data_file(const char *to_path, pgFile *file, bool allow_truncate,
 				elog(ERROR, "Page of file \"%s\" uncompressed to %d bytes. != BLCKSZ",
 					 file->path, uncompressed_size);
 		}
-
-		write_pos = (write_header) ? blknum * (BLCKSZ + sizeof(header)) :
-									 blknum * BLCKSZ;
-
-		/*
-		 * Seek and write the restored page.
-		 */
-		if (fio_fseek(out, write_pos) < 0)
-			elog(ERROR, "Cannot seek block %u of \"%s\": %s",
-				 blknum, to_path, strerror(errno));
-
-		if (write_header)
-		{
-			/* We uncompressed the page, so its size is BLCKSZ */
-			header.compressed_size = BLCKSZ;
-			if (fio_fwrite(out, &header, sizeof(header)) != sizeof(header))
-				elog(ERROR, "Cannot write header of block %u of \"%s\": %s",
-					 blknum, file->path, strerror(errno));
-		}
-
-		/* if we uncompressed the page - write page.data,
-		 * if page wasn't compressed -
-		 * write what we've read - compressed_page.data
-		 */
-		if (uncompressed_size == BLCKSZ)
-		{
-			if (fio_fwrite(out, page.data, BLCKSZ) != BLCKSZ)
-				elog(ERROR, "Cannot write block %u of \"%s\": %s",
-					 blknum, file->path, strerror(errno));
-		}
 		else
-		{
-			if (fio_fwrite(out, compressed_page.data, BLCKSZ) != BLCKSZ)
-				elog(ERROR, "Cannot write block %u of \"%s\": %s",
-					 blknum, file->path, strerror(errno));
-		}
-	}
+			memcpy(page.data, compressed_page.data, BLCKSZ);
 
-	/*
-	 * DELTA backup have no knowledge about truncated blocks as PAGE or PTRACK do
-	 * But during DELTA backup we read every file in PGDATA and thus DELTA backup
-	 * knows exact size of every file at the time of backup.
-	 * So when restoring file from DELTA backup we, knowing it`s size at
-	 * a time of a backup, can truncate file to this size.
-	 */
-	if (allow_truncate && file->n_blocks != BLOCKNUM_INVALID && !need_truncate)
-	{
-		struct stat st;
-		if (fio_ffstat(out, &st) == 0 && st.st_size > file->n_blocks * BLCKSZ)
-		{
-			truncate_from = file->n_blocks;
-			need_truncate = true;
-		}
+		compress_and_backup_page(result, blknum, NULL, &wbuf,
+								 &result->crc, 0, page.data,
+								 calg, clevel);
 	}
 
-	if (need_truncate)
-	{
-		off_t		write_pos;
-
-		write_pos = (write_header) ? truncate_from * (BLCKSZ + sizeof(header)) :
-									 truncate_from * BLCKSZ;
+	finish_backup_frames(result, NULL, &wbuf, &result->crc, calg, clevel);
+	flush_backup_buffer(result, NULL, &wbuf);
 
-		/*
-		 * Truncate file to this length.
-		 */
-		if (fio_ftruncate(out, write_pos) != 0)
-			elog(ERROR, "Cannot truncate \"%s\": %s",
-				 file->path, strerror(errno));
-		elog(VERBOSE, "Delta truncate file %s to block %u",
-			 file->path, truncate_from);
+	for (i = 0; i < nbackups; i++)
+	{
+		if (in[i])
+			fclose(in[i]);
 	}
+	pg_free(in);
+	pg_free(algs);
+	pg_free(versions);
+	pg_free(wbuf.data);
+	pg_free(wbuf.frame_pages);
+	pg_free(wbuf.frame_buffer);
+	frame_index_free(&wbuf.index);
+	pg_free(frame_pages);
+	pg_free(frame_buffer);
+	if (map)
+		free(map);
 
 	/* update file permission */
-	if (fio_chmod(to_path, file->mode, FIO_DB_HOST) == -1)
+	if (fio_chmod(to_path, FILE_PERMISSION, FIO_BACKUP_HOST) == -1)
 	{
 		int errno_tmp = errno;
 
-		if (in)
-			fclose(in);
 		fio_fclose(out);
 		elog(ERROR, "Cannot change mode of \"%s\": %s", to_path,
 			 strerror(errno_tmp));
@@ -957,8 +2902,8 @@ restore_data_file(const char *to_path, pgFile *file, bool allow_truncate,
 		fio_fclose(out))
 		elog(ERROR, "Cannot write \"%s\": %s", to_path, strerror(errno));
 
-	if (in)
-		fclose(in);
+	FIN_FILE_CRC32(true, result->crc);
+	result->compress_alg = calg;
 }
 
 /*
@@ -1159,12 +3104,8 @@ validate_one_page(Page page, pgFile *file,
 
 	if (PageIsNew(page))
 	{
-		int			i;
-
 		/* Check if the page is zeroed. */
-		for(i = 0; i < BLCKSZ && page[i] == 0; i++);
-
-		if (i == BLCKSZ)
+		if (page_is_zero(page))
 		{
 			elog(LOG, "File: %s blknum %u, page is New, empty zeroed page",
 				 file->path, blknum);
@@ -1235,13 +3176,16 @@ validate_one_page(Page page, pgFile *file,
 
 /*
  * Valiate pages of datafile in PGDATA one by one.
+ * Only blocks from start_block up to end_block are checked, end_block is
+ * InvalidBlockNumber to check the file till the end.
  *
  * returns true if the file is valid
  * also returns true if the file was not found
  */
 bool
-check_data_file(ConnectionArgs *arguments,
-				pgFile *file, uint32 checksum_version)
+check_data_file(ConnectionArgs *arguments, pgFile *file,
+				uint32 checksum_version, BlockNumber start_block,
+				BlockNumber end_block)
 {
 	FILE		*in;
 	BlockNumber	blknum = 0;
@@ -1250,6 +3194,7 @@ check_data_file(ConnectionArgs *arguments,
 	int			page_state;
 	char		curr_page[BLCKSZ];
 	bool 		is_valid = true;
+	PageReadBuffer *rbuf;
 
 	in = fopen(file->path, PG_BINARY_R);
 	if (in == NULL)
@@ -1269,7 +3214,8 @@ check_data_file(ConnectionArgs *arguments,
 		return false;
 	}
 
-	if (file->size % BLCKSZ != 0)
+	/* Warn about the file only once, if it is checked by ranges */
+	if (file->size % BLCKSZ != 0 && end_block == InvalidBlockNumber)
 		elog(WARNING, "File: \"%s\", invalid file size %zu", file->path, file->size);
 
 	/*
@@ -1278,11 +3224,15 @@ check_data_file(ConnectionArgs *arguments,
 	 * since the moment we computed it.
 	 */
 	nblocks = file->size/BLCKSZ;
+	if (end_block != InvalidBlockNumber)
+		nblocks = Min(nblocks, end_block);
+	rbuf = page_read_buffer_new(nblocks > start_block ? nblocks - start_block : 0,
+								InvalidXLogRecPtr);
 
-	for (blknum = 0; blknum < nblocks; blknum++)
+	for (blknum = start_block; blknum < nblocks; blknum++)
 	{
 		page_state = prepare_page(arguments, file, InvalidXLogRecPtr,
-									blknum, nblocks, in, &n_blocks_skipped,
+									blknum, nblocks, in, rbuf, &n_blocks_skipped,
 									BACKUP_MODE_FULL, curr_page, false, checksum_version,
 									0, NULL);
 
@@ -1312,6 +3262,7 @@ check_data_file(ConnectionArgs *arguments,
 		}
 	}
 
+	page_read_buffer_free(rbuf);
 	fclose(in);
 	return is_valid;
 }
@@ -1326,6 +3277,8 @@ check_file_pages(pgFile *file, XLogRecPtr stop_lsn, uint32 checksum_version,
 	FILE		*in;
 	pg_crc32	crc;
 	bool		use_crc32c = backup_version <= 20021 || backup_version >= 20025;
+	char	   *frame_pages = NULL;
+	char	   *frame_buffer = NULL;
 
 	elog(VERBOSE, "Validate relation blocks for file \"%s\"", file->path);
 
@@ -1342,6 +3295,12 @@ check_file_pages(pgFile *file, XLogRecPtr stop_lsn, uint32 checksum_version,
 			 file->path, strerror(errno));
 	}
 
+	if (!check_page_dictionary(file, WARNING))
+	{
+		fclose(in);
+		return false;
+	}
+
 	/* calc CRC of backup file */
 	INIT_FILE_CRC32(use_crc32c, crc);
 
@@ -1381,6 +3340,17 @@ check_file_pages(pgFile *file, XLogRecPtr stop_lsn, uint32 checksum_version,
 			continue;
 		}
 
+		/*
+		 * Index of frames ends the file, it only contributes to CRC.
+		 * Its header has block 0, so check it before the order of blocks.
+		 */
+		if (header.compressed_size == PageIsFrameIndex)
+		{
+			while ((read_len = fread(compressed_page.data, 1, BLCKSZ, in)) > 0)
+				COMP_FILE_CRC32(use_crc32c, crc, compressed_page.data, read_len);
+			break;
+		}
+
 		if (header.block < blknum)
 		{
 			elog(WARNING, "Backup is broken at block %u of \"%s\"",
@@ -1397,6 +3367,75 @@ check_file_pages(pgFile *file, XLogRecPtr stop_lsn, uint32 checksum_version,
 			continue;
 		}
 
+		if (header.compressed_size == PageIsFrame)
+		{
+			BackupFrameHeader frame_header;
+			size_t		size;
+			int32		uncompressed_size;
+			const char *errormsg = NULL;
+			uint32		i;
+
+			if (frame_pages == NULL)
+			{
+				frame_pages = pgut_malloc(BACKUP_FRAME_MAX_BLOCKS * BLCKSZ);
+				frame_buffer = pgut_malloc(BACKUP_FRAME_MAX_BLOCKS * BLCKSZ);
+			}
+
+			read_len = fread(&frame_header, 1, sizeof(frame_header), in);
+			size = (size_t) frame_header.nblocks * BLCKSZ;
+			if (read_len != sizeof(frame_header) ||
+				frame_header.nblocks == 0 ||
+				frame_header.nblocks > BACKUP_FRAME_MAX_BLOCKS ||
+				frame_header.compressed_size <= 0 ||
+				frame_header.compressed_size > size)
+			{
+				elog(WARNING, "Invalid header of frame at block %u of \"%s\"",
+					 blknum, file->path);
+				is_valid = false;
+				break;
+			}
+			COMP_FILE_CRC32(use_crc32c, crc, &frame_header, read_len);
+
+			read_len = fread(frame_buffer, 1,
+							 MAXALIGN(frame_header.compressed_size), in);
+			if (read_len != MAXALIGN(frame_header.compressed_size))
+			{
+				elog(WARNING, "Cannot read frame at block %u of \"%s\" read %zu of %d",
+					 blknum, file->path, read_len, frame_header.compressed_size);
+				is_valid = false;
+				break;
+			}
+			COMP_FILE_CRC32(use_crc32c, crc, frame_buffer, read_len);
+
+			if (frame_header.compressed_size == size)
+				memcpy(frame_pages, frame_buffer, size);
+			else
+			{
+				uncompressed_size = do_decompress(frame_pages, size, frame_buffer,
+												  frame_header.compressed_size,
+												  file->compress_alg, &errormsg);
+				if (uncompressed_size != size)
+				{
+					if (errormsg != NULL)
+						elog(WARNING, "An error occured during decompressing frame at block %u of file \"%s\": %s",
+							 blknum, file->path, errormsg);
+					elog(WARNING, "Frame at block %u of file \"%s\" uncompressed to %d bytes. != %zu",
+						 blknum, file->path, uncompressed_size, size);
+					is_valid = false;
+					break;
+				}
+			}
+
+			for (i = 0; i < frame_header.nblocks; i++)
+			{
+				if (validate_one_page(frame_pages + (size_t) i * BLCKSZ, file,
+									  blknum + i, stop_lsn,
+									  checksum_version) == PAGE_IS_FOUND_AND_NOT_VALID)
+					is_valid = false;
+			}
+			continue;
+		}
+
 		Assert(header.compressed_size <= BLCKSZ);
 
 		read_len = fread(compressed_page.data, 1,
@@ -1450,6 +3489,8 @@ check_file_pages(pgFile *file, XLogRecPtr stop_lsn, uint32 checksum_version,
 		}
 	}
 
+	pg_free(frame_pages);
+	pg_free(frame_buffer);
 	FIN_FILE_CRC32(use_crc32c, crc);
 	fclose(in);
 
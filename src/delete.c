@@ -522,35 +522,44 @@ do_retention_merge(parray *backup_list, parray *to_keep_list, parray *to_purge_l
 		 * 2 PAGE1
 		 * 3 FULL
 		 *
-		 * Consequentially merge incremental backups from PAGE1 to PAGE3
-		 * into FULL.
+		 * Merge incremental backups from PAGE1 to PAGE3 into FULL in one pass.
 		 */
 
-		for (j = parray_num(merge_list) - 2; j >= 0; j--)
-		{
-			pgBackup   *from_backup = (pgBackup *) parray_get(merge_list, j);
-
+		/* Consider this extreme case */
+		//  PAGEa1    PAGEb1   both valid
+		//      \     /
+		//        FULL
 
-			/* Consider this extreme case */
-			//  PAGEa1    PAGEb1   both valid
-			//      \     /
-			//        FULL
+		/* Check that FULL backup and intermediate backups do not have
+		 * multiple descendants, the chain can be merged only up to the
+		 * first backup which has them.
+		 */
+		for (j = parray_num(merge_list) - 1; j > 0; j--)
+		{
+			pgBackup   *backup = (pgBackup *) parray_get(merge_list, j);
 
-			/* Check that FULL backup do not has multiple descendants
-			 * full_backup always point to current full_backup after merge
-			 */
-			if (is_prolific(backup_list, full_backup))
+			if (is_prolific(backup_list, backup))
 			{
 				elog(WARNING, "Backup %s has multiple valid descendants. "
-						"Automatic merge is not possible.", base36enc(full_backup->start_time));
+						"Automatic merge is not possible.", base36enc(backup->start_time));
 				break;
 			}
+		}
+
+		/* Exclude backups which cannot be merged */
+		while (j-- > 0)
+			parray_remove(merge_list, 0);
 
-			merge_backups(full_backup, from_backup);
+		if (parray_num(merge_list) > 1)
+		{
+			merge_chain(merge_list,
+						((pgBackup *) parray_get(merge_list, 0))->start_time);
 			backup_merged = true;
 
-			/* Try to remove merged incremental backup from both keep and purge lists */
-			parray_rm(to_purge_list, from_backup, pgBackupCompareId);
+			/* Remove merged incremental backups from both keep and purge lists */
+			for (j = 0; j < parray_num(merge_list) - 1; j++)
+				parray_rm(to_purge_list, parray_get(merge_list, j),
+						  pgBackupCompareId);
 			parray_set(to_keep_list, i, NULL);
 		}
 
@@ -947,6 +956,8 @@ delete_walfiles_in_tli(XLogRecPtr keep_lsn, timelineInfo *tlinfo,
 					elog(VERBOSE, "Removed partial WAL segment \"%s\"", wal_file->file.path);
 				else if (wal_file->type == BACKUP_HISTORY_FILE)
 					elog(VERBOSE, "Removed backup history file \"%s\"", wal_file->file.path);
+				else if (wal_file->type == WAL_SUMMARY_FILE)
+					elog(VERBOSE, "Removed WAL summary file \"%s\"", wal_file->file.path);
 			}
 
 			wal_deleted = true;
@@ -1009,6 +1020,24 @@ do_delete_instance(void)
 			strerror(errno));
 	}
 
+	/* Delete backup catalog index */
+	snprintf(instance_config_path, MAXPGPATH, "%s/%s/.%s.%s", backup_path,
+			 BACKUPS_DIR, instance_name, BACKUP_CATALOG_INDEX);
+	if (remove(instance_config_path) && errno != ENOENT)
+	{
+		elog(ERROR, "Can't remove \"%s\": %s", instance_config_path,
+			strerror(errno));
+	}
+
+	/* Delete cached listing of WAL archive */
+	snprintf(instance_config_path, MAXPGPATH, "%s/%s/.%s.%s", backup_path,
+			 "wal", instance_name, BACKUP_CATALOG_INDEX);
+	if (remove(instance_config_path) && errno != ENOENT)
+	{
+		elog(ERROR, "Can't remove \"%s\": %s", instance_config_path,
+			strerror(errno));
+	}
+
 	/* Delete instance root directories */
 	if (rmdir(backup_instance_path) != 0)
 		elog(ERROR, "Can't remove \"%s\": %s", backup_instance_path,
@@ -17,11 +17,35 @@
 #endif
 #include "catalog/pg_tablespace.h"
 
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 
 #include "utils/configuration.h"
+#include "utils/thread.h"
+
+/* Size of buffer for reading files to calculate their CRC */
+#define CRC_READ_BUFFER_SIZE	(64 * 1024)
+/* Minimal size of file range checksummed by separate thread */
+#define CRC_PARALLEL_MIN_RANGE	(4 * 1024 * 1024)
+
+typedef struct
+{
+	const char *path;
+	off_t		offset;
+	size_t		len;		/* in: size of the range, out: bytes read */
+	pg_crc32c	crc;		/* raw CRC-32C of the range started from zero */
+
+	/*
+	 * Return value from the thread.
+	 * 0 means there is no error, 1 - there is an error.
+	 */
+	int			ret;
+} crc_range_arg;
 
 /*
  * The contents of these directories are removed or recreated during server
@@ -121,14 +145,68 @@ typedef struct TablespaceCreatedList
 	TablespaceCreatedListCell *tail;
 } TablespaceCreatedList;
 
+/* Parameters of directory listing and directories waiting to be listed */
+typedef struct
+{
+	bool		exclude;
+	bool		follow_symlink;
+	int			external_dir_num;
+	fio_location location;
+
+	parray	   *dirs;			/* directories waiting to be listed */
+	int			nbusy;			/* threads listing a directory right now */
+} dir_list_state;
+
+/* Context of fio_list_dir() callback */
+typedef struct
+{
+	dir_list_state *state;
+	pgFile	   *parent;
+	parray	   *files;
+	parray	   *subdirs;		/* listed directories to descend into */
+} dir_list_context;
+
+typedef struct
+{
+	dir_list_state *state;
+	parray	   *files;			/* files found by the thread */
+
+	/*
+	 * Return value from the thread.
+	 * 0 means there is no error, 1 - there is an error.
+	 */
+	int			ret;
+} dir_list_arg;
+
+/* Buffered reader of text file list opened with fio_open() */
+typedef struct
+{
+	int			fd;
+	const char *path;
+	char		buf[BLCKSZ * 8];
+	size_t		pos;			/* next byte of buf to return */
+	size_t		len;			/* bytes in buf */
+} FileListReader;
+
+/* Protects dir_list_state of the parallel listing */
+static pthread_mutex_t dir_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static int pgCompareString(const void *str1, const void *str2);
 
+static void pgFileSetName(pgFile *file);
 static char dir_check_file(pgFile *file);
-static void dir_list_file_internal(parray *files, pgFile *parent, bool exclude,
-								   bool follow_symlink,
-								   int external_dir_num, fio_location location);
+static void dir_list_one(dir_list_state *state, pgFile *parent, parray *files,
+						 parray *subdirs);
+static void dir_list_file_internal(parray *files, pgFile *parent,
+								   dir_list_state *state);
+static void dir_list_parallel(parray *files, dir_list_state *state);
 static void opt_path_map(ConfigOption *opt, const char *arg,
 						 TablespaceList *list, const char *type);
+static FileListMap *file_list_map_open_fd(const char *root,
+										  const char *external_prefix,
+										  const char *file_txt, int fd,
+										  FileListHeader *hdr,
+										  fio_location location);
 
 /* Tablespace mapping */
 static TablespaceList tablespace_dirs = {NULL, NULL};
@@ -190,30 +268,25 @@ pgFile *
 pgFileInit(const char *path, const char *rel_path)
 {
 	pgFile	   *file;
-	char	   *file_name = NULL;
+	size_t		path_len = strlen(path) + 1;
+	size_t		rel_path_len = strlen(rel_path) + 1;
 
-	file = (pgFile *) pgut_malloc(sizeof(pgFile));
+	/*
+	 * Paths are stored in the same chunk right after the structure, so that
+	 * the file costs one allocation and one free.
+	 */
+	file = (pgFile *) pgut_malloc(sizeof(pgFile) + path_len + rel_path_len);
 	MemSet(file, 0, sizeof(pgFile));
 
-	file->forkName = pgut_malloc(MAXPGPATH);
-	file->forkName[0] = '\0';
-
-	file->path = pgut_strdup(path);
+	file->path = (char *) (file + 1);
+	memcpy(file->path, path, path_len);
 	canonicalize_path(file->path);
 
-	file->rel_path = pgut_strdup(rel_path);
+	file->rel_path = file->path + path_len;
+	memcpy(file->rel_path, rel_path, rel_path_len);
 	canonicalize_path(file->rel_path);
 
-	/* Get file name from the path */
-	file_name = pgut_strdup(last_dir_separator(file->path));
-
-	if (file_name == NULL)
-		file->name = file->path;
-	else
-	{
-		file_name++;
-		file->name = file_name;
-	}
+	pgFileSetName(file);
 
 	/* Number of blocks readed during backup */
 	file->n_blocks = BLOCKNUM_INVALID;
@@ -221,6 +294,34 @@ pgFileInit(const char *path, const char *rel_path)
 	return file;
 }
 
+/*
+ * Replace the absolute path of the file. The new path may point into the
+ * old one.
+ */
+void
+pgFileSetPath(pgFile *file, const char *path)
+{
+	char	   *prev_path = file->path;
+
+	file->path = pgut_strdup(path);
+	pgFileSetName(file);
+
+	if (prev_path != (char *) (file + 1))
+		pfree(prev_path);
+}
+
+/* Get file name from the path */
+static void
+pgFileSetName(pgFile *file)
+{
+	char	   *file_name = last_dir_separator(file->path);
+
+	if (file_name == NULL)
+		file->name = file->path;
+	else
+		file->name = file_name + 1;
+}
+
 /*
  * Delete file pointed by the pgFile.
  * If the pgFile points directory, the directory must be empty.
@@ -263,7 +364,7 @@ pgFileGetCRC(const char *file_path, bool use_crc32c, bool raise_on_deleted,
 {
 	FILE	   *fp;
 	pg_crc32	crc = 0;
-	char		buf[1024];
+	char	   *buf;
 	size_t		len = 0;
 	size_t		total = 0;
 	int			errno_tmp;
@@ -284,13 +385,15 @@ pgFileGetCRC(const char *file_path, bool use_crc32c, bool raise_on_deleted,
 				file_path, strerror(errno));
 	}
 
+	buf = pgut_malloc(CRC_READ_BUFFER_SIZE);
+
 	/* calc CRC of file */
 	for (;;)
 	{
 		if (interrupted)
 			elog(ERROR, "interrupted during CRC calculation");
 
-		len = fio_fread(fp, buf, sizeof(buf));
+		len = fio_fread(fp, buf, CRC_READ_BUFFER_SIZE);
 		if(len == 0)
 			break;
 		/* update CRC */
@@ -308,6 +411,134 @@ pgFileGetCRC(const char *file_path, bool use_crc32c, bool raise_on_deleted,
 
 	FIN_FILE_CRC32(use_crc32c, crc);
 	fio_fclose(fp);
+	pg_free(buf);
+
+	return crc;
+}
+
+/*
+ * Calculate CRC-32C of the range of local file.
+ */
+static void *
+crc_range_worker(void *arg)
+{
+	crc_range_arg *arguments = (crc_range_arg *) arg;
+	char	   *buf;
+	off_t		offset = arguments->offset;
+	size_t		left = arguments->len;
+	int			fd;
+
+	fd = open(arguments->path, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+		elog(ERROR, "cannot open file \"%s\": %s",
+			 arguments->path, strerror(errno));
+
+	buf = pgut_malloc(CRC_READ_BUFFER_SIZE);
+	arguments->crc = 0;
+
+	while (left > 0)
+	{
+		ssize_t		rc;
+
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "interrupted during CRC calculation");
+
+		rc = pread(fd, buf, Min(left, CRC_READ_BUFFER_SIZE), offset);
+		if (rc < 0)
+			elog(ERROR, "cannot read \"%s\": %s",
+				 arguments->path, strerror(errno));
+		/* File was truncated meanwhile */
+		if (rc == 0)
+			break;
+
+		arguments->crc = crc32c_update(arguments->crc, buf, rc);
+		offset += rc;
+		left -= rc;
+	}
+
+	arguments->len -= left;
+	close(fd);
+	pg_free(buf);
+
+	arguments->ret = 0;
+
+	return NULL;
+}
+
+/*
+ * Same as pgFileGetCRC() with CRC-32C, but a large local file is split
+ * into num_threads ranges, which are checksummed in parallel. CRC of the
+ * ranges are merged by crc32c_combine().
+ * Should be called only from the main thread, when no other threads run:
+ * a failed range worker sets thread_interrupted, which stops the rest.
+ */
+pg_crc32
+pgFileGetCRCParallel(const char *file_path, bool raise_on_deleted,
+					 size_t *bytes_read, fio_location location)
+{
+	struct stat st;
+	pthread_t  *threads;
+	crc_range_arg *threads_args;
+	size_t		range;
+	size_t		total = 0;
+	int			nworkers;
+	int			i;
+	bool		error = false;
+	pg_crc32	crc;
+
+	/* Small, remote or missing files are processed by single pass */
+	if (num_threads <= 1 || fio_is_remote(location) ||
+		stat(file_path, &st) != 0 || !S_ISREG(st.st_mode))
+		return pgFileGetCRC(file_path, true, raise_on_deleted, bytes_read,
+							location);
+
+	nworkers = Min(num_threads, st.st_size / CRC_PARALLEL_MIN_RANGE);
+	if (nworkers <= 1)
+		return pgFileGetCRC(file_path, true, raise_on_deleted, bytes_read,
+							location);
+
+	range = st.st_size / nworkers;
+
+	threads = (pthread_t *) palloc(sizeof(pthread_t) * nworkers);
+	threads_args = (crc_range_arg *) palloc(sizeof(crc_range_arg) * nworkers);
+
+	for (i = 0; i < nworkers; i++)
+	{
+		crc_range_arg *arg = &(threads_args[i]);
+
+		arg->path = file_path;
+		arg->offset = (off_t) range * i;
+		/* The last range gets the rest of the file */
+		arg->len = (i == nworkers - 1) ? st.st_size - arg->offset : range;
+		arg->crc = 0;
+		/* By default there are some error */
+		arg->ret = 1;
+
+		pthread_create(&threads[i], NULL, crc_range_worker, arg);
+	}
+
+	INIT_CRC32C(crc);
+	for (i = 0; i < nworkers; i++)
+	{
+		pthread_join(threads[i], NULL);
+		if (threads_args[i].ret == 1)
+			error = true;
+		else
+		{
+			crc = crc32c_combine(crc, threads_args[i].crc, threads_args[i].len);
+			total += threads_args[i].len;
+		}
+	}
+	FIN_CRC32C(crc);
+
+	pfree(threads);
+	pfree(threads_args);
+
+	if (error)
+		elog(ERROR, "Calculation of CRC for file \"%s\" failed", file_path);
+
+	if (bytes_read)
+		*bytes_read = total;
 
 	return crc;
 }
@@ -325,11 +556,10 @@ pgFileFree(void *file)
 	if (file_ptr->linked)
 		free(file_ptr->linked);
 
-	if (file_ptr->forkName)
-		free(file_ptr->forkName);
+	/* Path is allocated separately only if it was replaced */
+	if (file_ptr->path != (char *) (file_ptr + 1))
+		pfree(file_ptr->path);
 
-	pfree(file_ptr->path);
-	pfree(file_ptr->rel_path);
 	pfree(file);
 }
 
@@ -499,12 +729,16 @@ db_map_entry_free(void *entry)
  *
  * When follow_symlink is true, symbolic link is ignored and only file or
  * directory linked to will be listed.
+ *
+ * If more than one thread is allowed, subdirectories are listed by several
+ * threads, so files are added to "files" in no particular order.
  */
 void
 dir_list_file(parray *files, const char *root, bool exclude, bool follow_symlink,
 			  bool add_root, int external_dir_num, fio_location location)
 {
 	pgFile	   *file;
+	dir_list_state state;
 
 	file = pgFileNew(root, "", follow_symlink, external_dir_num, location);
 	if (file == NULL)
@@ -528,8 +762,33 @@ dir_list_file(parray *files, const char *root, bool exclude, bool follow_symlink
 	if (add_root)
 		parray_append(files, file);
 
-	dir_list_file_internal(files, file, exclude, follow_symlink,
-						   external_dir_num, location);
+	state.exclude = exclude;
+	state.follow_symlink = follow_symlink;
+	state.external_dir_num = external_dir_num;
+	state.location = location;
+	state.dirs = parray_new();
+	state.nbusy = 0;
+
+	/*
+	 * Descend on this thread until the tree branches, e.g. an external
+	 * directory may contain a single subdirectory.
+	 */
+	dir_list_one(&state, file, files, state.dirs);
+	while (parray_num(state.dirs) == 1)
+		dir_list_one(&state, (pgFile *) parray_remove(state.dirs, 0), files,
+					 state.dirs);
+
+	if (num_threads > 1 && parray_num(state.dirs) > 1)
+		dir_list_parallel(files, &state);
+	else
+	{
+		int			i;
+
+		for (i = 0; i < parray_num(state.dirs); i++)
+			dir_list_file_internal(files, (pgFile *) parray_get(state.dirs, i),
+								   &state);
+	}
+	parray_free(state.dirs);
 
 	if (!add_root)
 		pgFileFree(file);
@@ -706,8 +965,8 @@ dir_check_file(pgFile *file)
 			fork_name = strstr(file->name, "_");
 			if (fork_name)
 			{
-				/* Auxiliary fork of the relfile */
-				sscanf(file->name, "%u_%s", &(file->relOid), file->forkName);
+				/* Auxiliary fork of the relfile, width is FORKNAMELEN - 1 */
+				sscanf(file->name, "%u_%15s", &(file->relOid), file->forkName);
 
 				/* Do not backup ptrack files */
 				if (strcmp(file->forkName, "ptrack") == 0)
@@ -742,105 +1001,219 @@ dir_check_file(pgFile *file)
 }
 
 /*
- * List files in parent->path directory.  If "exclude" is true do not add into
- * "files" files from pgdata_exclude_files and directories from
- * pgdata_exclude_dir.
+ * Add an entry of the listed directory to ctx->files. If "exclude" is true
+ * do not add files from pgdata_exclude_files and directories from
+ * pgdata_exclude_dir. Directories to descend into are added to ctx->subdirs
+ * as well.
+ */
+static void
+dir_list_entry(const fio_dir_entry *entry, void *arg)
+{
+	dir_list_context *ctx = (dir_list_context *) arg;
+	pgFile	   *file;
+	char		child[MAXPGPATH];
+	char		rel_child[MAXPGPATH];
+	char		check_res;
+
+	join_path_components(child, ctx->parent->path, entry->name);
+	join_path_components(rel_child, ctx->parent->rel_path, entry->name);
+
+	if (entry->stat_errno != 0)
+	{
+		/* file not found is not an error case */
+		if (entry->stat_errno == ENOENT)
+			return;
+		elog(ERROR, "cannot stat file \"%s\": %s", child,
+			 strerror(entry->stat_errno));
+	}
+
+	/*
+	 * Add only files, directories and links. Skip sockets and other
+	 * unexpected file formats.
+	 */
+	if (!S_ISDIR(entry->mode) && !S_ISREG(entry->mode))
+	{
+		elog(WARNING, "Skip \"%s\": unexpected file format", child);
+		return;
+	}
+
+	file = pgFileInit(child, rel_child);
+	file->size = entry->size;
+	file->mode = entry->mode;
+	file->external_dir_num = ctx->state->external_dir_num;
+
+	if (ctx->state->exclude)
+	{
+		check_res = dir_check_file(file);
+		if (check_res == CHECK_FALSE)
+		{
+			/* Skip */
+			pgFileFree(file);
+			return;
+		}
+		else if (check_res == CHECK_EXCLUDE_FALSE)
+		{
+			/* We add the directory itself which content was excluded */
+			parray_append(ctx->files, file);
+			return;
+		}
+	}
+
+	parray_append(ctx->files, file);
+
+	if (S_ISDIR(file->mode))
+		parray_append(ctx->subdirs, file);
+}
+
+/*
+ * List files in parent->path directory, without descending into
+ * subdirectories, which are added to "subdirs".
  */
 static void
-dir_list_file_internal(parray *files, pgFile *parent, bool exclude,
-					   bool follow_symlink,
-					   int external_dir_num, fio_location location)
+dir_list_one(dir_list_state *state, pgFile *parent, parray *files,
+			 parray *subdirs)
 {
-	DIR			  *dir;
-	struct dirent *dent;
+	dir_list_context ctx;
 
 	if (!S_ISDIR(parent->mode))
 		elog(ERROR, "\"%s\" is not a directory", parent->path);
 
-	/* Open directory and list contents */
-	dir = fio_opendir(parent->path, location);
-	if (dir == NULL)
+	ctx.state = state;
+	ctx.parent = parent;
+	ctx.files = files;
+	ctx.subdirs = subdirs;
+
+	if (fio_list_dir(parent->path, state->follow_symlink, state->location,
+					 dir_list_entry, &ctx) < 0)
 	{
+		/* Maybe the directory was removed */
 		if (errno == ENOENT)
-		{
-			/* Maybe the directory was removed */
 			return;
-		}
-		elog(ERROR, "Cannot open directory \"%s\": %s",
+		elog(ERROR, "Cannot read directory \"%s\": %s",
 			 parent->path, strerror(errno));
 	}
+}
 
-	errno = 0;
-	while ((dent = fio_readdir(dir)))
-	{
-		pgFile	   *file;
-		char		child[MAXPGPATH];
-		char		rel_child[MAXPGPATH];
-		char		check_res;
+/* List files in parent->path directory recursively */
+static void
+dir_list_file_internal(parray *files, pgFile *parent, dir_list_state *state)
+{
+	parray	   *subdirs = parray_new();
+	int			i;
 
-		join_path_components(child, parent->path, dent->d_name);
-		join_path_components(rel_child, parent->rel_path, dent->d_name);
+	dir_list_one(state, parent, files, subdirs);
 
-		file = pgFileNew(child, rel_child, follow_symlink, external_dir_num,
-						 location);
-		if (file == NULL)
-			continue;
+	for (i = 0; i < parray_num(subdirs); i++)
+		dir_list_file_internal(files, (pgFile *) parray_get(subdirs, i), state);
 
-		/* Skip entries point current dir or parent dir */
-		if (S_ISDIR(file->mode) &&
-			(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0))
+	parray_free(subdirs);
+}
+
+/*
+ * Take directories from the shared list and list them until the list is
+ * empty and no other thread can add new directories to it.
+ */
+static void *
+dir_list_worker(void *arg)
+{
+	dir_list_arg *arguments = (dir_list_arg *) arg;
+	dir_list_state *state = arguments->state;
+	parray	   *subdirs = parray_new();
+
+	while (true)
+	{
+		pgFile	   *dir = NULL;
+
+		/* check for interrupt */
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during directory listing");
+
+		pthread_lock(&dir_list_mutex);
+		if (parray_num(state->dirs) > 0)
 		{
-			pgFileFree(file);
-			continue;
+			dir = (pgFile *) parray_remove(state->dirs,
+										   parray_num(state->dirs) - 1);
+			state->nbusy++;
 		}
-
-		/*
-		 * Add only files, directories and links. Skip sockets and other
-		 * unexpected file formats.
-		 */
-		if (!S_ISDIR(file->mode) && !S_ISREG(file->mode))
+		else if (state->nbusy == 0)
 		{
-			elog(WARNING, "Skip \"%s\": unexpected file format", file->path);
-			pgFileFree(file);
-			continue;
+			pthread_mutex_unlock(&dir_list_mutex);
+			break;
 		}
+		pthread_mutex_unlock(&dir_list_mutex);
 
-		if (exclude)
+		/* Other threads may find more directories */
+		if (dir == NULL)
 		{
-			check_res = dir_check_file(file);
-			if (check_res == CHECK_FALSE)
-			{
-				/* Skip */
-				pgFileFree(file);
-				continue;
-			}
-			else if (check_res == CHECK_EXCLUDE_FALSE)
-			{
-				/* We add the directory itself which content was excluded */
-				parray_append(files, file);
-				continue;
-			}
+			pg_usleep(1000L);
+			continue;
 		}
 
-		parray_append(files, file);
+		dir_list_one(state, dir, arguments->files, subdirs);
 
-		/*
-		 * If the entry is a directory call dir_list_file_internal()
-		 * recursively.
-		 */
-		if (S_ISDIR(file->mode))
-			dir_list_file_internal(files, file, exclude, follow_symlink,
-								   external_dir_num, location);
+		pthread_lock(&dir_list_mutex);
+		while (parray_num(subdirs) > 0)
+			parray_append(state->dirs,
+						  parray_remove(subdirs, parray_num(subdirs) - 1));
+		state->nbusy--;
+		pthread_mutex_unlock(&dir_list_mutex);
 	}
 
-	if (errno && errno != ENOENT)
+	parray_free(subdirs);
+
+	/* ssh connection to longer needed */
+	fio_disconnect();
+
+	arguments->ret = 0;
+
+	return NULL;
+}
+
+/*
+ * List directories of state->dirs and their subdirectories in parallel
+ * threads. Every thread collects files into its own list, the lists are
+ * appended to "files" at the end.
+ */
+static void
+dir_list_parallel(parray *files, dir_list_state *state)
+{
+	pthread_t  *threads;
+	dir_list_arg *threads_args;
+	bool		list_isok = true;
+	int			i;
+
+	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
+	threads_args = (dir_list_arg *) palloc(sizeof(dir_list_arg) * num_threads);
+
+	for (i = 0; i < num_threads; i++)
 	{
-		int			errno_tmp = errno;
-		fio_closedir(dir);
-		elog(ERROR, "Cannot read directory \"%s\": %s",
-			 parent->path, strerror(errno_tmp));
+		dir_list_arg *arg = &(threads_args[i]);
+
+		arg->state = state;
+		arg->files = parray_new();
+		/* By default there are some error */
+		arg->ret = 1;
+
+		pthread_create(&threads[i], NULL, dir_list_worker, arg);
 	}
-	fio_closedir(dir);
+
+	for (i = 0; i < num_threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+		if (threads_args[i].ret == 1)
+			list_isok = false;
+	}
+	if (!list_isok)
+		elog(ERROR, "Directory listing failed");
+
+	for (i = 0; i < num_threads; i++)
+	{
+		parray_concat(files, threads_args[i].files);
+		parray_free(threads_args[i].files);
+	}
+
+	pfree(threads);
+	pfree(threads_args);
 }
 
 /*
@@ -1117,19 +1490,13 @@ read_tablespace_map(parray *files, const char *backup_dir)
 		if (sscanf(buf, "%1023s %1023s", link_name, path) != 2)
 			elog(ERROR, "invalid format found in \"%s\"", map_path);
 
-		file = pgut_new(pgFile);
-		memset(file, 0, sizeof(pgFile));
-
-		file->path = pgut_malloc(strlen(link_name) + 1);
-		strcpy(file->path, link_name);
-
+		file = pgFileInit(link_name, link_name);
 		file->name = file->path;
 
 		file->linked = pgut_malloc(strlen(path) + 1);
 		strcpy(file->linked, path);
 
 		canonicalize_path(file->linked);
-		canonicalize_path(file->path);
 
 		parray_append(files, file);
 	}
@@ -1425,6 +1792,67 @@ bad_format:
 	return false;	/* Make compiler happy */
 }
 
+/*
+ * Create pgFile for the entry of the backup content list.
+ * If root is not NULL, path will be absolute path.
+ */
+static pgFile *
+file_list_entry_init(const char *root, const char *external_prefix,
+					 const char *path, int external_dir_num)
+{
+	char		filepath[MAXPGPATH];
+
+	if (external_dir_num && external_prefix)
+	{
+		char temp[MAXPGPATH];
+
+		makeExternalDirPathByNum(temp, external_prefix, external_dir_num);
+		join_path_components(filepath, temp, path);
+	}
+	else if (root)
+		join_path_components(filepath, root, path);
+	else
+		strcpy(filepath, path);
+
+	return pgFileInit(filepath, path);
+}
+
+/*
+ * Read next line of the text file list, like fgets() does. Returns false at
+ * the end of file.
+ */
+static bool
+file_list_read_line(FileListReader *reader, char *line, size_t size)
+{
+	size_t		len = 0;
+
+	while (len < size - 1)
+	{
+		char		c;
+
+		if (reader->pos == reader->len)
+		{
+			ssize_t		rc = fio_read(reader->fd, reader->buf, sizeof(reader->buf));
+
+			if (rc < 0)
+				elog(ERROR, "Failed to read from file: \"%s\": %s",
+					 reader->path, strerror(errno));
+			if (rc == 0)
+				break;
+			reader->pos = 0;
+			reader->len = rc;
+		}
+
+		c = reader->buf[reader->pos++];
+		line[len++] = c;
+		if (c == '\n')
+			break;
+	}
+
+	line[len] = '\0';
+	return len > 0;
+}
+
 /*
  * Construct parray of pgFile from the backup content list.
  * If root is not NULL, path will be absolute path.
@@ -1433,20 +1861,53 @@ parray *
 dir_read_file_list(const char *root, const char *external_prefix,
 				   const char *file_txt, fio_location location)
 {
-	FILE   *fp;
+	FileListReader *reader;
+	FileListHeader header;
+	ssize_t	rc;
 	parray *files;
 	char	buf[MAXPGPATH * 2];
+	int		fd;
 
-	fp = fio_open_stream(file_txt, location);
-	if (fp == NULL)
+	/* The file is opened once, its format is known after the first read */
+	fd = fio_open(file_txt, O_RDONLY | PG_BINARY, location);
+	if (fd < 0)
 		elog(ERROR, "cannot open \"%s\": %s", file_txt, strerror(errno));
 
+	rc = fio_read(fd, &header, sizeof(header));
+	if (rc < 0)
+		elog(ERROR, "Failed to read from file: \"%s\": %s",
+			 file_txt, strerror(errno));
+
+	/* Binary file list */
+	if (rc == sizeof(header) && header.magic == FILE_LIST_MAGIC)
+	{
+		FileListMap *map;
+		uint32		i;
+
+		map = file_list_map_open_fd(root, external_prefix, file_txt, fd,
+									&header, location);
+
+		files = parray_new();
+		for (i = 0; i < map->nfiles; i++)
+			parray_append(files, file_list_map_get_file(map, &map->records[i]));
+
+		file_list_map_close(map);
+		return files;
+	}
+
+	/* Text file list, the bytes already read are its beginning */
+	reader = pgut_new(FileListReader);
+	reader->fd = fd;
+	reader->path = file_txt;
+	memcpy(reader->buf, &header, rc);
+	reader->pos = 0;
+	reader->len = rc;
+
 	files = parray_new();
 
-	while (fgets(buf, lengthof(buf), fp))
+	while (file_list_read_line(reader, buf, lengthof(buf)))
 	{
 		char		path[MAXPGPATH];
-		char		filepath[MAXPGPATH];
 		char		linked[MAXPGPATH];
 		char		compress_alg_string[MAXPGPATH];
 		int64		write_size,
@@ -1457,6 +1918,8 @@ dir_read_file_list(const char *root, const char *external_prefix,
 					crc,
 					segno,
 					n_blocks,
+					frame_size,
+					dict_crc,
 					dbOid;		/* used for partial restore */
 		pgFile	   *file;
 
@@ -1470,19 +1933,8 @@ dir_read_file_list(const char *root, const char *external_prefix,
 		get_control_value(buf, "external_dir_num", NULL, &external_dir_num, false);
 		get_control_value(buf, "dbOid", NULL, &dbOid, false);
 
-		if (external_dir_num && external_prefix)
-		{
-			char temp[MAXPGPATH];
-
-			makeExternalDirPathByNum(temp, external_prefix, external_dir_num);
-			join_path_components(filepath, temp, path);
-		}
-		else if (root)
-			join_path_components(filepath, root, path);
-		else
-			strcpy(filepath, path);
-
-		file = pgFileInit(filepath, path);
+		file = file_list_entry_init(root, external_prefix, path,
+									(int) external_dir_num);
 
 		file->write_size = (int64) write_size;
 		file->mode = (mode_t) mode;
@@ -1509,16 +1961,249 @@ dir_read_file_list(const char *root, const char *external_prefix,
 		if (get_control_value(buf, "n_blocks", NULL, &n_blocks, false))
 			file->n_blocks = (int) n_blocks;
 
+		if (get_control_value(buf, "frame_size", NULL, &frame_size, false))
+			file->frame_size = (int) frame_size;
+
+		if (get_control_value(buf, "dict_crc", NULL, &dict_crc, false))
+			file->dict_crc = (pg_crc32) dict_crc;
+
 		parray_append(files, file);
 	}
 
-	if (ferror(fp))
-		elog(ERROR, "Failed to read from file: \"%s\"", file_txt);
-
-	fio_close_stream(fp);
+	fio_close(fd);
+	pg_free(reader);
 	return files;
 }
 
+/*
+ * Check if the backup content list is written in binary format.
+ */
+bool
+file_list_is_binary(const char *file_txt, fio_location location)
+{
+	uint32		magic;
+	int			fd;
+	bool		result;
+
+	fd = fio_open(file_txt, O_RDONLY | PG_BINARY, location);
+	if (fd < 0)
+		elog(ERROR, "cannot open \"%s\": %s", file_txt, strerror(errno));
+
+	result = fio_read(fd, &magic, sizeof(magic)) == sizeof(magic) &&
+		magic == FILE_LIST_MAGIC;
+
+	fio_close(fd);
+	return result;
+}
+
+/*
+ * Load the backup content list written in binary format. Local file is
+ * mmap'ed, remote one is read into memory. Records are not converted into
+ * pgFile, use file_list_map_find() and file_list_map_get_file() to get
+ * the files which are really needed.
+ * Return NULL if the list is in text format.
+ */
+FileListMap *
+file_list_map_open(const char *root, const char *external_prefix,
+				   const char *file_txt, fio_location location)
+{
+	FileListHeader header;
+	int			fd;
+
+	fd = fio_open(file_txt, O_RDONLY | PG_BINARY, location);
+	if (fd < 0)
+		elog(ERROR, "cannot open \"%s\": %s", file_txt, strerror(errno));
+
+	if (fio_read(fd, &header, sizeof(header)) != sizeof(header) ||
+		header.magic != FILE_LIST_MAGIC)
+	{
+		/* File list in text format */
+		fio_close(fd);
+		return NULL;
+	}
+
+	return file_list_map_open_fd(root, external_prefix, file_txt, fd,
+								 &header, location);
+}
+
+/*
+ * Load the binary file list from fd, whose header is already read.
+ * Closes fd.
+ */
+static FileListMap *
+file_list_map_open_fd(const char *root, const char *external_prefix,
+					  const char *file_txt, int fd, FileListHeader *hdr,
+					  fio_location location)
+{
+	FileListHeader header = *hdr;
+	FileListMap *map;
+	struct stat	st;
+	size_t		records_size;
+	pg_crc32	crc;
+	uint32		i;
+
+	if (header.version != FILE_LIST_VERSION ||
+		header.record_size != sizeof(FileListRecord))
+		elog(ERROR, "File list \"%s\" has unsupported format version %u",
+			 file_txt, header.version);
+
+	if (fio_fstat(fd, &st) < 0)
+		elog(ERROR, "cannot stat \"%s\": %s", file_txt, strerror(errno));
+
+	records_size = (size_t) header.nfiles * sizeof(FileListRecord);
+	if (header.strings_size == 0 ||
+		(size_t) st.st_size != sizeof(header) + records_size + header.strings_size)
+		elog(ERROR, "File list \"%s\" has invalid size", file_txt);
+
+	map = pgut_new(FileListMap);
+	MemSet(map, 0, sizeof(FileListMap));
+	map->size = st.st_size;
+
+#ifndef WIN32
+	if (!fio_is_remote(location))
+	{
+		map->data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map->data == MAP_FAILED)
+			elog(ERROR, "cannot map \"%s\": %s", file_txt, strerror(errno));
+		map->mapped = true;
+	}
+	else
+#endif
+	{
+		size_t		read_len = sizeof(header);
+
+		map->data = pgut_malloc(map->size);
+		memcpy(map->data, &header, sizeof(header));
+
+		while (read_len < map->size)
+		{
+			ssize_t		rc;
+
+			rc = fio_read(fd, map->data + read_len, map->size - read_len);
+			if (rc <= 0)
+				elog(ERROR, "cannot read \"%s\": %s", file_txt,
+					 rc < 0 ? strerror(errno) : "unexpected end of file");
+			read_len += rc;
+		}
+	}
+
+	fio_close(fd);
+
+	map->nfiles = header.nfiles;
+	map->records = (FileListRecord *) (map->data + sizeof(header));
+	map->strings = map->data + sizeof(header) + records_size;
+
+	INIT_FILE_CRC32(true, crc);
+	COMP_FILE_CRC32(true, crc, map->records, records_size + header.strings_size);
+	FIN_FILE_CRC32(true, crc);
+
+	if (crc != header.crc)
+		elog(ERROR, "File list \"%s\" is corrupted, CRC mismatch", file_txt);
+
+	/* Offsets are used without checks later */
+	if (map->strings[header.strings_size - 1] != '\0')
+		elog(ERROR, "File list \"%s\" has invalid string table", file_txt);
+
+	for (i = 0; i < map->nfiles; i++)
+	{
+		if (map->records[i].path >= header.strings_size ||
+			map->records[i].linked >= header.strings_size)
+			elog(ERROR, "File list \"%s\" has invalid record %u", file_txt, i);
+	}
+
+	map->root = root ? pgut_strdup(root) : NULL;
+	map->external_prefix = external_prefix ? pgut_strdup(external_prefix) : NULL;
+
+	return map;
+}
+
+void
+file_list_map_close(FileListMap *map)
+{
+	if (map == NULL)
+		return;
+
+#ifndef WIN32
+	if (map->mapped)
+		munmap(map->data, map->size);
+	else
+#endif
+		pfree(map->data);
+
+	if (map->root)
+		pfree(map->root);
+	if (map->external_prefix)
+		pfree(map->external_prefix);
+	pfree(map);
+}
+
+/*
+ * Find the record by path and external directory number using binary search.
+ * Return NULL if the list doesn't contain the file.
+ */
+FileListRecord *
+file_list_map_find(FileListMap *map, const char *path, int external_dir_num)
+{
+	uint32		low = 0;
+	uint32		high = map->nfiles;
+
+	while (low < high)
+	{
+		uint32		middle = low + (high - low) / 2;
+		FileListRecord *rec = &map->records[middle];
+		int			res;
+
+		res = strcmp(map->strings + rec->path, path);
+		if (res == 0)
+		{
+			if (rec->external_dir_num == external_dir_num)
+				return rec;
+			res = rec->external_dir_num < external_dir_num ? -1 : 1;
+		}
+
+		if (res < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return NULL;
+}
+
+/*
+ * Create pgFile for the record of the binary file list.
+ */
+pgFile *
+file_list_map_get_file(FileListMap *map, FileListRecord *rec)
+{
+	pgFile	   *file;
+
+	file = file_list_entry_init(map->root, map->external_prefix,
+								map->strings + rec->path,
+								rec->external_dir_num);
+
+	file->write_size = rec->write_size;
+	file->mode = (mode_t) rec->mode;
+	file->is_datafile = rec->is_datafile ? true : false;
+	file->is_cfs = rec->is_cfs ? true : false;
+	file->crc = rec->crc;
+	file->compress_alg = (CompressAlg) rec->compress_alg;
+	file->external_dir_num = rec->external_dir_num;
+	file->dbOid = rec->dbOid;
+	file->segno = rec->segno;
+	file->n_blocks = rec->n_blocks;
+	file->frame_size = rec->frame_size;
+	file->dict_crc = rec->dict_crc;
+
+	if (rec->linked)
+	{
+		file->linked = pgut_strdup(map->strings + rec->linked);
+		canonicalize_path(file->linked);
+	}
+
+	return file;
+}
+
 /*
  * Check if directory empty.
  */
@@ -1710,8 +2395,7 @@ write_database_map(pgBackup *backup, parray *database_map, parray *backup_files_
 	/* Add metadata to backup_content.control */
 	file = pgFileNew(database_map_path, DATABASE_MAP, true, 0,
 								 FIO_BACKUP_HOST);
-	pfree(file->path);
-	file->path = strdup(DATABASE_MAP);
+	pgFileSetPath(file, DATABASE_MAP);
 	file->crc = pgFileGetCRC(database_map_path, true, false,
 							 &file->read_size, FIO_BACKUP_HOST);
 	file->write_size = file->read_size;
@@ -100,7 +100,7 @@ help_pg_probackup(void)
 	printf(_("                 [-d dbname] [-h host] [-p port] [-U username]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
-	printf(_("                 [--ssh-options]\n"));
+	printf(_("                 [--ssh-options] [--remote-connections=count]\n"));
 	printf(_("                 [--restore-command=cmdline] [--archive-host=destination]\n"));
 	printf(_("                 [--archive-port=port] [--archive-user=username]\n"));
 	printf(_("                 [--help]\n"));
@@ -118,6 +118,8 @@ help_pg_probackup(void)
 	printf(_("                 [--stream [-S slot-name]] [--temp-slot]\n"));
 	printf(_("                 [--backup-pg-log] [-j num-threads] [--progress]\n"));
 	printf(_("                 [--no-validate] [--skip-block-validation]\n"));
+	printf(_("                 [--read-chunk-size=read-chunk-size]\n"));
+	printf(_("                 [--binary-file-list]\n"));
 	printf(_("                 [--external-dirs=external-directories-paths]\n"));
 	printf(_("                 [--log-level-console=log-level-console]\n"));
 	printf(_("                 [--log-level-file=log-level-file]\n"));
@@ -133,12 +135,14 @@ help_pg_probackup(void)
 	printf(_("                 [--compress]\n"));
 	printf(_("                 [--compress-algorithm=compress-algorithm]\n"));
 	printf(_("                 [--compress-level=compress-level]\n"));
+	printf(_("                 [--compress-dictionary]\n"));
+	printf(_("                 [--compress-frame-size=blocks]\n"));
 	printf(_("                 [--archive-timeout=archive-timeout]\n"));
 	printf(_("                 [-d dbname] [-h host] [-p port] [-U username]\n"));
 	printf(_("                 [-w --no-password] [-W --password]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
-	printf(_("                 [--ssh-options]\n"));
+	printf(_("                 [--ssh-options] [--remote-connections=count]\n"));
 	printf(_("                 [--ttl] [--expire-time]\n"));
 	printf(_("                 [--help]\n"));
 
@@ -159,7 +163,7 @@ help_pg_probackup(void)
 	printf(_("                 [--db-include | --db-exclude]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
-	printf(_("                 [--ssh-options]\n"));
+	printf(_("                 [--ssh-options] [--remote-connections=count]\n"));
 	printf(_("                 [--archive-host=hostname]\n"));
 	printf(_("                 [--archive-port=port] [--archive-user=username]\n"));
 	printf(_("                 [--help]\n"));
@@ -176,11 +180,12 @@ help_pg_probackup(void)
 	printf(_("\n  %s checkdb [-B backup-path] [--instance=instance_name]\n"), PROGRAM_NAME);
 	printf(_("                 [-D pgdata-path] [--progress] [-j num-threads]\n"));
 	printf(_("                 [--amcheck] [--skip-block-validation]\n"));
+	printf(_("                 [--read-chunk-size=read-chunk-size]\n"));
 	printf(_("                 [--heapallindexed]\n"));
 	printf(_("                 [--help]\n"));
 
 	printf(_("\n  %s show -B backup-path\n"), PROGRAM_NAME);
-	printf(_("                 [--instance=instance_name [-i backup-id]]\n"));
+	printf(_("                 [--instance=instance_name [-i backup-id [--file-list]]]\n"));
 	printf(_("                 [--format=format] [--archive]\n"));
 	printf(_("                 [--help]\n"));
 
@@ -212,7 +217,8 @@ help_pg_probackup(void)
 	printf(_("\n  %s archive-push -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 --wal-file-path=wal-file-path\n"));
 	printf(_("                 --wal-file-name=wal-file-name\n"));
-	printf(_("                 [--overwrite]\n"));
+	printf(_("                 [--overwrite] [--wal-summary]\n"));
+	printf(_("                 [-j num-threads] [--batch-size=batch_size]\n"));
 	printf(_("                 [--compress]\n"));
 	printf(_("                 [--compress-algorithm=compress-algorithm]\n"));
 	printf(_("                 [--compress-level=compress-level]\n"));
@@ -224,9 +230,10 @@ help_pg_probackup(void)
 	printf(_("\n  %s archive-get -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 --wal-file-path=wal-file-path\n"));
 	printf(_("                 --wal-file-name=wal-file-name\n"));
+	printf(_("                 [-j num-threads] [--batch-size=batch_size]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
-	printf(_("                 [--ssh-options]\n"));
+	printf(_("                 [--ssh-options] [--remote-connections=count]\n"));
 	printf(_("                 [--help]\n"));
 
 	if ((PROGRAM_URL || PROGRAM_EMAIL))
@@ -255,6 +262,8 @@ help_backup(void)
 	printf(_("                 [--stream [-S slot-name] [--temp-slot]\n"));
 	printf(_("                 [--backup-pg-log] [-j num-threads] [--progress]\n"));
 	printf(_("                 [--no-validate] [--skip-block-validation]\n"));
+	printf(_("                 [--read-chunk-size=read-chunk-size]\n"));
+	printf(_("                 [--binary-file-list]\n"));
 	printf(_("                 [-E external-directories-paths]\n"));
 	printf(_("                 [--log-level-console=log-level-console]\n"));
 	printf(_("                 [--log-level-file=log-level-file]\n"));
@@ -270,12 +279,14 @@ help_backup(void)
 	printf(_("                 [--compress]\n"));
 	printf(_("                 [--compress-algorithm=compress-algorithm]\n"));
 	printf(_("                 [--compress-level=compress-level]\n"));
+	printf(_("                 [--compress-dictionary]\n"));
+	printf(_("                 [--compress-frame-size=blocks]\n"));
 	printf(_("                 [--archive-timeout=archive-timeout]\n"));
 	printf(_("                 [-d dbname] [-h host] [-p port] [-U username]\n"));
 	printf(_("                 [-w --no-password] [-W --password]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
-	printf(_("                 [--ssh-options]\n"));
+	printf(_("                 [--ssh-options] [--remote-connections=count]\n"));
 	printf(_("                 [--ttl] [--expire-time]\n\n"));
 
 	printf(_("  -B, --backup-path=backup-path    location of the backup storage area\n"));
@@ -291,6 +302,9 @@ help_backup(void)
 	printf(_("      --progress                   show progress\n"));
 	printf(_("      --no-validate                disable validation after backup\n"));
 	printf(_("      --skip-block-validation      set to validate only file-level checksum\n"));
+	printf(_("      --read-chunk-size=read-chunk-size\n"));
+	printf(_("                                   size of chunks data files are read by (default: 1MB)\n"));
+	printf(_("      --binary-file-list           write list of backup files in binary format\n"));
 	printf(_("  -E  --external-dirs=external-directories-paths\n"));
 	printf(_("                                   backup some directories not from pgdata \n"));
 	printf(_("                                   (example: --external-dirs=/tmp/dir1:/tmp/dir2)\n"));
@@ -339,9 +353,14 @@ help_backup(void)
 	printf(_("\n  Compression options:\n"));
 	printf(_("      --compress                   alias for --compress-algorithm='zlib' and --compress-level=1\n"));
 	printf(_("      --compress-algorithm=compress-algorithm\n"));
-	printf(_("                                   available options: 'zlib', 'pglz', 'none' (default: none)\n"));
+	printf(_("                                   available options: 'zlib', 'pglz', 'zstd', 'lz4', 'none' (default: none)\n"));
 	printf(_("      --compress-level=compress-level\n"));
-	printf(_("                                   level of compression [0-9] (default: 1)\n"));
+	printf(_("                                   level of compression [0-9], [1-22] for zstd (default: 1)\n"));
+	printf(_("      --compress-dictionary        train zstd dictionary on sample of pages and use it\n"));
+	printf(_("                                   to compress every page of the backup\n"));
+	printf(_("      --compress-frame-size=blocks\n"));
+	printf(_("                                   compress up to this number of consecutive pages\n"));
+	printf(_("                                   together [0-64] (default: 0, pages are compressed one by one)\n"));
 
 	printf(_("\n  Archive options:\n"));
 	printf(_("      --archive-timeout=timeout    wait timeout for WAL segment archiving (default: 5min)\n"));
@@ -364,6 +383,8 @@ help_backup(void)
 	printf(_("      --remote-user=username       user name for ssh connection (default: current user)\n"));
 	printf(_("      --ssh-options=ssh_options    additional ssh options (default: none)\n"));
 	printf(_("                                   (example: --ssh-options='-c cipher_spec -F configfile')\n"));
+	printf(_("      --remote-connections=count   number of ssh connections shared by all threads\n"));
+	printf(_("                                   (default: 0, each thread opens its own connection)\n"));
 
 	printf(_("\n  Replica options:\n"));
 	printf(_("      --master-user=user_name      user name to connect to master (deprecated)\n"));
@@ -393,7 +414,7 @@ help_restore(void)
 	printf(_("                 [--db-include dbname | --db-exclude dbname]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
-	printf(_("                 [--ssh-options]\n"));
+	printf(_("                 [--ssh-options] [--remote-connections=count]\n"));
 	printf(_("                 [--archive-host=hostname] [--archive-port=port]\n"));
 	printf(_("                 [--archive-user=username]\n\n"));
 
@@ -468,6 +489,8 @@ help_restore(void)
 	printf(_("      --remote-user=username       user name for ssh connection (default: current user)\n"));
 	printf(_("      --ssh-options=ssh_options    additional ssh options (default: none)\n"));
 	printf(_("                                   (example: --ssh-options='-c cipher_spec -F configfile')\n"));
+	printf(_("      --remote-connections=count   number of ssh connections shared by all threads\n"));
+	printf(_("                                   (default: 0, each thread opens its own connection)\n"));
 
 	printf(_("\n  Remote WAL archive options:\n"));
 	printf(_("      --archive-host=destination   address or hostname for ssh connection to archive host\n"));
@@ -531,7 +554,8 @@ help_checkdb(void)
 	printf(_("\n%s checkdb [-B backup-path] [--instance=instance_name]\n"), PROGRAM_NAME);
 	printf(_("                 [-D pgdata-path] [-j num-threads] [--progress]\n"));
 	printf(_("                 [--amcheck] [--skip-block-validation]\n"));
-	printf(_("                 [--heapallindexed]\n\n"));
+	printf(_("                 [--heapallindexed]\n"));
+	printf(_("                 [--read-chunk-size=read-chunk-size]\n\n"));
 
 	printf(_("  -B, --backup-path=backup-path    location of the backup storage area\n"));
 	printf(_("      --instance=instance_name     name of the instance\n"));
@@ -546,6 +570,8 @@ help_checkdb(void)
 	printf(_("                                   using 'amcheck' or 'amcheck_next' extensions\n"));
 	printf(_("      --heapallindexed             also check that heap is indexed\n"));
 	printf(_("                                   can be used only with '--amcheck' option\n"));
+	printf(_("      --read-chunk-size=read-chunk-size\n"));
+	printf(_("                                   size of chunks data files are read by (default: 1MB)\n"));
 
 	printf(_("\n  Logging options:\n"));
 	printf(_("      --log-level-console=log-level-console\n"));
@@ -581,13 +607,14 @@ static void
 help_show(void)
 {
 	printf(_("\n%s show -B backup-path\n"), PROGRAM_NAME);
-	printf(_("                 [--instance=instance_name [-i backup-id]]\n"));
+	printf(_("                 [--instance=instance_name [-i backup-id [--file-list]]]\n"));
 	printf(_("                 [--format=format] [--archive]\n\n"));
 
 	printf(_("  -B, --backup-path=backup-path    location of the backup storage area\n"));
 	printf(_("      --instance=instance_name     show info about specific instance\n"));
 	printf(_("  -i, --backup-id=backup-id        show info about specific backups\n"));
 	printf(_("      --archive                    show WAL archive information\n"));
+	printf(_("      --file-list                  show file list of the backup in text format\n"));
 	printf(_("      --format=format              show format=PLAIN|JSON\n\n"));
 }
 
@@ -721,7 +748,7 @@ help_set_config(void)
 	printf(_("                 [-d dbname] [-h host] [-p port] [-U username]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
-	printf(_("                 [--ssh-options]\n\n"));
+	printf(_("                 [--ssh-options] [--remote-connections=count]\n\n"));
 
 	printf(_("  -B, --backup-path=backup-path    location of the backup storage area\n"));
 	printf(_("      --instance=instance_name     name of the instance\n"));
@@ -763,9 +790,9 @@ help_set_config(void)
 	printf(_("\n  Compression options:\n"));
 	printf(_("      --compress                   alias for --compress-algorithm='zlib' and --compress-level=1\n"));
 	printf(_("      --compress-algorithm=compress-algorithm\n"));
-	printf(_("                                   available options: 'zlib','pglz','none' (default: 'none')\n"));
+	printf(_("                                   available options: 'zlib','pglz','zstd','lz4','none' (default: 'none')\n"));
 	printf(_("      --compress-level=compress-level\n"));
-	printf(_("                                   level of compression [0-9] (default: 1)\n"));
+	printf(_("                                   level of compression [0-9], [1-22] for zstd (default: 1)\n"));
 
 	printf(_("\n  Archive options:\n"));
 	printf(_("      --archive-timeout=timeout    wait timeout for WAL segment archiving (default: 5min)\n"));
@@ -786,6 +813,8 @@ help_set_config(void)
 	printf(_("      --remote-user=username       user name for ssh connection (default: current user)\n"));
 	printf(_("      --ssh-options=ssh_options    additional ssh options (default: none)\n"));
 	printf(_("                                   (example: --ssh-options='-c cipher_spec -F configfile')\n"));
+	printf(_("      --remote-connections=count   number of ssh connections shared by all threads\n"));
+	printf(_("                                   (default: 0, each thread opens its own connection)\n"));
 
 	printf(_("\n  Remote WAL archive options:\n"));
 	printf(_("      --archive-host=destination   address or hostname for ssh connection to archive host\n"));
@@ -819,7 +848,7 @@ help_add_instance(void)
 	printf(_("                 [-E external-directory-path]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
-	printf(_("                 [--ssh-options]\n\n"));
+	printf(_("                 [--ssh-options] [--remote-connections=count]\n\n"));
 
 	printf(_("  -B, --backup-path=backup-path    location of the backup storage area\n"));
 	printf(_("  -D, --pgdata=pgdata-path         location of the database storage area\n"));
@@ -837,7 +866,9 @@ help_add_instance(void)
 	printf(_("                                   (default: current binary path)\n"));
 	printf(_("      --remote-user=username       user name for ssh connection (default: current user)\n"));
 	printf(_("      --ssh-options=ssh_options    additional ssh options (default: none)\n"));
-	printf(_("                                   (example: --ssh-options='-c cipher_spec -F configfile')\n\n"));
+	printf(_("                                   (example: --ssh-options='-c cipher_spec -F configfile')\n"));
+	printf(_("      --remote-connections=count   number of ssh connections shared by all threads\n"));
+	printf(_("                                   (default: 0, each thread opens its own connection)\n\n"));
 }
 
 static void
@@ -855,7 +886,8 @@ help_archive_push(void)
 	printf(_("\n%s archive-push -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 --wal-file-path=wal-file-path\n"));
 	printf(_("                 --wal-file-name=wal-file-name\n"));
-	printf(_("                 [--overwrite]\n"));
+	printf(_("                 [--overwrite] [--wal-summary]\n"));
+	printf(_("                 [-j num-threads] [--batch-size=batch_size]\n"));
 	printf(_("                 [--compress]\n"));
 	printf(_("                 [--compress-algorithm=compress-algorithm]\n"));
 	printf(_("                 [--compress-level=compress-level]\n"));
@@ -870,11 +902,18 @@ help_archive_push(void)
 	printf(_("      --wal-file-name=wal-file-name\n"));
 	printf(_("                                   name of the WAL file to retrieve from the server\n"));
 	printf(_("      --overwrite                  overwrite archived WAL file\n"));
+	printf(_("      --wal-summary                write summary of changed blocks for PAGE backups\n"));
+	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
+	printf(_("      --batch-size=batch_size      number of WAL files to push in one call,\n"));
+	printf(_("                                   ready segments following the requested one\n"));
+	printf(_("                                   are pushed along with it (default: 1)\n"));
 
 	printf(_("\n  Compression options:\n"));
 	printf(_("      --compress                   alias for --compress-algorithm='zlib' and --compress-level=1\n"));
 	printf(_("      --compress-algorithm=compress-algorithm\n"));
-	printf(_("                                   available options: 'zlib','pglz','none' (default: 'none')\n"));
+	printf(_("                                   available options: 'zlib','none' (default: 'none')\n"));
+	printf(_("                                   'zstd' and 'lz4' fall back to 'zlib' for WAL,\n"));
+	printf(_("                                   'pglz' is not supported\n"));
 	printf(_("      --compress-level=compress-level\n"));
 	printf(_("                                   level of compression [0-9] (default: 1)\n"));
 
@@ -896,6 +935,7 @@ help_archive_get(void)
 	printf(_("\n%s archive-get -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 --wal-file-path=wal-file-path\n"));
 	printf(_("                 --wal-file-name=wal-file-name\n"));
+	printf(_("                 [-j num-threads] [--batch-size=batch_size]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
 	printf(_("                 [--ssh-options]\n\n"));
@@ -906,6 +946,10 @@ help_archive_get(void)
 	printf(_("                                   relative destination path name of the WAL file on the server\n"));
 	printf(_("      --wal-file-name=wal-file-name\n"));
 	printf(_("                                   name of the WAL file to retrieve from the archive\n"));
+	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
+	printf(_("      --batch-size=batch_size      number of WAL files to fetch in one call,\n"));
+	printf(_("                                   segments following the requested one\n"));
+	printf(_("                                   are prefetched into pg_wal (default: 1)\n"));
 
 	printf(_("\n  Remote options:\n"));
 	printf(_("      --remote-proto=protocol      remote protocol to use\n"));
@@ -14,18 +14,21 @@
 
 #include "utils/thread.h"
 
+/* Backup of the merged chain */
 typedef struct
 {
-	parray	   *to_files;
-	parray	   *files;
-	parray	   *from_external;
+	pgBackup   *backup;
+	parray	   *files;			/* sorted by pgFileCompareRelPathWithExternalDesc */
+	parray	   *external_dirs;	/* NULL if there are no external directories */
+	char		database_path[MAXPGPATH];
+	char		external_prefix[MAXPGPATH];
+} MergeSource;
 
-	pgBackup   *to_backup;
-	pgBackup   *from_backup;
-	const char *to_root;
-	const char *from_root;
-	const char *to_external_prefix;
-	const char *from_external_prefix;
+typedef struct
+{
+	FileScheduler *sched;		/* files of the destination backup */
+	MergeSource *chain;			/* from FULL to the destination backup */
+	int			nbackups;
 
 	/*
 	 * Return value from the thread.
@@ -55,6 +58,7 @@ do_merge(time_t backup_id)
 	parray	   *merge_list = parray_new();
 	pgBackup   *dest_backup = NULL;
 	pgBackup   *full_backup = NULL;
+	pgBackup   *backup;
 	int			i;
 
 	if (backup_id == INVALID_BACKUP_ID)
@@ -68,10 +72,19 @@ do_merge(time_t backup_id)
 	/* Get list of all backups sorted in order of descending start time */
 	backups = catalog_get_backup_list(instance_name, INVALID_BACKUP_ID);
 
-	/* Find destination backup first */
 	for (i = 0; i < parray_num(backups); i++)
 	{
-		pgBackup   *backup = (pgBackup *) parray_get(backups, i);
+		backup = (pgBackup *) parray_get(backups, i);
+
+		/*
+		 * Previous merge may be interrupted after files of the whole chain
+		 * were merged into FULL backup. Then some of incremental backups
+		 * may be deleted already, so don't look for the chain.
+		 */
+		if (backup->backup_mode == BACKUP_MODE_FULL &&
+			backup->status == BACKUP_STATUS_MERGING &&
+			backup->merge_dest_backup == backup_id)
+			full_backup = backup;
 
 		/* found target */
 		if (backup->start_time == backup_id)
@@ -90,44 +103,49 @@ do_merge(time_t backup_id)
 					 base36enc(backup->start_time));
 
 			dest_backup = backup;
-			break;
 		}
 	}
 
 	/* sanity */
-	if (dest_backup == NULL)
+	if (dest_backup == NULL && full_backup == NULL)
 		elog(ERROR, "Target backup %s was not found", base36enc(backup_id));
 
-	/* get full backup */
-	full_backup = find_parent_full_backup(dest_backup);
-
-	/* sanity */
 	if (full_backup == NULL)
-		elog(ERROR, "Parent full backup for the given backup %s was not found",
-			 base36enc(backup_id));
+	{
+		/* get full backup */
+		full_backup = find_parent_full_backup(dest_backup);
 
-	/* sanity */
-	if (full_backup->status != BACKUP_STATUS_OK &&
-		full_backup->status != BACKUP_STATUS_DONE &&
-		/* It is possible that previous merging was interrupted */
-		full_backup->status != BACKUP_STATUS_MERGING)
-		elog(ERROR, "Backup %s has status: %s",
-				base36enc(full_backup->start_time), status2str(full_backup->status));
-
-	/* form merge list */
-	while(dest_backup->parent_backup_link)
+		/* sanity */
+		if (full_backup == NULL)
+			elog(ERROR, "Parent full backup for the given backup %s was not found",
+				 base36enc(backup_id));
+
+		/* sanity */
+		if (full_backup->status != BACKUP_STATUS_OK &&
+			full_backup->status != BACKUP_STATUS_DONE &&
+			/* It is possible that previous merging was interrupted */
+			full_backup->status != BACKUP_STATUS_MERGING)
+			elog(ERROR, "Backup %s has status: %s",
+					base36enc(full_backup->start_time), status2str(full_backup->status));
+	}
+
+	/*
+	 * Form merge list. If the chain was merged already, it ends with the
+	 * oldest incremental backup which is not deleted yet.
+	 */
+	for (backup = dest_backup; backup && backup != full_backup;
+		 backup = backup->parent_backup_link)
 	{
 		/* sanity */
-		if (dest_backup->status != BACKUP_STATUS_OK &&
-			dest_backup->status != BACKUP_STATUS_DONE &&
+		if (backup->status != BACKUP_STATUS_OK &&
+			backup->status != BACKUP_STATUS_DONE &&
 			/* It is possible that previous merging was interrupted */
-			dest_backup->status != BACKUP_STATUS_MERGING &&
-			dest_backup->status != BACKUP_STATUS_DELETING)
+			backup->status != BACKUP_STATUS_MERGING &&
+			backup->status != BACKUP_STATUS_DELETING)
 			elog(ERROR, "Backup %s has status: %s",
-					base36enc(dest_backup->start_time), status2str(dest_backup->status));
+					base36enc(backup->start_time), status2str(backup->status));
 
-		parray_append(merge_list, dest_backup);
-		dest_backup = dest_backup->parent_backup_link;
+		parray_append(merge_list, backup);
 	}
 
 	/* Add FULL backup for easy locking */
@@ -139,12 +157,7 @@ do_merge(time_t backup_id)
 	/*
 	 * Found target and full backups, merge them and intermediate backups
 	 */
-	for (i = parray_num(merge_list) - 2; i >= 0; i--)
-	{
-		pgBackup   *from_backup = (pgBackup *) parray_get(merge_list, i);
-
-		merge_backups(full_backup, from_backup);
-	}
+	merge_chain(merge_list, backup_id);
 
 	pgBackupValidate(full_backup, NULL);
 	if (full_backup->status == BACKUP_STATUS_CORRUPT)
@@ -159,125 +172,145 @@ do_merge(time_t backup_id)
 }
 
 /*
- * Merge two backups data files using threads.
- * - to_backup - FULL, from_backup - incremental.
- * - move instance files from from_backup to to_backup
- * - remove unnecessary directories and files from to_backup
- * - update metadata of from_backup, it becames FULL backup
+ * Merge the chain of backups into its FULL backup in one pass using threads.
+ * - merge_list is ordered from the destination backup to FULL backup
+ * - every file of the destination backup is written into FULL backup once,
+ *   blocks of data files are taken from the newest backup containing them
+ * - remove unnecessary directories and files from FULL backup
+ * - delete incremental backups, FULL backup becomes the destination backup
+ *
+ * Progress is recorded in FULL backup: once all files are merged, it gets
+ * merge_dest_backup, so that the interrupted merge is continued just by
+ * deleting the remaining incremental backups. Incremental backups are
+ * deleted from the oldest one, so the remaining ones are still linked to
+ * the destination backup.
  */
 void
-merge_backups(pgBackup *to_backup, pgBackup *from_backup)
+merge_chain(parray *merge_list, time_t dest_backup_id)
 {
-	char	   *to_backup_id = base36enc_dup(to_backup->start_time),
-			   *from_backup_id = base36enc_dup(from_backup->start_time);
-	char		to_backup_path[MAXPGPATH],
-				to_database_path[MAXPGPATH],
-				to_external_prefix[MAXPGPATH],
-				from_backup_path[MAXPGPATH],
-				from_database_path[MAXPGPATH],
-				from_external_prefix[MAXPGPATH],
+	pgBackup   *full_backup = (pgBackup *) parray_get(merge_list,
+													  parray_num(merge_list) - 1);
+	pgBackup   *dest_backup = (pgBackup *) parray_get(merge_list, 0);
+	char	   *full_backup_id = base36enc_dup(full_backup->start_time),
+			   *dest_backup_id_str = base36enc_dup(dest_backup_id);
+	char		full_backup_path[MAXPGPATH],
+				dest_backup_path[MAXPGPATH],
 				control_file[MAXPGPATH];
-	parray	   *files,
-			   *to_files;
-	parray	   *to_external = NULL,
-			   *from_external = NULL;
+	MergeSource *chain = NULL;
+	MergeSource *full;
+	MergeSource *dest;
+	int			nbackups = parray_num(merge_list);
+	parray	   *files = NULL;
+	FileScheduler *sched = NULL;
 	pthread_t  *threads = NULL;
 	merge_files_arg *threads_args = NULL;
 	int			i;
 	time_t		merge_time;
 	bool		merge_isok = true;
 
+	pgBackupGetPath(full_backup, full_backup_path, lengthof(full_backup_path),
+					NULL);
+	join_path_components(dest_backup_path, backup_instance_path,
+						 dest_backup_id_str);
+
+	/* Files of the chain were merged by the previous interrupted merge */
+	if (full_backup->status == BACKUP_STATUS_MERGING &&
+		full_backup->merge_dest_backup == dest_backup_id)
+	{
+		elog(INFO, "Continue merging backup %s with backup %s",
+			 dest_backup_id_str, full_backup_id);
+		goto delete_source_backups;
+	}
+
+	Assert(nbackups >= 2 && dest_backup->start_time == dest_backup_id);
+
 	merge_time = time(NULL);
-	elog(INFO, "Merging backup %s with backup %s", from_backup_id, to_backup_id);
+	elog(INFO, "Merging backup %s with backup %s, %d incremental backups in chain",
+		 dest_backup_id_str, full_backup_id, nbackups - 1);
 
 	/* It's redundant to check block checksumms during merge */
 	skip_block_validation = true;
 
 	/*
-	 * Validate to_backup only if it is BACKUP_STATUS_OK. If it has
+	 * Validate FULL backup only if it is BACKUP_STATUS_OK. If it has
 	 * BACKUP_STATUS_MERGING status then it isn't valid backup until merging
 	 * finished.
 	 */
-	if (to_backup->status == BACKUP_STATUS_OK ||
-		to_backup->status == BACKUP_STATUS_DONE)
+	if (full_backup->status == BACKUP_STATUS_OK ||
+		full_backup->status == BACKUP_STATUS_DONE)
 	{
-		pgBackupValidate(to_backup, NULL);
-		if (to_backup->status == BACKUP_STATUS_CORRUPT)
+		pgBackupValidate(full_backup, NULL);
+		if (full_backup->status == BACKUP_STATUS_CORRUPT)
 			elog(ERROR, "Interrupt merging");
 	}
 
 	/*
-	 * It is OK to validate from_backup if it has BACKUP_STATUS_OK or
-	 * BACKUP_STATUS_MERGING status.
+	 * Get file lists of all backups of the chain, ordered from FULL backup
+	 * to the destination one. Each incremental backup is validated once.
 	 */
-	Assert(from_backup->status == BACKUP_STATUS_OK ||
-		   from_backup->status == BACKUP_STATUS_DONE ||
-		   from_backup->status == BACKUP_STATUS_MERGING ||
-		   from_backup->status == BACKUP_STATUS_DELETING);
-	pgBackupValidate(from_backup, NULL);
-	if (from_backup->status == BACKUP_STATUS_CORRUPT)
-		elog(ERROR, "Interrupt merging");
+	chain = (MergeSource *) palloc0(sizeof(MergeSource) * nbackups);
+	for (i = 0; i < nbackups; i++)
+	{
+		MergeSource *src = &chain[i];
 
-	/*
-	 * Make backup paths.
-	 */
-	pgBackupGetPath(to_backup, to_backup_path, lengthof(to_backup_path), NULL);
-	pgBackupGetPath(to_backup, to_database_path, lengthof(to_database_path),
-					DATABASE_DIR);
-	pgBackupGetPath(to_backup, to_external_prefix, lengthof(to_database_path),
-					EXTERNAL_DIR);
-	pgBackupGetPath(from_backup, from_backup_path, lengthof(from_backup_path), NULL);
-	pgBackupGetPath(from_backup, from_database_path, lengthof(from_database_path),
-					DATABASE_DIR);
-	pgBackupGetPath(from_backup, from_external_prefix, lengthof(from_database_path),
-					EXTERNAL_DIR);
+		src->backup = (pgBackup *) parray_get(merge_list, nbackups - 1 - i);
 
-	/*
-	 * Get list of files which will be modified or removed.
-	 */
-	pgBackupGetPath(to_backup, control_file, lengthof(control_file),
-					DATABASE_FILE_LIST);
-	to_files = dir_read_file_list(NULL, NULL, control_file, FIO_BACKUP_HOST);
-	/* To delete from leaf, sort in reversed order */
-	parray_qsort(to_files, pgFileCompareRelPathWithExternalDesc);
-	/*
-	 * Get list of files which need to be moved.
-	 */
-	pgBackupGetPath(from_backup, control_file, lengthof(control_file),
-					DATABASE_FILE_LIST);
-	files = dir_read_file_list(NULL, NULL, control_file, FIO_BACKUP_HOST);
-	/* sort by size for load balancing */
-	parray_qsort(files, pgFileCompareSize);
+		if (i > 0)
+		{
+			/*
+			 * It is OK to validate incremental backup if it has
+			 * BACKUP_STATUS_OK or BACKUP_STATUS_MERGING status.
+			 */
+			Assert(src->backup->status == BACKUP_STATUS_OK ||
+				   src->backup->status == BACKUP_STATUS_DONE ||
+				   src->backup->status == BACKUP_STATUS_MERGING ||
+				   src->backup->status == BACKUP_STATUS_DELETING);
+			pgBackupValidate(src->backup, NULL);
+			if (src->backup->status == BACKUP_STATUS_CORRUPT)
+				elog(ERROR, "Interrupt merging");
+		}
 
-	/*
-	 * Previous merging was interrupted during deleting source backup. It is
-	 * safe just to delete it again.
-	 */
-	if (from_backup->status == BACKUP_STATUS_DELETING)
-		goto delete_source_backup;
+		pgBackupGetPath(src->backup, src->database_path,
+						lengthof(src->database_path), DATABASE_DIR);
+		pgBackupGetPath(src->backup, src->external_prefix,
+						lengthof(src->external_prefix), EXTERNAL_DIR);
+		pgBackupGetPath(src->backup, control_file, lengthof(control_file),
+						DATABASE_FILE_LIST);
+		src->files = dir_read_file_list(NULL, NULL, control_file,
+										FIO_BACKUP_HOST);
+		parray_qsort(src->files, pgFileCompareRelPathWithExternalDesc);
+
+		if (src->backup->external_dir_str)
+			src->external_dirs =
+				make_external_directory_list(src->backup->external_dir_str,
+											 false);
+	}
+	full = &chain[0];
+	dest = &chain[nbackups - 1];
+
+	/* Merged backup keeps the file list format of the destination backup */
+	binary_file_list = file_list_is_binary(control_file, FIO_BACKUP_HOST);
 
-	write_backup_status(to_backup, BACKUP_STATUS_MERGING, instance_name);
-	write_backup_status(from_backup, BACKUP_STATUS_MERGING, instance_name);
+	files = parray_new();
+	parray_concat(files, dest->files);
 
-	create_data_directories(files, to_database_path, from_backup_path, false, FIO_BACKUP_HOST);
+	for (i = 0; i < nbackups; i++)
+		write_backup_status(chain[i].backup, BACKUP_STATUS_MERGING,
+							instance_name);
+
+	create_data_directories(files, full->database_path, dest_backup_path,
+							false, FIO_BACKUP_HOST);
 
 	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
 	threads_args = (merge_files_arg *) palloc(sizeof(merge_files_arg) * num_threads);
 
-	/* Create external directories lists */
-	if (to_backup->external_dir_str)
-		to_external = make_external_directory_list(to_backup->external_dir_str,
-												   false);
-	if (from_backup->external_dir_str)
-		from_external = make_external_directory_list(from_backup->external_dir_str,
-													 false);
-
 	/*
-	 * Rename external directories in to_backup (if exists)
-	 * according to numeration of external dirs in from_backup.
+	 * Rename external directories in FULL backup (if exists)
+	 * according to numeration of external dirs in the destination backup.
 	 */
-	if (to_external)
-		reorder_external_dirs(to_backup, to_external, from_external);
+	if (full->external_dirs)
+		reorder_external_dirs(full_backup, full->external_dirs,
+							  dest->external_dirs);
 
 	/* Setup threads */
 	for (i = 0; i < parray_num(files); i++)
@@ -290,28 +323,28 @@ merge_backups(pgBackup *to_backup, pgBackup *from_backup)
 			char		dirpath[MAXPGPATH];
 			char		new_container[MAXPGPATH];
 
-			makeExternalDirPathByNum(new_container, to_external_prefix,
+			makeExternalDirPathByNum(new_container, full->external_prefix,
 									 file->external_dir_num);
 			join_path_components(dirpath, new_container, file->path);
 			dir_create_dir(dirpath, DIR_PERMISSION);
 		}
-		pg_atomic_init_flag(&file->lock);
 	}
 
+	/* Merged datafiles are written as a stream, so they are not split */
+	sched = file_scheduler_new(files, false);
+
+	/* Pages of all backups may be compressed using their dictionaries */
+	for (i = 0; i < nbackups; i++)
+		load_page_dictionary(chain[i].backup);
+
 	thread_interrupted = false;
 	for (i = 0; i < num_threads; i++)
 	{
 		merge_files_arg *arg = &(threads_args[i]);
 
-		arg->to_files = to_files;
-		arg->files = files;
-		arg->to_backup = to_backup;
-		arg->from_backup = from_backup;
-		arg->to_root = to_database_path;
-		arg->from_root = from_database_path;
-		arg->from_external = from_external;
-		arg->to_external_prefix = to_external_prefix;
-		arg->from_external_prefix = from_external_prefix;
+		arg->sched = sched;
+		arg->chain = chain;
+		arg->nbackups = nbackups;
 		/* By default there are some error */
 		arg->ret = 1;
 
@@ -331,63 +364,30 @@ merge_backups(pgBackup *to_backup, pgBackup *from_backup)
 		elog(ERROR, "Data files merging failed");
 
 	/*
-	 * Update to_backup metadata.
-	 * We cannot set backup status to OK just yet,
-	 * because it still has old start_time.
-	 */
-	StrNCpy(to_backup->program_version, PROGRAM_VERSION,
-			sizeof(to_backup->program_version));
-	to_backup->parent_backup = INVALID_BACKUP_ID;
-	to_backup->start_lsn = from_backup->start_lsn;
-	to_backup->stop_lsn = from_backup->stop_lsn;
-	to_backup->recovery_time = from_backup->recovery_time;
-	to_backup->recovery_xid = from_backup->recovery_xid;
-	pfree(to_backup->external_dir_str);
-	to_backup->external_dir_str = from_backup->external_dir_str;
-	from_backup->external_dir_str = NULL; /* For safe pgBackupFree() */
-	to_backup->merge_time = merge_time;
-	to_backup->end_time = time(NULL);
-
-	/* Target backup must inherit wal mode too. */
-	to_backup->stream = from_backup->stream;
-
-	/* ARCHIVE backup must inherit wal_bytes. */
-	if (!to_backup->stream)
-		to_backup->wal_bytes = from_backup->wal_bytes;
-
-	write_backup_filelist(to_backup, files, from_database_path, NULL);
-	write_backup(to_backup);
-
-delete_source_backup:
-	/*
-	 * Files were copied into to_backup. It is time to remove source backup
-	 * entirely.
+	 * Delete files which are not in the file list of the destination backup.
+	 * It must be done before the file list of FULL backup is replaced,
+	 * otherwise we would lose track of them if interrupted.
 	 */
-	delete_backup_files(from_backup);
-
-	/*
-	 * Delete files which are not in from_backup file list.
-	 */
-	parray_qsort(files, pgFileCompareRelPathWithExternalDesc);
-	for (i = 0; i < parray_num(to_files); i++)
+	for (i = 0; i < parray_num(full->files); i++)
 	{
-		pgFile	   *file = (pgFile *) parray_get(to_files, i);
+		pgFile	   *file = (pgFile *) parray_get(full->files, i);
 
-		if (file->external_dir_num && to_external)
+		if (file->external_dir_num && full->external_dirs)
 		{
-			char *dir_name = parray_get(to_external, file->external_dir_num - 1);
-			if (backup_contains_external(dir_name, from_external))
+			char *dir_name = parray_get(full->external_dirs,
+										file->external_dir_num - 1);
+			if (backup_contains_external(dir_name, dest->external_dirs))
 				/* Dir already removed*/
 				continue;
 		}
 
-		if (parray_bsearch(files, file, pgFileCompareRelPathWithExternalDesc) == NULL)
+		if (parray_bsearch(dest->files, file, pgFileCompareRelPathWithExternalDesc) == NULL)
 		{
 			char		to_file_path[MAXPGPATH];
 			char	   *prev_path;
 
 			/* We need full path, file object has relative path */
-			join_path_components(to_file_path, to_database_path, file->path);
+			join_path_components(to_file_path, full->database_path, file->path);
 			prev_path = file->path;
 			file->path = to_file_path;
 
@@ -398,24 +398,60 @@ delete_source_backup:
 		}
 	}
 
+	/*
+	 * Update FULL backup metadata.
+	 * We cannot set backup status to OK just yet,
+	 * because it still has old start_time.
+	 */
+	StrNCpy(full_backup->program_version, PROGRAM_VERSION,
+			sizeof(full_backup->program_version));
+	full_backup->parent_backup = INVALID_BACKUP_ID;
+	full_backup->start_lsn = dest_backup->start_lsn;
+	full_backup->stop_lsn = dest_backup->stop_lsn;
+	full_backup->recovery_time = dest_backup->recovery_time;
+	full_backup->recovery_xid = dest_backup->recovery_xid;
+	pfree(full_backup->external_dir_str);
+	full_backup->external_dir_str = dest_backup->external_dir_str;
+	dest_backup->external_dir_str = NULL; /* For safe pgBackupFree() */
+	full_backup->merge_time = merge_time;
+	full_backup->end_time = time(NULL);
+
+	/* Target backup must inherit wal mode too. */
+	full_backup->stream = dest_backup->stream;
+
+	/* ARCHIVE backup must inherit wal_bytes. */
+	if (!full_backup->stream)
+		full_backup->wal_bytes = dest_backup->wal_bytes;
+
+	/* From now on FULL backup contains all data of the chain */
+	full_backup->merge_dest_backup = dest_backup_id;
+
+	write_backup_filelist(full_backup, files, dest->database_path, NULL);
+	write_backup(full_backup);
+
+delete_source_backups:
+	/*
+	 * Files were copied into FULL backup. It is time to remove incremental
+	 * backups entirely, starting from the oldest one.
+	 */
+	for (i = parray_num(merge_list) - 2; i >= 0; i--)
+		delete_backup_files((pgBackup *) parray_get(merge_list, i));
+
 	/*
 	 * Rename FULL backup directory.
 	 */
-	elog(INFO, "Rename %s to %s", to_backup_id, from_backup_id);
-	if (rename(to_backup_path, from_backup_path) == -1)
+	elog(INFO, "Rename %s to %s", full_backup_id, dest_backup_id_str);
+	if (rename(full_backup_path, dest_backup_path) == -1)
 		elog(ERROR, "Could not rename directory \"%s\" to \"%s\": %s",
-			 to_backup_path, from_backup_path, strerror(errno));
+			 full_backup_path, dest_backup_path, strerror(errno));
 
 	/*
 	 * Merging finished, now we can safely update ID of the destination backup.
-	 * TODO: for this critical section we must save incremental backup start_tome
-	 * to FULL backup meta, so even if crash happens after incremental backup removal
-	 * but before full backup obtaining new start_time we could safely continue
-	 * this failed backup.
 	 */
-	to_backup->status = BACKUP_STATUS_OK;
-	to_backup->start_time = from_backup->start_time;
-	write_backup(to_backup);
+	full_backup->status = BACKUP_STATUS_OK;
+	full_backup->start_time = dest_backup_id;
+	full_backup->merge_dest_backup = INVALID_BACKUP_ID;
+	write_backup(full_backup);
 
 	/* Cleanup */
 	if (threads)
@@ -424,36 +460,109 @@ delete_source_backup:
 		pfree(threads);
 	}
 
-	parray_walk(to_files, pgFileFree);
-	parray_free(to_files);
+	file_scheduler_free(sched);
+	if (files)
+		parray_free(files);
 
-	parray_walk(files, pgFileFree);
-	parray_free(files);
+	for (i = 0; chain && i < nbackups; i++)
+	{
+		parray_walk(chain[i].files, pgFileFree);
+		parray_free(chain[i].files);
+		if (chain[i].external_dirs)
+			free_dir_list(chain[i].external_dirs);
+	}
+	if (chain)
+		pfree(chain);
+
+	pfree(full_backup_id);
+	pfree(dest_backup_id_str);
+}
+
+/*
+ * Find the version of the file in the backup of the chain, NULL if the file
+ * is absent there. External directories may be numbered differently in
+ * every backup, dest_external is the list of the destination backup.
+ */
+static pgFile *
+find_chain_file(MergeSource *src, pgFile *file, parray *dest_external)
+{
+	pgFile		key;
+	pgFile	   *key_ptr = &key;
+	pgFile	  **res_file;
+
+	key.rel_path = file->rel_path;
+	key.external_dir_num = file->external_dir_num;
+
+	if (file->external_dir_num)
+	{
+		key.external_dir_num =
+			get_external_index(parray_get(dest_external,
+										  file->external_dir_num - 1),
+							   src->external_dirs);
+		if (key.external_dir_num == -1)
+			return NULL;
+	}
+
+	res_file = parray_bsearch(src->files, &key_ptr,
+							  pgFileCompareRelPathWithExternalDesc);
+	return (res_file) ? *res_file : NULL;
+}
+
+/*
+ * Build the path of the file in the backup of the chain.
+ */
+static void
+chain_file_path(char *path, MergeSource *src, pgFile *file)
+{
+	if (file->external_dir_num)
+	{
+		char		temp[MAXPGPATH];
 
-	pfree(to_backup_id);
-	pfree(from_backup_id);
+		makeExternalDirPathByNum(temp, src->external_prefix,
+								 file->external_dir_num);
+		join_path_components(path, temp, file->path);
+	}
+	else
+		join_path_components(path, src->database_path, file->path);
 }
 
 /*
- * Thread worker of merge_backups().
+ * Thread worker of merge_chain().
  */
 static void *
 merge_files(void *arg)
 {
 	merge_files_arg *argument = (merge_files_arg *) arg;
-	pgBackup   *to_backup = argument->to_backup;
-	pgBackup   *from_backup = argument->from_backup;
-	int			i,
-				num_files = parray_num(argument->files);
+	MergeSource *chain = argument->chain;
+	int			nbackups = argument->nbackups;
+	MergeSource *full = &chain[0];
+	MergeSource *dest = &chain[nbackups - 1];
+	pgBackup   *full_backup = full->backup;
+	pgFile	  **versions;
+	pgBackup  **backups;
+	char	  **prev_paths;
+	char	  (*paths)[MAXPGPATH];
+	FileTaskCursor cursor = FILE_TASK_CURSOR_INIT;
+	FileTask   *task;
+	int			i;
+
+	versions = (pgFile **) palloc(sizeof(pgFile *) * nbackups);
+	backups = (pgBackup **) palloc(sizeof(pgBackup *) * nbackups);
+	prev_paths = (char **) palloc(sizeof(char *) * nbackups);
+	paths = palloc(MAXPGPATH * nbackups);
 
-	for (i = 0; i < num_files; i++)
+	for (i = 0; i < nbackups; i++)
+		backups[i] = chain[i].backup;
+
+	while ((task = file_scheduler_next(argument->sched, &cursor)) != NULL)
 	{
-		pgFile	   *file = (pgFile *) parray_get(argument->files, i);
+		pgFile	   *file = task->file;
 		pgFile	   *to_file;
-		pgFile	  **res_file;
 		char		to_file_path[MAXPGPATH];	/* Path of target file */
-		char		from_file_path[MAXPGPATH];
-		char	   *prev_file_path;
+		int			newest;		/* the newest backup with the file content */
+		int			oldest;		/* the oldest backup with the file */
+		bool		delta_found = false;
+		int			k;
 
 		/* check for interrupt */
 		if (interrupted || thread_interrupted)
@@ -463,230 +572,183 @@ merge_files(void *arg)
 		if (S_ISDIR(file->mode))
 			continue;
 
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
-
 		if (progress)
 			elog(INFO, "Progress: (%d/%d). Process file \"%s\"",
-				 i + 1, num_files, file->path);
+				 (int) (task - argument->sched->tasks) + 1,
+				 argument->sched->ntasks, file->path);
 
-		res_file = parray_bsearch(argument->to_files, file,
-								  pgFileCompareRelPathWithExternalDesc);
-		to_file = (res_file) ? *res_file : NULL;
+		/*
+		 * Find versions of the file in the chain. If the file is absent in
+		 * some backup, it was deleted at that moment, so older versions
+		 * don't matter.
+		 */
+		versions[nbackups - 1] = file;
+		for (k = nbackups - 2; k >= 0; k--)
+		{
+			versions[k] = find_chain_file(&chain[k], file,
+										  dest->external_dirs);
+			if (versions[k] == NULL)
+				break;
+		}
+		oldest = k + 1;
+		for (; k >= 0; k--)
+			versions[k] = NULL;
 
-		join_path_components(to_file_path, argument->to_root, file->path);
+		to_file = versions[0];
+		chain_file_path(to_file_path, full, file);
 
 		/*
-		 * Skip files which haven't changed since previous backup. But in case
+		 * Find the newest backup where the file was changed. But in case
 		 * of DELTA backup we must truncate the target file to n_blocks.
 		 * Unless it is a non data file, in this case truncation is not needed.
 		 */
-		if (file->write_size == BYTES_INVALID)
+		for (newest = nbackups - 1; newest > oldest; newest--)
 		{
-			/* sanity */
+			if (versions[newest]->write_size != BYTES_INVALID)
+				break;
+			if (chain[newest].backup->backup_mode == BACKUP_MODE_DIFF_DELTA &&
+				file->is_datafile && !file->is_cfs)
+				delta_found = true;
+		}
+
+		/* sanity */
+		if (versions[newest]->write_size == BYTES_INVALID)
+		{
+			if (newest > 0)
+				elog(ERROR, "The file \"%s\" is missing in backup %s",
+					 file->rel_path,
+					 base36enc(chain[newest - 1].backup->start_time));
 			if (!to_file)
 				elog(ERROR, "The file \"%s\" is missing in FULL backup %s",
-						file->rel_path, base36enc(to_backup->start_time));
-
-			/* for not changed files of all types in PAGE and PTRACK */
-			if (from_backup->backup_mode != BACKUP_MODE_DIFF_DELTA ||
-			/* and not changed non-data files in DELTA */
-				(!file->is_datafile || file->is_cfs))
-			{
-				elog(VERBOSE, "Skip merging file \"%s\", the file didn't change",
-					 file->rel_path);
-
-				/*
-				 * If the file wasn't changed, retreive its
-				 * write_size and compression algorihtm from previous FULL backup.
-				 */
-				file->compress_alg = to_file->compress_alg;
-				file->write_size = to_file->write_size;
-
-				/*
-				 * Recalculate crc for backup prior to 2.0.25.
-				 */
-				if (parse_program_version(from_backup->program_version) < 20025)
-					file->crc = pgFileGetCRC(to_file_path, true, true, NULL, FIO_LOCAL_HOST);
-				/* Otherwise just get it from the previous file */
-				else
-					file->crc = to_file->crc;
-
-				continue;
-			}
+						file->rel_path, base36enc(full_backup->start_time));
 		}
 
-		/* TODO optimization: file from incremental backup has size 0, then
-		 * just truncate the file from FULL backup
-		 */
-
-		/* We need to make full path, file object has relative path */
-		if (file->external_dir_num)
+		/* The file wasn't changed since FULL backup */
+		if (newest == 0 && !delta_found)
 		{
-			char temp[MAXPGPATH];
-			makeExternalDirPathByNum(temp, argument->from_external_prefix,
-									 file->external_dir_num);
+			elog(VERBOSE, "Skip merging file \"%s\", the file didn't change",
+				 file->rel_path);
+
+			/*
+			 * If the file wasn't changed, retreive its
+			 * write_size and compression algorihtm from FULL backup.
+			 */
+			file->compress_alg = to_file->compress_alg;
+			file->write_size = to_file->write_size;
+			file->uncompressed_size = to_file->uncompressed_size;
+			file->frame_size = to_file->frame_size;
+			file->dict_crc = to_file->dict_crc;
 
-			join_path_components(from_file_path, temp, file->path);
+			/*
+			 * Recalculate crc for backup prior to 2.0.25.
+			 */
+			if (parse_program_version(dest->backup->program_version) < 20025)
+				file->crc = pgFileGetCRC(to_file_path, true, true, NULL, FIO_LOCAL_HOST);
+			/* Otherwise just get it from the previous file */
+			else
+				file->crc = to_file->crc;
+
+			continue;
 		}
-		else
-			join_path_components(from_file_path, argument->from_root,
-								 file->path);
-		prev_file_path = file->path;
-		file->path = from_file_path;
 
-		/*
-		 * Move the file. We need to decompress it and compress again if
-		 * necessary.
-		 */
 		elog(VERBOSE, "Merging file \"%s\", is_datafile %d, is_cfs %d",
-			 file->path, file->is_database, file->is_cfs);
+			 file->rel_path, file->is_database, file->is_cfs);
 
 		if (file->is_datafile && !file->is_cfs)
 		{
+			char		tmp_file_path[MAXPGPATH];
+			uint32		frame_size;
+
 			/*
-			 * We need more complicate algorithm if target file should be
-			 * compressed.
+			 * Merge pages of all versions into the temporary file and
+			 * replace the target file with it. Pages compressed with the
+			 * algorithm of FULL backup are copied as is.
+			 *
+			 * Merged file keeps the format of the file in FULL backup, so
+			 * that the interrupted merge can read it again.
 			 */
-			if (to_backup->compress_alg == PGLZ_COMPRESS ||
-				to_backup->compress_alg == ZLIB_COMPRESS)
-			{
-				char		merge_to_file_path[MAXPGPATH];
-				char		tmp_file_path[MAXPGPATH];
-				char	   *prev_path;
-
-				snprintf(merge_to_file_path, MAXPGPATH, "%s_merge", to_file_path);
-				snprintf(tmp_file_path, MAXPGPATH, "%s_tmp", to_file_path);
-
-				/* Start the magic */
-
-				/*
-				 * Merge files:
-				 * - if to_file in FULL backup exists, restore and decompress it to to_file_merge
-				 * - decompress source file if necessary and merge it with the
-				 *   target decompressed file in to_file_merge.
-				 * - compress result file to to_file_tmp
-				 * - rename to_file_tmp to to_file
-				 */
-
-				/*
-				 * We need to decompress target file in FULL backup if it exists.
-				 */
-				if (to_file)
-				{
-					elog(VERBOSE, "Merge target and source files into the temporary path \"%s\"",
-						 merge_to_file_path);
-
-					// TODO: truncate merge_to_file_path just in case?
-
-					/*
-					 * file->path is relative, to_file_path - is absolute.
-					 * Substitute them.
-					 */
-					prev_path = to_file->path;
-					to_file->path = to_file_path;
-					/* Decompress target file into temporary one */
-					restore_data_file(merge_to_file_path, to_file, false, false,
-									  parse_program_version(to_backup->program_version));
-					to_file->path = prev_path;
-				}
-				else
-					elog(VERBOSE, "Restore source file into the temporary path \"%s\"",
-						 merge_to_file_path);
-
-				/* TODO: Optimize merge of new files */
-
-				/* Merge source file with target file */
-				restore_data_file(merge_to_file_path, file,
-								  from_backup->backup_mode == BACKUP_MODE_DIFF_DELTA,
-								  false,
-								  parse_program_version(from_backup->program_version));
-
-				elog(VERBOSE, "Compress file and save it into the directory \"%s\"",
-					 argument->to_root);
-
-				/* Again we need to change path */
-				prev_path = file->path;
-				file->path = merge_to_file_path;
-				/* backup_data_file() requires file size to calculate nblocks */
-				file->size = pgFileSize(file->path);
-				/* Now we can compress the file */
-				backup_data_file(NULL, /* We shouldn't need 'arguments' here */
-								 tmp_file_path, file,
-								 to_backup->start_lsn,
-								 to_backup->backup_mode,
-								 to_backup->compress_alg,
-								 to_backup->compress_level,
-								 from_backup->checksum_version,
-								 0, NULL, false);
-
-				file->path = prev_path;
-
-				/* rename temp file */
-				if (rename(tmp_file_path, to_file_path) == -1)
-					elog(ERROR, "Could not rename file \"%s\" to \"%s\": %s",
-								file->path, tmp_file_path, strerror(errno));
-
-				/* We can remove temporary file */
-				if (unlink(merge_to_file_path))
-					elog(ERROR, "Could not remove temporary file \"%s\": %s",
-						 merge_to_file_path, strerror(errno));
-			}
+			snprintf(tmp_file_path, MAXPGPATH, "%s_tmp", to_file_path);
+
 			/*
-			 * Otherwise merging algorithm is simpler.
+			 * FULL backup may lose the file during the interrupted merge,
+			 * then only versions from incremental backups are merged.
 			 */
-			else
+			if (to_file && fio_access(to_file_path, F_OK, FIO_BACKUP_HOST) != 0)
 			{
-				/* We can merge in-place here */
-				restore_data_file(to_file_path, file,
-								  from_backup->backup_mode == BACKUP_MODE_DIFF_DELTA,
-								  true,
-								  parse_program_version(from_backup->program_version));
-
-				/*
-				 * We need to calculate write_size, restore_data_file() doesn't
-				 * do that.
-				 */
-				file->write_size = pgFileSize(to_file_path);
-				file->crc = pgFileGetCRC(to_file_path, true, true, NULL, FIO_LOCAL_HOST);
+				elog(WARNING, "File \"%s\" is missing in FULL backup %s",
+					 to_file_path, base36enc(full_backup->start_time));
+				versions[0] = to_file = NULL;
+				oldest = Max(oldest, 1);
 			}
+
+			frame_size = to_file ? to_file->frame_size : compress_frame_size;
+
+			/* file->path is relative, substitute absolute paths */
+			for (k = oldest; k < nbackups; k++)
+			{
+				chain_file_path(paths[k], &chain[k], versions[k]);
+				prev_paths[k] = versions[k]->path;
+				versions[k]->path = paths[k];
+			}
+
+			merge_data_file(tmp_file_path, versions, backups, nbackups,
+							full_backup->compress_alg,
+							full_backup->compress_level, frame_size);
+
+			for (k = oldest; k < nbackups; k++)
+				versions[k]->path = prev_paths[k];
+
+			/* rename temp file */
+			if (rename(tmp_file_path, to_file_path) == -1)
+				elog(ERROR, "Could not rename file \"%s\" to \"%s\": %s",
+					 tmp_file_path, to_file_path, strerror(errno));
 		}
-		else if (file->external_dir_num)
+		else
 		{
-			char	to_root[MAXPGPATH];
-			int		new_dir_num;
-			char   *file_external_path = parray_get(argument->from_external,
-													file->external_dir_num - 1);
-
-			Assert(argument->from_external);
-			new_dir_num = get_external_index(file_external_path,
-											 argument->from_external);
-			makeExternalDirPathByNum(to_root, argument->to_external_prefix,
-									 new_dir_num);
-			copy_file(FIO_LOCAL_HOST, to_root, FIO_LOCAL_HOST, file, false);
+			char		from_file_path[MAXPGPATH];
+			char	   *prev_file_path;
+			char		to_root[MAXPGPATH];
+
+			/* Copy the newest version, file object has relative path */
+			chain_file_path(from_file_path, &chain[newest], versions[newest]);
+			prev_file_path = file->path;
+			file->path = from_file_path;
+
+			if (file->external_dir_num)
+				makeExternalDirPathByNum(to_root, full->external_prefix,
+										 file->external_dir_num);
+			else
+				strcpy(to_root, full->database_path);
+
+			if (strcmp(file->name, "pg_control") == 0)
+				copy_pgcontrol_file(chain[newest].database_path, FIO_LOCAL_HOST,
+									to_root, FIO_LOCAL_HOST, file);
+			else
+				copy_file(FIO_LOCAL_HOST, to_root, FIO_LOCAL_HOST, file, false);
+
+			/* Restore relative path */
+			file->path = prev_file_path;
 		}
-		else if (strcmp(file->name, "pg_control") == 0)
-			copy_pgcontrol_file(argument->from_root, FIO_LOCAL_HOST, argument->to_root, FIO_LOCAL_HOST, file);
-		else
-			copy_file(FIO_LOCAL_HOST, argument->to_root, FIO_LOCAL_HOST, file, false);
 
 		/*
 		 * We need to save compression algorithm type of the target backup to be
 		 * able to restore in the future.
 		 */
-		file->compress_alg = to_backup->compress_alg;
+		file->compress_alg = full_backup->compress_alg;
 
 		if (file->write_size < 0)
 			elog(ERROR, "Merge of file \"%s\" failed. Invalid size: %i",
-				file->path, BYTES_INVALID);
+				file->rel_path, BYTES_INVALID);
 
 		elog(VERBOSE, "Merged file \"%s\": " INT64_FORMAT " bytes",
-				file->path, file->write_size);
-
-		/* Restore relative path */
-		file->path = prev_file_path;
+				file->rel_path, file->write_size);
 	}
 
+	pfree(versions);
+	pfree(backups);
+	pfree(prev_paths);
+	pfree(paths);
+
 	/* Data files merging is successful */
 	argument->ret = 0;
 
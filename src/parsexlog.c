@@ -94,6 +94,30 @@ typedef struct XLogRecTarget
 	XLogRecPtr	rec_lsn;
 } XLogRecTarget;
 
+/*
+ * Compressed WAL segment inflated by a helper thread of WAL reader, while
+ * the reader decodes its current segment.
+ */
+typedef struct XLogPrefetch
+{
+	pthread_t	thread;
+	bool		started;	/* the helper thread is started and not joined */
+	XLogSegNo	segno;
+	char		xlogpath[MAXPGPATH];
+	char		gz_xlogpath[MAXPGPATH];
+	char	   *buf;
+	bool		loaded;		/* buf contains inflated segment */
+	bool		reserved;	/* buf is accounted in prefetch_memory */
+} XLogPrefetch;
+
+/*
+ * Limit of memory taken by buffers of prefetched segments of all threads.
+ * Every buffer holds the whole inflated segment, in addition to the segment
+ * being decoded, so only a few threads may prefetch at once. Others inflate
+ * their segments themselves.
+ */
+#define XLOG_PREFETCH_MEMORY_LIMIT	((uint64) 64 * 1024 * 1024)
+
 typedef struct XLogReaderData
 {
 	int			thread_num;
@@ -102,6 +126,8 @@ typedef struct XLogReaderData
 	XLogRecTarget cur_rec;
 	XLogSegNo	xlogsegno;
 	bool		xlogexists;
+	/* Segment claimed by the thread to read after xlogsegno, 0 if none */
+	XLogSegNo	next_segno;
 
 	char		 page_buf[XLOG_BLCKSZ];
 	uint32		 prev_page_off;
@@ -112,8 +138,14 @@ typedef struct XLogReaderData
 	char		xlogpath[MAXPGPATH];
 
 #ifdef HAVE_LIBZ
-	gzFile		 gz_xlogfile;
 	char		 gz_xlogpath[MAXPGPATH];
+	/*
+	 * Compressed segment is inflated into memory at once, because seeking
+	 * backward in gz file means inflating it from the beginning.
+	 */
+	char		*gz_buf;
+	bool		 gz_loaded;		/* gz_buf contains segment xlogsegno */
+	XLogPrefetch *prefetch;
 #endif
 } XLogReaderData;
 
@@ -168,9 +200,22 @@ static bool SwitchThreadToNextWal(XLogReaderState *xlogreader,
 								  xlog_thread_arg *arg);
 static bool XLogWaitForConsistency(XLogReaderState *xlogreader);
 static void *XLogThreadWorker(void *arg);
+static void ReleaseXLogThread(XLogReaderState *xlogreader);
 static void CleanupXLogPageRead(XLogReaderState *xlogreader);
+static void FreeXLogPageRead(XLogReaderState *xlogreader);
+#ifdef HAVE_LIBZ
+static bool InflateXLogSegment(const char *gz_xlogpath, char *buf,
+							   int thread_num, int elevel);
+static void StartXLogPrefetch(XLogReaderData *reader_data);
+static void WaitXLogPrefetch(XLogReaderData *reader_data);
+#endif
 static void PrintXLogCorruptionMsg(XLogReaderData *reader_data, int elevel);
 
+static bool extractPageMapFromSummaries(const char *archivedir,
+										TimeLineID tli, uint32 segment_size,
+										XLogRecPtr startpoint,
+										XLogRecPtr endpoint);
+static bool isRecordTrackable(XLogReaderState *record);
 static void extractPageInfo(XLogReaderState *record,
 							XLogReaderData *reader_data, bool *stop_reading);
 static void validateXLogRecord(XLogReaderState *record,
@@ -186,6 +231,12 @@ static XLogSegNo segno_next = 0;
 static uint32 segnum_read = 0;
 /* Number of detected corrupted or absent segments */
 static uint32 segnum_corrupted = 0;
+/* Number of segments claimed ahead by threads which stopped before reading them */
+static uint32 segnum_skipped = 0;
+#ifdef HAVE_LIBZ
+/* Memory reserved for prefetch buffers, see XLOG_PREFETCH_MEMORY_LIMIT */
+static uint64 prefetch_memory = 0;
+#endif
 static pthread_mutex_t wal_segment_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* copied from timestamp.c */
@@ -237,6 +288,11 @@ extractPageMap(const char *archivedir, TimeLineID tli, uint32 wal_seg_size,
 {
 	bool		extract_isok = true;
 
+	/* Archive-push may have already done the work for us */
+	if (extractPageMapFromSummaries(archivedir, tli, wal_seg_size,
+									startpoint, endpoint))
+		return;
+
 	extract_isok = RunXLogThreads(archivedir, 0, InvalidTransactionId,
 								  InvalidXLogRecPtr, tli, wal_seg_size,
 								  startpoint, endpoint, false, extractPageInfo,
@@ -245,6 +301,164 @@ extractPageMap(const char *archivedir, TimeLineID tli, uint32 wal_seg_size,
 		elog(ERROR, "Pagemap compiling failed");
 }
 
+/*
+ * Read summary of the WAL segment written by archive-push. Returns NULL if
+ * there is no summary or it is corrupted.
+ */
+static WalSummaryBlock *
+read_wal_summary(const char *path, WalSummaryHeader *header)
+{
+	WalSummaryBlock *blocks;
+	size_t		size;
+	pg_crc32	crc;
+	int			fd;
+
+	fd = fio_open(path, O_RDONLY | PG_BINARY, FIO_BACKUP_HOST);
+	if (fd < 0)
+		return NULL;
+
+	if (fio_read(fd, header, sizeof(WalSummaryHeader)) != sizeof(WalSummaryHeader) ||
+		header->magic != WAL_SUMMARY_MAGIC)
+	{
+		elog(WARNING, "Invalid WAL summary file \"%s\"", path);
+		fio_close(fd);
+		return NULL;
+	}
+
+	size = sizeof(WalSummaryBlock) * header->nblocks;
+	blocks = pgut_malloc(Max(size, 1));
+	if (fio_read(fd, blocks, size) != size)
+	{
+		elog(WARNING, "Cannot read WAL summary file \"%s\": %s",
+			 path, strerror(errno));
+		pg_free(blocks);
+		fio_close(fd);
+		return NULL;
+	}
+	fio_close(fd);
+
+	INIT_FILE_CRC32(true, crc);
+	COMP_FILE_CRC32(true, crc, blocks, size);
+	FIN_FILE_CRC32(true, crc);
+	if (crc != header->crc)
+	{
+		elog(WARNING, "Invalid CRC of WAL summary file \"%s\"", path);
+		pg_free(blocks);
+		return NULL;
+	}
+
+	return blocks;
+}
+
+/*
+ * Build page map from the WAL summaries written by archive-push, see
+ * summarize_wal_segment(). The pagemap may contain some blocks changed
+ * outside of 'startpoint' and 'endpoint', it only makes the backup a bit
+ * larger.
+ *
+ * Returns false if some segment has no valid summary, the WAL has to be
+ * read then.
+ */
+static bool
+extractPageMapFromSummaries(const char *archivedir, TimeLineID tli,
+							uint32 segment_size, XLogRecPtr startpoint,
+							XLogRecPtr endpoint)
+{
+	XLogSegNo	start_segno;
+	XLogSegNo	end_segno;
+	XLogSegNo	segno;
+	WalSummaryHeader *headers;
+	WalSummaryBlock **blocks;
+	int			nsegments;
+	int			i;
+	bool		result = true;
+
+	GetXLogSegNo(startpoint, start_segno, segment_size);
+	GetXLogSegNo(endpoint, end_segno, segment_size);
+	nsegments = end_segno - start_segno + 1;
+
+	headers = pgut_newarray(WalSummaryHeader, nsegments);
+	blocks = pgut_newarray(WalSummaryBlock *, nsegments);
+	memset(blocks, 0, sizeof(WalSummaryBlock *) * nsegments);
+
+	/* Don't touch pagemap until we know that all summaries are there */
+	for (i = 0; i < nsegments; i++)
+	{
+		char		wal_segment[MAXFNAMELEN];
+		char		path[MAXPGPATH];
+
+		GetXLogFileName(wal_segment, tli, start_segno + i, segment_size);
+		snprintf(path, sizeof(path), "%s/%s.%s", archivedir, wal_segment,
+				 WAL_SUMMARY_SUFFIX);
+
+		blocks[i] = read_wal_summary(path, &headers[i]);
+		if (blocks[i] == NULL)
+		{
+			elog(LOG, "There is no WAL summary for segment \"%s\", reading WAL",
+				 wal_segment);
+			result = false;
+			goto cleanup;
+		}
+	}
+
+	for (i = 0; i < nsegments; i++)
+	{
+		uint32		j;
+		XLogRecPtr	next_segment_start;
+
+		for (j = 0; j < headers[i].nblocks; j++)
+			process_block_change(MAIN_FORKNUM, blocks[i][j].rnode,
+								 blocks[i][j].blkno);
+
+		/*
+		 * The last record of the segment continues into the next one and it
+		 * is not summarized, read it from WAL.
+		 */
+		segno = start_segno + i;
+		GetXLogRecPtr(segno + 1, 0, segment_size, next_segment_start);
+		if (!XLogRecPtrIsInvalid(headers[i].end_lsn) &&
+			headers[i].end_lsn < next_segment_start &&
+			headers[i].end_lsn < endpoint)
+		{
+			XLogReaderState *xlogreader;
+			XLogReaderData reader_data;
+			XLogRecPtr	found;
+			char	   *errormsg;
+			bool		stop_reading = false;
+
+			xlogreader = InitXLogPageRead(&reader_data, archivedir, tli,
+										  segment_size, false, false, true);
+
+			found = XLogFindNextRecord(xlogreader, headers[i].end_lsn);
+			if (XLogRecPtrIsInvalid(found) ||
+				XLogReadRecord(xlogreader, found, &errormsg) == NULL)
+				result = false;
+			else
+				extractPageInfo(xlogreader, &reader_data, &stop_reading);
+
+			FreeXLogPageRead(xlogreader);
+
+			if (!result)
+			{
+				elog(LOG, "Cannot read WAL record at %X/%X, reading WAL",
+					 (uint32) (headers[i].end_lsn >> 32),
+					 (uint32) (headers[i].end_lsn));
+				goto cleanup;
+			}
+		}
+	}
+
+	elog(INFO, "Pagemap is built from summaries of %d WAL segments", nsegments);
+
+cleanup:
+	for (i = 0; i < nsegments; i++)
+		pg_free(blocks[i]);
+	pg_free(blocks);
+	pg_free(headers);
+
+	return result;
+}
+
 /*
  * Ensure that the backup has all wal files needed for recovery to consistent
  * state.
@@ -473,8 +687,7 @@ read_recovery_info(const char *archivedir, TimeLineID tli, uint32 wal_seg_size,
 	res = false;
 
 cleanup:
-	CleanupXLogPageRead(xlogreader);
-	XLogReaderFree(xlogreader);
+	FreeXLogPageRead(xlogreader);
 
 	return res;
 }
@@ -511,8 +724,7 @@ wal_contains_lsn(const char *archivedir, XLogRecPtr target_lsn,
 		elog(WARNING, "Could not read WAL record at %X/%X: %s",
 				(uint32) (target_lsn >> 32), (uint32) (target_lsn), errormsg);
 
-	CleanupXLogPageRead(xlogreader);
-	XLogReaderFree(xlogreader);
+	FreeXLogPageRead(xlogreader);
 
 	return res;
 }
@@ -553,8 +765,7 @@ get_first_record_lsn(const char *archivedir, XLogSegNo	segno,
 				(uint32) (record >> 32), (uint32) (record));
 
 	/* cleanup */
-	CleanupXLogPageRead(xlogreader);
-	XLogReaderFree(xlogreader);
+	FreeXLogPageRead(xlogreader);
 
 	return record;
 }
@@ -665,12 +876,185 @@ get_prior_record_lsn(const char *archivedir, XLogRecPtr start_lsn,
 		startpoint = InvalidXLogRecPtr;
 	}
 
-	CleanupXLogPageRead(xlogreader);
-	XLogReaderFree(xlogreader);
+	FreeXLogPageRead(xlogreader);
 
 	return res;
 }
 
+/* WAL segment read into memory, see summarize_wal_segment() */
+typedef struct XLogBufferData
+{
+	const char *buf;
+	size_t		size;
+	XLogRecPtr	start;		/* LSN of the beginning of buf */
+	TimeLineID	tli;
+	bool		need_next;	/* page of the next segment was requested */
+} XLogBufferData;
+
+/* XLogreader callback function, to read a WAL page from memory */
+static int
+BufferXLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr,
+				   int reqLen, XLogRecPtr targetRecPtr, char *readBuf,
+				   TimeLineID *pageTLI)
+{
+	XLogBufferData *data = (XLogBufferData *) xlogreader->private_data;
+
+	/* Pages of other segments are not available */
+	if (targetPagePtr < data->start ||
+		targetPagePtr + XLOG_BLCKSZ > data->start + data->size)
+	{
+		if (targetPagePtr >= data->start + data->size)
+			data->need_next = true;
+		return -1;
+	}
+
+	memcpy(readBuf, data->buf + (targetPagePtr - data->start), XLOG_BLCKSZ);
+	*pageTLI = data->tli;
+	return XLOG_BLCKSZ;
+}
+
+static int
+WalSummaryBlockCompare(const void *a1, const void *a2)
+{
+	const WalSummaryBlock *b1 = (const WalSummaryBlock *) a1;
+	const WalSummaryBlock *b2 = (const WalSummaryBlock *) a2;
+
+	if (b1->rnode.relNode != b2->rnode.relNode)
+		return b1->rnode.relNode < b2->rnode.relNode ? -1 : 1;
+	if (b1->rnode.dbNode != b2->rnode.dbNode)
+		return b1->rnode.dbNode < b2->rnode.dbNode ? -1 : 1;
+	if (b1->rnode.spcNode != b2->rnode.spcNode)
+		return b1->rnode.spcNode < b2->rnode.spcNode ? -1 : 1;
+	if (b1->blkno != b2->blkno)
+		return b1->blkno < b2->blkno ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Collect main fork blocks changed by WAL records starting in the segment
+ * with number 'segno', whose content is in 'buf'. The last record may
+ * continue into the next segment which is not available yet, so it is not
+ * summarized, its LSN is returned in 'end_lsn'.
+ *
+ * Returns array of sorted unique blocks or NULL if the segment has a record
+ * whose changes can't be tracked or a record which can't be decoded, the
+ * segment should be read by PAGE backup itself then.
+ */
+WalSummaryBlock *
+summarize_wal_segment(const char *buf, size_t size, TimeLineID tli,
+					  XLogSegNo segno, uint32 wal_seg_size, uint32 *nblocks,
+					  XLogRecPtr *end_lsn)
+{
+	XLogReaderState *xlogreader;
+	XLogBufferData data;
+	WalSummaryBlock *blocks;
+	uint32		nalloc = 1024;
+	uint32		n = 0;
+	uint32		i;
+	XLogRecPtr	startpoint;
+	bool		trackable = true;
+
+	data.buf = buf;
+	data.size = size;
+	data.tli = tli;
+	data.need_next = false;
+	GetXLogRecPtr(segno, 0, wal_seg_size, data.start);
+
+#if PG_VERSION_NUM >= 110000
+	xlogreader = XLogReaderAllocate(wal_seg_size, &BufferXLogPageRead, &data);
+#else
+	xlogreader = XLogReaderAllocate(&BufferXLogPageRead, &data);
+#endif
+	if (xlogreader == NULL)
+		elog(ERROR, "Out of memory");
+	xlogreader->system_identifier = instance_config.system_identifier;
+
+	blocks = pgut_newarray(WalSummaryBlock, nalloc);
+	*end_lsn = InvalidXLogRecPtr;
+
+	/* Skip the end of the record started in previous segment */
+	startpoint = XLogFindNextRecord(xlogreader, data.start);
+
+	/* Read records until the one which continues into the next segment */
+	while (!XLogRecPtrIsInvalid(startpoint) || !XLogRecPtrIsInvalid(*end_lsn))
+	{
+		XLogRecord *record;
+		char	   *errormsg;
+		uint8		block_id;
+
+		record = XLogReadRecord(xlogreader, startpoint, &errormsg);
+		if (record == NULL)
+			break;
+		startpoint = InvalidXLogRecPtr;
+
+		if (!isRecordTrackable(xlogreader))
+		{
+			trackable = false;
+			break;
+		}
+
+		for (block_id = 0; block_id <= xlogreader->max_block_id; block_id++)
+		{
+			RelFileNode rnode;
+			ForkNumber	forknum;
+			BlockNumber blkno;
+
+			if (!XLogRecGetBlockTag(xlogreader, block_id, &rnode, &forknum, &blkno))
+				continue;
+
+			/* We only care about the main fork; others are copied as is */
+			if (forknum != MAIN_FORKNUM)
+				continue;
+
+			if (n == nalloc)
+			{
+				nalloc *= 2;
+				blocks = pgut_realloc(blocks, sizeof(WalSummaryBlock) * nalloc);
+			}
+			blocks[n].rnode = rnode;
+			blocks[n].blkno = blkno;
+			n++;
+		}
+
+		*end_lsn = xlogreader->EndRecPtr;
+	}
+
+	XLogReaderFree(xlogreader);
+
+	/*
+	 * Reading stops only on a record which is not available in this segment.
+	 * If the reader didn't ask for the next segment, the record is broken
+	 * and the rest of the segment is unknown.
+	 */
+	if (trackable && !data.need_next)
+	{
+		XLogRecPtr	broken_lsn = XLogRecPtrIsInvalid(*end_lsn) ?
+			data.start : *end_lsn;
+
+		elog(LOG, "Cannot read WAL record at %X/%X to summarize the segment",
+			 (uint32) (broken_lsn >> 32), (uint32) broken_lsn);
+		trackable = false;
+	}
+
+	if (!trackable)
+	{
+		pg_free(blocks);
+		return NULL;
+	}
+
+	/* Hot blocks are referenced by many records */
+	qsort(blocks, n, sizeof(WalSummaryBlock), WalSummaryBlockCompare);
+	*nblocks = 0;
+	for (i = 0; i < n; i++)
+	{
+		if (*nblocks == 0 ||
+			WalSummaryBlockCompare(&blocks[*nblocks - 1], &blocks[i]) != 0)
+			blocks[(*nblocks)++] = blocks[i];
+	}
+
+	return blocks;
+}
+
 #ifdef HAVE_LIBZ
 /*
  * Show error during work with compressed file
@@ -780,25 +1164,51 @@ SimpleXLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr,
 		/* Try to open compressed WAL segment */
 		else
 		{
+			XLogPrefetch *prefetch = reader_data->prefetch;
+
 			snprintf(reader_data->gz_xlogpath, sizeof(reader_data->gz_xlogpath),
 					 "%s.gz", reader_data->xlogpath);
-			if (fileExists(reader_data->gz_xlogpath, FIO_BACKUP_HOST))
+
+			/* Maybe the segment is already inflated in background */
+			if (prefetch != NULL && prefetch->started &&
+				prefetch->segno == reader_data->xlogsegno)
+			{
+				WaitXLogPrefetch(reader_data);
+				if (prefetch->loaded)
+				{
+					char	   *buf = reader_data->gz_buf;
+
+					elog(LOG, "Thread [%d]: Using prefetched WAL segment \"%s\"",
+						 reader_data->thread_num, reader_data->gz_xlogpath);
+
+					reader_data->gz_buf = prefetch->buf;
+					prefetch->buf = buf;
+					prefetch->loaded = false;
+					reader_data->xlogexists = true;
+					reader_data->gz_loaded = true;
+				}
+			}
+
+			if (!reader_data->xlogexists &&
+				fileExists(reader_data->gz_xlogpath, FIO_BACKUP_HOST))
 			{
 				elog(LOG, "Thread [%d]: Opening compressed WAL segment \"%s\"",
 					 reader_data->thread_num, reader_data->gz_xlogpath);
 
 				reader_data->xlogexists = true;
-				reader_data->gz_xlogfile = fio_gzopen(reader_data->gz_xlogpath,
-													  "rb", -1, FIO_BACKUP_HOST);
-				if (reader_data->gz_xlogfile == NULL)
-				{
-					elog(WARNING, "Thread [%d]: Could not open compressed WAL segment \"%s\": %s",
-						 reader_data->thread_num, reader_data->gz_xlogpath,
-						 strerror(errno));
+				if (reader_data->gz_buf == NULL)
+					reader_data->gz_buf = pgut_malloc(wal_seg_size);
+				if (!InflateXLogSegment(reader_data->gz_xlogpath,
+										reader_data->gz_buf,
+										reader_data->thread_num, WARNING))
 					return -1;
-				}
+				reader_data->gz_loaded = true;
 			}
 		}
+
+		/* Inflate the next segment of the thread while this one is decoded */
+		if (reader_data->xlogexists && reader_data->next_segno != 0)
+			StartXLogPrefetch(reader_data);
 #endif
 
 		/* Exit without error if WAL segment doesn't exist */
@@ -840,25 +1250,11 @@ SimpleXLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr,
 		}
 	}
 #ifdef HAVE_LIBZ
-	else
-	{
-		if (fio_gzseek(reader_data->gz_xlogfile, (z_off_t) targetPageOff, SEEK_SET) == -1)
-		{
-			elog(WARNING, "Thread [%d]: Could not seek in compressed WAL segment \"%s\": %s",
-				reader_data->thread_num, reader_data->gz_xlogpath,
-				get_gz_error(reader_data->gz_xlogfile));
-			return -1;
-		}
-
-		if (fio_gzread(reader_data->gz_xlogfile, readBuf, XLOG_BLCKSZ) != XLOG_BLCKSZ)
-		{
-			elog(WARNING, "Thread [%d]: Could not read from compressed WAL segment \"%s\": %s",
-				reader_data->thread_num, reader_data->gz_xlogpath,
-				get_gz_error(reader_data->gz_xlogfile));
-			return -1;
-		}
-	}
+	else if (reader_data->gz_loaded)
+		memcpy(readBuf, reader_data->gz_buf + targetPageOff, XLOG_BLCKSZ);
 #endif
+	else
+		return -1;
 
 	memcpy(reader_data->page_buf, readBuf, XLOG_BLCKSZ);
 	reader_data->prev_page_off = targetPageOff;
@@ -955,6 +1351,7 @@ RunXLogThreads(const char *archivedir, time_t target_time,
 	GetXLogSegNo(startpoint, segno_next, segment_size);
 	segnum_read = 0;
 	segnum_corrupted = 0;
+	segnum_skipped = 0;
 
 	threads = (pthread_t *) pgut_malloc(sizeof(pthread_t) * num_threads);
 	thread_args = (xlog_thread_arg *) pgut_malloc(sizeof(xlog_thread_arg) * num_threads);
@@ -1176,7 +1573,11 @@ XLogThreadWorker(void *arg)
 				 * Report error message if this is the first corrupted WAL.
 				*/
 				if (reader_data->xlogsegno > segno_report)
-					return NULL;	/* otherwise just stop the thread */
+				{
+					/* otherwise just stop the thread */
+					ReleaseXLogThread(xlogreader);
+					return NULL;
+				}
 			}
 
 			errptr = thread_arg->startpoint ?
@@ -1254,14 +1655,33 @@ XLogThreadWorker(void *arg)
 			break;
 	}
 
-	CleanupXLogPageRead(xlogreader);
-	XLogReaderFree(xlogreader);
+	ReleaseXLogThread(xlogreader);
 
 	/* Extracting is successful */
 	thread_arg->ret = 0;
 	return NULL;
 }
 
+/*
+ * Give up the segment claimed ahead by the thread, so that other threads
+ * don't wait for it to be read, and free the reader.
+ */
+static void
+ReleaseXLogThread(XLogReaderState *xlogreader)
+{
+	XLogReaderData *reader_data = (XLogReaderData *) xlogreader->private_data;
+
+	if (reader_data->next_segno != 0)
+	{
+		pthread_lock(&wal_segment_mutex);
+		segnum_skipped++;
+		pthread_mutex_unlock(&wal_segment_mutex);
+		reader_data->next_segno = 0;
+	}
+
+	FreeXLogPageRead(xlogreader);
+}
+
 /*
  * Do manual switch to the next WAL segment.
  *
@@ -1276,12 +1696,20 @@ SwitchThreadToNextWal(XLogReaderState *xlogreader, xlog_thread_arg *arg)
 	reader_data = (XLogReaderData *) xlogreader->private_data;
 	reader_data->need_switch = false;
 
-	/* Critical section */
+	/*
+	 * Critical section. Take the segment claimed earlier and claim the
+	 * following one, so that it can be prefetched while this one is read.
+	 */
 	pthread_lock(&wal_segment_mutex);
 	Assert(segno_next);
-	reader_data->xlogsegno = segno_next;
+	if (reader_data->next_segno != 0)
+		reader_data->xlogsegno = reader_data->next_segno;
+	else
+		reader_data->xlogsegno = segno_next++;
+	reader_data->next_segno = 0;
+	if (arg->endSegNo == 0 || segno_next <= arg->endSegNo)
+		reader_data->next_segno = segno_next++;
 	segnum_read++;
-	segno_next++;
 	pthread_mutex_unlock(&wal_segment_mutex);
 
 	/* We've reached the end */
@@ -1373,7 +1801,7 @@ XLogWaitForConsistency(XLogReaderState *xlogreader)
 				 reader_data->thread_num);
 
 		pthread_lock(&wal_segment_mutex);
-		segnum_current_read = segnum_read + segnum_corrupted;
+		segnum_current_read = segnum_read + segnum_corrupted + segnum_skipped;
 		segno = segno_target;
 		pthread_mutex_unlock(&wal_segment_mutex);
 
@@ -1412,16 +1840,160 @@ CleanupXLogPageRead(XLogReaderState *xlogreader)
 		reader_data->xlogfile = -1;
 	}
 #ifdef HAVE_LIBZ
-	else if (reader_data->gz_xlogfile != NULL)
-	{
-		fio_gzclose(reader_data->gz_xlogfile);
-		reader_data->gz_xlogfile = NULL;
-	}
+	reader_data->gz_loaded = false;
 #endif
 	reader_data->prev_page_off = 0;
 	reader_data->xlogexists = false;
 }
 
+/*
+ * Cleanup after WAL reading and free the reader.
+ */
+static void
+FreeXLogPageRead(XLogReaderState *xlogreader)
+{
+#ifdef HAVE_LIBZ
+	XLogReaderData *reader_data;
+
+	reader_data = (XLogReaderData *) xlogreader->private_data;
+	if (reader_data->prefetch != NULL)
+	{
+		WaitXLogPrefetch(reader_data);
+		if (reader_data->prefetch->reserved)
+		{
+			pthread_lock(&wal_segment_mutex);
+			prefetch_memory -= wal_seg_size;
+			pthread_mutex_unlock(&wal_segment_mutex);
+		}
+		pg_free(reader_data->prefetch->buf);
+		pg_free(reader_data->prefetch);
+		reader_data->prefetch = NULL;
+	}
+	pg_free(reader_data->gz_buf);
+	reader_data->gz_buf = NULL;
+#endif
+
+	CleanupXLogPageRead(xlogreader);
+	XLogReaderFree(xlogreader);
+}
+
+#ifdef HAVE_LIBZ
+/*
+ * Read whole compressed WAL segment into buf. Returns false in case of error,
+ * which is reported with the given elevel.
+ */
+static bool
+InflateXLogSegment(const char *gz_xlogpath, char *buf, int thread_num,
+				   int elevel)
+{
+	gzFile		gz;
+	size_t		size = 0;
+
+	gz = fio_gzopen(gz_xlogpath, "rb", -1, FIO_BACKUP_HOST);
+	if (gz == NULL)
+	{
+		elog(elevel, "Thread [%d]: Could not open compressed WAL segment \"%s\": %s",
+			 thread_num, gz_xlogpath, strerror(errno));
+		return false;
+	}
+
+	while (size < wal_seg_size)
+	{
+		int			rc = fio_gzread(gz, buf + size, wal_seg_size - size);
+
+		if (rc <= 0)
+			break;
+		size += rc;
+	}
+
+	if (size != wal_seg_size)
+	{
+		elog(elevel, "Thread [%d]: Could not read from compressed WAL segment \"%s\": %s",
+			 thread_num, gz_xlogpath, get_gz_error(gz));
+		fio_gzclose(gz);
+		return false;
+	}
+
+	fio_gzclose(gz);
+	return true;
+}
+
+/* Helper thread of WAL reader, inflates the segment claimed ahead */
+static void *
+XLogPrefetchWorker(void *arg)
+{
+	XLogPrefetch *prefetch = (XLogPrefetch *) arg;
+
+	/* Uncompressed segment is read by the reader itself */
+	prefetch->loaded = !fileExists(prefetch->xlogpath, FIO_BACKUP_HOST) &&
+		fileExists(prefetch->gz_xlogpath, FIO_BACKUP_HOST) &&
+		InflateXLogSegment(prefetch->gz_xlogpath, prefetch->buf, 0, LOG);
+
+	return NULL;
+}
+
+/*
+ * Start inflating of the segment claimed by the thread to read next, unless
+ * it is already done.
+ */
+static void
+StartXLogPrefetch(XLogReaderData *reader_data)
+{
+	XLogPrefetch *prefetch = reader_data->prefetch;
+	char		xlogfname[MAXFNAMELEN];
+
+	if (prefetch == NULL)
+	{
+		prefetch = pgut_new(XLogPrefetch);
+		memset(prefetch, 0, sizeof(XLogPrefetch));
+		reader_data->prefetch = prefetch;
+	}
+
+	if (prefetch->started || prefetch->segno == reader_data->next_segno)
+		return;
+
+	/* Don't prefetch if other threads have taken all the memory for it */
+	if (!prefetch->reserved)
+	{
+		pthread_lock(&wal_segment_mutex);
+		if (prefetch_memory + wal_seg_size <= XLOG_PREFETCH_MEMORY_LIMIT)
+		{
+			prefetch_memory += wal_seg_size;
+			prefetch->reserved = true;
+		}
+		pthread_mutex_unlock(&wal_segment_mutex);
+
+		if (!prefetch->reserved)
+			return;
+	}
+
+	prefetch->segno = reader_data->next_segno;
+	prefetch->loaded = false;
+	if (prefetch->buf == NULL)
+		prefetch->buf = pgut_malloc(wal_seg_size);
+
+	GetXLogFileName(xlogfname, reader_data->tli, prefetch->segno, wal_seg_size);
+	snprintf(prefetch->xlogpath, MAXPGPATH, "%s/%s", wal_archivedir, xlogfname);
+	snprintf(prefetch->gz_xlogpath, MAXPGPATH, "%s.gz", prefetch->xlogpath);
+
+	if (pthread_create(&prefetch->thread, NULL, XLogPrefetchWorker, prefetch) == 0)
+		prefetch->started = true;
+}
+
+/* Wait for the helper thread to finish inflating */
+static void
+WaitXLogPrefetch(XLogReaderData *reader_data)
+{
+	XLogPrefetch *prefetch = reader_data->prefetch;
+
+	if (prefetch != NULL && prefetch->started)
+	{
+		pthread_join(prefetch->thread, NULL);
+		prefetch->started = false;
+	}
+}
+#endif
+
 static void
 PrintXLogCorruptionMsg(XLogReaderData *reader_data, int elevel)
 {
@@ -1439,7 +2011,7 @@ PrintXLogCorruptionMsg(XLogReaderData *reader_data, int elevel)
 						 "Error has occured during reading WAL segment \"%s\"",
 				 reader_data->thread_num, reader_data->xlogpath);
 #ifdef HAVE_LIBZ
-		else if (reader_data->gz_xlogfile != NULL)
+		else if (reader_data->gz_xlogpath[0] != '\0')
 			elog(elevel, "Thread [%d]: Possible WAL corruption. "
 						 "Error has occured during reading WAL segment \"%s\"",
 				 reader_data->thread_num, reader_data->gz_xlogpath);
@@ -1454,13 +2026,12 @@ PrintXLogCorruptionMsg(XLogReaderData *reader_data, int elevel)
 }
 
 /*
- * Extract information about blocks modified in this record.
+ * Check if all changes of relation files done by the WAL record can be found
+ * from its block references.
  */
-static void
-extractPageInfo(XLogReaderState *record, XLogReaderData *reader_data,
-				bool *stop_reading)
+static bool
+isRecordTrackable(XLogReaderState *record)
 {
-	uint8		block_id;
 	RmgrId		rmid = XLogRecGetRmid(record);
 	uint8		info = XLogRecGetInfo(record);
 	uint8		rminfo = info & ~XLR_INFO_MASK;
@@ -1473,6 +2044,7 @@ extractPageInfo(XLogReaderState *record, XLogReaderData *reader_data,
 		 * New databases can be safely ignored. They would be completely
 		 * copied if found.
 		 */
+		return true;
 	}
 	else if (rmid == RM_DBASE_ID && rminfo == XLOG_DBASE_DROP)
 	{
@@ -1480,6 +2052,7 @@ extractPageInfo(XLogReaderState *record, XLogReaderData *reader_data,
 		 * An existing database was dropped. It is fine to ignore that
 		 * they will be removed appropriately.
 		 */
+		return true;
 	}
 	else if (rmid == RM_SMGR_ID && rminfo == XLOG_SMGR_CREATE)
 	{
@@ -1487,6 +2060,7 @@ extractPageInfo(XLogReaderState *record, XLogReaderData *reader_data,
 		 * We can safely ignore these. The file will be removed when
 		 * combining the backups in the case of differential on.
 		 */
+		return true;
 	}
 	else if (rmid == RM_SMGR_ID && rminfo == XLOG_SMGR_TRUNCATE)
 	{
@@ -1495,19 +2069,31 @@ extractPageInfo(XLogReaderState *record, XLogReaderData *reader_data,
 		 * we'll notice that they differ, and copy the missing tail from
 		 * source system.
 		 */
+		return true;
 	}
-	else if (info & XLR_SPECIAL_REL_UPDATE)
-	{
-		/*
-		 * This record type modifies a relation file in some special way, but
-		 * we don't recognize the type. That's bad - we don't know how to
-		 * track that change.
-		 */
+
+	/*
+	 * This record type modifies a relation file in some special way, but
+	 * we don't recognize the type. That's bad - we don't know how to
+	 * track that change.
+	 */
+	return (info & XLR_SPECIAL_REL_UPDATE) == 0;
+}
+
+/*
+ * Extract information about blocks modified in this record.
+ */
+static void
+extractPageInfo(XLogReaderState *record, XLogReaderData *reader_data,
+				bool *stop_reading)
+{
+	uint8		block_id;
+
+	if (!isRecordTrackable(record))
 		elog(ERROR, "WAL record modifies a relation, but record type is not recognized\n"
 			 "lsn: %X/%X, rmgr: %s, info: %02X",
 		  (uint32) (record->ReadRecPtr >> 32), (uint32) (record->ReadRecPtr),
-				 RmgrNames[rmid], info);
-	}
+				 RmgrNames[XLogRecGetRmid(record)], XLogRecGetInfo(record));
 
 	for (block_id = 0; block_id <= record->max_block_id; block_id++)
 	{
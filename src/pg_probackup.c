@@ -76,6 +76,8 @@ bool		temp_slot = false;
 /* backup options */
 bool		backup_logs = false;
 bool		smooth_checkpoint;
+uint32		read_chunk_size = READ_CHUNK_SIZE_DEFAULT;
+bool		binary_file_list = false;
 char       *remote_agent;
 
 /* restore options */
@@ -117,18 +119,23 @@ bool		dry_run = false;
 
 /* compression options */
 bool 		compress_shortcut = false;
+bool		compress_dictionary = false;
+uint32		compress_frame_size = 0;
 
 /* other options */
 char	   *instance_name;
 
-/* archive push options */
+/* archive push and archive get options */
 static char *wal_file_path;
 static char *wal_file_name;
 static bool	file_overwrite = false;
+static bool	wal_summary = false;
+static int	batch_size = 1;
 
 /* show options */
 ShowFormat show_format = SHOW_PLAIN;
 bool show_archive = false;
+static bool show_file_list = false;
 
 /* set-backup options */
 int64 ttl = -1;
@@ -172,6 +179,8 @@ static ConfigOption cmd_options[] =
 	{ 'b', 135, "delete-expired",	&delete_expired,	SOURCE_CMD_STRICT },
 	{ 'b', 235, "merge-expired",	&merge_expired,		SOURCE_CMD_STRICT },
 	{ 'b', 237, "dry-run",			&dry_run,			SOURCE_CMD_STRICT },
+	{ 'b', 166, "binary-file-list", &binary_file_list,	SOURCE_CMD_STRICT },
+	{ 'u', 162, "read-chunk-size",	&read_chunk_size,	SOURCE_CMD_STRICT, SOURCE_DEFAULT, 0, OPTION_UNIT_KB, option_get_value },
 	/* restore options */
 	{ 's', 136, "recovery-target-time",	&target_time,	SOURCE_CMD_STRICT },
 	{ 's', 137, "recovery-target-xid",	&target_xid,	SOURCE_CMD_STRICT },
@@ -200,18 +209,23 @@ static ConfigOption cmd_options[] =
 	{ 'b', 147, "force",			&force,				SOURCE_CMD_STRICT },
 	/* compression options */
 	{ 'b', 148, "compress",			&compress_shortcut,	SOURCE_CMD_STRICT },
+	{ 'b', 163, "compress-dictionary", &compress_dictionary, SOURCE_CMD_STRICT },
+	{ 'u', 164, "compress-frame-size", &compress_frame_size, SOURCE_CMD_STRICT },
 	/* connection options */
 	{ 'B', 'w', "no-password",		&prompt_password,	SOURCE_CMD_STRICT },
 	{ 'b', 'W', "password",			&force_password,	SOURCE_CMD_STRICT },
 	/* other options */
 	{ 's', 149, "instance",			&instance_name,		SOURCE_CMD_STRICT },
-	/* archive-push options */
+	/* archive-push and archive-get options */
 	{ 's', 150, "wal-file-path",	&wal_file_path,		SOURCE_CMD_STRICT },
 	{ 's', 151, "wal-file-name",	&wal_file_name,		SOURCE_CMD_STRICT },
 	{ 'b', 152, "overwrite",		&file_overwrite,	SOURCE_CMD_STRICT },
+	{ 'b', 165, "wal-summary",		&wal_summary,		SOURCE_CMD_STRICT },
+	{ 'i', 167, "batch-size",		&batch_size,		SOURCE_CMD_STRICT },
 	/* show options */
 	{ 'f', 153, "format",			opt_show_format,	SOURCE_CMD_STRICT },
 	{ 'b', 161, "archive",			&show_archive,		SOURCE_CMD_STRICT },
+	{ 'b', 168, "file-list",		&show_file_list,	SOURCE_CMD_STRICT },
 	/* set-backup options */
 	{ 'I', 170, "ttl", &ttl, SOURCE_CMD_STRICT, SOURCE_DEFAULT, 0, OPTION_UNIT_S, option_get_value},
 	{ 's', 171, "expire-time",		&expire_time_string,	SOURCE_CMD_STRICT },
@@ -333,7 +347,12 @@ main(int argc, char *argv[])
 					 "Agent version %s doesn't match master pg_probackup version %s",
 					 PROGRAM_VERSION, remote_agent);
 			}
-			fio_communicate(STDIN_FILENO, STDOUT_FILENO);
+#ifndef WIN32
+			if (argc > 3 && strcmp(argv[3], AGENT_MUX_MODE) == 0)
+				mux_agent(STDIN_FILENO, STDOUT_FILENO);
+			else
+#endif
+				fio_communicate(STDIN_FILENO, STDOUT_FILENO);
 			return 0;
 		}
 		else if (strcmp(argv[1], "--help") == 0 ||
@@ -724,6 +743,10 @@ main(int argc, char *argv[])
 	if (num_threads < 1)
 		num_threads = 1;
 
+	if (read_chunk_size < BLCKSZ / 1024 || read_chunk_size > READ_CHUNK_SIZE_MAX)
+		elog(ERROR, "--read-chunk-size value must be in the range from %dkB to %dMB",
+			 BLCKSZ / 1024, READ_CHUNK_SIZE_MAX / 1024);
+
 	compress_init();
 
 	/* do actual operation */
@@ -731,10 +754,11 @@ main(int argc, char *argv[])
 	{
 		case ARCHIVE_PUSH_CMD:
 			return do_archive_push(&instance_config, wal_file_path,
-								   wal_file_name, file_overwrite);
+								   wal_file_name, file_overwrite,
+								   wal_summary, batch_size);
 		case ARCHIVE_GET_CMD:
 			return do_archive_get(&instance_config,
-								  wal_file_path, wal_file_name);
+								  wal_file_path, wal_file_name, batch_size);
 		case ADD_INSTANCE_CMD:
 			return do_add_instance(&instance_config);
 		case DELETE_INSTANCE_CMD:
@@ -773,7 +797,8 @@ main(int argc, char *argv[])
 						  recovery_target_options,
 						  restore_params);
 		case SHOW_CMD:
-			return do_show(instance_name, current.backup_id, show_archive);
+			return do_show(instance_name, current.backup_id, show_archive,
+						   show_file_list);
 		case DELETE_CMD:
 			if (delete_expired && backup_id_string)
 				elog(ERROR, "You cannot specify --delete-expired and (-i, --backup-id) options together");
@@ -860,21 +885,46 @@ compress_init(void)
 			elog(ERROR, "Cannot specify compress-level option without compress-alg option");
 	}
 
-	if (instance_config.compress_level < 0 || instance_config.compress_level > 9)
+	if (instance_config.compress_alg == ZSTD_COMPRESS)
+	{
+		if (instance_config.compress_level < 1 || instance_config.compress_level > 22)
+			elog(ERROR, "--compress-level value must be in the range from 1 to 22 for zstd");
+	}
+	else if (instance_config.compress_level < 0 || instance_config.compress_level > 9)
 		elog(ERROR, "--compress-level value must be in the range from 0 to 9");
 
 	if (instance_config.compress_alg == ZLIB_COMPRESS && instance_config.compress_level == 0)
 		elog(WARNING, "Compression level 0 will lead to data bloat!");
 
+	if (compress_frame_size > BACKUP_FRAME_MAX_BLOCKS)
+		elog(ERROR, "--compress-frame-size value must be in the range from 0 to %d",
+			 BACKUP_FRAME_MAX_BLOCKS);
+
 	if (backup_subcmd == BACKUP_CMD || backup_subcmd == ARCHIVE_PUSH_CMD)
 	{
 #ifndef HAVE_LIBZ
 		if (instance_config.compress_alg == ZLIB_COMPRESS)
 			elog(ERROR, "This build does not support zlib compression");
 		else
+#endif
+		/* archive-push compresses WAL with zlib instead of zstd and lz4 */
+#ifndef HAVE_LIBZSTD
+		if (instance_config.compress_alg == ZSTD_COMPRESS &&
+			backup_subcmd == BACKUP_CMD)
+			elog(ERROR, "This build does not support zstd compression");
+		else
+#endif
+#ifndef HAVE_LIBLZ4
+		if (instance_config.compress_alg == LZ4_COMPRESS &&
+			backup_subcmd == BACKUP_CMD)
+			elog(ERROR, "This build does not support lz4 compression");
+		else
 #endif
 		if (instance_config.compress_alg == PGLZ_COMPRESS && num_threads > 1)
 			elog(ERROR, "Multithread backup does not support pglz compression");
+
+		if (compress_dictionary && instance_config.compress_alg != ZSTD_COMPRESS)
+			elog(ERROR, "--compress-dictionary option requires zstd compression");
 	}
 }
 
@@ -35,6 +35,7 @@
 #include "utils/parray.h"
 #include "utils/pgut.h"
 #include "utils/file.h"
+#include "utils/crc32c.h"
 
 #include "datapagemap.h"
 
@@ -60,11 +61,14 @@ extern const char  *PROGRAM_EMAIL;
 #define BACKUP_CONTROL_FILE		"backup.control"
 #define BACKUP_CATALOG_CONF_FILE	"pg_probackup.conf"
 #define BACKUP_CATALOG_PID		"backup.pid"
+#define BACKUP_CATALOG_INDEX	"index"	/* BACKUPS_DIR/.<instance>.index */
 #define DATABASE_FILE_LIST		"backup_content.control"
 #define PG_BACKUP_LABEL_FILE	"backup_label"
 #define PG_TABLESPACE_MAP_FILE "tablespace_map"
 #define EXTERNAL_DIR			"external_directories/externaldir"
 #define DATABASE_MAP			"database_map"
+#define DATABASE_PAGE_DICTIONARY	"page_dictionary"
+#define PREFETCH_DIR			"pbk_prefetch"	/* in PG_XLOG_DIR */
 
 /* Timeout defaults */
 #define PARTIAL_WAL_TIMER			60
@@ -85,6 +89,9 @@ extern const char  *PROGRAM_EMAIL;
 #define STDOUT_FILENO 1
 #endif
 
+/* Size of pgFile.forkName, longer suffixes of relation files are cut */
+#define FORKNAMELEN			16
+
 /* Check if an XLogRecPtr value is pointed to 0 offset */
 #define XRecOffIsNull(xlrp) \
 		((xlrp) % XLOG_BLCKSZ == 0)
@@ -108,8 +115,25 @@ typedef enum CompressAlg
 	NONE_COMPRESS,
 	PGLZ_COMPRESS,
 	ZLIB_COMPRESS,
+	ZSTD_COMPRESS,
+	LZ4_COMPRESS,
 } CompressAlg;
 
+/* Use compression libraries PostgreSQL is built with */
+#if defined(USE_ZSTD) && !defined(HAVE_LIBZSTD)
+#define HAVE_LIBZSTD 1
+#endif
+#if defined(USE_LZ4) && !defined(HAVE_LIBLZ4)
+#define HAVE_LIBLZ4 1
+#endif
+
+/* Storage class for variables local to each thread */
+#ifdef _MSC_VER
+#define pg_thread_local __declspec(thread)
+#else
+#define pg_thread_local __thread
+#endif
+
 #define INIT_FILE_CRC32(use_crc32c, crc) \
 do { \
 	if (use_crc32c) \
@@ -120,7 +144,7 @@ do { \
 #define COMP_FILE_CRC32(use_crc32c, crc, data, len) \
 do { \
 	if (use_crc32c) \
-		COMP_CRC32C((crc), (data), (len)); \
+		(crc) = crc32c_update((crc), (data), (len)); \
 	else \
 		COMP_TRADITIONAL_CRC32(crc, data, len); \
 } while (0)
@@ -134,10 +158,18 @@ do { \
 
 
 /* Information about single file (or dir) in backup */
+/*
+ * Lists of files may contain millions of entries, so the structure is
+ * allocated as one chunk together with path and rel_path by pgFileInit(),
+ * and fields are grouped by size to avoid padding.
+ */
 typedef struct pgFile
 {
-	char   *name;			/* file or directory name */
-	mode_t	mode;			/* protection (file type and permission) */
+	char   *name;			/* file or directory name, points into path */
+	char   *path;			/* absolute path of the file */
+	char   *rel_path;		/* relative path of the file */
+	char   *linked;			/* path of the linked file */
+	datapagemap_t	pagemap;			/* bitmap of pages updated since previous backup */
 	size_t	size;			/* size of the file */
 	size_t	read_size;		/* size of the portion read (if only some pages are
 							   backed up, it's different from size) */
@@ -148,26 +180,27 @@ typedef struct pgFile
 								 * and adding block headers.
 								 */
 							/* we need int64 here to store '-1' value */
+	mode_t	mode;			/* protection (file type and permission) */
 	pg_crc32 crc;			/* CRC value of the file, regular file only */
-	char   *linked;			/* path of the linked file */
-	bool	is_datafile;	/* true if the file is PostgreSQL data file */
-	char   *path;			/* absolute path of the file */
-	char   *rel_path;		/* relative path of the file */
 	Oid		tblspcOid;		/* tblspcOid extracted from path, if applicable */
 	Oid		dbOid;			/* dbOid extracted from path, if applicable */
 	Oid		relOid;			/* relOid extracted from path, if applicable */
-	char   *forkName;		/* forkName extracted from path, if applicable */
 	int		segno;			/* Segment number for ptrack */
 	int		n_blocks;		/* size of the file in blocks, readed during DELTA backup */
+	int		external_dir_num;	/* Number of external directory. 0 if not external */
+	CompressAlg		compress_alg;		/* compression algorithm applied to the file */
+	int				frame_size;			/* maximum number of pages compressed together
+										 * in one frame, 0 if pages are compressed
+										 * one by one */
+	pg_crc32		dict_crc;			/* CRC of zstd dictionary the pages may be
+										 * compressed with, 0 if none */
+	char	forkName[FORKNAMELEN];	/* forkName extracted from path, if applicable */
+	bool	is_datafile;	/* true if the file is PostgreSQL data file */
 	bool	is_cfs;			/* Flag to distinguish files compressed by CFS*/
 	bool	is_database;
-	int		external_dir_num;	/* Number of external directory. 0 if not external */
 	bool	exists_in_prev;		/* Mark files, both data and regular, that exists in previous backup */
-	CompressAlg		compress_alg;		/* compression algorithm applied to the file */
-	volatile 		pg_atomic_flag lock;/* lock for synchronization of parallel threads  */
-	datapagemap_t	pagemap;			/* bitmap of pages updated since previous backup */
-	bool			pagemap_isabsent;	/* Used to mark files with unknown state of pagemap,
-										 * i.e. datafiles without _ptrack */
+	bool	pagemap_isabsent;	/* Used to mark files with unknown state of pagemap,
+								 * i.e. datafiles without _ptrack */
 } pgFile;
 
 typedef struct page_map_entry
@@ -177,6 +210,63 @@ typedef struct page_map_entry
 	size_t		 pagemapsize;
 } page_map_entry;
 
+/* States of FileParts.shared_state */
+#define FILE_PARTS_SHARED_EMPTY		0
+#define FILE_PARTS_SHARED_BUILDING	1
+#define FILE_PARTS_SHARED_READY		2
+
+/*
+ * State of a datafile split into ranges, shared by the ranges. Data which
+ * is the same for every range (e.g. the block map of restore) is built by
+ * the range which starts first and freed by the range which finishes last.
+ */
+typedef struct FileParts
+{
+	pg_atomic_uint32 left;			/* unfinished ranges of the file */
+	pg_atomic_uint32 shared_state;	/* FILE_PARTS_SHARED_* */
+	void	   *shared;				/* valid in FILE_PARTS_SHARED_READY */
+} FileParts;
+
+/*
+ * Unit of work of the file scheduler: a whole file or a range of blocks
+ * of a large datafile. Ranges of one file may be processed by different
+ * threads at the same time.
+ */
+typedef struct FileTask
+{
+	pgFile	   *file;
+	BlockNumber	start_block;	/* first block of the range */
+	BlockNumber	end_block;		/* block after the range, InvalidBlockNumber
+								 * if the range lasts till the end of file */
+	int64		size;			/* estimated amount of work in bytes */
+	FileParts  *parts;			/* state shared by ranges of the file, NULL
+								 * if the file is not split */
+} FileTask;
+
+/*
+ * Shared queue of files for worker threads. Tasks are ordered from the
+ * largest to the smallest and grouped into chunks, threads claim whole
+ * chunks by advancing next_chunk.
+ */
+typedef struct FileScheduler
+{
+	FileTask   *tasks;
+	int			ntasks;
+	int		   *chunks;			/* index of the first task of each chunk */
+	int			nchunks;
+	pg_atomic_uint32 next_chunk;
+	FileParts  *parts;			/* shared states of split files */
+} FileScheduler;
+
+/* Position of a thread in the chunk it has claimed */
+typedef struct FileTaskCursor
+{
+	int			pos;
+	int			end;
+} FileTaskCursor;
+
+#define FILE_TASK_CURSOR_INIT	{0, 0}
+
 /* Special values of datapagemap_t bitmapsize */
 #define PageBitmapIsEmpty 0		/* Used to mark unchanged datafiles */
 
@@ -216,8 +306,11 @@ typedef enum ShowFormat
 #define BYTES_INVALID		(-1) /* file didn`t changed since previous backup, DELTA backup do not rely on it */
 #define FILE_NOT_FOUND		(-2) /* file disappeared during backup */
 #define BLOCKNUM_INVALID	(-1)
-#define PROGRAM_VERSION	"2.2.7"
-#define AGENT_PROTOCOL_VERSION 20207
+#define READ_CHUNK_SIZE_DEFAULT	1024	/* in kilobytes */
+#define READ_CHUNK_SIZE_MAX		(64 * 1024)	/* in kilobytes */
+#define PROGRAM_VERSION	"2.2.10"
+#define AGENT_PROTOCOL_VERSION 20210
+#define AGENT_MUX_MODE		"mux"	/* agent serves channels of shared connection */
 
 
 typedef struct ConnectionOptions
@@ -323,6 +416,9 @@ struct pgBackup
 	time_t			start_time;	/* since this moment backup has status
 								 * BACKUP_STATUS_RUNNING */
 	time_t			merge_time; /* the moment when merge was started or 0 */
+	time_t			merge_dest_backup; /* ID of the backup which data FULL backup
+										* already contains, if the merge was
+										* interrupted after merging files */
 	time_t			end_time;	/* the moment when backup was finished, or the moment
 								 * when we realized that backup is broken */
 	time_t			recovery_time;	/* Earliest moment for which you can restore
@@ -431,6 +527,7 @@ typedef struct
 	const char *external_prefix;
 
 	parray	   *files_list;
+	FileScheduler *sched;		/* queue of files_list for the threads */
 	parray	   *prev_filelist;
 	parray	   *external_dirs;
 	XLogRecPtr	prev_start_lsn;
@@ -484,7 +581,8 @@ typedef enum xlogFileType
 {
 	SEGMENT,
 	PARTIAL_SEGMENT,
-	BACKUP_HISTORY_FILE
+	BACKUP_HISTORY_FILE,
+	WAL_SUMMARY_FILE
 } xlogFileType;
 
 typedef struct xlogFile
@@ -497,6 +595,86 @@ typedef struct xlogFile
 				*/
 } xlogFile;
 
+/*
+ * Summary of main fork blocks changed by WAL records of one segment. It is
+ * written by archive-push --wal-summary into file with WAL_SUMMARY_SUFFIX
+ * next to the segment and used by PAGE backup instead of reading the
+ * segment. WalSummaryHeader is followed by nblocks of WalSummaryBlock
+ * sorted and without duplicates.
+ */
+#define WAL_SUMMARY_SUFFIX	"summary"
+#define WAL_SUMMARY_MAGIC	0x53575042	/* "PBWS" */
+
+typedef struct WalSummaryHeader
+{
+	uint32		magic;
+	uint32		nblocks;
+	XLogRecPtr	end_lsn;	/* end of the last summarized record, record
+							 * starting here continues into next segment
+							 * and isn't summarized. Invalid if no record
+							 * starts in the segment. */
+	pg_crc32	crc;		/* CRC of the blocks */
+} WalSummaryHeader;
+
+typedef struct WalSummaryBlock
+{
+	RelFileNode	rnode;
+	BlockNumber	blkno;
+} WalSummaryBlock;
+
+/*
+ * Binary format of DATABASE_FILE_LIST, written by backup --binary-file-list.
+ * FileListHeader is followed by nfiles of fixed-size FileListRecord sorted
+ * by path and external directory number and then by the string table with
+ * paths, so a file can be found by binary search right in the mapped file
+ * without reading the whole list. The text format is still the default.
+ */
+#define FILE_LIST_MAGIC		0x4C465042	/* "BPFL" */
+#define FILE_LIST_VERSION	2
+
+typedef struct FileListHeader
+{
+	uint32		magic;
+	uint32		version;
+	uint32		nfiles;
+	uint32		record_size;	/* sizeof(FileListRecord) */
+	uint32		strings_size;	/* size of the string table */
+	pg_crc32	crc;			/* CRC of the records and the string table */
+} FileListHeader;
+
+typedef struct FileListRecord
+{
+	int64		write_size;
+	uint32		mode;
+	pg_crc32	crc;
+	pg_crc32	dict_crc;
+	Oid			dbOid;
+	int32		segno;
+	int32		n_blocks;
+	int32		frame_size;
+	int32		external_dir_num;
+	uint32		path;			/* offsets in the string table, */
+	uint32		linked;			/* 0 is an empty string */
+	uint8		is_datafile;
+	uint8		is_cfs;
+	uint8		compress_alg;
+	uint8		padding;
+} FileListRecord;
+
+/* Binary file list loaded into memory */
+typedef struct FileListMap
+{
+	char	   *data;
+	size_t		size;
+	bool		mapped;			/* data is mmap'ed, not allocated */
+	uint32		nfiles;
+	FileListRecord *records;
+	const char *strings;
+	/* used to build absolute paths of the files */
+	char	   *root;
+	char	   *external_prefix;
+} FileListMap;
+
 
 /*
  * When copying datafiles to backup we validate and compress them block
@@ -512,6 +690,64 @@ typedef struct BackupPageHeader
 #define PageIsTruncated -2
 #define SkipCurrentPage -3
 #define PageIsCorrupted -4 /* used by checkdb */
+#define PageIsFrame -5		/* frame of consecutive pages follows */
+#define PageIsFrameIndex -6	/* index of frames follows, see BackupFrameIndexHeader */
+
+/*
+ * Consecutive pages compressed together. Stored after BackupPageHeader with
+ * compressed_size equal to PageIsFrame and block equal to the first block
+ * of the frame.
+ */
+typedef struct BackupFrameHeader
+{
+	uint32		nblocks;		/* number of pages in the frame */
+	int32		compressed_size;	/* nblocks * BLCKSZ if frame is not compressed */
+} BackupFrameHeader;
+
+/*
+ * Backup file with frames ends with index of its frames:
+ * BackupPageHeader with compressed_size equal to PageIsFrameIndex,
+ * BackupFrameIndexHeader, nframes of BackupFrameIndexEntry and offset
+ * of the BackupPageHeader as int64, so that index can be found by reading
+ * the end of file.
+ */
+typedef struct BackupFrameIndexHeader
+{
+	uint32		nframes;
+	BlockNumber	truncated_block;	/* InvalidBlockNumber if the file
+									 * was not truncated */
+} BackupFrameIndexHeader;
+
+typedef struct BackupFrameIndexEntry
+{
+	BlockNumber	block;			/* first block of the frame */
+	uint32		nblocks;
+	int64		offset;			/* offset of the frame BackupPageHeader */
+} BackupFrameIndexEntry;
+
+/* Index of frames being written */
+typedef struct BackupFrameIndex
+{
+	BackupFrameIndexEntry *frames;
+	uint32		nframes;
+	uint32		max_frames;
+	BlockNumber	truncated_block;
+} BackupFrameIndex;
+
+#define BACKUP_FRAME_MAX_BLOCKS		64
+/* Room for compressed frame with its headers */
+#define BACKUP_FRAME_BUFFER_SIZE(nblocks) \
+	(sizeof(BackupPageHeader) + sizeof(BackupFrameHeader) + 2 * (size_t) (nblocks) * BLCKSZ)
+
+/* Result of page classification, see classify_pages() */
+typedef enum PageClass
+{
+	PAGE_CLASS_INVALID,		/* header is not valid and page is not zeroed */
+	PAGE_CLASS_ZERO,		/* page is filled with zeroes */
+	PAGE_CLASS_NEW,			/* header is valid, but LSN is not set */
+	PAGE_CLASS_UNCHANGED,	/* header is valid, LSN is below the horizon */
+	PAGE_CLASS_CHANGED		/* header is valid, LSN is not below the horizon */
+} PageClass;
 
 
 /*
@@ -588,6 +824,9 @@ extern bool 	temp_slot;
 
 /* backup options */
 extern bool		smooth_checkpoint;
+extern uint32	read_chunk_size;
+extern uint32	compress_frame_size;
+extern bool		binary_file_list;
 
 /* remote probackup options */
 extern char* remote_agent;
@@ -602,6 +841,7 @@ extern bool		dry_run;
 
 /* compression options */
 extern bool		compress_shortcut;
+extern bool		compress_dictionary;
 
 /* other options */
 extern char *instance_name;
@@ -658,7 +898,7 @@ extern parray *read_timeline_history(const char *arclog_path, TimeLineID targetT
 
 /* in merge.c */
 extern void do_merge(time_t backup_id);
-extern void merge_backups(pgBackup *backup, pgBackup *next_backup);
+extern void merge_chain(parray *merge_list, time_t dest_backup_id);
 
 extern parray *read_database_map(pgBackup *backup);
 
@@ -668,9 +908,10 @@ extern int do_add_instance(InstanceConfig *instance);
 
 /* in archive.c */
 extern int do_archive_push(InstanceConfig *instance, char *wal_file_path,
-						   char *wal_file_name, bool overwrite);
+						   char *wal_file_name, bool overwrite,
+						   bool wal_summary, int batch_size);
 extern int do_archive_get(InstanceConfig *instance, char *wal_file_path,
-						  char *wal_file_name);
+						  char *wal_file_name, int batch_size);
 
 /* in configure.c */
 extern void do_show_config(void);
@@ -679,7 +920,8 @@ extern void init_config(InstanceConfig *config, const char *instance_name);
 extern InstanceConfig *readInstanceConfigFile(const char *instance_name);
 
 /* in show.c */
-extern int do_show(const char *instance_name, time_t requested_backup_id, bool show_archive);
+extern int do_show(const char *instance_name, time_t requested_backup_id,
+				   bool show_archive, bool show_file_list);
 
 /* in delete.c */
 extern void do_delete(time_t backup_id);
@@ -728,6 +970,7 @@ extern bool pin_backup(pgBackup	*target_backup,
 extern void pgBackupWriteControl(FILE *out, pgBackup *backup);
 extern void write_backup_filelist(pgBackup *backup, parray *files,
 								  const char *root, parray *external_list);
+extern void print_backup_filelist(FILE *out, pgBackup *backup);
 
 extern void pgBackupGetPath(const pgBackup *backup, char *path, size_t len,
 							const char *subdir);
@@ -753,6 +996,7 @@ extern int get_backup_index_number(parray *backup_list, pgBackup *backup);
 extern bool launch_agent(void);
 extern void launch_ssh(char* argv[]);
 extern void wait_ssh(void);
+extern void mux_agent(int in, int out);
 
 #define COMPRESS_ALG_DEFAULT NOT_DEFINED_COMPRESS
 #define COMPRESS_LEVEL_DEFAULT 1
@@ -787,6 +1031,15 @@ extern void print_file_list(FILE *out, const parray *files, const char *root,
 							const char *external_prefix, parray *external_list);
 extern parray *dir_read_file_list(const char *root, const char *external_prefix,
 								  const char *file_txt, fio_location location);
+extern bool file_list_is_binary(const char *file_txt, fio_location location);
+extern FileListMap *file_list_map_open(const char *root,
+									   const char *external_prefix,
+									   const char *file_txt,
+									   fio_location location);
+extern void file_list_map_close(FileListMap *map);
+extern FileListRecord *file_list_map_find(FileListMap *map, const char *path,
+										  int external_dir_num);
+extern pgFile *file_list_map_get_file(FileListMap *map, FileListRecord *rec);
 extern parray *make_external_directory_list(const char *colon_separated_dirs,
 											bool remap);
 extern void free_dir_list(parray *list);
@@ -804,10 +1057,13 @@ extern pgFile *pgFileNew(const char *path, const char *rel_path,
 						 bool follow_symlink, int external_dir_num,
 						 fio_location location);
 extern pgFile *pgFileInit(const char *path, const char *rel_path);
+extern void pgFileSetPath(pgFile *file, const char *path);
 extern void pgFileDelete(pgFile *file);
 extern void pgFileFree(void *file);
 extern pg_crc32 pgFileGetCRC(const char *file_path, bool use_crc32c,
 							 bool raise_on_deleted, size_t *bytes_read, fio_location location);
+extern pg_crc32 pgFileGetCRCParallel(const char *file_path, bool raise_on_deleted,
+									size_t *bytes_read, fio_location location);
 extern int pgFileCompareName(const void *f1, const void *f2);
 extern int pgFileComparePath(const void *f1, const void *f2);
 extern int pgFileMapComparePath(const void *f1, const void *f2);
@@ -820,8 +1076,19 @@ extern int pgFileCompareLinked(const void *f1, const void *f2);
 extern int pgFileCompareSize(const void *f1, const void *f2);
 extern int pgCompareOid(const void *f1, const void *f2);
 
+/* in schedule.c */
+extern FileScheduler *file_scheduler_new(parray *files, bool split_datafiles);
+extern FileTask *file_scheduler_next(FileScheduler *sched,
+									 FileTaskCursor *cursor);
+extern bool file_task_finish(FileTask *task);
+extern bool file_task_get_shared(FileTask *task, void **shared);
+extern void file_task_set_shared(FileTask *task, void *shared);
+extern void file_scheduler_free(FileScheduler *sched);
+
 /* in data.c */
-extern bool check_data_file(ConnectionArgs* arguments, pgFile* file, uint32 checksum_version);
+extern bool check_data_file(ConnectionArgs* arguments, pgFile* file,
+							uint32 checksum_version, BlockNumber start_block,
+							BlockNumber end_block);
 extern bool backup_data_file(backup_files_arg* arguments,
 							 const char *to_path, pgFile *file,
 							 XLogRecPtr prev_backup_start_lsn,
@@ -835,6 +1102,12 @@ extern void restore_data_file(const char *to_path,
 							  pgFile *file, bool allow_truncate,
 							  bool write_header,
 							  uint32 backup_version);
+extern void restore_data_file_chain(const char *to_path, pgFile **files,
+									pgBackup **backups, int nbackups,
+									FileTask *task);
+extern void merge_data_file(const char *to_path, pgFile **files,
+							pgBackup **backups, int nbackups,
+							CompressAlg calg, int clevel, uint32 frame_size);
 extern bool copy_file(fio_location from_location, const char *to_root,
 					  fio_location to_location, pgFile *file, bool missing_ok);
 extern bool create_empty_file(fio_location from_location, const char *to_root,
@@ -862,6 +1135,11 @@ extern XLogRecPtr get_prior_record_lsn(const char *archivedir, XLogRecPtr start_
 
 extern XLogRecPtr get_first_record_lsn(const char *archivedir, XLogRecPtr start_lsn,
 									TimeLineID tli, uint32 wal_seg_size);
+extern WalSummaryBlock *summarize_wal_segment(const char *buf, size_t size,
+											  TimeLineID tli, XLogSegNo segno,
+											  uint32 wal_seg_size,
+											  uint32 *nblocks,
+											  XLogRecPtr *end_lsn);
 
 /* in util.c */
 extern TimeLineID get_current_timeline(PGconn *conn);
@@ -885,8 +1163,21 @@ extern long unsigned int base36dec(const char *text);
 extern uint32 parse_server_version(const char *server_version_str);
 extern uint32 parse_program_version(const char *program_version);
 extern bool   parse_page(Page page, XLogRecPtr *lsn);
+extern bool   page_is_zero(const char *page);
+extern void   classify_pages(const char *buf, int npages, XLogRecPtr horizon_lsn,
+							 PageClass *classes);
 int32  do_compress(void* dst, size_t dst_size, void const* src, size_t src_size,
 				   CompressAlg alg, int level, const char **errormsg);
+extern size_t compress_frame(char *dst, const char *pages, BlockNumber block,
+							 uint32 nblocks, CompressAlg calg, int clevel);
+extern void frame_index_init(BackupFrameIndex *index);
+extern void frame_index_add(BackupFrameIndex *index, BlockNumber block,
+							uint32 nblocks, int64 offset);
+extern void frame_index_free(BackupFrameIndex *index);
+extern void set_page_dictionary(const void *dict, size_t size, int level);
+extern void load_page_dictionary(pgBackup *backup);
+extern bool check_page_dictionary(pgFile *file, int elevel);
+extern void train_page_dictionary(parray *files, pgBackup *backup);
 
 extern void pretty_size(int64 size, char *buf, size_t len);
 extern void pretty_time_interval(int64 num_seconds, char *buf, size_t len);
@@ -19,12 +19,14 @@
 
 typedef struct
 {
-	parray	   *files;
-	pgBackup   *backup;
-	parray	   *external_dirs;
-	char	   *external_prefix;
+	pgBackup  **backups;		/* backups of the chain, FULL goes first */
+	parray	  **backup_files;	/* file lists of the chain backups */
+	FileListMap **backup_maps;	/* binary file lists used instead of
+								 * backup_files of the parent backups */
+	parray	  **backup_external_dirs;
+	int			nbackups;
 	parray	   *dest_external_dirs;
-	parray	   *dest_files;
+	FileScheduler *sched;		/* queue of the destination backup files */
 	parray	   *dbOid_exclude_list;
 	bool		skip_external_dirs;
 
@@ -35,9 +37,9 @@ typedef struct
 	int			ret;
 } restore_files_arg;
 
-static void restore_backup(pgBackup *backup, parray *dest_external_dirs,
-						   parray *dest_files, parray *dbOid_exclude_list,
-						   pgRestoreParams *params);
+static void restore_chain(parray *parent_chain, parray *dest_external_dirs,
+						  parray *dest_files, parray *dbOid_exclude_list,
+						  pgRestoreParams *params);
 static void create_recovery_conf(time_t backup_id,
 								 pgRecoveryTarget *rt,
 								 pgBackup *backup,
@@ -500,7 +502,7 @@ do_restore_or_validate(time_t target_backup_id, pgRecoveryTarget *rt,
 		}
 
 		/*
-		 * Restore backups files starting from the parent backup.
+		 * Check and lock backups of the chain, then restore them at once.
 		 */
 		for (i = parray_num(parent_chain) - 1; i >= 0; i--)
 		{
@@ -518,10 +520,11 @@ do_restore_or_validate(time_t target_backup_id, pgRecoveryTarget *rt,
 			 */
 			if (params->no_validate && !lock_backup(backup))
 				elog(ERROR, "Cannot lock backup directory");
-
-			restore_backup(backup, dest_external_dirs, dest_files, dbOid_exclude_list, params);
 		}
 
+		restore_chain(parent_chain, dest_external_dirs, dest_files,
+					  dbOid_exclude_list, params);
+
 		if (dest_external_dirs != NULL)
 			free_dir_list(dest_external_dirs);
 
@@ -543,77 +546,117 @@ do_restore_or_validate(time_t target_backup_id, pgRecoveryTarget *rt,
 }
 
 /*
- * Restore one backup.
+ * Restore the whole backup chain in one pass.
+ *
+ * parent_chain is ordered from the destination backup to the FULL backup.
+ * Instead of replaying every backup of the chain over the previous one,
+ * we load file lists of all backups at once and restore every file
+ * only from the backups which contain its latest content.
  */
-void
-restore_backup(pgBackup *backup, parray *dest_external_dirs,
-				parray *dest_files, parray *dbOid_exclude_list,
-				pgRestoreParams *params)
+static void
+restore_chain(parray *parent_chain, parray *dest_external_dirs,
+			  parray *dest_files, parray *dbOid_exclude_list,
+			  pgRestoreParams *params)
 {
 	char		timestamp[100];
-	char		database_path[MAXPGPATH];
+	int			nbackups = parray_num(parent_chain);
+	pgBackup  **backups;
+	parray	  **backup_files;
+	FileListMap **backup_maps;
+	parray	  **backup_external_dirs;
+	pgBackup   *dest_backup;
 	char		external_prefix[MAXPGPATH];
-	char		list_path[MAXPGPATH];
-	parray	   *files;
-	parray	   *external_dirs = NULL;
 	int			i;
 	/* arrays with meta info for multi threaded backup */
 	pthread_t  *threads;
 	restore_files_arg *threads_args;
 	bool		restore_isok = true;
+	FileScheduler *sched;
+
+	backups = (pgBackup **) palloc(sizeof(pgBackup *) * nbackups);
+	backup_files = (parray **) palloc(sizeof(parray *) * nbackups);
+	backup_maps = (FileListMap **) palloc(sizeof(FileListMap *) * nbackups);
+	backup_external_dirs = (parray **) palloc(sizeof(parray *) * nbackups);
 
-	if (backup->status != BACKUP_STATUS_OK &&
-		backup->status != BACKUP_STATUS_DONE)
+	/*
+	 * Get lists of files of every backup in the chain,
+	 * starting from the FULL backup.
+	 */
+	for (i = 0; i < nbackups; i++)
 	{
-		if (params->force)
-			elog(WARNING, "Backup %s is not valid, restore is forced",
-				 base36enc(backup->start_time));
-		else
-			elog(ERROR, "Backup %s cannot be restored because it is not valid",
-				 base36enc(backup->start_time));
-	}
+		pgBackup   *backup = (pgBackup *) parray_get(parent_chain, nbackups - i - 1);
+		char		database_path[MAXPGPATH];
+		char		list_path[MAXPGPATH];
+
+		if (backup->status != BACKUP_STATUS_OK &&
+			backup->status != BACKUP_STATUS_DONE)
+		{
+			if (params->force)
+				elog(WARNING, "Backup %s is not valid, restore is forced",
+					 base36enc(backup->start_time));
+			else
+				elog(ERROR, "Backup %s cannot be restored because it is not valid",
+					 base36enc(backup->start_time));
+		}
 
-	/* confirm block size compatibility */
-	if (backup->block_size != BLCKSZ)
-		elog(ERROR,
-			"BLCKSZ(%d) is not compatible(%d expected)",
-			backup->block_size, BLCKSZ);
-	if (backup->wal_block_size != XLOG_BLCKSZ)
-		elog(ERROR,
-			"XLOG_BLCKSZ(%d) is not compatible(%d expected)",
-			backup->wal_block_size, XLOG_BLCKSZ);
+		/* confirm block size compatibility */
+		if (backup->block_size != BLCKSZ)
+			elog(ERROR,
+				"BLCKSZ(%d) is not compatible(%d expected)",
+				backup->block_size, BLCKSZ);
+		if (backup->wal_block_size != XLOG_BLCKSZ)
+			elog(ERROR,
+				"XLOG_BLCKSZ(%d) is not compatible(%d expected)",
+				backup->wal_block_size, XLOG_BLCKSZ);
 
-	time2iso(timestamp, lengthof(timestamp), backup->start_time);
-	elog(LOG, "Restoring database from backup %s", timestamp);
+		/* Pages may be compressed using dictionary of the backup */
+		load_page_dictionary(backup);
 
-	if (backup->external_dir_str)
-		external_dirs = make_external_directory_list(backup->external_dir_str,
-													 true);
+		time2iso(timestamp, lengthof(timestamp), backup->start_time);
+		elog(LOG, "Reading file list of backup %s", timestamp);
 
-	/*
-	 * Get list of files which need to be restored.
-	 */
-	pgBackupGetPath(backup, database_path, lengthof(database_path), DATABASE_DIR);
-	pgBackupGetPath(backup, external_prefix, lengthof(external_prefix),
-					EXTERNAL_DIR);
-	pgBackupGetPath(backup, list_path, lengthof(list_path), DATABASE_FILE_LIST);
-	files = dir_read_file_list(database_path, external_prefix, list_path,
-							   FIO_BACKUP_HOST);
+		backup_external_dirs[i] = NULL;
+		if (backup->external_dir_str)
+			backup_external_dirs[i] = make_external_directory_list(backup->external_dir_str,
+																   true);
+
+		pgBackupGetPath(backup, database_path, lengthof(database_path), DATABASE_DIR);
+		pgBackupGetPath(backup, external_prefix, lengthof(external_prefix),
+						EXTERNAL_DIR);
+		pgBackupGetPath(backup, list_path, lengthof(list_path), DATABASE_FILE_LIST);
+
+		/*
+		 * Parent backups are only searched for the files of the destination
+		 * backup, so if their file lists are binary, look up the records
+		 * right in the lists instead of loading every file.
+		 */
+		backup_files[i] = NULL;
+		backup_maps[i] = NULL;
+		if (i < nbackups - 1)
+			backup_maps[i] = file_list_map_open(database_path, external_prefix,
+												list_path, FIO_BACKUP_HOST);
+		if (backup_maps[i] == NULL)
+		{
+			backup_files[i] = dir_read_file_list(database_path, external_prefix,
+												 list_path, FIO_BACKUP_HOST);
+			parray_qsort(backup_files[i], pgFileCompareRelPathWithExternal);
+		}
 
-	/* Restore directories in do_backup_instance way */
-	parray_qsort(files, pgFileComparePath);
+		backups[i] = backup;
+	}
 
 	/*
-	 * Make external directories before restore
-	 * and setup threads at the same time
+	 * Make external directories before restore. File list of the destination
+	 * backup contains every directory we need.
 	 */
-	for (i = 0; i < parray_num(files); i++)
+	dest_backup = backups[nbackups - 1];
+	pgBackupGetPath(dest_backup, external_prefix, lengthof(external_prefix),
+					EXTERNAL_DIR);
+	for (i = 0; i < parray_num(backup_files[nbackups - 1]); i++)
 	{
-		pgFile	   *file = (pgFile *) parray_get(files, i);
+		pgFile	   *file = (pgFile *) parray_get(backup_files[nbackups - 1], i);
+		parray	   *external_dirs = backup_external_dirs[nbackups - 1];
 
-		/*
-		 * If the entry was an external directory, create it in the backup.
-		 */
 		if (!params->skip_external_dirs &&
 			file->external_dir_num && S_ISDIR(file->mode) &&
 			/* Do not create unnecessary external directories */
@@ -622,7 +665,7 @@ restore_backup(pgBackup *backup, parray *dest_external_dirs,
 			char	   *external_path;
 
 			if (!external_dirs ||
-				parray_num(external_dirs) < file->external_dir_num - 1)
+				parray_num(external_dirs) < file->external_dir_num)
 				elog(ERROR, "Inconsistent external directory backup metadata");
 
 			external_path = parray_get(external_dirs,
@@ -641,10 +684,10 @@ restore_backup(pgBackup *backup, parray *dest_external_dirs,
 				fio_mkdir(dirpath, DIR_PERMISSION, FIO_DB_HOST);
 			}
 		}
-
-		/* setup threads */
-		pg_atomic_clear_flag(&file->lock);
 	}
+
+	/* Large datafiles are restored by several threads */
+	sched = file_scheduler_new(dest_files, true);
 	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
 	threads_args = (restore_files_arg *) palloc(sizeof(restore_files_arg) *
 												num_threads);
@@ -655,19 +698,20 @@ restore_backup(pgBackup *backup, parray *dest_external_dirs,
 	{
 		restore_files_arg *arg = &(threads_args[i]);
 
-		arg->files = files;
-		arg->backup = backup;
-		arg->external_dirs = external_dirs;
-		arg->external_prefix = external_prefix;
+		arg->backups = backups;
+		arg->backup_files = backup_files;
+		arg->backup_maps = backup_maps;
+		arg->backup_external_dirs = backup_external_dirs;
+		arg->nbackups = nbackups;
 		arg->dest_external_dirs = dest_external_dirs;
-		arg->dest_files = dest_files;
+		arg->sched = sched;
 		arg->dbOid_exclude_list = dbOid_exclude_list;
 		arg->skip_external_dirs = params->skip_external_dirs;
 		/* By default there are some error */
 		threads_args[i].ret = 1;
 
 		/* Useless message TODO: rewrite */
-		elog(LOG, "Start thread for num:%zu", parray_num(files));
+		elog(LOG, "Start thread for num:%zu", parray_num(dest_files));
 
 		pthread_create(&threads[i], NULL, restore_files, arg);
 	}
@@ -684,113 +728,155 @@ restore_backup(pgBackup *backup, parray *dest_external_dirs,
 
 	pfree(threads);
 	pfree(threads_args);
+	file_scheduler_free(sched);
 
 	/* cleanup */
-	parray_walk(files, pgFileFree);
-	parray_free(files);
+	for (i = 0; i < nbackups; i++)
+	{
+		if (backup_files[i])
+		{
+			parray_walk(backup_files[i], pgFileFree);
+			parray_free(backup_files[i]);
+		}
+		file_list_map_close(backup_maps[i]);
 
-	if (external_dirs != NULL)
-		free_dir_list(external_dirs);
+		if (backup_external_dirs[i] != NULL)
+			free_dir_list(backup_external_dirs[i]);
+	}
+	pfree(backups);
+	pfree(backup_files);
+	pfree(backup_maps);
+	pfree(backup_external_dirs);
+
+	elog(LOG, "Restore of backup chain of %s completed",
+		 base36enc(dest_backup->start_time));
+}
+
+/*
+ * Free files created from the records of the binary file lists.
+ */
+static void
+free_file_versions(restore_files_arg *arguments, pgFile **versions)
+{
+	int			n;
 
-	elog(LOG, "Restore %s backup completed", base36enc(backup->start_time));
+	for (n = 0; n < arguments->nbackups; n++)
+	{
+		if (arguments->backup_maps[n] && versions[n])
+		{
+			pgFileFree(versions[n]);
+			versions[n] = NULL;
+		}
+	}
 }
 
 /*
  * Restore files into $PGDATA.
+ *
+ * Every file of the destination backup is restored only once: datafiles
+ * are assembled from the latest versions of their blocks across the chain,
+ * other files are copied from the latest backup which contains them.
+ * Large datafiles are restored by ranges of blocks, possibly by different
+ * threads.
  */
 static void *
 restore_files(void *arg)
 {
-	int			i;
 	restore_files_arg *arguments = (restore_files_arg *)arg;
+	pgFile	  **versions;
+	FileTaskCursor cursor = FILE_TASK_CURSOR_INIT;
+	FileTask   *task;
+
+	versions = (pgFile **) palloc(sizeof(pgFile *) * arguments->nbackups);
+	MemSet(versions, 0, sizeof(pgFile *) * arguments->nbackups);
 
-	for (i = 0; i < parray_num(arguments->files); i++)
+	while ((task = file_scheduler_next(arguments->sched, &cursor)) != NULL)
 	{
 		char		from_root[MAXPGPATH];
-		pgFile	   *file = (pgFile *) parray_get(arguments->files, i);
-
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
-
-		pgBackupGetPath(arguments->backup, from_root,
-						lengthof(from_root), DATABASE_DIR);
+		pgFile	   *dest_file = task->file;
+		pgFile	   *file = NULL;
+		pgBackup   *backup = NULL;
+		int			n;
 
 		/* check for interrupt */
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Interrupted during restore database");
 
 		/* Directories were created before */
-		if (S_ISDIR(file->mode))
+		if (S_ISDIR(dest_file->mode))
 			continue;
 
 		if (progress)
-			elog(INFO, "Progress: (%d/%lu). Process file %s ",
-				 i + 1, (unsigned long) parray_num(arguments->files),
-				 file->rel_path);
+			elog(INFO, "Progress: (%d/%d). Process file %s ",
+				 (int) (task - arguments->sched->tasks) + 1,
+				 arguments->sched->ntasks, dest_file->rel_path);
 
 		/* Only files from pgdata can be skipped by partial restore */
-		if (arguments->dbOid_exclude_list && file->external_dir_num == 0)
+		if (arguments->dbOid_exclude_list && dest_file->external_dir_num == 0)
 		{
 			/* Check if the file belongs to the database we exclude */
 			if (parray_bsearch(arguments->dbOid_exclude_list,
-							   &file->dbOid, pgCompareOid))
+							   &dest_file->dbOid, pgCompareOid))
 			{
 				/*
 				 * We cannot simply skip the file, because it may lead to
-				 * failure during WAL redo; hence, create empty file. 
+				 * failure during WAL redo; hence, create empty file.
+				 * Ranges of a split file make it only once.
 				 */
-				create_empty_file(FIO_BACKUP_HOST,
-					  instance_config.pgdata, FIO_DB_HOST, file);
-
-				elog(VERBOSE, "Exclude file due to partial restore: \"%s\"",
-					 file->rel_path);
-				continue;
-			}
-		}
+				if (task->start_block == 0)
+				{
+					create_empty_file(FIO_BACKUP_HOST,
+						  instance_config.pgdata, FIO_DB_HOST, dest_file);
 
-		/*
-		 * For PAGE and PTRACK backups skip datafiles which haven't changed
-		 * since previous backup and thus were not backed up.
-		 * We cannot do the same when restoring DELTA backup because we need information
-		 * about every datafile to correctly truncate them.
-		 */
-		if (file->write_size == BYTES_INVALID)
-		{
-			/* data file, only PAGE and PTRACK can skip */
-			if (((file->is_datafile && !file->is_cfs) &&
-				(arguments->backup->backup_mode == BACKUP_MODE_DIFF_PAGE ||
-				 arguments->backup->backup_mode == BACKUP_MODE_DIFF_PTRACK)) ||
-				/* non-data file can be skipped regardless of backup type */
-				!(file->is_datafile && !file->is_cfs))
-			{
-				elog(VERBOSE, "The file didn`t change. Skip restore: \"%s\"", file->path);
+					elog(VERBOSE, "Exclude file due to partial restore: \"%s\"",
+						 dest_file->rel_path);
+				}
 				continue;
 			}
 		}
 
 		/* Do not restore tablespace_map file */
-		if (path_is_prefix_of_path(PG_TABLESPACE_MAP_FILE, file->rel_path))
+		if (path_is_prefix_of_path(PG_TABLESPACE_MAP_FILE, dest_file->rel_path))
 		{
 			elog(VERBOSE, "Skip tablespace_map");
 			continue;
 		}
 
 		/* Do not restore database_map file */
-		if ((file->external_dir_num == 0) &&
-			strcmp(DATABASE_MAP, file->rel_path) == 0)
+		if ((dest_file->external_dir_num == 0) &&
+			strcmp(DATABASE_MAP, dest_file->rel_path) == 0)
 		{
 			elog(VERBOSE, "Skip database_map");
 			continue;
 		}
 
 		/* Do no restore external directory file if a user doesn't want */
-		if (arguments->skip_external_dirs && file->external_dir_num > 0)
+		if (arguments->skip_external_dirs && dest_file->external_dir_num > 0)
 			continue;
 
-		/* Skip unnecessary file */
-		if (parray_bsearch(arguments->dest_files, file,
-						   pgFileCompareRelPathWithExternal) == NULL)
-			continue;
+		/* Find the file in every backup of the chain */
+		free_file_versions(arguments, versions);
+		for (n = 0; n < arguments->nbackups; n++)
+		{
+			pgFile	  **res_file;
+
+			if (arguments->backup_maps[n])
+			{
+				FileListRecord *rec;
+
+				rec = file_list_map_find(arguments->backup_maps[n],
+										 dest_file->rel_path,
+										 dest_file->external_dir_num);
+				versions[n] = (rec) ?
+					file_list_map_get_file(arguments->backup_maps[n], rec) : NULL;
+				continue;
+			}
+
+			res_file = (pgFile **) parray_bsearch(arguments->backup_files[n],
+												  dest_file,
+												  pgFileCompareRelPathWithExternal);
+			versions[n] = (res_file) ? *res_file : NULL;
+		}
 
 		/*
 		 * restore the file.
@@ -799,23 +885,53 @@ restore_files(void *arg)
 		 * copy the file from backup.
 		 */
 		elog(VERBOSE, "Restoring file \"%s\", is_datafile %i, is_cfs %i",
-			 file->path, file->is_datafile?1:0, file->is_cfs?1:0);
+			 dest_file->rel_path, dest_file->is_datafile?1:0,
+			 dest_file->is_cfs?1:0);
 
-		if (file->is_datafile && !file->is_cfs)
+		if (dest_file->is_datafile && !dest_file->is_cfs)
 		{
 			char		to_path[MAXPGPATH];
 
 			join_path_components(to_path, instance_config.pgdata,
-								 file->rel_path);
-			restore_data_file(to_path, file,
-							  arguments->backup->backup_mode == BACKUP_MODE_DIFF_DELTA,
-							  false,
-							  parse_program_version(arguments->backup->program_version));
+								 dest_file->rel_path);
+			restore_data_file_chain(to_path, versions, arguments->backups,
+									arguments->nbackups, task);
+			continue;
+		}
+
+		/*
+		 * Non-data file is restored from the latest backup which contains it.
+		 * Unchanged files are not copied to incremental backups.
+		 */
+		for (n = arguments->nbackups - 1; n >= 0; n--)
+		{
+			if (versions[n] && versions[n]->write_size != BYTES_INVALID)
+			{
+				file = versions[n];
+				backup = arguments->backups[n];
+				break;
+			}
 		}
-		else if (file->external_dir_num)
+
+		if (file == NULL)
 		{
-			char	   *external_path = parray_get(arguments->external_dirs,
-												   file->external_dir_num - 1);
+			elog(VERBOSE, "The file didn`t change. Skip restore: \"%s\"",
+				 dest_file->rel_path);
+			continue;
+		}
+
+		pgBackupGetPath(backup, from_root, lengthof(from_root), DATABASE_DIR);
+
+		if (file->external_dir_num)
+		{
+			char	   *external_path;
+
+			if (!arguments->backup_external_dirs[n] ||
+				parray_num(arguments->backup_external_dirs[n]) < file->external_dir_num)
+				elog(ERROR, "Inconsistent external directory backup metadata");
+
+			external_path = parray_get(arguments->backup_external_dirs[n],
+									   file->external_dir_num - 1);
 			if (backup_contains_external(external_path,
 										 arguments->dest_external_dirs))
 				copy_file(FIO_BACKUP_HOST,
@@ -836,6 +952,9 @@ restore_files(void *arg)
 				 file->path, file->write_size);
 	}
 
+	free_file_versions(arguments, versions);
+	pfree(versions);
+
 	/* Data files restoring is successful */
 	arguments->ret = 0;
 
@@ -0,0 +1,251 @@
+/*-------------------------------------------------------------------------
+ *
+ * schedule.c: distribute files between worker threads.
+ *
+ * Copyright (c) 2019, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+#include "utils/thread.h"
+
+/*
+ * Chunk of tasks claimed by a thread at once is closed when it contains
+ * SCHEDULE_CHUNK_TASKS tasks or SCHEDULE_CHUNK_SIZE bytes of work. Tasks
+ * larger than SCHEDULE_CHUNK_SIZE always make a chunk of their own.
+ */
+#define SCHEDULE_CHUNK_TASKS	64
+#define SCHEDULE_CHUNK_SIZE		(8 * 1024 * 1024)
+
+/*
+ * Datafiles larger than two ranges are split into ranges of
+ * SCHEDULE_RANGE_BLOCKS blocks.
+ */
+#define SCHEDULE_RANGE_BLOCKS	((BlockNumber) (128 * 1024 * 1024 / BLCKSZ))
+
+static int
+FileTaskCompareSizeDesc(const void *t1, const void *t2)
+{
+	const FileTask *t1p = (const FileTask *) t1;
+	const FileTask *t2p = (const FileTask *) t2;
+
+	if (t1p->size > t2p->size)
+		return -1;
+	else if (t1p->size < t2p->size)
+		return 1;
+	else if (t1p->start_block < t2p->start_block)
+		return -1;
+	else if (t1p->start_block > t2p->start_block)
+		return 1;
+	else
+		return 0;
+}
+
+/*
+ * Make a queue of tasks for the files. If split_datafiles is true and more
+ * than one thread is used, large datafiles (not compressed by cfs) are
+ * split into block ranges, otherwise every file is one task.
+ * Directories are included too, the callers skip them.
+ */
+FileScheduler *
+file_scheduler_new(parray *files, bool split_datafiles)
+{
+	FileScheduler *sched = pgut_new(FileScheduler);
+	size_t		nfiles = parray_num(files);
+	size_t		ntasks = 0;
+	int			nsplit = 0;
+	int64		chunk_size = 0;
+	size_t		i;
+
+	split_datafiles = split_datafiles && num_threads > 1;
+
+	/* Count tasks first */
+	for (i = 0; i < nfiles; i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+		BlockNumber	nblocks = file->size / BLCKSZ;
+
+		if (split_datafiles && file->is_datafile && !file->is_cfs &&
+			S_ISREG(file->mode) && nblocks > 2 * SCHEDULE_RANGE_BLOCKS)
+		{
+			ntasks += (nblocks + SCHEDULE_RANGE_BLOCKS - 1) / SCHEDULE_RANGE_BLOCKS;
+			nsplit++;
+		}
+		else
+			ntasks++;
+	}
+
+	sched->tasks = pgut_newarray(FileTask, Max(ntasks, 1));
+	sched->chunks = pgut_newarray(int, Max(ntasks, 1));
+	sched->parts = (nsplit > 0) ? pgut_newarray(FileParts, nsplit) : NULL;
+	sched->ntasks = 0;
+	sched->nchunks = 0;
+	pg_atomic_init_u32(&sched->next_chunk, 0);
+
+	nsplit = 0;
+	for (i = 0; i < nfiles; i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+		BlockNumber	nblocks = file->size / BLCKSZ;
+		FileTask   *task;
+
+		if (split_datafiles && file->is_datafile && !file->is_cfs &&
+			S_ISREG(file->mode) && nblocks > 2 * SCHEDULE_RANGE_BLOCKS)
+		{
+			FileParts  *parts = &sched->parts[nsplit++];
+			BlockNumber	start;
+			uint32		nparts = 0;
+
+			for (start = 0; start < nblocks; start += SCHEDULE_RANGE_BLOCKS)
+			{
+				task = &sched->tasks[sched->ntasks++];
+				task->file = file;
+				task->start_block = start;
+				task->parts = parts;
+
+				/* The last range takes everything the file has at the end */
+				if (nblocks - start > SCHEDULE_RANGE_BLOCKS)
+				{
+					task->end_block = start + SCHEDULE_RANGE_BLOCKS;
+					task->size = (int64) SCHEDULE_RANGE_BLOCKS * BLCKSZ;
+				}
+				else
+				{
+					task->end_block = InvalidBlockNumber;
+					task->size = file->size - (int64) start * BLCKSZ;
+				}
+				nparts++;
+			}
+			pg_atomic_init_u32(&parts->left, nparts);
+			pg_atomic_init_u32(&parts->shared_state, FILE_PARTS_SHARED_EMPTY);
+			parts->shared = NULL;
+			continue;
+		}
+
+		task = &sched->tasks[sched->ntasks++];
+		task->file = file;
+		task->start_block = 0;
+		task->end_block = InvalidBlockNumber;
+		task->size = S_ISREG(file->mode) ? file->size : 0;
+		task->parts = NULL;
+	}
+
+	/* The largest tasks go first, so there is no long tail of them */
+	qsort(sched->tasks, sched->ntasks, sizeof(FileTask), FileTaskCompareSizeDesc);
+
+	for (i = 0; i < (size_t) sched->ntasks; i++)
+	{
+		if (i == 0 || chunk_size >= SCHEDULE_CHUNK_SIZE ||
+			i - sched->chunks[sched->nchunks - 1] >= SCHEDULE_CHUNK_TASKS)
+		{
+			sched->chunks[sched->nchunks++] = i;
+			chunk_size = 0;
+		}
+		chunk_size += sched->tasks[i].size;
+	}
+
+	return sched;
+}
+
+/*
+ * Get the next task for the thread. Tasks of the chunk claimed earlier are
+ * returned first, then the next free chunk is claimed. Returns NULL when
+ * all tasks are claimed.
+ */
+FileTask *
+file_scheduler_next(FileScheduler *sched, FileTaskCursor *cursor)
+{
+	if (cursor->pos >= cursor->end)
+	{
+		uint32		chunk = pg_atomic_fetch_add_u32(&sched->next_chunk, 1);
+
+		if (chunk >= (uint32) sched->nchunks)
+			return NULL;
+
+		cursor->pos = sched->chunks[chunk];
+		cursor->end = (chunk + 1 < (uint32) sched->nchunks) ?
+			sched->chunks[chunk + 1] : sched->ntasks;
+	}
+
+	return &sched->tasks[cursor->pos++];
+}
+
+/*
+ * Mark the task as done. Returns true if the whole file is done, i.e. the
+ * file is not split or this is the last unfinished range of it. The caller
+ * must have finished writing the range before calling this.
+ */
+bool
+file_task_finish(FileTask *task)
+{
+	if (task->parts == NULL)
+		return true;
+
+	return pg_atomic_sub_fetch_u32(&task->parts->left, 1) == 0;
+}
+
+/*
+ * Get the data shared by ranges of the file. Returns true if the caller
+ * has to build the data and pass it to file_task_set_shared(), this is
+ * the case for the range which asks first and for a file which is not
+ * split. Otherwise waits until the data is built by another range and
+ * returns false with *shared set.
+ */
+bool
+file_task_get_shared(FileTask *task, void **shared)
+{
+	uint32		state = FILE_PARTS_SHARED_EMPTY;
+
+	*shared = NULL;
+
+	if (task->parts == NULL)
+		return true;
+
+	if (pg_atomic_compare_exchange_u32(&task->parts->shared_state, &state,
+									   FILE_PARTS_SHARED_BUILDING))
+		return true;
+
+	while (state == FILE_PARTS_SHARED_BUILDING)
+	{
+		/* The range building the data may fail, don't wait for it forever */
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted while waiting for \"%s\"",
+				 task->file->rel_path);
+
+		pg_usleep(1000L);
+		state = pg_atomic_read_u32(&task->parts->shared_state);
+	}
+
+	pg_read_barrier();
+	*shared = task->parts->shared;
+	return false;
+}
+
+/*
+ * Publish the data built after file_task_get_shared() returned true.
+ * Does nothing if the file is not split.
+ */
+void
+file_task_set_shared(FileTask *task, void *shared)
+{
+	if (task->parts == NULL)
+		return;
+
+	task->parts->shared = shared;
+	pg_write_barrier();
+	pg_atomic_write_u32(&task->parts->shared_state, FILE_PARTS_SHARED_READY);
+}
+
+void
+file_scheduler_free(FileScheduler *sched)
+{
+	if (sched == NULL)
+		return;
+
+	pg_free(sched->tasks);
+	pg_free(sched->chunks);
+	pg_free(sched->parts);
+	pg_free(sched);
+}
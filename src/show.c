@@ -57,6 +57,7 @@ static void show_instance_end(void);
 static void show_instance(const char *instance_name, time_t requested_backup_id, bool show_name);
 static void print_backup_json_object(PQExpBuffer buf, pgBackup *backup);
 static int show_backup(const char *instance_name, time_t requested_backup_id);
+static int show_backup_file_list(const char *instance_name, time_t requested_backup_id);
 
 static void show_instance_plain(const char *instance_name, parray *backup_list, bool show_name);
 static void show_instance_json(const char *instance_name, parray *backup_list);
@@ -75,7 +76,8 @@ static int32 json_level = 0;
  * Entry point of pg_probackup SHOW subcommand.
  */
 int
-do_show(const char *instance_name, time_t requested_backup_id, bool show_archive)
+do_show(const char *instance_name, time_t requested_backup_id,
+		bool show_archive, bool show_file_list)
 {
 	int i;
 
@@ -87,6 +89,16 @@ do_show(const char *instance_name, time_t requested_backup_id, bool show_archive
 		requested_backup_id != INVALID_BACKUP_ID)
 		elog(ERROR, "You cannot specify --archive and (-i, --backup-id) options together");
 
+	if (show_file_list)
+	{
+		if (show_archive)
+			elog(ERROR, "You cannot specify --archive and --file-list options together");
+		if (requested_backup_id == INVALID_BACKUP_ID)
+			elog(ERROR, "You must specify parameter (-i, --backup-id) to use --file-list option");
+
+		return show_backup_file_list(instance_name, requested_backup_id);
+	}
+
 	/*
 	 * if instance_name is not specified,
 	 * show information about all instances in this backup catalog
@@ -449,6 +461,27 @@ show_backup(const char *instance_name, time_t requested_backup_id)
 	return 0;
 }
 
+/*
+ * Show the file list of specified backup in text format. It is useful to
+ * look into the file list written with --binary-file-list.
+ */
+static int
+show_backup_file_list(const char *instance_name, time_t requested_backup_id)
+{
+	pgBackup   *backup;
+
+	backup = read_backup(instance_name, requested_backup_id);
+	if (backup == NULL)
+		elog(ERROR, "Requested backup \"%s\" is not found.",
+			 base36enc(requested_backup_id));
+
+	print_backup_filelist(stdout, backup);
+
+	pgBackupFree(backup);
+
+	return 0;
+}
+
 /*
  * Show instance backups in plain format.
  */
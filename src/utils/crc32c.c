@@ -0,0 +1,264 @@
+/*-------------------------------------------------------------------------
+ *
+ * crc32c.c: CRC-32C calculation with hardware acceleration.
+ *
+ * On x86-64 with SSE 4.2 the data is checksummed by three interleaved
+ * streams of crc32 instructions, which hides latency of the instruction,
+ * and partial checksums of the streams are merged by table lookups.
+ * The same math lets to merge checksums of independently processed parts
+ * of the data, see crc32c_combine().
+ *
+ * Copyright (c) 2020, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres_fe.h"
+
+#include "crc32c.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define USE_SSE42_CRC32C_STREAMS
+#endif
+
+/* Reversed CRC-32C (Castagnoli) polynomial */
+#define CRC32C_POLY		0x82F63B78
+
+/* Multiply 32x32 matrix over GF(2) by vector */
+static uint32
+gf2_matrix_times(const uint32 *mat, uint32 vec)
+{
+	uint32		sum = 0;
+
+	while (vec)
+	{
+		if (vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+	return sum;
+}
+
+static void
+gf2_matrix_square(uint32 *square, const uint32 *mat)
+{
+	int			n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/* Put operator for one zero bit into odd and for four zero bits into even */
+static void
+crc32c_zeros_init(uint32 *odd, uint32 *even)
+{
+	uint32		row = 1;
+	int			n;
+
+	odd[0] = CRC32C_POLY;
+	for (n = 1; n < 32; n++)
+	{
+		odd[n] = row;
+		row <<= 1;
+	}
+	gf2_matrix_square(even, odd);
+	gf2_matrix_square(odd, even);
+}
+
+/*
+ * Return CRC of the data followed by len zero bytes given CRC of the data.
+ */
+pg_crc32c
+crc32c_shift(pg_crc32c crc, size_t len)
+{
+	uint32		even[32];
+	uint32		odd[32];
+
+	if (len == 0)
+		return crc;
+
+	crc32c_zeros_init(odd, even);
+
+	/* Apply operators for 2^n zero bytes according to bits of len */
+	do
+	{
+		gf2_matrix_square(even, odd);
+		if (len & 1)
+			crc = gf2_matrix_times(even, crc);
+		len >>= 1;
+		if (len == 0)
+			break;
+
+		gf2_matrix_square(odd, even);
+		if (len & 1)
+			crc = gf2_matrix_times(odd, crc);
+		len >>= 1;
+	} while (len);
+
+	return crc;
+}
+
+/*
+ * Given CRC of two consecutive parts of the data return CRC of the whole.
+ * CRC of the second part must be calculated starting from zero.
+ */
+pg_crc32c
+crc32c_combine(pg_crc32c crc1, pg_crc32c crc2, size_t len2)
+{
+	return crc32c_shift(crc1, len2) ^ crc2;
+}
+
+#ifdef USE_SSE42_CRC32C_STREAMS
+
+/* Length of each of three streams of long and short blocks */
+#define CRC32C_LONG		8192
+#define CRC32C_SHORT	256
+
+/* Tables to shift CRC by CRC32C_LONG and CRC32C_SHORT zero bytes */
+static uint32 crc32c_long[4][256];
+static uint32 crc32c_short[4][256];
+
+static void
+crc32c_zeros_table(uint32 table[4][256], size_t len)
+{
+	uint32		even[32];
+	uint32		odd[32];
+	uint32	   *op = NULL;
+	int			n;
+
+	/* len is power of two, so the operator is one of squares */
+	crc32c_zeros_init(odd, even);
+	do
+	{
+		gf2_matrix_square(even, odd);
+		op = even;
+		len >>= 1;
+		if (len == 0)
+			break;
+		gf2_matrix_square(odd, even);
+		op = odd;
+		len >>= 1;
+	} while (len);
+
+	for (n = 0; n < 256; n++)
+	{
+		table[0][n] = gf2_matrix_times(op, n);
+		table[1][n] = gf2_matrix_times(op, n << 8);
+		table[2][n] = gf2_matrix_times(op, n << 16);
+		table[3][n] = gf2_matrix_times(op, (uint32) n << 24);
+	}
+}
+
+static inline uint32
+crc32c_shift_table(uint32 table[4][256], uint32 crc)
+{
+	return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+		table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+__attribute__((target("sse4.2")))
+static pg_crc32c
+crc32c_sse42(pg_crc32c crc, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	const unsigned char *end;
+	uint64		crc0 = crc;
+	uint64		crc1;
+	uint64		crc2;
+
+	/* Align to 8 bytes */
+	while (len > 0 && ((uintptr_t) p & 7) != 0)
+	{
+		crc0 = _mm_crc32_u8((uint32) crc0, *p++);
+		len--;
+	}
+
+	/* Three streams of long blocks, then three streams of short blocks */
+	while (len >= CRC32C_LONG * 3)
+	{
+		crc1 = crc2 = 0;
+		end = p + CRC32C_LONG;
+		do
+		{
+			crc0 = _mm_crc32_u64(crc0, *(const uint64 *) p);
+			crc1 = _mm_crc32_u64(crc1, *(const uint64 *) (p + CRC32C_LONG));
+			crc2 = _mm_crc32_u64(crc2, *(const uint64 *) (p + CRC32C_LONG * 2));
+			p += 8;
+		} while (p < end);
+		crc0 = crc32c_shift_table(crc32c_long, (uint32) crc0) ^ crc1;
+		crc0 = crc32c_shift_table(crc32c_long, (uint32) crc0) ^ crc2;
+		p += CRC32C_LONG * 2;
+		len -= CRC32C_LONG * 3;
+	}
+
+	while (len >= CRC32C_SHORT * 3)
+	{
+		crc1 = crc2 = 0;
+		end = p + CRC32C_SHORT;
+		do
+		{
+			crc0 = _mm_crc32_u64(crc0, *(const uint64 *) p);
+			crc1 = _mm_crc32_u64(crc1, *(const uint64 *) (p + CRC32C_SHORT));
+			crc2 = _mm_crc32_u64(crc2, *(const uint64 *) (p + CRC32C_SHORT * 2));
+			p += 8;
+		} while (p < end);
+		crc0 = crc32c_shift_table(crc32c_short, (uint32) crc0) ^ crc1;
+		crc0 = crc32c_shift_table(crc32c_short, (uint32) crc0) ^ crc2;
+		p += CRC32C_SHORT * 2;
+		len -= CRC32C_SHORT * 3;
+	}
+
+	while (len >= 8)
+	{
+		crc0 = _mm_crc32_u64(crc0, *(const uint64 *) p);
+		p += 8;
+		len -= 8;
+	}
+
+	while (len > 0)
+	{
+		crc0 = _mm_crc32_u8((uint32) crc0, *p++);
+		len--;
+	}
+
+	return (pg_crc32c) crc0;
+}
+#endif
+
+static pg_crc32c
+crc32c_generic(pg_crc32c crc, const void *data, size_t len)
+{
+	COMP_CRC32C(crc, data, len);
+	return crc;
+}
+
+static pg_crc32c crc32c_choose(pg_crc32c crc, const void *data, size_t len);
+
+static pg_crc32c (*crc32c_update_impl) (pg_crc32c crc, const void *data,
+										size_t len) = crc32c_choose;
+
+/* Choose the fastest implementation on the first call */
+static pg_crc32c
+crc32c_choose(pg_crc32c crc, const void *data, size_t len)
+{
+#ifdef USE_SSE42_CRC32C_STREAMS
+	if (__builtin_cpu_supports("sse4.2"))
+	{
+		crc32c_zeros_table(crc32c_long, CRC32C_LONG);
+		crc32c_zeros_table(crc32c_short, CRC32C_SHORT);
+		crc32c_update_impl = crc32c_sse42;
+	}
+	else
+#endif
+		crc32c_update_impl = crc32c_generic;
+
+	return crc32c_update_impl(crc, data, len);
+}
+
+pg_crc32c
+crc32c_update(pg_crc32c crc, const void *data, size_t len)
+{
+	return crc32c_update_impl(crc, data, len);
+}
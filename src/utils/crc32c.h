@@ -0,0 +1,23 @@
+/*-------------------------------------------------------------------------
+ *
+ * crc32c.h: CRC-32C calculation with hardware acceleration.
+ *
+ * Copyright (c) 2020, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef PROBACKUP_CRC32C_H
+#define PROBACKUP_CRC32C_H
+
+#include "port/pg_crc32c.h"
+
+/*
+ * Functions below operate on raw CRC-32C value, i.e. they must be used
+ * between INIT_CRC32C() and FIN_CRC32C() the same way as COMP_CRC32C().
+ */
+extern pg_crc32c crc32c_update(pg_crc32c crc, const void *data, size_t len);
+extern pg_crc32c crc32c_shift(pg_crc32c crc, size_t len);
+extern pg_crc32c crc32c_combine(pg_crc32c crc1, pg_crc32c crc2, size_t len2);
+
+#endif   /* PROBACKUP_CRC32C_H */
@@ -5,6 +5,7 @@
 #ifdef WIN32
 #define __thread __declspec(thread)
 #else
+#include <fcntl.h>
 #include <pthread.h>
 #endif
 
@@ -15,13 +16,27 @@
 #define PRINTF_BUF_SIZE  1024
 #define FILE_PERMISSIONS 0600
 #define PAGE_READ_ATTEMPTS 100
+#define DIR_LIST_BATCH_SIZE (256*1024) /* must fit into fio_header.size */
 
 static __thread unsigned long fio_fdset = 0;
 static __thread void* fio_stdin_buffer;
+static __thread unsigned fio_last_tag = 0;
 static __thread int fio_stdout = 0;
 static __thread int fio_stdin = 0;
 static __thread int fio_stderr = 0;
 
+/*
+ * Dictionary for compression of pages, see fio_set_page_dictionary().
+ * Each connection to the agent gets it before the first FIO_SEND_PAGES,
+ * fio_page_dict_sent remembers which version of it the agent of this
+ * thread has.
+ */
+static char *fio_page_dict = NULL;
+static size_t fio_page_dict_size = 0;
+static int fio_page_dict_level = 0;
+static uint32 fio_page_dict_version = 0;
+static __thread uint32 fio_page_dict_sent = 0;
+
 fio_location MyLocation;
 
 typedef struct
@@ -32,6 +47,8 @@ typedef struct
 	uint32      checksumVersion;
 	int         calg;
 	int         clevel;
+	uint32      readChunkBlocks; /* number of blocks read by one pread() */
+	uint32      frameBlocks;     /* maximal number of blocks in a frame, 0 if pages are sent one by one */
 } fio_send_request;
 
 
@@ -135,7 +152,7 @@ static int remove_file_or_dir(char const* path)
 #endif
 
 /* Check if specified location is local for current node */
-static bool fio_is_remote(fio_location location)
+bool fio_is_remote(fio_location location)
 {
 	bool is_remote = MyLocation != FIO_LOCAL_HOST
 		&& location != FIO_LOCAL_HOST
@@ -183,6 +200,122 @@ static ssize_t fio_write_all(int fd, void const* buf, size_t size)
 	return offs;
 }
 
+/*
+ * Requests to the agent are tagged and may be pipelined: several requests
+ * can be sent before waiting for the reply to the first one. Replies are
+ * matched to requests by tag, so replies received while waiting for
+ * another request are kept in the list of stashed replies until they are
+ * asked for.
+ */
+typedef struct fio_reply
+{
+	fio_header hdr;
+	char*      data;
+	struct fio_reply* next;
+} fio_reply;
+
+static __thread fio_reply* fio_stashed_replies;
+static __thread fio_reply* fio_current_reply;	/* stashed reply being read */
+static __thread size_t fio_current_reply_pos;
+
+/* Assign new tag to the request which expects reply */
+static unsigned fio_new_tag(void)
+{
+	return ++fio_last_tag;
+}
+
+/* Send request to the agent */
+static void fio_send_header(fio_header* hdr)
+{
+	IO_CHECK(fio_write_all(fio_stdout, hdr, sizeof(*hdr)), sizeof(*hdr));
+}
+
+/*
+ * Receive header of the reply to the request with specified tag.
+ * Reply data should be read by fio_read_reply_data().
+ */
+static void fio_read_reply(unsigned tag, fio_header* hdr)
+{
+	fio_reply** prev;
+	fio_reply** tail;
+
+	Assert(fio_current_reply == NULL);
+
+	/* Reply may be already received */
+	for (prev = &fio_stashed_replies; *prev != NULL; prev = &(*prev)->next)
+	{
+		if ((*prev)->hdr.tag == tag)
+		{
+			fio_reply* reply = *prev;
+
+			*prev = reply->next;
+			*hdr = reply->hdr;
+			if (hdr->size != 0)
+			{
+				fio_current_reply = reply;
+				fio_current_reply_pos = 0;
+			}
+			else
+				free(reply);
+			return;
+		}
+	}
+	tail = prev;
+
+	while (true)
+	{
+		fio_reply* reply;
+
+		IO_CHECK(fio_read_all(fio_stdin, hdr, sizeof(*hdr)), sizeof(*hdr));
+		if (hdr->tag == tag)
+			return;
+
+		/* Reply to another pipelined request, keep it */
+		reply = (fio_reply*)pgut_malloc(sizeof(fio_reply) + hdr->size);
+		reply->hdr = *hdr;
+		reply->data = (char*)(reply + 1);
+		reply->next = NULL;
+		if (hdr->size != 0)
+			IO_CHECK(fio_read_all(fio_stdin, reply->data, hdr->size), hdr->size);
+		*tail = reply;
+		tail = &reply->next;
+	}
+}
+
+/* Read data of the reply received by fio_read_reply() */
+static void fio_read_reply_data(void* buf, size_t size)
+{
+	if (fio_current_reply != NULL)
+	{
+		Assert(fio_current_reply_pos + size <= fio_current_reply->hdr.size);
+		memcpy(buf, fio_current_reply->data + fio_current_reply_pos, size);
+		fio_current_reply_pos += size;
+		if (fio_current_reply_pos == fio_current_reply->hdr.size)
+		{
+			free(fio_current_reply);
+			fio_current_reply = NULL;
+		}
+	}
+	else
+		IO_CHECK(fio_read_all(fio_stdin, buf, size), size);
+}
+
+/* Forget replies to requests nobody is waiting for anymore */
+static void fio_free_replies(void)
+{
+	while (fio_stashed_replies != NULL)
+	{
+		fio_reply* next = fio_stashed_replies->next;
+		free(fio_stashed_replies);
+		fio_stashed_replies = next;
+	}
+	if (fio_current_reply != NULL)
+	{
+		free(fio_current_reply);
+		fio_current_reply = NULL;
+	}
+}
+
 /* Open input stream. Remote file is fetched to the in-memory buffer and then accessed through Linux fmemopen */
 FILE* fio_open_stream(char const* path, fio_location location)
 {
@@ -192,17 +325,18 @@ FILE* fio_open_stream(char const* path, fio_location location)
 		fio_header hdr;
 		hdr.cop = FIO_LOAD;
 		hdr.size = strlen(path) + 1;
+		hdr.tag = fio_new_tag();
 
-		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_send_header(&hdr);
 		IO_CHECK(fio_write_all(fio_stdout, path, hdr.size), hdr.size);
 
-		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_read_reply(hdr.tag, &hdr);
 		Assert(hdr.cop == FIO_SEND);
 		if (hdr.size > 0)
 		{
 			Assert(fio_stdin_buffer == NULL);
 			fio_stdin_buffer = pgut_malloc(hdr.size);
-			IO_CHECK(fio_read_all(fio_stdin, fio_stdin_buffer, hdr.size), hdr.size);
+			fio_read_reply_data(fio_stdin_buffer, hdr.size);
 #ifdef WIN32
 			f = tmpfile();
 			IO_CHECK(fwrite(f, 1, hdr.size, fio_stdin_buffer), hdr.size);
@@ -252,12 +386,13 @@ DIR* fio_opendir(char const* path, fio_location location)
 		hdr.cop = FIO_OPENDIR;
 		hdr.handle = i;
 		hdr.size = strlen(path) + 1;
+		hdr.tag = fio_new_tag();
 		fio_fdset |= 1 << i;
 
-		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_send_header(&hdr);
 		IO_CHECK(fio_write_all(fio_stdout, path, hdr.size), hdr.size);
 
-		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_read_reply(hdr.tag, &hdr);
 
 		if (hdr.arg != 0)
 		{
@@ -284,13 +419,14 @@ struct dirent* fio_readdir(DIR *dir)
 		hdr.cop = FIO_READDIR;
 		hdr.handle = (size_t)dir - 1;
 		hdr.size = 0;
-		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+		hdr.tag = fio_new_tag();
+		fio_send_header(&hdr);
 
-		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_read_reply(hdr.tag, &hdr);
 		Assert(hdr.cop == FIO_SEND);
 		if (hdr.size) {
 			Assert(hdr.size == sizeof(entry));
-			IO_CHECK(fio_read_all(fio_stdin, &entry, sizeof(entry)), sizeof(entry));
+			fio_read_reply_data(&entry, sizeof(entry));
 		}
 
 		return hdr.size ? &entry : NULL;
@@ -301,6 +437,193 @@ struct dirent* fio_readdir(DIR *dir)
 	}
 }
 
+/*
+ * List directory and stat its entries at once. The callback is called for
+ * every entry except "." and "..". Entries are examined by fstatat()
+ * relative to the directory, so the path is not resolved for each of them.
+ */
+static int fio_list_dir_impl(char const* path, bool follow_symlink,
+							 fio_list_dir_callback callback, void* arg)
+{
+	DIR* dir;
+	struct dirent* dent;
+	fio_dir_entry* entry;
+	int rc;
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+
+	entry = (fio_dir_entry*)pgut_malloc(offsetof(fio_dir_entry, name) + MAXPGPATH);
+
+	errno = 0;
+	while ((dent = readdir(dir)) != NULL)
+	{
+		struct stat st;
+
+		if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+			continue;
+
+#ifdef WIN32
+		{
+			char child[MAXPGPATH];
+
+			join_path_components(child, path, dent->d_name);
+			rc = follow_symlink ? stat(child, &st) : lstat(child, &st);
+		}
+#else
+		rc = fstatat(dirfd(dir), dent->d_name, &st,
+					 follow_symlink ? 0 : AT_SYMLINK_NOFOLLOW);
+#endif
+		entry->stat_errno = rc < 0 ? errno : 0;
+		entry->mode = rc < 0 ? 0 : st.st_mode;
+		entry->size = rc < 0 ? 0 : st.st_size;
+		entry->name_len = strlen(dent->d_name) + 1;
+		memcpy(entry->name, dent->d_name, entry->name_len);
+
+		callback(entry, arg);
+		errno = 0;
+	}
+	rc = errno;
+
+	closedir(dir);
+	free(entry);
+
+	if (rc != 0)
+	{
+		errno = rc;
+		return -1;
+	}
+	return 0;
+}
+
+/* Entries of the directory collected by the agent to be sent at once */
+typedef struct
+{
+	int      out;
+	unsigned tag;
+	size_t   size;
+	char*    buf;
+} fio_dir_batch;
+
+static void fio_flush_dir_batch(fio_dir_batch* batch)
+{
+	fio_header hdr;
+
+	if (batch->size == 0)
+		return;
+
+	hdr.cop = FIO_SEND;
+	hdr.handle = -1;
+	hdr.size = batch->size;
+	hdr.arg = 0;
+	hdr.tag = batch->tag;
+	IO_CHECK(fio_write_all(batch->out, &hdr, sizeof(hdr)), sizeof(hdr));
+	IO_CHECK(fio_write_all(batch->out, batch->buf, batch->size), batch->size);
+	batch->size = 0;
+}
+
+static void fio_batch_dir_entry(const fio_dir_entry* entry, void* arg)
+{
+	fio_dir_batch* batch = (fio_dir_batch*)arg;
+	size_t entry_size = MAXALIGN(offsetof(fio_dir_entry, name) + entry->name_len);
+
+	if (batch->size + entry_size > DIR_LIST_BATCH_SIZE)
+		fio_flush_dir_batch(batch);
+	memcpy(batch->buf + batch->size, entry, offsetof(fio_dir_entry, name) + entry->name_len);
+	batch->size += entry_size;
+}
+
+/*
+ * Send entries of the directory to the master in batches. The last message
+ * has no data, its arg is errno if the directory cannot be listed.
+ */
+static void fio_send_dir_entries(int out, char const* path, bool follow_symlink, unsigned tag)
+{
+	fio_dir_batch batch;
+	fio_header hdr;
+
+	batch.out = out;
+	batch.tag = tag;
+	batch.size = 0;
+	batch.buf = (char*)pgut_malloc(DIR_LIST_BATCH_SIZE);
+
+	hdr.arg = fio_list_dir_impl(path, follow_symlink, fio_batch_dir_entry, &batch) < 0 ? errno : 0;
+	fio_flush_dir_batch(&batch);
+	free(batch.buf);
+
+	hdr.cop = FIO_SEND;
+	hdr.handle = -1;
+	hdr.size = 0;
+	hdr.tag = tag;
+	IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
+}
+
+/*
+ * List directory with attributes of its entries. Remote directory is listed
+ * by a single request, instead of a round trip for every readdir() and
+ * stat() call.
+ * Returns 0 on success, -1 and sets errno if the directory cannot be listed.
+ */
+int fio_list_dir(char const* path, bool follow_symlink, fio_location location,
+				 fio_list_dir_callback callback, void* arg)
+{
+	if (fio_is_remote(location))
+	{
+		fio_header hdr;
+		size_t path_len = strlen(path) + 1;
+		unsigned tag = fio_new_tag();
+		char* buf = NULL;
+		size_t buf_size = 0;
+
+		hdr.cop = FIO_LIST_DIR;
+		hdr.handle = -1;
+		hdr.arg = follow_symlink;
+		hdr.size = path_len;
+		hdr.tag = tag;
+
+		fio_send_header(&hdr);
+		IO_CHECK(fio_write_all(fio_stdout, path, path_len), path_len);
+
+		while (true)
+		{
+			size_t pos = 0;
+
+			fio_read_reply(tag, &hdr);
+			Assert(hdr.cop == FIO_SEND);
+			if (hdr.size == 0)
+				break;
+
+			if (hdr.size > buf_size)
+			{
+				buf_size = hdr.size;
+				buf = (char*)pgut_realloc(buf, buf_size);
+			}
+			fio_read_reply_data(buf, hdr.size);
+
+			while (pos < hdr.size)
+			{
+				fio_dir_entry* entry = (fio_dir_entry*)(buf + pos);
+
+				callback(entry, arg);
+				pos += MAXALIGN(offsetof(fio_dir_entry, name) + entry->name_len);
+			}
+		}
+		free(buf);
+
+		if (hdr.arg != 0)
+		{
+			errno = hdr.arg;
+			return -1;
+		}
+		return 0;
+	}
+	else
+	{
+		return fio_list_dir_impl(path, follow_symlink, callback, arg);
+	}
+}
+
 /* Close directory */
 int fio_closedir(DIR *dir)
 {
@@ -321,7 +644,11 @@ int fio_closedir(DIR *dir)
 	}
 }
 
-/* Open file */
+/*
+ * Open file.
+ * Unlike fio_close() and fio_chmod(), which don't wait for the agent, remote
+ * open waits for the reply: callers handle errors like ENOENT right here.
+ */
 int fio_open(char const* path, int mode, fio_location location)
 {
 	int fd;
@@ -340,12 +667,13 @@ int fio_open(char const* path, int mode, fio_location location)
 		hdr.handle = i;
 		hdr.size = strlen(path) + 1;
 		hdr.arg = mode & ~O_EXCL;
+		hdr.tag = fio_new_tag();
 		fio_fdset |= 1 << i;
 
-		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_send_header(&hdr);
 		IO_CHECK(fio_write_all(fio_stdout, path, hdr.size), hdr.size);
 
-		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_read_reply(hdr.tag, &hdr);
 
 		if (hdr.arg != 0)
 		{
@@ -372,6 +700,8 @@ fio_disconnect(void)
 		SYS_CHECK(close(fio_stdout));
 		fio_stdin = 0;
 		fio_stdout = 0;
+		fio_page_dict_sent = 0;
+		fio_free_replies();
 		wait_ssh();
 	}
 }
@@ -416,7 +746,20 @@ FILE* fio_fopen(char const* path, char const* mode, fio_location location)
 	{
 		f = fopen(path, mode);
 		if (f == NULL && strcmp(mode, PG_BINARY_R "+") == 0)
-			f = fopen(path, PG_BINARY_W);
+		{
+			/*
+			 * Create the file like the agent does. Do not truncate it,
+			 * other threads may be writing their parts of it already.
+			 */
+			int fd = open(path, O_RDWR | O_CREAT | PG_BINARY, FILE_PERMISSIONS);
+
+			if (fd >= 0)
+			{
+				f = fdopen(fd, mode);
+				if (f == NULL)
+					close(fd);
+			}
+		}
 	}
 	return f;
 }
@@ -542,13 +885,14 @@ int fio_pread(FILE* f, void* buf, off_t offs)
 		hdr.handle = fd & ~FIO_PIPE_MARKER;
 		hdr.size = 0;
 		hdr.arg = offs;
+		hdr.tag = fio_new_tag();
 
-		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_send_header(&hdr);
 
-		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_read_reply(hdr.tag, &hdr);
 		Assert(hdr.cop == FIO_SEND);
 		if (hdr.size != 0)
-			IO_CHECK(fio_read_all(fio_stdin, buf, hdr.size), hdr.size);
+			fio_read_reply_data(buf, hdr.size);
 
 		return hdr.arg;
 	}
@@ -637,12 +981,14 @@ ssize_t fio_read(int fd, void* buf, size_t size)
 		hdr.handle = fd & ~FIO_PIPE_MARKER;
 		hdr.size = 0;
 		hdr.arg = size;
+		hdr.tag = fio_new_tag();
 
-		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_send_header(&hdr);
 
-		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_read_reply(hdr.tag, &hdr);
 		Assert(hdr.cop == FIO_SEND);
-		IO_CHECK(fio_read_all(fio_stdin, buf, hdr.size), hdr.size);
+		if (hdr.size != 0)
+			fio_read_reply_data(buf, hdr.size);
 
 		return hdr.size;
 	}
@@ -670,12 +1016,13 @@ int fio_fstat(int fd, struct stat* st)
 		hdr.cop = FIO_FSTAT;
 		hdr.handle = fd & ~FIO_PIPE_MARKER;
 		hdr.size = 0;
+		hdr.tag = fio_new_tag();
 
-		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_send_header(&hdr);
 
-		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_read_reply(hdr.tag, &hdr);
 		Assert(hdr.cop == FIO_FSTAT);
-		IO_CHECK(fio_read_all(fio_stdin, st, sizeof(*st)), sizeof(*st));
+		fio_read_reply_data(st, sizeof(*st));
 
 		if (hdr.arg != 0)
 		{
@@ -695,32 +1042,54 @@ int fio_stat(char const* path, struct stat* st, bool follow_symlink, fio_locatio
 {
 	if (fio_is_remote(location))
 	{
-		fio_header hdr;
-		size_t path_len = strlen(path) + 1;
+		return fio_stat_wait(fio_stat_async(path, follow_symlink, location), st);
+	}
+	else
+	{
+		return follow_symlink ? stat(path, st) : lstat(path,  st);
+	}
+}
 
-		hdr.cop = FIO_STAT;
-		hdr.handle = -1;
-		hdr.arg = follow_symlink;
-		hdr.size = path_len;
+/*
+ * Send request for information about remote file without waiting for reply.
+ * Returns identifier of the request to be passed to fio_stat_wait().
+ * Several requests can be in flight at once, which hides network latency
+ * when many files are examined.
+ */
+int fio_stat_async(char const* path, bool follow_symlink, fio_location location)
+{
+	fio_header hdr;
+	size_t path_len = strlen(path) + 1;
 
-		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
-		IO_CHECK(fio_write_all(fio_stdout, path, path_len), path_len);
+	Assert(fio_is_remote(location));
 
-		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
-		Assert(hdr.cop == FIO_STAT);
-		IO_CHECK(fio_read_all(fio_stdin, st, sizeof(*st)), sizeof(*st));
+	hdr.cop = FIO_STAT;
+	hdr.handle = -1;
+	hdr.arg = follow_symlink;
+	hdr.size = path_len;
+	hdr.tag = fio_new_tag();
 
-		if (hdr.arg != 0)
-		{
-			errno = hdr.arg;
-			return -1;
-		}
-		return 0;
-	}
-	else
+	fio_send_header(&hdr);
+	IO_CHECK(fio_write_all(fio_stdout, path, path_len), path_len);
+
+	return hdr.tag;
+}
+
+/* Wait for reply to the request sent by fio_stat_async() */
+int fio_stat_wait(int request, struct stat* st)
+{
+	fio_header hdr;
+
+	fio_read_reply(request, &hdr);
+	Assert(hdr.cop == FIO_STAT);
+	fio_read_reply_data(st, sizeof(*st));
+
+	if (hdr.arg != 0)
 	{
-		return follow_symlink ? stat(path, st) : lstat(path,  st);
+		errno = hdr.arg;
+		return -1;
 	}
+	return 0;
 }
 
 /* Check presence of the file */
@@ -734,11 +1103,12 @@ int fio_access(char const* path, int mode, fio_location location)
 		hdr.handle = -1;
 		hdr.size = path_len;
 		hdr.arg = mode;
+		hdr.tag = fio_new_tag();
 
-		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_send_header(&hdr);
 		IO_CHECK(fio_write_all(fio_stdout, path, path_len), path_len);
 
-		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_read_reply(hdr.tag, &hdr);
 		Assert(hdr.cop == FIO_ACCESS);
 
 		if (hdr.arg != 0)
@@ -836,11 +1206,12 @@ int fio_mkdir(char const* path, int mode, fio_location location)
 		hdr.handle = -1;
 		hdr.size = path_len;
 		hdr.arg = mode;
+		hdr.tag = fio_new_tag();
 
-		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_send_header(&hdr);
 		IO_CHECK(fio_write_all(fio_stdout, path, path_len), path_len);
 
-		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		fio_read_reply(hdr.tag, &hdr);
 		Assert(hdr.cop == FIO_MKDIR);
 
 		return hdr.arg;
@@ -1148,7 +1519,7 @@ z_off_t fio_gzseek(gzFile f, z_off_t offset, int whence)
 #endif
 
 /* Send file content */
-static void fio_send_file(int out, char const* path)
+static void fio_send_file(int out, char const* path, unsigned tag)
 {
 	int fd = open(path, O_RDONLY);
 	fio_header hdr;
@@ -1156,6 +1527,7 @@ static void fio_send_file(int out, char const* path)
 
 	hdr.cop = FIO_SEND;
 	hdr.size = 0;
+	hdr.tag = tag;
 
 	if (fd >= 0)
 	{
@@ -1174,8 +1546,14 @@ static void fio_send_file(int out, char const* path)
 	}
 }
 
+/*
+ * Receive pages of the file from the agent and write them to out.
+ * If frame_size is greater than 0, the agent groups consecutive pages into
+ * frames of at most frame_size blocks, which are registered in the index.
+ */
 int fio_send_pages(FILE* in, FILE* out, pgFile *file,
-				   XLogRecPtr horizonLsn, BlockNumber* nBlocksSkipped, int calg, int clevel)
+				   XLogRecPtr horizonLsn, BlockNumber* nBlocksSkipped, int calg, int clevel,
+				   uint32 frame_size, BackupFrameIndex *index)
 {
 	struct {
 		fio_header hdr;
@@ -1183,12 +1561,16 @@ int fio_send_pages(FILE* in, FILE* out, pgFile *file,
 	} req;
 	BlockNumber	n_blocks_read = 0;
 	BlockNumber blknum = 0;
+	size_t buf_size = frame_size > 0 ? BACKUP_FRAME_BUFFER_SIZE(frame_size)
+		: BLCKSZ + sizeof(BackupPageHeader);
+	char* buf = pgut_malloc(buf_size);
 
 	Assert(fio_is_remote_file(in));
 
 	req.hdr.cop = FIO_SEND_PAGES;
 	req.hdr.size = sizeof(fio_send_request);
 	req.hdr.handle = fio_fileno(in) & ~FIO_PIPE_MARKER;
+	req.hdr.tag = fio_new_tag();
 
 	req.arg.nblocks = file->size/BLCKSZ;
 	req.arg.segBlockNum = file->segno * RELSEG_SIZE;
@@ -1196,20 +1578,26 @@ int fio_send_pages(FILE* in, FILE* out, pgFile *file,
 	req.arg.checksumVersion = current.checksum_version;
 	req.arg.calg = calg;
 	req.arg.clevel = clevel;
+	req.arg.readChunkBlocks = Max(read_chunk_size * 1024 / BLCKSZ, 1);
+	req.arg.frameBlocks = frame_size;
 
 	file->compress_alg = calg;
 
+	if (fio_page_dict != NULL)
+		fio_send_page_dictionary();
+
 	IO_CHECK(fio_write_all(fio_stdout, &req, sizeof(req)), sizeof(req));
 
 	while (true)
 	{
 		fio_header hdr;
-		char buf[BLCKSZ + sizeof(BackupPageHeader)];
-		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
+		BackupPageHeader* bph = (BackupPageHeader*)buf;
+		fio_read_reply(req.hdr.tag, &hdr);
 		Assert(hdr.cop == FIO_PAGE);
 
 		if ((int)hdr.arg < 0) /* read error */
 		{
+			pg_free(buf);
 			return (int)hdr.arg;
 		}
 
@@ -1217,8 +1605,20 @@ int fio_send_pages(FILE* in, FILE* out, pgFile *file,
 		if (hdr.size == 0) /* end of segment */
 			break;
 
-		Assert(hdr.size <= sizeof(buf));
-		IO_CHECK(fio_read_all(fio_stdin, buf, hdr.size), hdr.size);
+		Assert(hdr.size <= buf_size);
+		fio_read_reply_data(buf, hdr.size);
+
+		if (bph->compressed_size == PageIsFrame)
+		{
+			BackupFrameHeader* frame_header = (BackupFrameHeader*)(buf + sizeof(BackupPageHeader));
+
+			Assert(index != NULL);
+			frame_index_add(index, bph->block, frame_header->nblocks, file->write_size);
+			/* hdr.arg is the last block of the frame */
+			n_blocks_read += frame_header->nblocks - 1;
+		}
+		else if (bph->compressed_size == PageIsTruncated && index != NULL)
+			index->truncated_block = bph->block;
 
 		COMP_FILE_CRC32(true, file->crc, buf, hdr.size);
 
@@ -1232,33 +1632,148 @@ int fio_send_pages(FILE* in, FILE* out, pgFile *file,
 		file->write_size += hdr.size;
 		n_blocks_read++;
 
-		if (((BackupPageHeader*)buf)->compressed_size == PageIsTruncated)
+		if (bph->compressed_size == PageIsTruncated)
 		{
 			blknum += 1;
 			break;
 		}
 	}
+	pg_free(buf);
 	*nBlocksSkipped = blknum - n_blocks_read;
 	return blknum;
 }
 
-static void fio_send_pages_impl(int fd, int out, fio_send_request* req)
+/* Send the dictionary to the agent of this thread, if it doesn't have it yet */
+static void fio_send_page_dictionary(void)
+{
+	fio_header hdr;
+
+	if (fio_page_dict_sent == fio_page_dict_version)
+		return;
+
+	hdr.cop = FIO_PAGE_DICTIONARY;
+	hdr.handle = -1;
+	hdr.size = fio_page_dict_size;
+	hdr.arg = fio_page_dict_level;
+
+	IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+	IO_CHECK(fio_write_all(fio_stdout, fio_page_dict, fio_page_dict_size), fio_page_dict_size);
+
+	fio_page_dict_sent = fio_page_dict_version;
+}
+
+/*
+ * Set dictionary for compression of pages at the host, where they are read.
+ * It is also set locally for pages compressed by this process.
+ * Agents of the worker threads get it with their first FIO_SEND_PAGES,
+ * so it should be called before worker threads start.
+ */
+void fio_set_page_dictionary(void const* dict, size_t size, int level, fio_location location)
+{
+	pg_free(fio_page_dict);
+	fio_page_dict = pgut_malloc(size);
+	memcpy(fio_page_dict, dict, size);
+	fio_page_dict_size = size;
+	fio_page_dict_level = level;
+	fio_page_dict_version++;
+
+	if (fio_is_remote(location))
+		fio_send_page_dictionary();
+
+	set_page_dictionary(dict, size, level);
+}
+
+/* Send frame of consecutive pages collected by fio_send_pages_impl() */
+static void fio_send_frame(int out, char* frame_buffer, char const* pages,
+						   BlockNumber first, BlockNumber nblocks, fio_send_request* req,
+						   unsigned tag)
+{
+	fio_header hdr;
+
+	hdr.cop = FIO_PAGE;
+	hdr.tag = tag;
+	hdr.arg = first + nblocks - 1;
+	hdr.size = compress_frame(frame_buffer, pages, first, nblocks, req->calg, req->clevel);
+
+	IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
+	IO_CHECK(fio_write_all(out, frame_buffer, hdr.size), hdr.size);
+}
+
+static void fio_send_pages_impl(int fd, int out, fio_send_request* req, unsigned tag)
 {
 	BlockNumber blknum;
-	char read_buffer[BLCKSZ+1];
+	char read_buffer[BLCKSZ];
 	fio_header hdr;
+	/* Pages are read by large chunks, which are kept between requests */
+	static char* chunk = NULL;
+	static PageClass* chunk_classes = NULL;
+	static BlockNumber chunk_size = 0;
+	BlockNumber chunk_start = 0;
+	BlockNumber chunk_blocks = 0; /* number of valid blocks in the chunk */
+	BlockNumber max_chunk_blocks = Max(req->readChunkBlocks, 1);
+	/* Consecutive pages are collected in frames if requested */
+	static char* frame_pages = NULL;
+	static char* frame_buffer = NULL;
+	static BlockNumber frame_size = 0;
+	BlockNumber frame_first = 0;
+	BlockNumber frame_nblocks = 0;
+
+	if (chunk_size < max_chunk_blocks)
+	{
+		chunk_size = max_chunk_blocks;
+		chunk = (char*)realloc(chunk, (size_t)chunk_size*BLCKSZ);
+		chunk_classes = (PageClass*)realloc(chunk_classes, chunk_size*sizeof(PageClass));
+	}
+	if (frame_size < req->frameBlocks)
+	{
+		frame_size = req->frameBlocks;
+		frame_pages = (char*)realloc(frame_pages, (size_t)frame_size*BLCKSZ);
+		frame_buffer = (char*)realloc(frame_buffer, BACKUP_FRAME_BUFFER_SIZE(frame_size));
+	}
 
 	hdr.cop = FIO_PAGE;
-	read_buffer[BLCKSZ] = 1; /* barrier */
+	hdr.tag = tag;
 
 	for (blknum = 0; blknum < req->nblocks; blknum++)
 	{
 		int retry_attempts = PAGE_READ_ATTEMPTS;
-		XLogRecPtr page_lsn = InvalidXLogRecPtr;
+		char* page = NULL;
+		PageClass page_class = PAGE_CLASS_INVALID;
 
 		while (true)
 		{
-			ssize_t rc = pread(fd, read_buffer, BLCKSZ, blknum*BLCKSZ);
+			ssize_t rc;
+
+			/*
+			 * At first try to take the page from the chunk, read it again
+			 * individually only if it turns out to be invalid.
+			 * Pages of the chunk are classified all at once.
+			 */
+			if (blknum >= chunk_start + chunk_blocks
+				&& retry_attempts == PAGE_READ_ATTEMPTS)
+			{
+				BlockNumber n = Min(max_chunk_blocks, req->nblocks - blknum);
+				ssize_t chunk_rc = pread(fd, chunk, (size_t)n*BLCKSZ, (off_t)blknum*BLCKSZ);
+
+				chunk_start = blknum;
+				chunk_blocks = chunk_rc > 0 ? chunk_rc / BLCKSZ : 0;
+				classify_pages(chunk, chunk_blocks, req->horizonLsn, chunk_classes);
+			}
+
+			if (blknum < chunk_start + chunk_blocks
+				&& retry_attempts == PAGE_READ_ATTEMPTS)
+			{
+				page = chunk + (size_t)(blknum - chunk_start)*BLCKSZ;
+				page_class = chunk_classes[blknum - chunk_start];
+				rc = BLCKSZ;
+			}
+			else
+			{
+				page = read_buffer;
+				rc = pread(fd, read_buffer, BLCKSZ, (off_t)blknum*BLCKSZ);
+				if (rc == BLCKSZ)
+					classify_pages(read_buffer, 1, req->horizonLsn, &page_class);
+			}
 
 			if (rc <= 0)
 			{
@@ -1272,6 +1787,10 @@ static void fio_send_pages_impl(int fd, int out, fio_send_request* req)
 				else
 				{
 					BackupPageHeader bph;
+
+					if (frame_nblocks > 0)
+						fio_send_frame(out, frame_buffer, frame_pages, frame_first, frame_nblocks, req, tag);
+
 					bph.block = blknum;
 					bph.compressed_size = PageIsTruncated;
 					hdr.arg = blknum;
@@ -1283,17 +1802,12 @@ static void fio_send_pages_impl(int fd, int out, fio_send_request* req)
 			}
 			else if (rc == BLCKSZ)
 			{
-				if (!parse_page((Page)read_buffer, &page_lsn))
-				{
-					int i;
-					for (i = 0; read_buffer[i] == 0; i++);
-
-					/* Page is zeroed. No need to check header and checksum. */
-					if (i == BLCKSZ)
-						break;
-				}
-				else if (!req->checksumVersion
-						 || pg_checksum_page(read_buffer, req->segBlockNum + blknum) == ((PageHeader)read_buffer)->pd_checksum)
+				/* Page is zeroed. No need to check header and checksum. */
+				if (page_class == PAGE_CLASS_ZERO)
+					break;
+				else if (page_class != PAGE_CLASS_INVALID
+						 && (!req->checksumVersion
+							 || pg_checksum_page(page, req->segBlockNum + blknum) == ((PageHeader)page)->pd_checksum))
 				{
 					break;
 				}
@@ -1307,8 +1821,22 @@ static void fio_send_pages_impl(int fd, int out, fio_send_request* req)
 				return;
 			}
 		}
-		/* horizonLsn is not 0 for delta backup. As far as unsigned number are always greater or equal than zero, there is no sense to add more checks */
-		if (page_lsn >= req->horizonLsn || page_lsn == InvalidXLogRecPtr)
+		/* Pages which haven't changed since the previous backup are skipped by delta backup */
+		if (page_class != PAGE_CLASS_UNCHANGED && req->frameBlocks > 0)
+		{
+			/* Send collected frame if it is full or this page doesn't continue it */
+			if (frame_nblocks > 0
+				&& (frame_nblocks == req->frameBlocks || frame_first + frame_nblocks != blknum))
+			{
+				fio_send_frame(out, frame_buffer, frame_pages, frame_first, frame_nblocks, req, tag);
+				frame_nblocks = 0;
+			}
+			if (frame_nblocks == 0)
+				frame_first = blknum;
+			memcpy(frame_pages + (size_t)frame_nblocks*BLCKSZ, page, BLCKSZ);
+			frame_nblocks += 1;
+		}
+		else if (page_class != PAGE_CLASS_UNCHANGED)
 		{
 			char write_buffer[BLCKSZ*2];
 			BackupPageHeader* bph = (BackupPageHeader*)write_buffer;
@@ -1318,12 +1846,12 @@ static void fio_send_pages_impl(int fd, int out, fio_send_request* req)
 			hdr.size = sizeof(BackupPageHeader);
 
 			bph->compressed_size = do_compress(write_buffer + sizeof(BackupPageHeader), sizeof(write_buffer) - sizeof(BackupPageHeader),
-											   read_buffer, BLCKSZ, req->calg, req->clevel,
+											   page, BLCKSZ, req->calg, req->clevel,
 											   &errormsg);
 			if (bph->compressed_size <= 0 || bph->compressed_size >= BLCKSZ)
 			{
 				/* Do not compress page */
-				memcpy(write_buffer + sizeof(BackupPageHeader), read_buffer, BLCKSZ);
+				memcpy(write_buffer + sizeof(BackupPageHeader), page, BLCKSZ);
 				bph->compressed_size = BLCKSZ;
 			}
 			hdr.size += MAXALIGN(bph->compressed_size);
@@ -1332,6 +1860,9 @@ static void fio_send_pages_impl(int fd, int out, fio_send_request* req)
 			IO_CHECK(fio_write_all(out, write_buffer, hdr.size), hdr.size);
 		}
 	}
+	if (frame_nblocks > 0)
+		fio_send_frame(out, frame_buffer, frame_pages, frame_first, frame_nblocks, req, tag);
+
 	hdr.size = 0;
 	hdr.arg = blknum;
 	IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
@@ -1371,7 +1902,7 @@ void fio_communicate(int in, int out)
 		}
 		switch (hdr.cop) {
 		  case FIO_LOAD: /* Send file content */
-			fio_send_file(out, buf);
+			fio_send_file(out, buf, hdr.tag);
 			break;
 		  case FIO_OPENDIR: /* Open directory for traversal */
 			dir[hdr.handle] = opendir(buf);
@@ -1397,6 +1928,9 @@ void fio_communicate(int in, int out)
 		  case FIO_CLOSEDIR: /* Finish directory traversal */
 			SYS_CHECK(closedir(dir[hdr.handle]));
 			break;
+		  case FIO_LIST_DIR: /* List directory with attributes of its entries */
+			fio_send_dir_entries(out, buf, hdr.arg != 0, hdr.tag);
+			break;
 		  case FIO_OPEN: /* Open file */
 			fd[hdr.handle] = open(buf, hdr.arg, FILE_PERMISSIONS);
 			hdr.arg = fd[hdr.handle] < 0 ? errno : 0;
@@ -1473,7 +2007,10 @@ void fio_communicate(int in, int out)
 			break;
 		  case FIO_SEND_PAGES:
 			Assert(hdr.size == sizeof(fio_send_request));
-			fio_send_pages_impl(fd[hdr.handle], out, (fio_send_request*)buf);
+			fio_send_pages_impl(fd[hdr.handle], out, (fio_send_request*)buf, hdr.tag);
+			break;
+		  case FIO_PAGE_DICTIONARY: /* Set dictionary for compression of pages */
+			set_page_dictionary(buf, hdr.size, hdr.arg);
 			break;
 		  default:
 			Assert(false);
@@ -33,7 +33,9 @@ typedef enum
 	FIO_READDIR,
 	FIO_CLOSEDIR,
 	FIO_SEND_PAGES,
-	FIO_PAGE
+	FIO_PAGE,
+	FIO_PAGE_DICTIONARY,
+	FIO_LIST_DIR
 } fio_operations;
 
 typedef enum
@@ -57,13 +59,27 @@ typedef struct
 	unsigned handle : 7;
 	unsigned size   : 20;
 	unsigned arg;
+	unsigned tag;   /* identifies request, agent replies with the same tag */
 } fio_header;
 
 extern fio_location MyLocation;
 
+/* Entry of the directory listed by fio_list_dir() */
+typedef struct fio_dir_entry
+{
+	int64	size;
+	mode_t	mode;
+	int		stat_errno;	/* errno of stat() of the entry, 0 on success */
+	int		name_len;	/* length of the name including terminating zero */
+	char	name[FLEXIBLE_ARRAY_MEMBER];
+} fio_dir_entry;
+
+typedef void (*fio_list_dir_callback)(const fio_dir_entry *entry, void *arg);
+
 /* Check if FILE handle is local or remote (created by FIO) */
 #define fio_is_remote_file(file) ((size_t)(file) <= FIO_FDMAX)
 
+extern bool    fio_is_remote(fio_location location);
 extern void    fio_redirect(int in, int out, int err);
 extern void    fio_communicate(int in, int out);
 
@@ -80,8 +96,13 @@ extern int     fio_ffstat(FILE* f, struct stat* st);
 extern void    fio_error(int rc, int size, char const* file, int line);
 
 struct pgFile;
+struct BackupFrameIndex;
 extern  int    fio_send_pages(FILE* in, FILE* out, struct pgFile *file, XLogRecPtr horizonLsn, 
-							  BlockNumber* nBlocksSkipped, int calg, int clevel);
+							  BlockNumber* nBlocksSkipped, int calg, int clevel,
+							  uint32 frame_size, struct BackupFrameIndex *index);
+
+extern void    fio_set_page_dictionary(void const* dict, size_t size, int level,
+										fio_location location);
 
 extern int     fio_open(char const* name, int mode, fio_location location);
 extern ssize_t fio_write(int fd, void const* buf, size_t size);
@@ -100,9 +121,13 @@ extern int     fio_mkdir(char const* path, int mode, fio_location location);
 extern int     fio_chmod(char const* path, int mode, fio_location location);
 extern int     fio_access(char const* path, int mode, fio_location location);
 extern int     fio_stat(char const* path, struct stat* st, bool follow_symlinks, fio_location location);
+extern int     fio_stat_async(char const* path, bool follow_symlinks, fio_location location);
+extern int     fio_stat_wait(int request, struct stat* st);
 extern DIR*    fio_opendir(char const* path, fio_location location);
 extern struct dirent * fio_readdir(DIR *dirp);
 extern int     fio_closedir(DIR *dirp);
+extern int     fio_list_dir(char const* path, bool follow_symlink, fio_location location,
+							fio_list_dir_callback callback, void *arg);
 extern FILE*   fio_open_stream(char const* name, fio_location location);
 extern int     fio_close_stream(FILE* f);
 
@@ -4,11 +4,14 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <fcntl.h>
 
 #ifdef WIN32
 #define __thread __declspec(thread)
 #else
 #include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
 #endif
 
 #include "pg_probackup.h"
@@ -77,6 +80,11 @@ void wait_ssh(void)
  */
 #ifndef WIN32
 	int status;
+
+	/* Channel of shared connection, SSH process is still used by others */
+	if (child_pid == 0)
+		return;
+
 	waitpid(child_pid, &status, 0);
 	elog(LOG, "SSH process %d is terminated with status %d",  child_pid, status);
 #endif
@@ -103,7 +111,12 @@ static bool needs_quotes(char const* path)
 	return strchr(path, ' ') != NULL;
 }
 
-bool launch_agent(void)
+/*
+ * Spawn SSH process running agent at the remote host. If multiplexed is true,
+ * the agent serves several channels, see mux_agent().
+ * Returns pipes connected to stdin, stdout and stderr of the agent.
+ */
+static bool start_agent(bool multiplexed, int* in, int* out, int* err, int* pid)
 {
 	char cmd[MAX_CMDLINE_LENGTH];
 	char* ssh_argv[MAX_CMDLINE_OPTIONS];
@@ -111,6 +124,7 @@ bool launch_agent(void)
 	int outfd[2];
 	int infd[2];
 	int errfd[2];
+	char const* mode = multiplexed ? " " AGENT_MUX_MODE : "";
 
 	ssh_argc = 0;
 #ifdef WIN32
@@ -163,24 +177,24 @@ bool launch_agent(void)
 			}
 		}
 		if (needs_quotes(instance_config.remote.path) || needs_quotes(PROGRAM_NAME_FULL))
-			snprintf(cmd, sizeof(cmd), "\"%s\\%s\" agent %s",
-					 instance_config.remote.path, probackup, PROGRAM_VERSION);
+			snprintf(cmd, sizeof(cmd), "\"%s\\%s\" agent %s%s",
+					 instance_config.remote.path, probackup, PROGRAM_VERSION, mode);
 		else
-			snprintf(cmd, sizeof(cmd), "%s\\%s agent %s",
-					 instance_config.remote.path, probackup, PROGRAM_VERSION);
+			snprintf(cmd, sizeof(cmd), "%s\\%s agent %s%s",
+					 instance_config.remote.path, probackup, PROGRAM_VERSION, mode);
 #else
 		if (needs_quotes(instance_config.remote.path) || needs_quotes(PROGRAM_NAME_FULL))
-			snprintf(cmd, sizeof(cmd), "\"%s/%s\" agent %s",
-					 instance_config.remote.path, probackup, PROGRAM_VERSION);
+			snprintf(cmd, sizeof(cmd), "\"%s/%s\" agent %s%s",
+					 instance_config.remote.path, probackup, PROGRAM_VERSION, mode);
 		else
-			snprintf(cmd, sizeof(cmd), "%s/%s agent %s",
-					 instance_config.remote.path, probackup, PROGRAM_VERSION);
+			snprintf(cmd, sizeof(cmd), "%s/%s agent %s%s",
+					 instance_config.remote.path, probackup, PROGRAM_VERSION, mode);
 #endif
 	} else {
 		if (needs_quotes(PROGRAM_NAME_FULL))
-			snprintf(cmd, sizeof(cmd), "\"%s\" agent %s", PROGRAM_NAME_FULL, PROGRAM_VERSION);
+			snprintf(cmd, sizeof(cmd), "\"%s\" agent %s%s", PROGRAM_NAME_FULL, PROGRAM_VERSION, mode);
 		else
-			snprintf(cmd, sizeof(cmd), "%s agent %s", PROGRAM_NAME_FULL, PROGRAM_VERSION);
+			snprintf(cmd, sizeof(cmd), "%s agent %s%s", PROGRAM_NAME_FULL, PROGRAM_VERSION, mode);
 	}
 
 #ifdef WIN32
@@ -189,18 +203,18 @@ bool launch_agent(void)
 	ssh_argv[2] = psprintf("%d", outfd[0]);
 	ssh_argv[3] = psprintf("%d", infd[1]);
 	{
-	    intptr_t pid = _spawnvp(_P_NOWAIT, ssh_argv[0], ssh_argv);
-		if (pid < 0)
+	    intptr_t proc = _spawnvp(_P_NOWAIT, ssh_argv[0], ssh_argv);
+		if (proc < 0)
 			return false;
-		child_pid = GetProcessId((HANDLE)pid);
+		*pid = GetProcessId((HANDLE)proc);
 #else
 	SYS_CHECK(pipe(infd));
 	SYS_CHECK(pipe(outfd));
 	SYS_CHECK(pipe(errfd));
 
-	SYS_CHECK(child_pid = fork());
+	SYS_CHECK(*pid = fork());
 
-	if (child_pid == 0) { /* child */
+	if (*pid == 0) { /* child */
 		SYS_CHECK(close(STDIN_FILENO));
 		SYS_CHECK(close(STDOUT_FILENO));
 		SYS_CHECK(close(STDERR_FILENO));
@@ -220,13 +234,631 @@ bool launch_agent(void)
 			return false;
 	} else {
 #endif
-		elog(LOG, "Spawn agent %d version %s", child_pid, PROGRAM_VERSION);
+		elog(LOG, "Spawn agent %d version %s", *pid, PROGRAM_VERSION);
 		SYS_CHECK(close(infd[1]));  /* These are being used by the child */
 		SYS_CHECK(close(outfd[0]));
 		SYS_CHECK(close(errfd[1]));
 		/*atexit(kill_child);*/
 
-		fio_redirect(infd[0], outfd[1], errfd[0]); /* write to stdout */
+		*in = infd[0];
+		*out = outfd[1];
+		*err = errfd[0];
+	}
+	return true;
+}
+
+#ifndef WIN32
+
+/*
+ * Several threads may share one SSH connection, see --remote-connections.
+ * Each thread talks to the agent through its own channel: the thread uses
+ * one end of a socket pair instead of the SSH pipes, and the multiplexer
+ * thread of the connection forwards data between socket pairs and the
+ * connection, splitting it into frames marked with the channel number.
+ * At the remote host mux_agent() does the same with channels connected to
+ * the processes running fio_communicate().
+ *
+ * The receiver of the channel data buffers at most MUX_WINDOW bytes of it and
+ * the sender doesn't send more until receiver confirms that data is
+ * delivered, so a slow channel can't block others.
+ */
+#define MUX_MAX_CHANNELS	256
+#define MUX_FRAME_SIZE		(64*1024)	/* maximal size of data in one frame */
+#define MUX_WINDOW			(256*1024)	/* maximal size of undelivered data of channel */
+
+/* Channel may be closed by other side at any moment, don't die of SIGPIPE */
+#ifdef MSG_NOSIGNAL
+#define MUX_SEND_FLAGS		MSG_NOSIGNAL
+#else
+#define MUX_SEND_FLAGS		0
+#endif
+
+typedef enum
+{
+	MUX_OPEN,		/* open new channel */
+	MUX_DATA,		/* data of the channel follows */
+	MUX_CREDIT,		/* receiver has delivered "size" bytes of the channel data */
+	MUX_CLOSE		/* no more data will be sent to the channel */
+} MuxFrameType;
+
+typedef struct
+{
+	uint16		channel;
+	uint16		type;
+	uint32		size;
+} MuxFrameHeader;
+
+typedef struct
+{
+	bool		used;
+	bool		close_sent;
+	bool		close_received;
+	int			fd;			/* local end of the channel, -1 if it is closed */
+	pid_t		pid;		/* process serving the channel at the agent side */
+	char	   *buf;		/* received data which is not delivered to fd yet */
+	size_t		buf_len;
+	size_t		credit;		/* how much data we can send to the channel */
+	size_t		consumed;	/* how much data is delivered, but not confirmed */
+} MuxChannel;
+
+typedef struct
+{
+	bool		started;
+	bool		broken;		/* multiplexer thread has exited */
+	int			in;
+	int			out;
+	int			err;
+	int			wakeup[2];	/* to interrupt poll() when channel is opened */
+	pthread_t	thread;
+	pthread_mutex_t lock;
+	MuxChannel	channels[MUX_MAX_CHANNELS];
+	char	   *out_buf;	/* frames to be sent */
+	size_t		out_len;
+	size_t		out_size;
+	char	   *in_buf;		/* partially received frame */
+	size_t		in_len;
+} MuxConnection;
+
+static MuxConnection *mux_connections;
+static uint32 mux_next_connection;
+static pthread_mutex_t mux_connections_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+mux_set_nonblocking(int fd)
+{
+	SYS_CHECK(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK));
+}
+
+/* Close local end of the channel */
+static void
+mux_close_channel_fd(MuxChannel *ch)
+{
+	close(ch->fd);
+	ch->fd = -1;
+	ch->buf_len = 0;
+
+	/*
+	 * Process serving the channel exits when its socket is closed. Don't
+	 * wait for it here, other channels would be stuck meanwhile: it is
+	 * reaped by mux_reap_children().
+	 */
+	ch->pid = 0;
+}
+
+/* Reap exited processes which served channels at the agent side */
+static void
+mux_reap_children(void)
+{
+	while (waitpid(-1, NULL, WNOHANG) > 0);
+}
+
+static void
+mux_init_channel(MuxChannel *ch, int fd)
+{
+	ch->used = true;
+	ch->close_sent = false;
+	ch->close_received = false;
+	ch->fd = fd;
+	ch->pid = 0;
+	ch->buf = pgut_malloc(MUX_WINDOW);
+	ch->buf_len = 0;
+	ch->credit = MUX_WINDOW;
+	ch->consumed = 0;
+	mux_set_nonblocking(fd);
+}
+
+/* Append frame to the output buffer of the connection */
+static void
+mux_queue_frame(MuxConnection *conn, int channel, MuxFrameType type,
+				char const *data, uint32 size)
+{
+	MuxFrameHeader hdr;
+	size_t		len = sizeof(hdr) + (type == MUX_DATA ? size : 0);
+
+	if (conn->out_len + len > conn->out_size)
+	{
+		conn->out_size = Max(conn->out_size * 2, conn->out_len + len);
+		conn->out_buf = pgut_realloc(conn->out_buf, conn->out_size);
 	}
+
+	hdr.channel = channel;
+	hdr.type = type;
+	hdr.size = size;
+	memcpy(conn->out_buf + conn->out_len, &hdr, sizeof(hdr));
+	if (type == MUX_DATA)
+		memcpy(conn->out_buf + conn->out_len + sizeof(hdr), data, size);
+	conn->out_len += len;
+}
+
+/*
+ * Finish closing of the channel: close local end when all received data is
+ * delivered, let the peer know about it and free the channel when both
+ * sides are closed.
+ */
+static void
+mux_check_closed(MuxConnection *conn, int channel)
+{
+	MuxChannel *ch = &conn->channels[channel];
+
+	if (!ch->close_received)
+		return;
+
+	if (ch->fd >= 0 && ch->buf_len == 0)
+		mux_close_channel_fd(ch);
+	if (ch->fd < 0 && !ch->close_sent)
+	{
+		mux_queue_frame(conn, channel, MUX_CLOSE, NULL, 0);
+		ch->close_sent = true;
+	}
+	if (ch->close_sent)
+	{
+		pg_free(ch->buf);
+		ch->buf = NULL;
+		ch->used = false;
+	}
+}
+
+/* Start process serving new channel at the agent side */
+static void
+mux_spawn_channel(MuxConnection *conn, int channel)
+{
+	int			sv[2];
+	pid_t		pid;
+	int			i;
+
+	SYS_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	SYS_CHECK(pid = fork());
+
+	if (pid == 0)
+	{
+		/* Child serves only its own channel */
+		close(conn->in);
+		close(conn->out);
+		close(sv[0]);
+		for (i = 0; i < MUX_MAX_CHANNELS; i++)
+			if (conn->channels[i].used && conn->channels[i].fd >= 0)
+				close(conn->channels[i].fd);
+
+		fio_communicate(sv[1], sv[1]);
+		exit(0);
+	}
+
+	close(sv[1]);
+	mux_init_channel(&conn->channels[channel], sv[0]);
+	conn->channels[channel].pid = pid;
+}
+
+/*
+ * Process frame received from the peer. Returns false if the frame violates
+ * the protocol.
+ */
+static bool
+mux_receive_frame(MuxConnection *conn, MuxFrameHeader *hdr, char *data,
+				  bool agent)
+{
+	MuxChannel *ch;
+
+	if (hdr->channel >= MUX_MAX_CHANNELS)
+	{
+		elog(WARNING, "Invalid channel %d of remote connection", hdr->channel);
+		return false;
+	}
+	ch = &conn->channels[hdr->channel];
+
+	switch (hdr->type)
+	{
+		case MUX_OPEN:
+			if (!agent || ch->used)
+			{
+				elog(WARNING, "Unexpected opening of channel %d", hdr->channel);
+				return false;
+			}
+			mux_spawn_channel(conn, hdr->channel);
+			break;
+		case MUX_DATA:
+			if (!ch->used || ch->buf_len + hdr->size > MUX_WINDOW)
+			{
+				elog(WARNING, "Unexpected data of channel %d", hdr->channel);
+				return false;
+			}
+			/* Data for closed local end is thrown away */
+			if (ch->fd >= 0)
+			{
+				memcpy(ch->buf + ch->buf_len, data, hdr->size);
+				ch->buf_len += hdr->size;
+			}
+			break;
+		case MUX_CREDIT:
+			if (ch->used)
+				ch->credit += hdr->size;
+			break;
+		case MUX_CLOSE:
+			if (!ch->used)
+			{
+				elog(WARNING, "Unexpected closing of channel %d", hdr->channel);
+				return false;
+			}
+			ch->close_received = true;
+			mux_check_closed(conn, hdr->channel);
+			break;
+		default:
+			elog(WARNING, "Invalid frame of remote connection: %d", hdr->type);
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Forward data between channels and the connection until connection is
+ * closed. Returns false if connection is broken or the peer violates the
+ * protocol. Errors are not thrown here: the caller has to close the channels
+ * to let their users know that connection is lost.
+ */
+static bool
+mux_loop(MuxConnection *conn, bool agent)
+{
+	struct pollfd fds[MUX_MAX_CHANNELS + 3];
+	int			channel_of[MUX_MAX_CHANNELS + 3];
+
+	conn->in_buf = pgut_malloc(sizeof(MuxFrameHeader) + MUX_FRAME_SIZE);
+	conn->in_len = 0;
+	mux_set_nonblocking(conn->in);
+	mux_set_nonblocking(conn->out);
+
+	while (true)
+	{
+		int			nfds = 0;
+		int			i;
+		ssize_t		rc;
+
+		pthread_mutex_lock(&conn->lock);
+
+		fds[nfds].fd = conn->in;
+		fds[nfds].events = POLLIN;
+		channel_of[nfds++] = -1;
+		fds[nfds].fd = conn->out;
+		fds[nfds].events = conn->out_len > 0 ? POLLOUT : 0;
+		channel_of[nfds++] = -1;
+		if (!agent)
+		{
+			fds[nfds].fd = conn->wakeup[0];
+			fds[nfds].events = POLLIN;
+			channel_of[nfds++] = -1;
+		}
+		for (i = 0; i < MUX_MAX_CHANNELS; i++)
+		{
+			MuxChannel *ch = &conn->channels[i];
+
+			if (!ch->used || ch->fd < 0)
+				continue;
+			fds[nfds].fd = ch->fd;
+			fds[nfds].events = (ch->buf_len > 0 ? POLLOUT : 0) |
+				(ch->credit > 0 && !ch->close_sent ? POLLIN : 0);
+			channel_of[nfds++] = i;
+		}
+
+		pthread_mutex_unlock(&conn->lock);
+
+		if (poll(fds, nfds, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		if (agent)
+			mux_reap_children();
+
+		pthread_mutex_lock(&conn->lock);
+
+		for (i = 0; i < nfds; i++)
+		{
+			MuxChannel *ch;
+			int			channel = channel_of[i];
+
+			if (fds[i].revents == 0)
+				continue;
+
+			if (fds[i].fd == conn->in)
+			{
+				char	   *p = conn->in_buf;
+
+				rc = read(conn->in, conn->in_buf + conn->in_len,
+						  sizeof(MuxFrameHeader) + MUX_FRAME_SIZE - conn->in_len);
+				if (rc < 0 && (errno == EAGAIN || errno == EINTR))
+					continue;
+				if (rc <= 0)
+				{
+					pthread_mutex_unlock(&conn->lock);
+					return rc == 0;
+				}
+				conn->in_len += rc;
+
+				/* Process all completely received frames */
+				while (conn->in_len - (p - conn->in_buf) >= sizeof(MuxFrameHeader))
+				{
+					MuxFrameHeader hdr;
+					size_t		len;
+
+					memcpy(&hdr, p, sizeof(hdr));
+					len = sizeof(hdr) + (hdr.type == MUX_DATA ? hdr.size : 0);
+					if (hdr.type == MUX_DATA && hdr.size > MUX_FRAME_SIZE)
+					{
+						elog(WARNING, "Too large frame of remote connection: %u", hdr.size);
+						pthread_mutex_unlock(&conn->lock);
+						return false;
+					}
+					if (conn->in_len - (p - conn->in_buf) < len)
+						break;
+					if (!mux_receive_frame(conn, &hdr, p + sizeof(hdr), agent))
+					{
+						pthread_mutex_unlock(&conn->lock);
+						return false;
+					}
+					p += len;
+				}
+				conn->in_len -= p - conn->in_buf;
+				memmove(conn->in_buf, p, conn->in_len);
+			}
+			else if (fds[i].fd == conn->out)
+			{
+				rc = write(conn->out, conn->out_buf, conn->out_len);
+				if (rc < 0 && (errno == EAGAIN || errno == EINTR))
+					continue;
+				if (rc < 0)
+				{
+					pthread_mutex_unlock(&conn->lock);
+					return false;
+				}
+				conn->out_len -= rc;
+				memmove(conn->out_buf, conn->out_buf + rc, conn->out_len);
+			}
+			else if (channel < 0)
+			{
+				char		dummy[64];
+
+				/* New channel is opened, just drain the wakeup pipe */
+				while (read(conn->wakeup[0], dummy, sizeof(dummy)) > 0);
+			}
+			else
+			{
+				ch = &conn->channels[channel];
+
+				/* Deliver received data */
+				if ((fds[i].revents & POLLOUT) && ch->fd >= 0)
+				{
+					rc = send(ch->fd, ch->buf, ch->buf_len, MUX_SEND_FLAGS);
+					if (rc > 0)
+					{
+						ch->buf_len -= rc;
+						memmove(ch->buf, ch->buf + rc, ch->buf_len);
+						ch->consumed += rc;
+						if (ch->consumed >= MUX_WINDOW / 4 || ch->buf_len == 0)
+						{
+							mux_queue_frame(conn, channel, MUX_CREDIT, NULL,
+											ch->consumed);
+							ch->consumed = 0;
+						}
+					}
+					else if (rc < 0 && errno != EAGAIN && errno != EINTR)
+					{
+						/* Other side of channel is gone */
+						ch->buf_len = 0;
+					}
+					mux_check_closed(conn, channel);
+				}
+
+				/* Send data of the channel */
+				if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+					ch->used && ch->fd >= 0 && !ch->close_sent && ch->credit > 0)
+				{
+					char		buf[MUX_FRAME_SIZE];
+
+					rc = read(ch->fd, buf, Min(ch->credit, sizeof(buf)));
+					if (rc > 0)
+					{
+						mux_queue_frame(conn, channel, MUX_DATA, buf, rc);
+						ch->credit -= rc;
+					}
+					else if (rc == 0 || (errno != EAGAIN && errno != EINTR))
+					{
+						/* Channel is closed at our side */
+						mux_close_channel_fd(ch);
+						mux_queue_frame(conn, channel, MUX_CLOSE, NULL, 0);
+						ch->close_sent = true;
+						if (ch->close_received)
+						{
+							pg_free(ch->buf);
+							ch->buf = NULL;
+							ch->used = false;
+						}
+					}
+				}
+			}
+		}
+
+		pthread_mutex_unlock(&conn->lock);
+	}
+}
+
+/* Multiplexer thread of the connection at the master side */
+static void *
+mux_connection_thread(void *arg)
+{
+	MuxConnection *conn = (MuxConnection *) arg;
+	int			i;
+
+	mux_loop(conn, false);
+
+	/*
+	 * Connection is broken. Mark all channels closed and close their local
+	 * ends, so that threads reading them get EOF instead of waiting forever.
+	 * Channels can't be opened over this connection anymore.
+	 */
+	pthread_mutex_lock(&conn->lock);
+	conn->broken = true;
+	for (i = 0; i < MUX_MAX_CHANNELS; i++)
+	{
+		MuxChannel *ch = &conn->channels[i];
+
+		if (!ch->used)
+			continue;
+		if (ch->fd >= 0)
+			mux_close_channel_fd(ch);
+		ch->close_sent = true;
+		ch->close_received = true;
+	}
+	pthread_mutex_unlock(&conn->lock);
+
+	return NULL;
+}
+
+/*
+ * Open new channel to the agent over one of shared connections and use it
+ * for FIO functions of the current thread.
+ */
+static bool
+mux_open_channel(void)
+{
+	MuxConnection *conn;
+	int			sv[2];
+	int			channel;
+	int			out;
+
+	pthread_mutex_lock(&mux_connections_lock);
+	if (mux_connections == NULL)
+	{
+		mux_connections = pgut_newarray(MuxConnection,
+										instance_config.remote.connections);
+		memset(mux_connections, 0,
+			   instance_config.remote.connections * sizeof(MuxConnection));
+	}
+
+	/* Spread channels between connections */
+	conn = &mux_connections[mux_next_connection++ % instance_config.remote.connections];
+	if (!conn->started)
+	{
+		int			pid;
+
+		if (!start_agent(true, &conn->in, &conn->out, &conn->err, &pid))
+		{
+			pthread_mutex_unlock(&mux_connections_lock);
+			return false;
+		}
+		SYS_CHECK(pipe(conn->wakeup));
+		mux_set_nonblocking(conn->wakeup[0]);
+		mux_set_nonblocking(conn->err);
+		pthread_mutex_init(&conn->lock, NULL);
+		if (pthread_create(&conn->thread, NULL, mux_connection_thread, conn) != 0)
+			elog(ERROR, "Cannot start thread of remote connection: %s",
+				 strerror(errno));
+		conn->started = true;
+	}
+	pthread_mutex_unlock(&mux_connections_lock);
+
+	SYS_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+
+	pthread_mutex_lock(&conn->lock);
+	if (conn->broken)
+	{
+		pthread_mutex_unlock(&conn->lock);
+		close(sv[0]);
+		close(sv[1]);
+		errno = ECONNRESET;
+		return false;
+	}
+	for (channel = 0; channel < MUX_MAX_CHANNELS; channel++)
+		if (!conn->channels[channel].used)
+			break;
+	if (channel == MUX_MAX_CHANNELS)
+	{
+		pthread_mutex_unlock(&conn->lock);
+		elog(ERROR, "Too many channels of remote connection");
+	}
+	mux_init_channel(&conn->channels[channel], sv[0]);
+	mux_queue_frame(conn, channel, MUX_OPEN, NULL, 0);
+	pthread_mutex_unlock(&conn->lock);
+
+	/* Wake up multiplexer thread to take new channel into account */
+	IO_CHECK(write(conn->wakeup[1], "", 1), 1);
+
+	/* fio_disconnect() closes both descriptors */
+	SYS_CHECK(out = dup(sv[1]));
+	child_pid = 0;
+	fio_redirect(sv[1], out, conn->err);
+	return true;
+}
+
+/*
+ * Entry point of the agent serving channels of shared connection.
+ */
+void
+mux_agent(int in, int out)
+{
+	MuxConnection *conn = pgut_new(MuxConnection);
+	int			i;
+
+	memset(conn, 0, sizeof(MuxConnection));
+	conn->in = in;
+	conn->out = out;
+	pthread_mutex_init(&conn->lock, NULL);
+
+	if (!mux_loop(conn, true))
+	{
+		perror("read");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 * Connection is closed. Close remaining channels, so that processes
+	 * serving them exit, and wait for them.
+	 */
+	for (i = 0; i < MUX_MAX_CHANNELS; i++)
+		if (conn->channels[i].used && conn->channels[i].fd >= 0)
+			close(conn->channels[i].fd);
+	while (wait(NULL) > 0);
+}
+
+#endif
+
+bool launch_agent(void)
+{
+	int		in;
+	int		out;
+	int		err;
+
+	if (instance_config.remote.connections > 0)
+	{
+#ifdef WIN32
+		elog(ERROR, "--remote-connections option is not supported on Windows");
+#else
+		return mux_open_channel();
+#endif
+	}
+
+	if (!start_agent(false, &in, &out, &err, &child_pid))
+		return false;
+
+	fio_redirect(in, out, err); /* write to stdout */
 	return true;
 }
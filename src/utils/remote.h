@@ -19,6 +19,8 @@ typedef struct RemoteConfig
 	char* user;
 	char *ssh_config;
 	char *ssh_options;
+	uint32 connections;	/* number of connections shared by threads,
+						 * 0 if every thread has its own connection */
 } RemoteConfig;
 
 #endif
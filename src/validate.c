@@ -24,7 +24,7 @@ static bool skipped_due_to_lock = false;
 typedef struct
 {
 	const char *base_path;
-	parray		*files;
+	FileScheduler *sched;
 	bool		corrupted;
 	XLogRecPtr 	stop_lsn;
 	uint32		checksum_version;
@@ -55,6 +55,7 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 	/* arrays with meta info for multi threaded validate */
 	pthread_t  *threads;
 	validate_files_arg *threads_args;
+	FileScheduler *sched;
 	int			i;
 //	parray		*dbOid_exclude_list = NULL;
 
@@ -108,16 +109,18 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 	pgBackupGetPath(backup, path, lengthof(path), DATABASE_FILE_LIST);
 	files = dir_read_file_list(base_path, external_prefix, path, FIO_BACKUP_HOST);
 
+	/* Pages may be compressed using dictionary of the backup */
+	load_page_dictionary(backup);
+
 //	if (params && params->partial_db_list)
 //		dbOid_exclude_list = get_dbOid_exclude_list(backup, files, params->partial_db_list,
 //														params->partial_restore_type);
 
-	/* setup threads */
-	for (i = 0; i < parray_num(files); i++)
-	{
-		pgFile	   *file = (pgFile *) parray_get(files, i);
-		pg_atomic_clear_flag(&file->lock);
-	}
+	/*
+	 * Files are validated as a whole, because CRC of the backup file and
+	 * its pages are computed sequentially.
+	 */
+	sched = file_scheduler_new(files, false);
 
 	/* init thread args with own file lists */
 	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
@@ -131,7 +134,7 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 		validate_files_arg *arg = &(threads_args[i]);
 
 		arg->base_path = base_path;
-		arg->files = files;
+		arg->sched = sched;
 		arg->corrupted = false;
 		arg->backup_mode = backup->backup_mode;
 		arg->stop_lsn = backup->stop_lsn;
@@ -162,6 +165,7 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 	pfree(threads_args);
 
 	/* cleanup */
+	file_scheduler_free(sched);
 	parray_walk(files, pgFileFree);
 	parray_free(files);
 
@@ -208,15 +212,15 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 static void *
 pgBackupValidateFiles(void *arg)
 {
-	int			i;
 	validate_files_arg *arguments = (validate_files_arg *)arg;
-	int			num_files = parray_num(arguments->files);
+	FileTaskCursor cursor = FILE_TASK_CURSOR_INIT;
+	FileTask   *task;
 	pg_crc32	crc;
 
-	for (i = 0; i < num_files; i++)
+	while ((task = file_scheduler_next(arguments->sched, &cursor)) != NULL)
 	{
 		struct stat st;
-		pgFile	   *file = (pgFile *) parray_get(arguments->files, i);
+		pgFile	   *file = task->file;
 
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Interrupted during validate");
@@ -246,12 +250,10 @@ pgBackupValidateFiles(void *arg)
 		if (file->is_cfs)
 			continue;
 
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
-
 		if (progress)
 			elog(INFO, "Progress: (%d/%d). Process file \"%s\"",
-				 i + 1, num_files, file->path);
+				 (int) (task - arguments->sched->tasks) + 1,
+				 arguments->sched->ntasks, file->path);
 
 		/*
 		 * Skip files which has no data, because they
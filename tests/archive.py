@@ -1761,6 +1761,125 @@ class ArchiveTest(ProbackupTest, unittest.TestCase):
         # Clean after yourself
         self.del_test_dir(module_name, fname)
 
+    # @unittest.skip("skip")
+    def test_archive_cached_listing(self):
+        """
+        check that cached listing of WAL archive is used
+        only while the archive directory is not changed
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        self.backup_node(backup_dir, 'node', node)
+
+        for i in range(5):
+            node.safe_psql(
+                'postgres',
+                'create table t_heap_{0} as select i from '
+                'generate_series(0,1000) i'.format(i))
+            self.switch_wal_segment(node)
+
+        node.stop()
+
+        # make sure the directory is older than the cached listing
+        sleep(1)
+
+        timeline = self.show_archive(backup_dir, 'node', tli=1)
+        self.assertFalse(timeline['lost-segments'])
+
+        self.assertTrue(os.path.isfile(
+            os.path.join(backup_dir, 'wal', '.node.index')))
+
+        # cached listing
+        self.assertEqual(
+            self.show_archive(backup_dir, 'node', tli=1), timeline)
+
+        # remove segment in the middle of the archive
+        wals_dir = os.path.join(backup_dir, 'wal', 'node')
+        wals = sorted(
+            f for f in os.listdir(wals_dir)
+            if os.path.isfile(os.path.join(wals_dir, f))
+            and not f.endswith('.backup') and not f.endswith('.history'))
+        os.remove(os.path.join(wals_dir, wals[len(wals) // 2]))
+
+        timeline = self.show_archive(backup_dir, 'node', tli=1)
+        self.assertEqual(len(timeline['lost-segments']), 1)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_archive_push_batch(self):
+        """
+        check that archive-push pushes segments ready
+        for archiving along with the requested one
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        # let segments pile up in pg_wal
+        self.set_auto_conf(node, {'archive_command': "'exit 1'"})
+        node.reload()
+
+        for i in range(5):
+            node.safe_psql(
+                'postgres',
+                'create table t_heap_{0} as select i from '
+                'generate_series(0,1000) i'.format(i))
+            self.switch_wal_segment(node)
+
+        if self.get_version(node) < 100000:
+            status_dir = os.path.join(
+                node.data_dir, 'pg_xlog', 'archive_status')
+        else:
+            status_dir = os.path.join(
+                node.data_dir, 'pg_wal', 'archive_status')
+
+        ready = sorted(
+            f[:-len('.ready')] for f in os.listdir(status_dir)
+            if f.endswith('.ready') and not f.endswith('.backup.ready'))
+        self.assertTrue(len(ready) >= 5)
+
+        self.set_archiving(backup_dir, 'node', node, batch_size=10)
+        node.reload()
+
+        for i in range(60):
+            if not any(
+                    f.endswith('.ready') for f in os.listdir(status_dir)):
+                break
+            sleep(1)
+
+        wals_dir = os.path.join(backup_dir, 'wal', 'node')
+        for wal in ready:
+            self.assertTrue(
+                os.path.isfile(os.path.join(wals_dir, wal)) or
+                os.path.isfile(os.path.join(wals_dir, wal + '.gz')))
+
+        log_file = os.path.join(node.logs_dir, 'postgresql.log')
+        with open(log_file, 'r') as f:
+            log_content = f.read()
+
+        self.assertIn('WAL files in batch', log_content)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
 # important - switchpoint may be NullOffset LSN and not actually existing in archive to boot.
 # so write WAL validation code accordingly
 
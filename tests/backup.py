@@ -2400,3 +2400,117 @@ class BackupTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_read_chunk_size(self):
+        """
+        make FULL and DELTA backups reading data files by chunks
+        of different size, restore and compare PGDATA content
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '--read-chunk-size=8kB'])
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '--read-chunk-size=4MB'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        # invalid chunk size
+        try:
+            self.backup_node(
+                backup_dir, 'node', node,
+                options=['--stream', '--read-chunk-size=1kB'])
+            # we should die here because exception is what we expect to happen
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because of invalid read chunk size.\n "
+                "Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'ERROR: --read-chunk-size value must be in the range',
+                e.message,
+                '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                    repr(e.message), self.cmd))
+
+        node.cleanup()
+        self.restore_node(backup_dir, 'node', node)
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_parallel_listing(self):
+        """
+        make FULL backup of instance with several databases and external
+        directory with nested subdirectories listed by several threads,
+        check that nothing is missed, restore and compare PGDATA content
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        for i in range(5):
+            node.safe_psql(
+                'postgres', 'create database db{0}'.format(i))
+            node.safe_psql(
+                'db{0}'.format(i),
+                'create table t_heap as select i as id '
+                'from generate_series(0,1000) i')
+
+        external_dir = self.get_tblspace_path(node, 'external_dir')
+        for i in range(4):
+            for j in range(3):
+                subdir = os.path.join(
+                    external_dir, 'dir{0}'.format(i), 'subdir{0}'.format(j))
+                os.makedirs(subdir)
+                with open(os.path.join(subdir, 'file'), 'w') as f:
+                    f.write('content {0} {1}'.format(i, j))
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=[
+                '--stream', '-j', '4',
+                '--external-dirs={0}'.format(external_dir)])
+
+        pgdata = self.pgdata_content(node.base_dir, exclude_dirs=['logs'])
+
+        node.cleanup()
+        shutil.rmtree(external_dir, ignore_errors=True)
+
+        self.restore_node(backup_dir, 'node', node, options=['-j', '4'])
+
+        pgdata_restored = self.pgdata_content(
+            node.base_dir, exclude_dirs=['logs'])
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
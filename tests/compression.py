@@ -433,6 +433,371 @@ class CompressionTest(ProbackupTest, unittest.TestCase):
         # Clean after yourself
         self.del_test_dir(module_name, fname)
 
+    # @unittest.skip("skip")
+    def test_compression_stream_zstd_lz4(self):
+        """
+        make node, make full and delta stream backups compressed
+        by zstd and lz4, validate, merge and restore them,
+        check data correctness
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=3)
+
+        for alg, level in [('zstd', '3'), ('lz4', '1'), ('lz4', '9')]:
+            try:
+                self.backup_node(
+                    backup_dir, 'node', node,
+                    options=[
+                        '--stream',
+                        '--compress-algorithm={0}'.format(alg),
+                        '--compress-level={0}'.format(level)])
+            except ProbackupException as e:
+                if 'This build does not support' in e.message:
+                    continue
+                raise
+
+            pgbench = node.pgbench(options=['-T', '5', '-c', '2'])
+            pgbench.wait()
+
+            backup_id = self.backup_node(
+                backup_dir, 'node', node, backup_type='delta',
+                options=[
+                    '--stream',
+                    '--compress-algorithm={0}'.format(alg),
+                    '--compress-level={0}'.format(level)])
+
+            self.assertEqual(
+                self.show_pb(backup_dir, 'node', backup_id)['compress-alg'],
+                alg)
+
+            pgdata = self.pgdata_content(node.data_dir)
+
+            self.validate_pb(backup_dir, 'node', backup_id)
+            self.merge_backup(backup_dir, 'node', backup_id)
+
+            node_restored = self.make_simple_node(
+                base_dir=os.path.join(module_name, fname, 'node_restored'))
+            node_restored.cleanup()
+
+            self.restore_node(
+                backup_dir, 'node', node_restored, options=['-j', '4'])
+
+            if self.paranoia:
+                pgdata_restored = self.pgdata_content(node_restored.data_dir)
+                self.compare_pgdata(pgdata, pgdata_restored)
+
+            self.delete_pb(backup_dir, 'node', backup_id)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_compression_archive_zstd_lz4_fallback(self):
+        """
+        make archive node with zstd and lz4 set in instance config,
+        check that archive-push compresses WAL with zlib instead of
+        failing, and that page backup restores from such archive
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        self.set_config(
+            backup_dir, 'node',
+            options=['--compress-algorithm=zstd', '--compress-level=15'])
+        node.slow_start()
+
+        self.backup_node(
+            backup_dir, 'node', node, options=['--compress-algorithm=zlib'])
+
+        node.pgbench_init(scale=1)
+        self.switch_wal_segment(node)
+
+        self.set_config(
+            backup_dir, 'node', options=['--compress-algorithm=lz4'])
+
+        pgbench = node.pgbench(options=['-T', '5', '-c', '2'])
+        pgbench.wait()
+        self.switch_wal_segment(node)
+
+        wal_dir = os.path.join(backup_dir, 'wal', 'node')
+        wal_files = [
+            f for f in os.listdir(wal_dir)
+            if len(f) == 24 or (len(f) == 27 and f.endswith('.gz'))]
+        self.assertTrue(wal_files)
+        for f in wal_files:
+            self.assertTrue(
+                f.endswith('.gz'),
+                'WAL file {0} is not compressed with zlib'.format(f))
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='page',
+            options=['--compress-algorithm=zlib'])
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, backup_id=backup_id,
+            options=['-j', '4'])
+
+        if self.paranoia:
+            pgdata_restored = self.pgdata_content(node_restored.data_dir)
+            self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_compression_dictionary(self):
+        """
+        make node, make full and delta backups compressed by zstd
+        with trained dictionary, make sure that dictionary is stored
+        in backup directory, restore and check data correctness
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=3)
+
+        try:
+            full_id = self.backup_node(
+                backup_dir, 'node', node,
+                options=[
+                    '--stream', '--compress-algorithm=zstd',
+                    '--compress-dictionary'])
+        except ProbackupException as e:
+            if 'This build does not support' in e.message:
+                self.del_test_dir(module_name, fname)
+                self.skipTest('This build does not support zstd')
+            raise
+
+        self.assertTrue(
+            os.path.isfile(os.path.join(
+                backup_dir, 'backups', 'node', full_id, 'page_dictionary')))
+
+        pgbench = node.pgbench(options=['-T', '5', '-c', '2'])
+        pgbench.wait()
+
+        delta_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=[
+                '--stream', '--compress-algorithm=zstd',
+                '--compress-dictionary'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, options=['-j', '4'])
+
+        if self.paranoia:
+            pgdata_restored = self.pgdata_content(node_restored.data_dir)
+            self.compare_pgdata(pgdata, pgdata_restored)
+
+        # files must not be decompressed with a foreign dictionary
+        with open(os.path.join(
+                backup_dir, 'backups', 'node', full_id,
+                'page_dictionary'), 'rb') as f:
+            full_dict = f.read()
+        with open(os.path.join(
+                backup_dir, 'backups', 'node', delta_id,
+                'page_dictionary'), 'wb') as f:
+            f.write(full_dict)
+
+        node_restored.cleanup()
+        try:
+            self.restore_node(
+                backup_dir, 'node', node_restored,
+                options=['-j', '4', '--no-validate'])
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because dictionary of backup is replaced.\n "
+                "Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'ERROR: Compression dictionary of file',
+                e.message,
+                '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                    repr(e.message), self.cmd))
+
+        # dictionary is useless without zstd
+        try:
+            self.backup_node(
+                backup_dir, 'node', node,
+                options=[
+                    '--stream', '--compress-algorithm=zlib',
+                    '--compress-dictionary'])
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because compress-dictionary "
+                "requires zstd.\n Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'ERROR: --compress-dictionary option requires zstd compression',
+                e.message,
+                '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                    repr(e.message), self.cmd))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_compression_dictionary_remote(self):
+        """
+        make node, make full backups compressed by zstd in several
+        threads over ssh with and without dictionary, make sure that
+        the agents of all threads use the dictionary,
+        restore and check data correctness
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=3)
+
+        remote_options = [
+            '--stream', '-j', '4', '--compress-algorithm=zstd',
+            '--remote-proto=ssh', '--remote-host=localhost']
+
+        try:
+            plain_id = self.backup_node(
+                backup_dir, 'node', node, options=remote_options,
+                no_remote=True)
+        except ProbackupException as e:
+            if 'This build does not support' in e.message:
+                self.del_test_dir(module_name, fname)
+                self.skipTest('This build does not support zstd')
+            raise
+
+        dict_id = self.backup_node(
+            backup_dir, 'node', node,
+            options=remote_options + ['--compress-dictionary'],
+            no_remote=True)
+
+        self.assertLess(
+            self.show_pb(backup_dir, 'node', dict_id)['data-bytes'],
+            self.show_pb(backup_dir, 'node', plain_id)['data-bytes'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, backup_id=dict_id,
+            options=['-j', '4'])
+
+        if self.paranoia:
+            pgdata_restored = self.pgdata_content(node_restored.data_dir)
+            self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    def test_compression_frames(self):
+        """
+        make node, make full and delta backups with pages compressed
+        in frames, validate, restore and check data correctness,
+        merge backups and check data correctness again
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=3)
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=[
+                '--stream', '--compress-algorithm=zlib',
+                '--compress-frame-size=16'])
+
+        pgbench = node.pgbench(options=['-T', '5', '-c', '2'])
+        pgbench.wait()
+
+        delta_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=[
+                '--stream', '--compress-algorithm=zlib',
+                '--compress-frame-size=16'])
+
+        self.validate_pb(backup_dir, 'node')
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, options=['-j', '4'])
+
+        if self.paranoia:
+            pgdata_restored = self.pgdata_content(node_restored.data_dir)
+            self.compare_pgdata(pgdata, pgdata_restored)
+
+        self.merge_backup(
+            backup_dir, 'node', delta_id,
+            options=['--compress-frame-size=16'])
+
+        node_restored.cleanup()
+        self.restore_node(
+            backup_dir, 'node', node_restored, options=['-j', '4'])
+
+        if self.paranoia:
+            pgdata_restored = self.pgdata_content(node_restored.data_dir)
+            self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
     def test_compression_wrong_algorithm(self):
         """
         make archive node, make full and page backups,
@@ -1125,7 +1125,8 @@ class ProbackupTest(object):
 
     def set_archiving(
             self, backup_dir, instance, node, replica=False,
-            overwrite=False, compress=False, old_binary=False):
+            overwrite=False, compress=False, old_binary=False,
+            wal_summary=False, batch_size=None):
 
         # parse postgresql.auto.conf
         options = {}
@@ -1155,6 +1156,13 @@ class ProbackupTest(object):
         if overwrite:
             options['archive_command'] += '--overwrite '
 
+        if wal_summary:
+            options['archive_command'] += '--wal-summary '
+
+        if batch_size:
+            options['archive_command'] += '-j 2 --batch-size={0} '.format(
+                batch_size)
+
         if os.name == 'posix':
             options['archive_command'] += '--wal-file-path=%p --wal-file-name=%f'
 
@@ -1797,22 +1797,34 @@ class MergeTest(ProbackupTest, unittest.TestCase):
         self.assertEqual(
             full_id, self.show_pb(backup_dir, 'node')[0]['id'])
 
+        self.assertEqual(
+            'MERGING', self.show_pb(backup_dir, 'node')[0]['status'])
+
         # restore
         node.cleanup()
         try:
             self.restore_node(backup_dir, 'node', node)
             self.assertEqual(
                     1, 0,
-                    "Expecting Error because of orphan status.\n "
+                    "Expecting Error because of unfinished merge.\n "
                     "Output: {0} \n CMD: {1}".format(
                         repr(self.output), self.cmd))
         except ProbackupException as e:
             self.assertIn(
-                "ERROR: Backup {0} is orphan".format(page_1),
+                "ERROR: Backup satisfying target options is not found",
                 e.message,
                 '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
                     repr(e.message), self.cmd))
 
+        # Continue failed merge
+        self.merge_backup(backup_dir, 'node', page_id)
+
+        self.assertEqual(
+            page_id, self.show_pb(backup_dir, 'node')[0]['id'])
+
+        self.assertEqual(
+            'OK', self.show_pb(backup_dir, 'node')[0]['status'])
+
         self.del_test_dir(module_name, fname)
 
     # @unittest.skip("skip")
@@ -2154,6 +2166,123 @@ class MergeTest(ProbackupTest, unittest.TestCase):
         # Clean after yourself
         self.del_test_dir(module_name, fname)
 
+    def test_merge_compressed_frames_and_pages(self):
+        """
+        make FULL backup with pages compressed in frames and DELTA backup
+        with pages compressed one by one, merge them,
+        check that merged backup is valid and data is correct
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=3)
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=[
+                '--stream', '--compress-algorithm=zlib',
+                '--compress-frame-size=16'])
+
+        pgbench = node.pgbench(options=['-T', '5', '-c', '2'])
+        pgbench.wait()
+
+        delta_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '--compress-algorithm=zlib'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        self.merge_backup(backup_dir, 'node', delta_id, options=['-j2'])
+
+        self.validate_pb(backup_dir, 'node')
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, options=['-j', '4'])
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    def test_merge_chain_continue_after_delete(self):
+        """
+        make FULL and three PAGE backups, merge the whole chain,
+        crash after the oldest PAGE backup is deleted,
+        continue merge and check data correctness
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=1)
+
+        full_id = self.backup_node(backup_dir, 'node', node)
+
+        for i in range(3):
+            pgbench = node.pgbench(options=['-t', '1000', '-c', '2'])
+            pgbench.wait()
+
+            page_id = self.backup_node(
+                backup_dir, 'node', node, backup_type='page')
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        gdb = self.merge_backup(backup_dir, 'node', page_id, gdb=True)
+
+        gdb.set_breakpoint('delete_backup_files')
+        gdb.run_until_break()
+        gdb.continue_execution_until_break()
+
+        gdb._execute('signal SIGKILL')
+
+        show_backups = self.show_pb(backup_dir, 'node')
+        self.assertEqual(len(show_backups), 3)
+        self.assertEqual(show_backups[0]['id'], full_id)
+        self.assertEqual(show_backups[0]['status'], 'MERGING')
+
+        # Continue failed merge
+        self.merge_backup(backup_dir, 'node', page_id)
+
+        show_backups = self.show_pb(backup_dir, 'node')
+        self.assertEqual(len(show_backups), 1)
+        self.assertEqual(show_backups[0]['id'], page_id)
+        self.assertEqual(show_backups[0]['status'], 'OK')
+        self.assertEqual(show_backups[0]['backup-mode'], 'FULL')
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, options=['-j', '4'])
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
 
 # 1. always use parent link when merging (intermediates may be from different chain)
 # 2. page backup we are merging with may disappear after failed merge,
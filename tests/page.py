@@ -282,6 +282,56 @@ class PageTest(ProbackupTest, unittest.TestCase):
         # Clean after yourself
         self.del_test_dir(module_name, fname)
 
+    # @unittest.skip("skip")
+    def test_page_archive_wal_summary(self):
+        """
+        make archive node with WAL summaries, take full and page
+        backups, check that page map is built from summaries and
+        restored data is correct
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node, wal_summary=True)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        self.backup_node(backup_dir, 'node', node)
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+
+        output = self.backup_node(
+            backup_dir, 'node', node, backup_type='page',
+            options=['-j', '4', '--log-level-console=INFO'])
+
+        self.assertIn(
+            'Pagemap is built from summaries', output,
+            '\n Unexpected Output: {0}\n CMD: {1}'.format(
+                repr(output), self.cmd))
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored, options=['-j', '4'])
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
     # @unittest.skip("skip")
     def test_page_multiple_segments(self):
         """
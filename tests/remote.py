@@ -43,3 +43,64 @@ class RemoteTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_remote_connections(self):
+        """
+        Backup and restore with threads sharing
+        fewer ssh connections than there are threads
+        """
+        if not self.remote:
+            return unittest.skip(
+                'You need to enable PGPROBACKUP_SSH_REMOTE for this test')
+
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '-j', '4', '--remote-connections=2'])
+
+        pgbench = node.pgbench(options=['-T', '5', '-c', '2'])
+        pgbench.wait()
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '-j', '4', '--remote-connections=2'])
+
+        if self.paranoia:
+            pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, 'node', node_restored,
+            options=['-j', '4', '--remote-connections=2'])
+
+        if self.paranoia:
+            pgdata_restored = self.pgdata_content(node_restored.data_dir)
+            self.compare_pgdata(pgdata, pgdata_restored)
+
+        self.set_auto_conf(node_restored, {'port': node_restored.port})
+        node_restored.slow_start()
+
+        result = node.safe_psql(
+            'postgres', 'SELECT count(*) FROM pgbench_accounts')
+        result_restored = node_restored.safe_psql(
+            'postgres', 'SELECT count(*) FROM pgbench_accounts')
+        self.assertEqual(result, result_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
@@ -3376,4 +3376,277 @@ class RestoreTest(ProbackupTest, unittest.TestCase):
         self.assertEqual('2', timeline_id)
 
         # Clean after yourself
-        self.del_test_dir(module_name, fname)
\ No newline at end of file
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_with_prefetch(self):
+        """
+        check that archive-get with --batch-size prefetches
+        WAL segments and recovery uses them
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        self.backup_node(backup_dir, 'node', node)
+
+        for i in range(5):
+            node.safe_psql(
+                'postgres',
+                'create table t_heap_{0} as select i from '
+                'generate_series(0,1000) i'.format(i))
+            self.switch_wal_segment(node)
+
+        node.safe_psql('postgres', 'create table t1()')
+        self.switch_wal_segment(node)
+        node.stop()
+
+        node.cleanup()
+
+        restore_cmd = self.get_restore_command(backup_dir, 'node', node)
+        restore_cmd += ' -j 2 --batch-size=4'
+
+        self.restore_node(
+            backup_dir, 'node', node,
+            options=['--restore-command={0}'.format(restore_cmd)])
+
+        node.slow_start()
+
+        node.safe_psql('postgres', 'select * from t1')
+
+        log_file = os.path.join(node.logs_dir, 'postgresql.log')
+        with open(log_file, 'r') as f:
+            log_content = f.read()
+
+        self.assertIn('Prefetched', log_content)
+        self.assertIn('pbk_prefetch', log_content)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_chain_truncated_relation(self):
+        """
+        make FULL, PAGE, DELTA and PAGE backups with the relation
+        being updated, truncated and extended in between,
+        restore the whole chain and compare PGDATA content
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'],
+            pg_options={'autovacuum': 'off'})
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql(
+            'postgres',
+            'create table t_heap as select i as id, '
+            'md5(i::text) as text from generate_series(0,100000) i')
+
+        # FULL
+        self.backup_node(backup_dir, 'node', node)
+
+        node.safe_psql(
+            'postgres',
+            'update t_heap set text = md5(text) where id % 7 = 0')
+
+        # PAGE
+        self.backup_node(backup_dir, 'node', node, backup_type='page')
+
+        node.safe_psql(
+            'postgres',
+            'delete from t_heap where id > 20000')
+
+        node.safe_psql(
+            'postgres',
+            'vacuum t_heap')
+
+        # DELTA
+        self.backup_node(backup_dir, 'node', node, backup_type='delta')
+
+        node.safe_psql(
+            'postgres',
+            'insert into t_heap select i as id, '
+            'md5(i::text) as text from generate_series(20001,40000) i')
+
+        # PAGE
+        self.backup_node(backup_dir, 'node', node, backup_type='page')
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node.cleanup()
+
+        self.restore_node(backup_dir, 'node', node)
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        node.slow_start()
+
+        self.assertEqual(
+            '40001',
+            node.safe_psql(
+                'postgres',
+                'select count(*) from t_heap').rstrip())
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_chain_binary_file_list(self):
+        """
+        make FULL, PAGE and DELTA backups with binary file lists,
+        restore the chain and compare PGDATA content,
+        then merge the chain and check that merged backup
+        keeps binary file list and can be restored
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'],
+            pg_options={'autovacuum': 'off'})
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.safe_psql(
+            'postgres',
+            'create table t_heap as select i as id, '
+            'md5(i::text) as text from generate_series(0,10000) i')
+
+        # FULL
+        self.backup_node(
+            backup_dir, 'node', node, options=['--binary-file-list'])
+
+        node.safe_psql(
+            'postgres',
+            'update t_heap set text = md5(text) where id % 7 = 0')
+
+        # PAGE, text file list
+        self.backup_node(backup_dir, 'node', node, backup_type='page')
+
+        node.safe_psql(
+            'postgres',
+            'delete from t_heap where id > 5000')
+
+        # DELTA
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--binary-file-list'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node.cleanup()
+
+        self.restore_node(backup_dir, 'node', node)
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        self.merge_backup(backup_dir, 'node', backup_id)
+
+        filelist_path = os.path.join(
+            backup_dir, 'backups', 'node', backup_id,
+            'backup_content.control')
+
+        with open(filelist_path, 'rb') as f:
+            self.assertEqual(f.read(4), b'BPFL')
+
+        node.cleanup()
+
+        self.restore_node(backup_dir, 'node', node)
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        node.slow_start()
+
+        self.assertEqual(
+            '5001',
+            node.safe_psql(
+                'postgres',
+                'select count(*) from t_heap').rstrip())
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_large_relation_by_ranges(self):
+        """
+        make FULL and DELTA backups of relation larger than 256MB,
+        which is split into block ranges, truncate it in between,
+        restore it with several threads and compare PGDATA content
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'],
+            pg_options={'autovacuum': 'off'})
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        # fillfactor 10 makes about 330MB of pages
+        node.safe_psql(
+            'postgres',
+            'create table t_large with (fillfactor=10) as select i as id, '
+            'md5(i::text) as text from generate_series(0,500000) i')
+
+        # FULL
+        self.backup_node(
+            backup_dir, 'node', node, options=['--stream', '-j', '4'])
+
+        node.safe_psql(
+            'postgres',
+            'update t_large set text = md5(text) where id % 1000 = 0; '
+            'delete from t_large where id > 400000; '
+            'vacuum t_large')
+
+        # DELTA
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '-j', '4'])
+
+        self.checkdb_node(
+            backup_dir, 'node', options=['-j', '4', '-d', 'postgres',
+                                         '-p', str(node.port)])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node.cleanup()
+
+        self.restore_node(backup_dir, 'node', node, options=['-j', '4'])
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        node.slow_start()
+
+        self.assertEqual(
+            '400001',
+            node.safe_psql(
+                'postgres',
+                'select count(*) from t_large').rstrip())
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
@@ -538,3 +538,120 @@ class OptionTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_show_catalog_index(self):
+        """
+        check that show uses backup catalog index,
+        notices changes of backup.control made after the index
+        was written and survives corruption of the index
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        backup_id_1 = self.backup_node(backup_dir, 'node', node)
+        backup_id_2 = self.backup_node(backup_dir, 'node', node)
+
+        show_before = self.show_pb(backup_dir, 'node')
+
+        index_path = os.path.join(backup_dir, 'backups', '.node.index')
+        self.assertTrue(os.path.isfile(index_path))
+
+        # change status of the backup right after the index is written
+        control_path = os.path.join(
+            backup_dir, 'backups', 'node', backup_id_2, 'backup.control')
+        with open(control_path, 'r') as f:
+            control = f.read()
+        with open(control_path, 'w') as f:
+            f.write(control.replace('status = OK', 'status = ERROR'))
+
+        self.assertEqual(
+            self.show_pb(backup_dir, 'node', backup_id_2)['status'], 'ERROR')
+
+        with open(control_path, 'w') as f:
+            f.write(control)
+
+        self.assertEqual(self.show_pb(backup_dir, 'node'), show_before)
+
+        # corrupt the index
+        with open(index_path, 'r+b') as f:
+            f.seek(40)
+            f.write(b'garbage')
+
+        self.assertEqual(self.show_pb(backup_dir, 'node'), show_before)
+
+        self.delete_pb(backup_dir, 'node', backup_id_1)
+        self.assertEqual(len(self.show_pb(backup_dir, 'node')), 1)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_show_file_list(self):
+        """
+        check that show --file-list prints the file list
+        in text format, whatever format it is stored in
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        text_id = self.backup_node(backup_dir, 'node', node)
+        binary_id = self.backup_node(
+            backup_dir, 'node', node, options=['--binary-file-list'])
+
+        text_path = os.path.join(
+            backup_dir, 'backups', 'node', text_id, 'backup_content.control')
+        with open(text_path, 'r') as f:
+            text_list = f.read().splitlines()
+
+        output = self.show_pb(
+            backup_dir, 'node', text_id,
+            options=['--file-list'], as_json=False, as_text=True)
+        self.assertEqual(
+            sorted(output.splitlines()), sorted(text_list))
+
+        output = self.show_pb(
+            backup_dir, 'node', binary_id,
+            options=['--file-list'], as_json=False, as_text=True)
+
+        for line in output.splitlines():
+            self.assertTrue(line.startswith('{"path":"'), line)
+        self.assertIn('{"path":"PG_VERSION", ', output)
+        self.assertIn('{"path":"global/pg_control", ', output)
+
+        try:
+            self.show_pb(
+                backup_dir, 'node',
+                options=['--file-list'], as_json=False, as_text=True)
+            # we should die here because exception is what we expect to happen
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because backup id is missing.\n "
+                "Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'ERROR: You must specify parameter (-i, --backup-id) '
+                'to use --file-list option',
+                e.message,
+                '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                    repr(e.message), self.cmd))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)